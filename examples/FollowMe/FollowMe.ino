@@ -18,7 +18,7 @@ void setup() {
     digitalWrite(13, HIGH);
   }
   // Disable torque on servo 1
-  servos.writeRegister(1, STS::registers::TORQUE_SWITCH, 0);
+  servos.writeRegister(1, STSRegisters::TORQUE_SWITCH, 0);
   // Set servo 2 to position mode.
   servos.setMode(2, STSMode::POSITION);
 }
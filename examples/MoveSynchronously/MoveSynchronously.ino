@@ -25,7 +25,7 @@ void setup()
     // Reset all servos to position mode: servos have three modes (position, velocity, step position).
     // Position is the default mode so this shouldn't be needed but it's here just to make sure
     // (depending on what you've run before, the servos could be in a different mode)
-    servos.setMode(0xFE, STSMode::POSITION); // 0xFE is broadcast address and applies to all servos.
+    servos.setMode(STS_BROADCAST_ID, STSMode::POSITION); // STS_BROADCAST_ID (0xFE) is the broadcast address and applies to all servos.
 }
 
 void loop()
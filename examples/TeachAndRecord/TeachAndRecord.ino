@@ -0,0 +1,72 @@
+// Teach a motion by hand, then replay it.
+// Servos 1 and 2 are turned off for 5 seconds, during which they can be moved by hand: their positions are
+// recorded at the highest rate the bus allows, and kept as keyframes. The led then blinks once per 10 samples
+// per keyframe (up to 20 times), and the motion is replayed in a loop.
+
+#include "STSRecorder.h"
+
+byte const SERVO_IDS[] = {1, 2};
+byte const N_SERVOS = sizeof(SERVO_IDS);
+// With the default tolerance of 3 steps (STS_RECORDER_TOLERANCE), a few keyframes per second of motion are
+// enough: tens of samples make a single keyframe.
+uint16_t const MAX_KEYFRAMES = 64;
+unsigned long const RECORD_MS = 5000;
+
+STSServoDriver servos;
+uint32_t times[MAX_KEYFRAMES];
+int16_t positions[MAX_KEYFRAMES * N_SERVOS];
+STSRecorder recorder(servos, times, positions, MAX_KEYFRAMES, N_SERVOS);
+
+// Move back to the start of the motion, then replay it.
+void replayFromStart()
+{
+  recorder.moveToStart(1000);
+  delay(2000);
+  recorder.startReplay(micros());
+}
+
+void setup() {
+  pinMode(13, OUTPUT);
+  digitalWrite(13, LOW);
+  // Since the serial port is taken by the servo, we can't easily send debug messages, so
+  // we use the on-board led instead.
+  // Try to connect with the servos, using pin 2 as direction pin and the default (only) serial
+  // interface of an Arduino Uno.
+  bool failed = !servos.init(2);
+  // Disable torque on all the servos at once, and record while they are moved by hand.
+  recorder.startRecording(N_SERVOS, SERVO_IDS);
+  unsigned long const start = millis();
+  while (millis() - start < RECORD_MS && !recorder.isFull())
+    recorder.sample();
+  // Enable torque again, the servos holding where they were left.
+  recorder.stopRecording();
+
+  // Compression ratio: number of samples per keyframe.
+  if (recorder.getKeyframeCount() > 0)
+  {
+    unsigned long const ratio = recorder.getSampleCount() / recorder.getKeyframeCount();
+    for (unsigned long i = 0; i < ratio / 10 && i < 20; i++)
+    {
+      digitalWrite(13, HIGH);
+      delay(200);
+      digitalWrite(13, LOW);
+      delay(200);
+    }
+  }
+  // Failed to get a ping reply, or samples were lost: turn on the led.
+  if (failed || recorder.getDroppedCount() > 0)
+    digitalWrite(13, HIGH);
+  replayFromStart();
+}
+
+void loop()
+{
+  // Send the keyframes as they become due.
+  recorder.updateReplay(micros());
+  if (recorder.isReplayFinished())
+  {
+    delay(1000);
+    replayFromStart();
+  }
+  delay(1);
+}
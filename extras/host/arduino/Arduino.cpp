@@ -0,0 +1,133 @@
+#include "Arduino.h"
+#include "SerialTrace.h"
+
+#include <chrono>
+
+HardwareSerial Serial;
+HardwareSerial Serial1;
+
+namespace
+{
+    // Values written to the pins, e.g. the LED of the examples.
+    thread_local uint8_t pinValues[256];
+};
+
+VirtualClock &VirtualClock::current()
+{
+    static thread_local VirtualClock clock;
+    return clock;
+}
+
+void pinMode(uint8_t, uint8_t)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+    pinValues[pin] = value;
+}
+
+int digitalRead(uint8_t pin)
+{
+    return pinValues[pin];
+}
+
+unsigned long millis()
+{
+    return VirtualClock::current().now() / 1000000;
+}
+
+unsigned long micros()
+{
+    return VirtualClock::current().now() / 1000;
+}
+
+void delay(unsigned long ms)
+{
+    uint64_t const start = VirtualClock::current().now();
+    VirtualClock::current().advance(ms * 1000000ULL);
+    SerialTrace::recordDelay(start, VirtualClock::current().now());
+}
+
+void delayMicroseconds(unsigned int us)
+{
+    uint64_t const start = VirtualClock::current().now();
+    VirtualClock::current().advance(us * 1000ULL);
+    SerialTrace::recordDelay(start, VirtualClock::current().now());
+}
+
+uint32_t cpuNanos()
+{
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+uint64_t SerialDevice::startWrite(const uint8_t *data, size_t length, uint64_t const &)
+{
+    write(data, length);
+    return VirtualClock::current().now();
+}
+
+HardwareSerial::HardwareSerial() : device_(nullptr), timeoutMs_(1000)
+{
+}
+
+void HardwareSerial::attach(SerialDevice *device)
+{
+    device_ = device;
+}
+
+void HardwareSerial::begin(long baudRate)
+{
+    if (device_ != nullptr)
+        device_->begin(baudRate);
+}
+
+void HardwareSerial::begin(long baudRate, uint32_t, int8_t, int8_t)
+{
+    begin(baudRate);
+}
+
+size_t HardwareSerial::write(uint8_t value)
+{
+    return write(&value, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *data, size_t length)
+{
+    if (device_ == nullptr)
+        return length;
+    return device_->write(data, length);
+}
+
+int HardwareSerial::available()
+{
+    if (device_ == nullptr)
+        return 0;
+    return device_->available();
+}
+
+int HardwareSerial::read()
+{
+    if (device_ == nullptr)
+        return -1;
+    return device_->read(0);
+}
+
+size_t HardwareSerial::readBytes(uint8_t *buffer, size_t length)
+{
+    // Like Stream::readBytes, the timeout applies to each byte.
+    size_t n = 0;
+    while (n < length)
+    {
+        int c = device_ == nullptr ? -1 : device_->read(timeoutMs_);
+        if (c < 0)
+        {
+            if (device_ == nullptr)
+                delay(timeoutMs_);
+            break;
+        }
+        buffer[n++] = static_cast<uint8_t>(c);
+    }
+    return n;
+}
@@ -0,0 +1,47 @@
+/// \file Arduino.h
+/// \brief Minimal Arduino core for running the driver on a Linux host.
+///
+/// \details Time is virtual: millis(), micros() and delay() read and advance the VirtualClock of the
+///          calling thread, so that code talking to the simulated servos runs faster than real time
+///          while still measuring realistic durations.
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "VirtualClock.h"
+
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT  0x0
+#define OUTPUT 0x1
+
+#define LED_BUILTIN 13
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+/// \brief Value last written to a pin, LOW if never written.
+int digitalRead(uint8_t pin);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+/// \brief Real (not virtual) time in ns, wrapping around: for measuring CPU costs, to which the virtual clock is blind.
+uint32_t cpuNanos();
+
+// No interrupts on the host: events are delivered by polling, in the thread of the caller.
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+#include "HardwareSerial.h"
+
+#endif
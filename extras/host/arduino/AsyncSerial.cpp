@@ -0,0 +1,34 @@
+#include "AsyncSerial.h"
+
+AsyncSerial::AsyncSerial(SerialDevice *device) :
+    device_(device),
+    busy_(false),
+    inEvent_(false),
+    completion_(0)
+{
+}
+
+void AsyncSerial::startWrite(const byte *data, size_t const &length)
+{
+    uint64_t const date = inEvent_ ? completion_ : VirtualClock::current().now();
+    completion_ = device_->startWrite(data, length, date);
+    busy_ = true;
+}
+
+void AsyncSerial::poll()
+{
+    while (busy_ && VirtualClock::current().now() >= completion_)
+    {
+        busy_ = false;
+        inEvent_ = true;
+        writeComplete();
+        inEvent_ = false;
+    }
+}
+
+void AsyncSerial::waitForEvent()
+{
+    if (busy_)
+        VirtualClock::current().advanceTo(completion_);
+    poll();
+}
@@ -0,0 +1,32 @@
+/// \file AsyncSerial.h
+/// \brief Background transmitter of the host Arduino shim, for STSTxPipeline.
+#ifndef HOST_ASYNC_SERIAL_H
+#define HOST_ASYNC_SERIAL_H
+
+#include "HardwareSerial.h"
+#include "STSTxPipeline.h"
+
+/// \brief Transport sending frames to a SerialDevice in the background, as a TX DMA would.
+/// \details There are no interrupts on the host: the completion events are delivered when the pipeline
+///          polls, or waits for them, once the virtual clock has reached the end of the transfer. A transfer
+///          queued behind the completed one starts at the completion date, as it would from the interrupt.
+class AsyncSerial : public STSAsyncTransport
+{
+public:
+    explicit AsyncSerial(SerialDevice *device);
+
+    void startWrite(const byte *data, size_t const &length) override;
+    void poll() override;
+    void waitForEvent() override;
+
+    /// \brief Whether a transfer is in progress.
+    bool isBusy() const { return busy_; }
+
+private:
+    SerialDevice *device_;
+    bool busy_;
+    bool inEvent_;         ///< Whether the completion event is being delivered.
+    uint64_t completion_;  ///< Date at which the transfer in progress ends, in ns.
+};
+
+#endif
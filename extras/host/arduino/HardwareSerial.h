@@ -0,0 +1,75 @@
+/// \file HardwareSerial.h
+/// \brief Serial port of the host Arduino shim, forwarding to a SerialDevice.
+#ifndef HardwareSerial_h
+#define HardwareSerial_h
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Print.h"
+
+// Frame format of HardwareSerial::begin: only 8N1 is used by the servos.
+#define SERIAL_8N1 0x06
+
+/// \brief Something a serial port can be connected to: a simulated bus, a tty...
+class SerialDevice
+{
+public:
+    virtual ~SerialDevice() {}
+
+    /// \brief Open the device at the given baud rate.
+    virtual void begin(long baudRate) = 0;
+
+    /// \brief Write bytes, returning once they are on the wire.
+    /// \return Number of bytes written.
+    virtual size_t write(const uint8_t *data, size_t length) = 0;
+
+    /// \brief Hand bytes over to a background transmitter (TX DMA), returning at once.
+    /// \details By default, the bytes are written with write, and are on the wire on return.
+    /// \param[in] date Date at which the transmitter is handed the bytes, in ns: the current time, or the end of
+    ///            the previous transfer if the next one is started from its completion event.
+    /// \return Date at which the last byte is on the wire, in ns.
+    virtual uint64_t startWrite(const uint8_t *data, size_t length, uint64_t const &date);
+
+    /// \brief Read a byte, waiting at most timeoutMs for it to arrive.
+    /// \return The byte, -1 on timeout.
+    virtual int read(unsigned long timeoutMs) = 0;
+
+    /// \brief Number of bytes that can be read without waiting.
+    virtual int available() = 0;
+};
+
+/// \brief Serial port, with the subset of the Arduino API used by the driver.
+class HardwareSerial : public Print
+{
+public:
+    HardwareSerial();
+
+    /// \brief Connect the port to a device. Until then, writes are dropped and reads time out.
+    void attach(SerialDevice *device);
+
+    void begin(long baudRate);
+    /// \brief Open the port with the pins of ESP32 boards, which the host ignores.
+    void begin(long baudRate, uint32_t config, int8_t rxPin = -1, int8_t txPin = -1);
+    void end() {}
+    void setTimeout(unsigned long timeoutMs) { timeoutMs_ = timeoutMs; }
+
+    size_t write(uint8_t value) override;
+    size_t write(const uint8_t *data, size_t length) override;
+
+    int available();
+    int read();
+    size_t readBytes(uint8_t *buffer, size_t length);
+    void flush() {}
+
+    operator bool() const { return device_ != nullptr; }
+
+private:
+    SerialDevice *device_;
+    unsigned long timeoutMs_;
+};
+
+extern HardwareSerial Serial;
+extern HardwareSerial Serial1;
+
+#endif
@@ -0,0 +1,52 @@
+/// \file Print.h
+/// \brief Byte output of the host Arduino shim, base of HardwareSerial.
+#ifndef Print_h
+#define Print_h
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+/// \brief Something bytes can be written to, as the Arduino Print class.
+class Print
+{
+public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t value) = 0;
+
+    virtual size_t write(const uint8_t *data, size_t length)
+    {
+        size_t n = 0;
+        while (n < length && write(data[n]) == 1)
+            n++;
+        return n;
+    }
+
+    size_t print(const char *text)
+    {
+        return write(reinterpret_cast<const uint8_t *>(text), strlen(text));
+    }
+
+    size_t println(const char *text = "")
+    {
+        return print(text) + print("\r\n");
+    }
+
+    /// \brief Formatted output, as in the ESP32 core.
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)))
+    {
+        char text[256];
+        va_list arguments;
+        va_start(arguments, format);
+        int const length = vsnprintf(text, sizeof(text), format, arguments);
+        va_end(arguments);
+        if (length < 0)
+            return 0;
+        return write(reinterpret_cast<const uint8_t *>(text), strlen(text));
+    }
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include "SerialTrace.h"
+#include "VirtualClock.h"
+
+#include <string.h>
+
+namespace
+{
+    thread_local SerialTrace *threadTrace = nullptr;
+}
+
+SerialTrace::SerialTrace(SerialDevice *device, char const *path) :
+    device_(device),
+    file_(fopen(path, "wb")),
+    rxFlags_(0),
+    rxStart_(0),
+    rxEnd_(0)
+{
+    if (file_ == nullptr)
+        return;
+    STSTrace::FileHeader header;
+    memcpy(header.magic, STSTrace::MAGIC, sizeof(header.magic));
+    header.version = STSTrace::VERSION;
+    header.reserved = 0;
+    fwrite(&header, sizeof(header), 1, file_);
+    threadTrace = this;
+}
+
+SerialTrace::~SerialTrace()
+{
+    if (threadTrace == this)
+        threadTrace = nullptr;
+    if (file_ == nullptr)
+        return;
+    flushRx();
+    fclose(file_);
+}
+
+void SerialTrace::begin(long baudRate)
+{
+    device_->begin(baudRate);
+    uint32_t const rate = baudRate;
+    uint64_t const now = VirtualClock::current().now();
+    flushRx();
+    record(STSTrace::BEGIN, 0, now, now, reinterpret_cast<uint8_t const *>(&rate), sizeof(rate));
+}
+
+size_t SerialTrace::write(const uint8_t *data, size_t length)
+{
+    flushRx();
+    uint64_t const start = VirtualClock::current().now();
+    size_t const written = device_->write(data, length);
+    record(STSTrace::TX, 0, start, VirtualClock::current().now(), data, written);
+    return written;
+}
+
+int SerialTrace::read(unsigned long timeoutMs)
+{
+    uint64_t const start = VirtualClock::current().now();
+    int const c = device_->read(timeoutMs);
+    uint64_t const end = VirtualClock::current().now();
+    if (c < 0)
+    {
+        flushRx();
+        if (end > start)
+            record(STSTrace::TIMEOUT, 0, start, end, nullptr, 0);
+        return c;
+    }
+    uint8_t const readFlags = timeoutMs == 0 ? STSTrace::flags::POLLED : 0;
+    // Start a new record when this byte had to be waited for, so that record times match arrival times.
+    if (!rx_.empty() && (end > start || readFlags != rxFlags_ || rx_.size() == UINT16_MAX))
+        flushRx();
+    if (rx_.empty())
+    {
+        rxStart_ = start;
+        rxFlags_ = readFlags;
+    }
+    rx_.push_back(static_cast<uint8_t>(c));
+    rxEnd_ = end;
+    return c;
+}
+
+int SerialTrace::available()
+{
+    return device_->available();
+}
+
+void SerialTrace::recordDelay(uint64_t const &start, uint64_t const &end)
+{
+    if (threadTrace == nullptr)
+        return;
+    threadTrace->flushRx();
+    threadTrace->record(STSTrace::DELAY, 0, start, end, nullptr, 0);
+}
+
+void SerialTrace::record(uint8_t type, uint8_t flags, uint64_t start, uint64_t end, const uint8_t *data, size_t length)
+{
+    if (file_ == nullptr)
+        return;
+    STSTrace::RecordHeader header;
+    header.type = type;
+    header.flags = flags;
+    header.length = static_cast<uint16_t>(length);
+    header.reserved = 0;
+    header.start = start;
+    header.end = end;
+    fwrite(&header, sizeof(header), 1, file_);
+    if (length > 0)
+        fwrite(data, 1, length, file_);
+}
+
+void SerialTrace::flushRx()
+{
+    if (rx_.empty())
+        return;
+    record(STSTrace::RX, rxFlags_, rxStart_, rxEnd_, rx_.data(), rx_.size());
+    rx_.clear();
+}
@@ -0,0 +1,89 @@
+/// \file SerialTrace.h
+/// \brief Capture of the traffic of a serial port to a file, for offline analysis with TraceAnalyzer.
+#ifndef HOST_SERIAL_TRACE_H
+#define HOST_SERIAL_TRACE_H
+
+#include "HardwareSerial.h"
+
+#include <stdio.h>
+#include <vector>
+
+/// \brief Binary format of the capture files.
+/// \details A file starts with a FileHeader, followed by records: a RecordHeader, then \c length bytes
+///          of payload. All fields are little-endian, times are in ns of virtual time.
+namespace STSTrace
+{
+    char const MAGIC[8] = {'S', 'T', 'S', 'T', 'R', 'A', 'C', 'E'};
+    uint32_t const VERSION = 1;
+
+    enum RecordType : uint8_t
+    {
+        BEGIN = 0,   ///< Port opened, payload is the baud rate (uint32).
+        TX = 1,      ///< Bytes written by the host, between start and end.
+        RX = 2,      ///< Bytes read by the host, the last one at end.
+        TIMEOUT = 3, ///< A blocking read that returned nothing, waiting from start to end.
+        DELAY = 4    ///< delay() or delayMicroseconds() called by the host.
+    };
+
+    namespace flags
+    {
+        uint8_t const POLLED = 0x01; ///< RX record: bytes read without waiting (read() with no timeout).
+    }
+
+    struct FileHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+    };
+
+    struct RecordHeader
+    {
+        uint8_t type;
+        uint8_t flags;
+        uint16_t length; ///< Payload length, in bytes.
+        uint32_t reserved;
+        uint64_t start;
+        uint64_t end;
+    };
+
+    static_assert(sizeof(FileHeader) == 16, "Unexpected trace header layout");
+    static_assert(sizeof(RecordHeader) == 24, "Unexpected trace record layout");
+}
+
+/// \brief SerialDevice forwarding to another device, and recording all the traffic to a capture file.
+/// \details Consecutive reads are merged into a single RX record, as long as they did not have to wait for
+///          data. While a trace is attached to a port, delay() calls from the same thread are recorded too.
+class SerialTrace : public SerialDevice
+{
+public:
+    /// \brief Start a capture.
+    /// \param[in] device Device to forward to.
+    /// \param[in] path Capture file, overwritten if it exists.
+    SerialTrace(SerialDevice *device, char const *path);
+    ~SerialTrace();
+
+    /// \brief Whether the capture file could be created.
+    bool isOpen() const { return file_ != nullptr; }
+
+    void begin(long baudRate) override;
+    size_t write(const uint8_t *data, size_t length) override;
+    int read(unsigned long timeoutMs) override;
+    int available() override;
+
+    /// \brief Record a delay of the calling thread, if a trace was created on it. Called by the Arduino shim.
+    static void recordDelay(uint64_t const &start, uint64_t const &end);
+
+private:
+    void record(uint8_t type, uint8_t flags, uint64_t start, uint64_t end, const uint8_t *data, size_t length);
+    void flushRx();
+
+    SerialDevice *device_;
+    FILE *file_;
+    std::vector<uint8_t> rx_; ///< RX bytes not yet recorded.
+    uint8_t rxFlags_;
+    uint64_t rxStart_;
+    uint64_t rxEnd_;
+};
+
+#endif
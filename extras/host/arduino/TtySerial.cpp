@@ -0,0 +1,112 @@
+#include "TtySerial.h"
+#include "VirtualClock.h"
+
+#include <asm/termbits.h>
+#include <chrono>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <thread>
+#include <unistd.h>
+
+namespace
+{
+    uint64_t realTime()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+TtySerial::TtySerial(char const *path) :
+    fd_(open(path, O_RDWR | O_NOCTTY | O_NONBLOCK)),
+    epoch_(realTime() - VirtualClock::current().now())
+{
+}
+
+TtySerial::~TtySerial()
+{
+    if (fd_ >= 0)
+        close(fd_);
+}
+
+void TtySerial::begin(long baudRate)
+{
+    if (fd_ < 0)
+        return;
+    // termios2 takes any baud rate (BOTHER), not only the Bxxx constants: 250000 and 128000 are common on these buses.
+    struct termios2 settings;
+    if (ioctl(fd_, TCGETS2, &settings) != 0)
+        return;
+    settings.c_iflag = 0;
+    settings.c_oflag = 0;
+    settings.c_lflag = 0;
+    settings.c_cflag = CS8 | CREAD | CLOCAL | BOTHER;
+    settings.c_ispeed = baudRate;
+    settings.c_ospeed = baudRate;
+    settings.c_cc[VMIN] = 0;
+    settings.c_cc[VTIME] = 0;
+    ioctl(fd_, TCSETS2, &settings);
+    ioctl(fd_, TCFLSH, TCIOFLUSH);
+    synchronize();
+}
+
+size_t TtySerial::write(const uint8_t *data, size_t length)
+{
+    synchronize();
+    size_t written = 0;
+    while (fd_ >= 0 && written < length)
+    {
+        ssize_t const n = ::write(fd_, data + written, length - written);
+        if (n < 0)
+        {
+            struct pollfd event = {fd_, POLLOUT, 0};
+            if (poll(&event, 1, 100) <= 0)
+                break;
+            continue;
+        }
+        written += n;
+    }
+    // Wait for the frame to be on the wire: the reply follows right after it.
+    if (fd_ >= 0)
+        ioctl(fd_, TCSBRK, 1);
+    synchronize();
+    return written;
+}
+
+int TtySerial::read(unsigned long timeoutMs)
+{
+    synchronize();
+    if (fd_ < 0)
+        return -1;
+    uint8_t value;
+    if (::read(fd_, &value, 1) == 1)
+        return value;
+    if (timeoutMs == 0)
+        return -1;
+    struct pollfd event = {fd_, POLLIN, 0};
+    int const ready = poll(&event, 1, static_cast<int>(timeoutMs));
+    synchronize();
+    if (ready > 0 && ::read(fd_, &value, 1) == 1)
+        return value;
+    return -1;
+}
+
+int TtySerial::available()
+{
+    synchronize();
+    int n = 0;
+    if (fd_ < 0 || ioctl(fd_, FIONREAD, &n) != 0)
+        return 0;
+    return n;
+}
+
+void TtySerial::synchronize()
+{
+    VirtualClock &clock = VirtualClock::current();
+    uint64_t const now = realTime() - epoch_;
+    if (clock.now() > now)
+        std::this_thread::sleep_for(std::chrono::nanoseconds(clock.now() - now));
+    else
+        clock.advanceTo(now);
+}
@@ -0,0 +1,37 @@
+/// \file TtySerial.h
+/// \brief Serial device on a Linux tty, to run host programs on a real bus, e.g. through a USB adapter.
+#ifndef HOST_TTY_SERIAL_H
+#define HOST_TTY_SERIAL_H
+
+#include "HardwareSerial.h"
+
+/// \brief SerialDevice on a tty (/dev/ttyUSB0...), in raw mode, at any baud rate the adapter supports.
+/// \details The virtual clock of the calling thread is kept in step with real time: each access moves it
+///          to the real time elapsed since the device was opened, and first sleeps if delay() moved it
+///          ahead. The durations measured with micros() are thus real, and delays are honored.
+/// \note Half-duplex adapters are expected to switch direction by themselves: writes wait for the last
+///       byte to be on the wire, so that the reply is not missed.
+class TtySerial : public SerialDevice
+{
+public:
+    /// \brief Open a tty. Check isOpen: on failure, errno tells why.
+    explicit TtySerial(char const *path);
+    ~TtySerial();
+
+    /// \brief Whether the tty could be opened.
+    bool isOpen() const { return fd_ >= 0; }
+
+    void begin(long baudRate) override;
+    size_t write(const uint8_t *data, size_t length) override;
+    int read(unsigned long timeoutMs) override;
+    int available() override;
+
+private:
+    /// \brief Bring the virtual clock to the real time, sleeping if it is ahead.
+    void synchronize();
+
+    int fd_;
+    uint64_t epoch_; ///< Real time at which the virtual clock read 0, in ns.
+};
+
+#endif
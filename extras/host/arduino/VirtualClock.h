@@ -0,0 +1,35 @@
+/// \file VirtualClock.h
+/// \brief Simulated time for host builds.
+#ifndef HOST_VIRTUAL_CLOCK_H
+#define HOST_VIRTUAL_CLOCK_H
+
+#include <stdint.h>
+
+/// \brief Virtual time, in nanoseconds, shared by the Arduino shim and the simulated devices.
+/// \details Each thread has its own clock, so that several simulated buses can run in parallel.
+class VirtualClock
+{
+public:
+    /// \brief Get the clock of the calling thread.
+    static VirtualClock &current();
+
+    /// \brief Current time, in ns.
+    uint64_t now() const { return now_; }
+
+    /// \brief Move time forward.
+    /// \param[in] duration Duration, in ns.
+    void advance(uint64_t const &duration) { now_ += duration; }
+
+    /// \brief Move time forward up to a given date. Does nothing if this date is already past.
+    void advanceTo(uint64_t const &date) { if (date > now_) now_ = date; }
+
+    /// \brief Reset time to 0.
+    void reset() { now_ = 0; }
+
+private:
+    VirtualClock() : now_(0) {}
+
+    uint64_t now_;
+};
+
+#endif
@@ -0,0 +1,134 @@
+// Drive several buses from one CPU, each cycle computing then sending a SYNC WRITE of setpoints per bus,
+// with blocking writes, then through a STSTxPipeline over a simulated background transmitter (TX DMA).
+// The time the application spends computing the setpoints of a bus is simulated as a busy wait.
+// Reports the cycle rate and how busy the CPU and the wires are, and checks that all frames arrived.
+//
+// Usage: AsyncTransport [servos per bus] [cycles]
+
+#include "AsyncSerial.h"
+#include "STSServoDriver.h"
+#include "STSSimulator.h"
+
+#include <cmath>
+#include <memory>
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+    struct Bus
+    {
+        STSSimulatedBus simulator;
+        HardwareSerial port;
+        STSServoDriver servos;
+        std::unique_ptr<AsyncSerial> transport;
+        std::unique_ptr<STSTxPipeline> pipeline;
+        std::vector<byte> ids;
+        std::vector<int> positions;
+        std::vector<int> speeds;
+    };
+
+    struct Run
+    {
+        double cycleRate = 0;       ///< In Hz.
+        double cpuLoad = 0;         ///< Fraction of the time spent computing.
+        double wireLoad = 0;        ///< Mean fraction of the time the wires are busy.
+        uint32_t stalls = 0;
+        bool delivered = true;      ///< Whether the servos ended up with the last setpoints.
+    };
+
+    Run run(int const nBuses, int const nServos, int const nCycles, unsigned int const computeUs, bool const pipelined)
+    {
+        VirtualClock::current().reset();
+        std::vector<std::unique_ptr<Bus>> buses;
+        for (int b = 0; b < nBuses; b++)
+        {
+            buses.emplace_back(new Bus);
+            Bus &bus = *buses.back();
+            for (int i = 0; i < nServos; i++)
+            {
+                bus.ids.push_back(i + 1);
+                bus.simulator.addServo(i + 1);
+            }
+            bus.positions.resize(nServos);
+            bus.speeds.resize(nServos, 0);
+            bus.port.attach(&bus.simulator);
+            bus.servos.init(&bus.port);
+            if (pipelined)
+            {
+                bus.transport.reset(new AsyncSerial(&bus.simulator));
+                bus.pipeline.reset(new STSTxPipeline(*bus.transport));
+                bus.servos.setTxPipeline(bus.pipeline.get());
+            }
+        }
+
+        std::vector<uint64_t> wireStart(nBuses);
+        for (int b = 0; b < nBuses; b++)
+            wireStart[b] = buses[b]->simulator.wireBusyTime();
+        uint64_t const start = VirtualClock::current().now();
+        for (int cycle = 0; cycle < nCycles; cycle++)
+        {
+            for (int b = 0; b < nBuses; b++)
+            {
+                Bus &bus = *buses[b];
+                // Application: compute the setpoints of this bus.
+                delayMicroseconds(computeUs);
+                for (int i = 0; i < nServos; i++)
+                    bus.positions[i] = 2048 + static_cast<int>(1000 * std::sin(0.01 * cycle + 0.3 * i + b));
+                bus.servos.setTargetPositions(nServos, bus.ids.data(), bus.positions.data(), bus.speeds.data());
+            }
+        }
+        for (auto &bus : buses)
+            if (bus->pipeline)
+                bus->pipeline->flush();
+        double const elapsed = (VirtualClock::current().now() - start) * 1e-9;
+
+        Run result;
+        result.cycleRate = nCycles / elapsed;
+        result.cpuLoad = nCycles * nBuses * computeUs * 1e-6 / elapsed;
+        for (int b = 0; b < nBuses; b++)
+        {
+            Bus &bus = *buses[b];
+            result.wireLoad += (bus.simulator.wireBusyTime() - wireStart[b]) * 1e-9 / elapsed / nBuses;
+            if (bus.pipeline)
+                result.stalls += bus.pipeline->getStallCount();
+            for (int i = 0; i < nServos; i++)
+            {
+                byte const *m = bus.simulator.memory(i);
+                int const target = m[STSRegisters::TARGET_POSITION] | (m[STSRegisters::TARGET_POSITION + 1] << 8);
+                if (target != bus.positions[i])
+                    result.delivered = false;
+            }
+        }
+        return result;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int const nServos = argc > 1 ? atoi(argv[1]) : 12;
+    int const nCycles = argc > 2 ? atoi(argv[2]) : 2000;
+
+    printf("%d servos per bus, %d cycles at the highest rate\n", nServos, nCycles);
+    printf("%5s %12s | %10s %6s %6s | %10s %6s %6s %7s | %6s\n", "buses", "compute (us)", "blocking", "cpu", "wire",
+           "pipelined", "cpu", "wire", "stalls", "gain");
+    bool delivered = true;
+    int const busCounts[] = {1, 2, 4};
+    unsigned int const computeCosts[] = {0, 100, 300};
+    for (int const nBuses : busCounts)
+    {
+        for (unsigned int const computeUs : computeCosts)
+        {
+            Run const blocking = run(nBuses, nServos, nCycles, computeUs, false);
+            Run const pipelined = run(nBuses, nServos, nCycles, computeUs, true);
+            printf("%5d %12u | %8.0fHz %5.0f%% %5.0f%% | %8.0fHz %5.0f%% %5.0f%% %7u | %5.2fx\n", nBuses, computeUs,
+                   blocking.cycleRate, 100 * blocking.cpuLoad, 100 * blocking.wireLoad,
+                   pipelined.cycleRate, 100 * pipelined.cpuLoad, 100 * pipelined.wireLoad, pipelined.stalls,
+                   pipelined.cycleRate / blocking.cycleRate);
+            delivered = delivered && blocking.delivered && pipelined.delivered;
+        }
+    }
+    if (!delivered)
+        printf("Some servos did not receive their last setpoint\n");
+    return delivered ? 0 : 1;
+}
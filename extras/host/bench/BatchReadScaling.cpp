@@ -0,0 +1,105 @@
+// Read the feedback of growing batches of servos in one readTelemetry call, through a serial port with a
+// 64-byte receive buffer like the AVR one: the replies of a large batch are many times larger than the buffer,
+// and are only read correctly if the driver consumes them while they arrive.
+//
+// Each batch is read on a clean link, then with stray bytes and truncated replies, to check that a corrupted
+// reply only costs this reply. The report gives the share of servos read, the time per batch, the highest
+// occupancy of the receive buffer, the reply bytes it lost and the replies read with a wrong position: with
+// an 8-bit checksum, about one corrupted reply in 256 goes undetected.
+//
+// Usage: BatchReadScaling [cycles]
+
+#include "STSServoDriver.h"
+#include "STSSimulator.h"
+
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+    size_t const RX_BUFFER_SIZE = 64;
+
+    struct Run
+    {
+        double readRate = 0;   ///< Share of the servos read, in %.
+        double batchTime = 0;  ///< In ms.
+        size_t highWater = 0;  ///< In bytes.
+        uint64_t lost = 0;     ///< Reply bytes lost in receive buffer overflows.
+        long wrong = 0;        ///< Replies read with a wrong position.
+    };
+
+    Run run(int const nServos, int const nCycles, STSFaultScenario const &scenario)
+    {
+        VirtualClock::current().reset();
+        STSSimulatedBus bus;
+        std::vector<byte> ids(nServos);
+        for (int i = 0; i < nServos; i++)
+        {
+            ids[i] = i + 1;
+            bus.addServo(ids[i]);
+            bus.setPosition(i, 100 + 15 * i);
+        }
+        bus.setRxBufferSize(RX_BUFFER_SIZE);
+        HardwareSerial port;
+        port.attach(&bus);
+        STSServoDriver servos;
+        servos.init(&port);
+        // Release the servos: once stopped, each one stays on its own position, which identifies its reply.
+        servos.writeRegister(STS_BROADCAST_ID, STSRegisters::TORQUE_SWITCH, 0);
+        delay(10);
+        std::vector<int> positions(nServos);
+        for (int i = 0; i < nServos; i++)
+            positions[i] = servos.getCurrentPosition(ids[i]);
+        bus.setFaultScenario(scenario);
+
+        std::vector<STSTelemetry> telemetry(nServos);
+        std::vector<byte> responded((nServos + 7) / 8);
+        Run result;
+        long reads = 0;
+        uint64_t const start = VirtualClock::current().now();
+        for (int cycle = 0; cycle < nCycles; cycle++)
+        {
+            reads += servos.readTelemetry(nServos, ids.data(), telemetry.data(), responded.data());
+            for (int i = 0; i < nServos; i++)
+                if ((responded[i / 8] & (1 << (i % 8))) && telemetry[i].position != positions[i])
+                    result.wrong++;
+        }
+        result.readRate = 100.0 * reads / (static_cast<double>(nServos) * nCycles);
+        result.batchTime = (VirtualClock::current().now() - start) * 1e-6 / nCycles;
+        result.highWater = bus.rxHighWater();
+        result.lost = bus.rxOverflowCount();
+        return result;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int const nCycles = argc > 1 ? atoi(argv[1]) : 200;
+
+    STSFaultScenario faulty;
+    faulty.strayBytes = 0.01;
+    faulty.truncateReply = 0.01;
+
+    printf("readTelemetry, %d cycles, %zu-byte receive buffer; faults: 1%% stray bytes, 1%% truncated replies\n",
+           nCycles, RX_BUFFER_SIZE);
+    printf("%6s %11s | %7s %10s %9s %6s | %7s %10s %9s %6s %6s\n", "servos", "reply bytes", "read %", "batch (ms)",
+           "rx (max)", "lost", "read %", "batch (ms)", "rx (max)", "lost", "wrong");
+    bool ok = true;
+    int const batchSizes[] = {8, 16, 32, 64, 128, 253};
+    for (int const nServos : batchSizes)
+    {
+        Run const clean = run(nServos, nCycles, STSFaultScenario());
+        Run const faults = run(nServos, nCycles, faulty);
+        // Reply of a servo: header, ID, length, status, registers and checksum.
+        int const replyBytes = nServos * (6 + STSRegisters::CURRENT_CURRENT + 2 - STSRegisters::CURRENT_POSITION);
+        printf("%6d %11d | %7.2f %10.2f %9zu %6lu | %7.2f %10.2f %9zu %6lu %6ld\n", nServos, replyBytes,
+               clean.readRate, clean.batchTime, clean.highWater, static_cast<unsigned long>(clean.lost),
+               faults.readRate, faults.batchTime, faults.highWater, static_cast<unsigned long>(faults.lost),
+               faults.wrong);
+        // A fault costs the faulty reply, and at worst the following ones of the same SYNC READ.
+        ok = ok && clean.readRate == 100 && clean.lost == 0 && clean.wrong == 0 && faults.readRate > 90;
+    }
+    if (!ok)
+        printf("Some batches were not read correctly\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,225 @@
+// Time the writes to STS_BROADCAST_ID (mode, acceleration, speed, position of all the servos) against their
+// wire time, and against writing each servo in turn. Also checks that every servo got the value, and that a
+// two-byte broadcast is refused on a bus mixing SCS and STS servos until the bus type is declared.
+// Then compares the bytes sent by batch writes of uniform or mostly uniform values to the whole bus, with
+// and without declaring the servos of the bus (setBusServos), which lets the driver broadcast them. Velocities
+// are only broadcast when all the same: mostly uniform ones must still take a single SYNC WRITE, so that no servo
+// is briefly commanded the velocity of the others.
+//
+// Usage: BroadcastWrites [servos] [writes]
+
+#include "STSServoDriver.h"
+#include "STSSimulator.h"
+
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+    // Wire time of a WRITE of length bytes at 1Mbps, in us.
+    double wireTime(int const &length)
+    {
+        return (length + 7) * 10.0;
+    }
+
+    struct Command
+    {
+        char const *name;
+        byte reg;
+        int length;
+        int value;
+    };
+
+    bool write(STSServoDriver &servos, byte const &id, Command const &command)
+    {
+        if (command.length == 1)
+            return servos.writeRegister(id, command.reg, command.value);
+        return servos.writeTwoBytesRegister(id, command.reg, command.value);
+    }
+
+    enum class Kind
+    {
+        REGISTER,   ///< syncWriteRegisters of a single byte.
+        POSITIONS,  ///< setTargetPositions.
+        VELOCITIES  ///< setTargetVelocities.
+    };
+
+    /// \brief A batch write to all the servos.
+    struct Batch
+    {
+        char const *name;
+        byte reg;       ///< Register checked afterwards.
+        int differing;  ///< Number of servos with another value than the others.
+        Kind kind;
+    };
+
+    /// \brief Send a batch, value being given to all but the differing servos, which get value + 1.
+    void send(STSServoDriver &servos, Batch const &batch, std::vector<byte> const &ids, int const &value)
+    {
+        int const n = ids.size();
+        std::vector<int> values(n, value);
+        for (int i = 0; i < batch.differing; i++)
+            values[n - 1 - i] = value + 1;
+        if (batch.kind == Kind::POSITIONS)
+        {
+            std::vector<int> speeds(n, 1000);
+            servos.setTargetPositions(n, ids.data(), values.data(), speeds.data());
+        }
+        else if (batch.kind == Kind::VELOCITIES)
+            servos.setTargetVelocities(n, ids.data(), values.data());
+        else
+        {
+            std::vector<byte> data(values.begin(), values.end());
+            servos.syncWriteRegisters(n, ids.data(), batch.reg, 1, data.data());
+        }
+    }
+
+    /// \brief Whether the servos got the values of the batch.
+    bool check(STSSimulatedBus &bus, Batch const &batch, int const &value)
+    {
+        int const n = bus.size();
+        for (int i = 0; i < n; i++)
+        {
+            int const expected = i >= n - batch.differing ? value + 1 : value;
+            byte const *m = bus.memory(i);
+            int const actual = batch.kind != Kind::REGISTER ? m[batch.reg] | (m[batch.reg + 1] << 8) : m[batch.reg];
+            if (actual != expected)
+                return false;
+        }
+        return true;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int const nServos = argc > 1 ? atoi(argv[1]) : 12;
+    int const nWrites = argc > 2 ? atoi(argv[2]) : 100;
+
+    STSSimulatedBus bus;
+    std::vector<byte> ids;
+    for (int i = 0; i < nServos; i++)
+    {
+        ids.push_back(i + 1);
+        bus.addServo(i + 1);
+    }
+    HardwareSerial port;
+    port.attach(&bus);
+
+    Command const commands[] = {
+        {"mode", STSRegisters::OPERATION_MODE, 1, 0},
+        {"acceleration", STSRegisters::TARGET_ACCELERATION, 1, 50},
+        {"speed", STSRegisters::RUNNING_SPEED, 2, 1500},
+        {"position", STSRegisters::TARGET_POSITION, 2, 3000}};
+
+    bool ok = true;
+    printf("%d servos, %d writes of each command, times in us\n", nServos, nWrites);
+    printf("%-14s %10s %10s %8s | %12s %8s\n", "command", "broadcast", "wire", "ratio", "one by one", "gain");
+    for (Command const &command : commands)
+    {
+        // A fresh driver: no servo has been probed yet, the broadcast must not probe either.
+        STSServoDriver servos;
+        servos.init(&port);
+        uint64_t start = VirtualClock::current().now();
+        for (int n = 0; n < nWrites; n++)
+            ok = write(servos, STS_BROADCAST_ID, command) && ok;
+        double const broadcast = (VirtualClock::current().now() - start) * 1e-3 / nWrites;
+
+        start = VirtualClock::current().now();
+        for (int n = 0; n < nWrites; n++)
+            for (byte const &id : ids)
+                write(servos, id, command);
+        double const unicast = (VirtualClock::current().now() - start) * 1e-3 / nWrites;
+
+        double const wire = wireTime(command.length);
+        printf("%-14s %10.1f %10.1f %7.2fx | %12.1f %7.1fx\n", command.name, broadcast, wire, broadcast / wire,
+               unicast, unicast / broadcast);
+        // Some slack for the direction pin and scheduling, but far from a receive timeout or the post-send delay.
+        ok = ok && broadcast < 1.1 * wire;
+
+        for (int i = 0; i < nServos; i++)
+        {
+            byte const *m = bus.memory(i);
+            int const value = command.length == 1 ? m[command.reg] : m[command.reg] | (m[command.reg + 1] << 8);
+            if (value != command.value)
+            {
+                printf("Servo %d did not get the %s broadcast\n", ids[i], command.name);
+                ok = false;
+            }
+        }
+    }
+
+    // Mixed bus: the second servo reports itself as SCS.
+    if (nServos > 1)
+    {
+        bus.memory(1)[STSRegisters::SERVO_MAJOR] = 5;
+        STSServoDriver servos;
+        servos.init(&port);
+        for (byte const &id : ids)
+            servos.getCapabilities(id);
+        bool const refused = !servos.writeTwoBytesRegister(STS_BROADCAST_ID, STSRegisters::RUNNING_SPEED, 1000);
+        servos.setBusType(ServoType::STS);
+        bool const declared = servos.writeTwoBytesRegister(STS_BROADCAST_ID, STSRegisters::RUNNING_SPEED, 1000);
+        printf("Mixed bus: two-byte broadcast %s, %s once the bus type is declared\n",
+               refused ? "refused" : "sent", declared ? "sent" : "refused");
+        ok = ok && refused && declared;
+    }
+
+    // Batch writes, on a bus of STS servos only.
+    if (nServos > 1)
+        bus.memory(1)[STSRegisters::SERVO_MAJOR] = 9;
+    Batch const batches[] = {
+        {"torque on", STSRegisters::TORQUE_SWITCH, 0, Kind::REGISTER},
+        {"acceleration", STSRegisters::TARGET_ACCELERATION, 0, Kind::REGISTER},
+        {"acc., 2 differ", STSRegisters::TARGET_ACCELERATION, 2, Kind::REGISTER},
+        {"homing", STSRegisters::TARGET_POSITION, 0, Kind::POSITIONS},
+        {"pos., 1 differs", STSRegisters::TARGET_POSITION, 1, Kind::POSITIONS},
+        {"velocity", STSRegisters::RUNNING_SPEED, 0, Kind::VELOCITIES},
+        {"vel., 2 differ", STSRegisters::RUNNING_SPEED, 2, Kind::VELOCITIES}};
+    printf("\n%-16s %12s %12s %8s\n", "batch", "bytes", "declared bus", "gain");
+    STSServoDriver plain;
+    plain.init(&port);
+    STSServoDriver declared;
+    declared.init(&port);
+    if (!declared.setBusServos(nServos, ids.data()))
+        printf("More servos than STS_MAX_SERVOS: the bus cannot be declared\n");
+    // Probe the servos beforehand: only count the batches.
+    for (byte const &id : ids)
+    {
+        plain.getCapabilities(id);
+        declared.getCapabilities(id);
+    }
+    int value = 1;
+    for (Batch const &batch : batches)
+    {
+        uint32_t bytes[2];
+        uint32_t transactions = 0;
+        STSServoDriver *drivers[2] = {&plain, &declared};
+        for (int d = 0; d < 2; d++)
+        {
+            if (batch.kind == Kind::POSITIONS)
+                value += 500;
+            else if (batch.kind == Kind::VELOCITIES)
+                value = (value + 100) % 3000;
+            else
+                value = (value + 10) % 200;
+            STSStatistics const start = drivers[d]->getStatistics();
+            send(*drivers[d], batch, ids, value);
+            bytes[d] = drivers[d]->getStatistics().bytesSent - start.bytesSent;
+            transactions = drivers[d]->getStatistics().transactions - start.transactions;
+            if (!check(bus, batch, value))
+            {
+                printf("Some servos did not get the %s batch\n", batch.name);
+                ok = false;
+            }
+        }
+        printf("%-16s %12u %12u %7.1fx\n", batch.name, bytes[0], bytes[1], static_cast<double>(bytes[0]) / bytes[1]);
+        ok = ok && bytes[1] <= bytes[0];
+        if (batch.kind == Kind::VELOCITIES && transactions != 1)
+        {
+            printf("The %s batch took %u transactions on the declared bus, instead of one\n", batch.name,
+                   static_cast<unsigned>(transactions));
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}
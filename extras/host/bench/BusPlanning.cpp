@@ -0,0 +1,177 @@
+// Spread a fleet of simulated servos over several buses with STSBusPlanner, then check its prediction.
+//
+// The fleet has six legs of three servos, read with readTelemetry, and a head of two servos and four grippers,
+// read with readPositions; each leg and the head are synchronization groups. The traffic of each kind of servo is
+// measured first, as the bus time of a cycle (SYNC WRITE of the targets, then SYNC READ) per servo, in bytes. The
+// planner spreads the fleet over two 1Mbps buses and a 500kbps one, and each bus then runs its cycle back to back
+// with its servos declared by setBusServos. The utilization predicted for each bus is compared to the one measured,
+// the requested rate over the loop rate of the bus: the check fails beyond MAX_ERROR. The loop rate of the fleet
+// is also compared to the one of a naive assignment, the servos split in equal parts in ID order.
+//
+// Usage: BusPlanning [rate]   (rate: cycles per second requested for every servo)
+
+#include "STSBusPlanner.h"
+#include "STSServoDriver.h"
+#include "STSSimulator.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+    int const N_LEGS = 6;
+    int const LEG_SERVOS = 3;
+    int const HEAD_SERVOS = 2;
+    int const GRIPPERS = 4;
+    int const N_BUSES = 3;
+    long const BAUD_RATES[N_BUSES] = {1000000, 1000000, 500000};
+    // Value of the BAUDRATE register for each baud rate above.
+    byte const BAUD_REGISTERS[N_BUSES] = {0, 0, 1};
+    // Servos per bus of the traffic measurement: about the mean of the fleet, to share the cost of the headers as
+    // on the real buses.
+    int const CALIBRATION_SERVOS = 8;
+    // Largest relative error of the predicted utilization of a bus.
+    double const MAX_ERROR = 0.1;
+
+    struct Servo
+    {
+        byte id;
+        byte group;
+        bool telemetry; ///< Read with readTelemetry rather than readPositions.
+    };
+
+    /// \brief Run the cycle of a bus back to back for a second, and return its rate, in Hz.
+    double loopRate(std::vector<Servo> const &servos, long const &baudRate, byte const &baudRegister)
+    {
+        VirtualClock::current().reset();
+        STSSimulatedBus bus;
+        std::vector<byte> ids, telemetryIds, positionIds;
+        for (Servo const &servo : servos)
+        {
+            int const index = bus.addServo(servo.id);
+            bus.memory(index)[STSRegisters::BAUDRATE] = baudRegister;
+            ids.push_back(servo.id);
+            (servo.telemetry ? telemetryIds : positionIds).push_back(servo.id);
+        }
+        HardwareSerial port;
+        port.attach(&bus);
+        STSServoDriver driver;
+        driver.init(&port, baudRate);
+        driver.setBusServos(ids.size(), ids.data());
+
+        int const n = ids.size();
+        std::vector<int> positions(n), speeds(n, 0);
+        std::vector<STSTelemetry> telemetry(telemetryIds.size());
+        std::vector<int16_t> feedback(positionIds.size());
+        std::vector<byte> responded((n + 7) / 8);
+        uint64_t const start = VirtualClock::current().now();
+        uint64_t const end = start + 1000000000ULL;
+        int nCycles = 0;
+        while (VirtualClock::current().now() < end)
+        {
+            for (int i = 0; i < n; i++)
+                positions[i] = 2048 + (nCycles * 8 + i * 64) % 512;
+            driver.setTargetPositions(n, ids.data(), positions.data(), speeds.data());
+            if (!telemetryIds.empty())
+                driver.readTelemetry(telemetryIds.size(), telemetryIds.data(), telemetry.data(), responded.data());
+            if (!positionIds.empty())
+                driver.readPositions(positionIds.size(), positionIds.data(), feedback.data(), responded.data());
+            nCycles++;
+        }
+        return nCycles * 1e9 / (VirtualClock::current().now() - start);
+    }
+
+    /// \brief Bus time of a cycle per servo of a kind, in bytes at 1Mbps.
+    unsigned int measureTraffic(bool const &telemetry)
+    {
+        std::vector<Servo> servos;
+        for (int i = 0; i < CALIBRATION_SERVOS; i++)
+            servos.push_back({static_cast<byte>(i + 1), 0xFF, telemetry});
+        double const rate = loopRate(servos, 1000000, 0);
+        return static_cast<unsigned int>(lround(1000000 / 10.0 / rate / CALIBRATION_SERVOS));
+    }
+
+    /// \brief Loop rate of each bus for an assignment, in Hz.
+    std::vector<double> busRates(std::vector<Servo> const &fleet, std::vector<byte> const &assignment)
+    {
+        std::vector<double> rates(N_BUSES);
+        for (int b = 0; b < N_BUSES; b++)
+        {
+            std::vector<Servo> servos;
+            for (size_t i = 0; i < fleet.size(); i++)
+                if (assignment[i] == b)
+                    servos.push_back(fleet[i]);
+            rates[b] = servos.empty() ? INFINITY : loopRate(servos, BAUD_RATES[b], BAUD_REGISTERS[b]);
+        }
+        return rates;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    float const rate = std::max(argc > 1 ? atof(argv[1]) : 100.0, 1.0);
+
+    std::vector<Servo> fleet;
+    for (int leg = 0; leg < N_LEGS; leg++)
+        for (int j = 0; j < LEG_SERVOS; j++)
+            fleet.push_back({static_cast<byte>(fleet.size() + 1), static_cast<byte>(leg), true});
+    for (int j = 0; j < HEAD_SERVOS; j++)
+        fleet.push_back({static_cast<byte>(fleet.size() + 1), N_LEGS, false});
+    for (int j = 0; j < GRIPPERS; j++)
+        fleet.push_back({static_cast<byte>(fleet.size() + 1), 0xFF, false});
+    int const nServos = fleet.size();
+
+    unsigned int const telemetryBytes = measureTraffic(true);
+    unsigned int const positionBytes = measureTraffic(false);
+    std::vector<STSServoTraffic> traffic(nServos);
+    for (int i = 0; i < nServos; i++)
+        traffic[i] = {fleet[i].id, fleet[i].group, fleet[i].telemetry ? telemetryBytes : positionBytes, rate};
+    std::vector<byte> assignment(nServos);
+    float utilization[N_BUSES];
+    float const worst = STSBusPlanner::plan(nServos, traffic.data(), N_BUSES, BAUD_RATES, assignment.data(),
+                                            utilization);
+
+    printf("%d servos at %.0fHz: %d legs of %d, a head of %d and %d grippers, on buses of %ld, %ld and %ld baud\n",
+           nServos, rate, N_LEGS, LEG_SERVOS, HEAD_SERVOS, GRIPPERS, BAUD_RATES[0], BAUD_RATES[1], BAUD_RATES[2]);
+    printf("measured traffic per cycle: %u bytes per servo read with readTelemetry, %u with readPositions\n",
+           telemetryBytes, positionBytes);
+    printf("%4s %8s %-36s %10s %10s %10s %7s\n", "bus", "baud", "servos", "predicted", "measured", "loop rate",
+           "error");
+    std::vector<double> const rates = busRates(fleet, assignment);
+    double maxError = 0;
+    bool grouped = true;
+    for (int b = 0; b < N_BUSES; b++)
+    {
+        byte ids[nServos];
+        byte const n = STSBusPlanner::servoIdsOnBus(nServos, traffic.data(), assignment.data(), b, ids);
+        char list[128] = "";
+        for (int i = 0, length = 0; i < n && length < static_cast<int>(sizeof(list)) - 4; i++)
+            length += snprintf(list + length, sizeof(list) - length, i == 0 ? "%d" : ",%d", ids[i]);
+        double const measured = rate / rates[b];
+        double const error = fabs(utilization[b] - measured) / measured;
+        maxError = std::max(maxError, error);
+        printf("%4d %8ld %-36s %9.1f%% %9.1f%% %8.0fHz %6.1f%%\n", b, BAUD_RATES[b], list, 100 * utilization[b],
+               100 * measured, rates[b], 100 * error);
+    }
+    for (int i = 0; i < nServos; i++)
+        for (int j = 0; j < nServos; j++)
+            if (fleet[i].group != 0xFF && fleet[i].group == fleet[j].group && assignment[i] != assignment[j])
+                grouped = false;
+
+    std::vector<byte> naive(nServos);
+    for (int i = 0; i < nServos; i++)
+        naive[i] = i * N_BUSES / nServos;
+    std::vector<double> const naiveRates = busRates(fleet, naive);
+    double const fleetRate = *std::min_element(rates.begin(), rates.end());
+    double const naiveRate = *std::min_element(naiveRates.begin(), naiveRates.end());
+    printf("fleet loop rate: predicted %.0fHz, measured %.0fHz (naive assignment: %.0fHz), largest error %.1f%%\n",
+           rate / worst, fleetRate, naiveRate, 100 * maxError);
+
+    bool const ok = grouped && maxError <= MAX_ERROR && fleetRate > naiveRate;
+    if (!ok)
+        printf("The planner splits a group, mispredicts a bus by more than %.0f%% or is beaten by the naive "
+               "assignment\n", 100 * MAX_ERROR);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+// Track sine paths with a position loop on the host around simulated servos in velocity mode: with per-servo
+// calls (two reads and a write per servo and cycle), then with STSController, back to back at the highest rate,
+// then on a fixed period, on a clean link and with dropped replies. All runs use the same fixed-point PID.
+// Reports the cycle rate, the period and jitter statistics, and the tracking error of the simulated servos.
+//
+// Usage: CascadedControl [servos] [seconds]
+
+#include "STSController.h"
+#include "STSServoDriver.h"
+#include "STSSimulator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+    STSPidGains const GAINS = {20 * 256, 10 * 256, 64, 3000};
+    // Tracking errors are measured once the servos have caught up with their paths.
+    double const SETTLE_S = 0.5;
+
+    struct Run
+    {
+        double rate = 0;           ///< In Hz.
+        STSControllerStatistics statistics = {};
+        double rmsError = 0;       ///< In steps.
+        double maxError = 0;       ///< In steps.
+    };
+
+    // Target of a servo: sine of amplitude 600 steps, period 2 to 3s.
+    void path(int const &servo, double const &t, int16_t &position, int16_t &speed)
+    {
+        double const w = 2 * M_PI / (2 + 0.1 * servo);
+        position = static_cast<int16_t>(std::lround(2048 + 600 * std::sin(w * t + servo)));
+        speed = static_cast<int16_t>(std::lround(600 * w * std::cos(w * t + servo)));
+    }
+
+    /// \brief Drive the servos for a given virtual time.
+    /// \param[in] mode 0: per-servo calls, 1: controller back to back, 2: controller on periodUs.
+    Run run(int const &nServos, double const &seconds, int const &mode, uint32_t const &periodUs,
+            STSFaultScenario const &scenario)
+    {
+        VirtualClock::current().reset();
+        STSSimulatedBus bus;
+        std::vector<byte> ids(nServos);
+        for (int i = 0; i < nServos; i++)
+        {
+            ids[i] = i + 1;
+            bus.addServo(ids[i]);
+            bus.setPosition(i, 2048);
+        }
+        HardwareSerial port;
+        port.attach(&bus);
+        STSServoDriver servos;
+        servos.init(&port);
+        for (byte const id : ids)
+            servos.setMode(id, STSMode::VELOCITY);
+        bus.setFaultScenario(scenario);
+
+        STSController controller(servos);
+        std::vector<STSJoint> joints(nServos);
+        for (int i = 0; i < nServos; i++)
+        {
+            controller.addJoint(ids[i], GAINS);
+            joints[i] = *controller.getJoint(ids[i]);
+        }
+        controller.start(mode == 2 ? periodUs : 0);
+
+        Run result;
+        double squaredError = 0;
+        long samples = 0;
+        long cycles = 0;
+        uint64_t const start = VirtualClock::current().now();
+        uint64_t const end = start + static_cast<uint64_t>(seconds * 1e9);
+        std::vector<uint32_t> feedbackTimes(nServos, 0);
+        while (VirtualClock::current().now() < end)
+        {
+            double const t = (VirtualClock::current().now() - start) * 1e-9;
+            for (int i = 0; i < nServos; i++)
+            {
+                int16_t position, speed;
+                path(i, t, position, speed);
+                controller.setTarget(ids[i], position, speed);
+                joints[i].target = position;
+                joints[i].targetSpeed = speed;
+                if (t > SETTLE_S)
+                {
+                    double error = std::fabs(bus.position(i) - position);
+                    error = std::min(error, 4096 - error);
+                    squaredError += error * error;
+                    result.maxError = std::max(result.maxError, error);
+                    samples++;
+                }
+            }
+            if (mode == 0)
+            {
+                for (int i = 0; i < nServos; i++)
+                {
+                    joints[i].position = servos.getCurrentPosition(ids[i]);
+                    joints[i].speed = servos.getCurrentSpeed(ids[i]);
+                    uint32_t const now = micros();
+                    uint32_t const periodUs = cycles > 0 ? now - feedbackTimes[i] : 0;
+                    feedbackTimes[i] = now;
+                    joints[i].command = STSController::pid(nullptr, joints[i], periodUs);
+                }
+                for (int i = 0; i < nServos; i++)
+                    servos.setTargetVelocity(ids[i], joints[i].command);
+            }
+            else
+                controller.runCycle();
+            cycles++;
+        }
+        result.rate = cycles / seconds;
+        result.statistics = controller.getStatistics();
+        result.rmsError = samples > 0 ? std::sqrt(squaredError / samples) : 0;
+        return result;
+    }
+
+    void print(char const *name, Run const &run, bool const &timed)
+    {
+        STSControllerStatistics const &s = run.statistics;
+        printf("%-22s %8.0f %10.2f %10.2f", name, run.rate, run.rmsError, run.maxError);
+        if (timed)
+            printf(" %8u %8u %8u %8u %8u %8u", s.minPeriod, s.maxPeriod, s.meanJitter(), s.maxJitter, s.overruns,
+                   s.missed);
+        printf("\n");
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int const nServos = std::min(argc > 1 ? atoi(argv[1]) : 8, STS_CONTROLLER_JOINTS);
+    double const seconds = argc > 2 ? atof(argv[2]) : 5;
+
+    printf("%d servos in velocity mode tracking sine paths for %.1f s; times in us, errors in steps\n", nServos, seconds);
+    printf("%-22s %8s %10s %10s %8s %8s %8s %8s %8s %8s\n", "", "rate(Hz)", "rms error", "max error", "min per",
+           "max per", "jitter", "max jit", "overrun", "missed");
+    Run const perServo = run(nServos, seconds, 0, 0, STSFaultScenario());
+    print("per-servo calls", perServo, false);
+    Run const backToBack = run(nServos, seconds, 1, 0, STSFaultScenario());
+    print("controller, max rate", backToBack, true);
+    // Fixed period: the longest cycle, with a margin, rounded up to 100us.
+    uint32_t const periodUs = (backToBack.statistics.maxCycleTime * 11 / 10 + 99) / 100 * 100;
+    Run const periodic = run(nServos, seconds, 2, periodUs, STSFaultScenario());
+    char name[32];
+    snprintf(name, sizeof(name), "controller, %uus", periodUs);
+    print(name, periodic, true);
+    STSFaultScenario drops;
+    drops.dropReply = 0.01;
+    Run const faulty = run(nServos, seconds, 2, periodUs, drops);
+    snprintf(name, sizeof(name), "  1%% dropped replies");
+    print(name, faulty, true);
+
+    bool const ok = backToBack.rate > perServo.rate && backToBack.rmsError <= perServo.rmsError
+                    && periodic.statistics.overruns == 0 && periodic.statistics.maxJitter < periodUs / 10
+                    && periodic.statistics.missed == 0;
+    printf("controller: %.1fx the rate of per-servo calls\n", backToBack.rate / perServo.rate);
+    if (!ok)
+        printf("The controller did not keep its rate or period\n");
+    return ok ? 0 : 1;
+}
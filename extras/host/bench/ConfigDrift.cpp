@@ -0,0 +1,159 @@
+// Check the EEPROM configuration of a fleet of simulated servos against a profile captured from a reference
+// servo, some servos having drifted (gains, angle limits, protection thresholds) and all of them having their
+// own POSITION_CORRECTION, which the profile ignores. Times the check (a single SYNC READ of the whole region)
+// against reading the registers one by one, checks that exactly the drifted registers are reported, then
+// repairs the servos and counts the EEPROM writes against rewriting the whole region.
+//
+// Usage: ConfigDrift [servos]
+
+#include "STSServoDriver.h"
+#include "STSSimulator.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+    /// \brief A change of an EEPROM register, applied to every period-th servo, from the offset-th.
+    struct Drift
+    {
+        char const *name;
+        byte reg;
+        byte value;
+        int period;
+        int offset;
+    };
+
+    Drift const DRIFTS[] = {
+        {"POS_PROPORTIONAL_GAIN", STSRegisters::POS_PROPORTIONAL_GAIN, 48, 5, 2},
+        {"MINIMUM_ANGLE", STSRegisters::MINIMUM_ANGLE, 0x20, 7, 3},
+        {"TORQUE_PROTECTION_TH", STSRegisters::TORQUE_PROTECTION_TH, 35, 7, 3},
+        {"MAXIMUM_TEMPERATURE", STSRegisters::MAXIMUM_TEMPERATURE, 85, 11, 10},
+    };
+
+    bool drifts(Drift const &drift, int const &servo)
+    {
+        return servo % drift.period == drift.offset;
+    }
+
+    double elapsedMs(uint64_t const &start)
+    {
+        return (VirtualClock::current().now() - start) * 1e-6;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int const nServos = std::min(std::max(argc > 1 ? atoi(argv[1]) : 12, 2), 253);
+
+    VirtualClock::current().reset();
+    STSSimulatedBus bus;
+    std::vector<byte> ids(nServos);
+    for (int i = 0; i < nServos; i++)
+    {
+        ids[i] = i + 1;
+        bus.addServo(ids[i]);
+        // Calibration of each servo: not part of the profile.
+        bus.memory(i)[STSRegisters::POSITION_CORRECTION] = i;
+    }
+    HardwareSerial port;
+    port.attach(&bus);
+    STSServoDriver servos;
+    servos.init(&port);
+
+    STSConfigProfile profile;
+    if (!servos.captureConfiguration(ids[0], profile))
+    {
+        printf("No reply from the reference servo\n");
+        return 1;
+    }
+    int nExpected = 0;
+    int nDriftedBytes = 0;
+    for (int i = 1; i < nServos; i++)
+    {
+        bool drifted = false;
+        for (Drift const &drift : DRIFTS)
+            if (drifts(drift, i))
+            {
+                bus.memory(i)[drift.reg] = drift.value;
+                nDriftedBytes++;
+                drifted = true;
+            }
+        nExpected += drifted;
+    }
+
+    // Reference: every register of the region read on its own, then compared.
+    uint64_t start = VirtualClock::current().now();
+    int nFound = 0;
+    for (int i = 0; i < nServos; i++)
+    {
+        bool drifted = false;
+        for (int r = 0; r < STSConfigRegion::LENGTH; r++)
+        {
+            bool const checked = profile.mask[r / 8] & (1 << (r % 8));
+            if (checked && servos.readRegister(ids[i], STSConfigRegion::START + r) != profile.values[r])
+                drifted = true;
+        }
+        nFound += drifted;
+    }
+    double const perRegisterMs = elapsedMs(start);
+
+    std::vector<STSConfigDrift> drift(nServos);
+    std::vector<byte> responded((nServos + 7) / 8);
+    start = VirtualClock::current().now();
+    int const nDrifted = servos.checkConfiguration(nServos, ids.data(), profile, drift.data(), responded.data());
+    double const checkMs = elapsedMs(start);
+
+    printf("%d servos, %d registers checked per servo, %d drifted servos\n", nServos, STSConfigRegion::LENGTH - 2,
+           nExpected);
+    printf("%-24s %10s %10s\n", "", "time(ms)", "drifted");
+    printf("%-24s %10.2f %10d\n", "register by register", perRegisterMs, nFound);
+    printf("%-24s %10.2f %10d\n", "checkConfiguration", checkMs, nDrifted);
+
+    // The reported registers must be exactly the drifted ones.
+    bool reported = true;
+    int nResponded = 0;
+    for (int i = 0; i < nServos; i++)
+    {
+        nResponded += (responded[i / 8] >> (i % 8)) & 1;
+        for (int r = 0; r < STSConfigRegion::LENGTH; r++)
+        {
+            bool expected = false;
+            for (Drift const &d : DRIFTS)
+                expected |= drifts(d, i) && d.reg == STSConfigRegion::START + r;
+            bool const mismatched = drift[i].mismatched[r / 8] & (1 << (r % 8));
+            if (mismatched != expected)
+                reported = false;
+        }
+    }
+    for (Drift const &d : DRIFTS)
+    {
+        int n = 0;
+        for (int i = 1; i < nServos; i++)
+            n += drifts(d, i);
+        printf("  %-22s drifted on %d servos\n", d.name, n);
+    }
+
+    // Repair: only the drifted registers are written to the EEPROM.
+    start = VirtualClock::current().now();
+    int nWritten = 0;
+    for (int i = 0; i < nServos; i++)
+        if (drift[i].digest != profile.digest)
+            nWritten += std::max(servos.repairConfiguration(ids[i], profile, drift[i]), 0);
+    double const repairMs = elapsedMs(start);
+    int const nAfter = servos.checkConfiguration(nServos, ids.data(), profile, drift.data(), responded.data());
+    bool locked = true;
+    for (int i = 0; i < nServos; i++)
+        locked &= bus.memory(i)[STSRegisters::WRITE_LOCK] == 1;
+    printf("repair: %d EEPROM writes in %.2f ms (whole region: %d), %d drifted servos left\n",
+           static_cast<int>(bus.eepromWriteCount()), repairMs, nExpected * (STSConfigRegion::LENGTH - 2), nAfter);
+
+    bool const ok = nResponded == nServos && nDrifted == nExpected && nFound == nExpected && reported
+                    && checkMs < perRegisterMs && nWritten == nDriftedBytes
+                    && static_cast<int>(bus.eepromWriteCount()) == nDriftedBytes && nAfter == 0 && locked;
+    printf("checkConfiguration: %.1fx faster than register by register\n", perRegisterMs / checkMs);
+    if (!ok)
+        printf("The check or the repair did not find or fix exactly the drifted registers\n");
+    return ok ? 0 : 1;
+}
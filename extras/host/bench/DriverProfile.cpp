@@ -0,0 +1,71 @@
+// Profile the CPU cost of the driver functions (frame building, checksums, type dispatch, reply parsing),
+// wire waits excluded, over a typical control loop: SYNC WRITE of setpoints, motions, velocities and raw
+// registers, SYNC READ of the telemetry and a few single reads. The host build profiles in real time (STS_PROFILE_CLOCK is cpuNanos):
+// the costs are those of the host CPU, the relative costs of the functions carry over to a MCU.
+//
+// Usage: DriverProfile [servos] [cycles]
+
+#include "STSServoDriver.h"
+#include "STSSimulator.h"
+
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+    char const *const NAMES[STSProfile::COUNT] = {
+        "sendMessage", "receiveMessage", "convertIntToBytes", "setTargetPositions", "setTargetMotions",
+        "syncReadRegisters", "syncWriteRegisters", "setTargetVelocities"};
+};
+
+int main(int argc, char **argv)
+{
+    int const nServos = argc > 1 ? atoi(argv[1]) : 12;
+    int const nCycles = argc > 2 ? atoi(argv[2]) : 10000;
+
+    STSSimulatedBus bus;
+    std::vector<byte> ids(nServos);
+    for (int i = 0; i < nServos; i++)
+    {
+        ids[i] = i + 1;
+        bus.addServo(ids[i]);
+    }
+    HardwareSerial port;
+    port.attach(&bus);
+    STSServoDriver servos;
+    servos.init(&port);
+    // Probe all the servos before profiling.
+    for (byte const &id : ids)
+        servos.ping(id);
+    servos.resetProfile();
+
+    std::vector<int> positions(nServos), speeds(nServos, 2000);
+    std::vector<byte> accelerations(nServos, 50);
+    std::vector<STSTelemetry> telemetry(nServos);
+    std::vector<byte> responded((nServos + 7) / 8);
+    for (int cycle = 0; cycle < nCycles; cycle++)
+    {
+        for (int i = 0; i < nServos; i++)
+            positions[i] = (cycle * 13 + i * 300) % 4096;
+        if (cycle % 3 == 0)
+            servos.setTargetPositions(nServos, ids.data(), positions.data(), speeds.data());
+        else if (cycle % 3 == 1)
+            servos.setTargetMotions(nServos, ids.data(), positions.data(), speeds.data(), accelerations.data());
+        else
+        {
+            servos.syncWriteRegisters(nServos, ids.data(), STSRegisters::TARGET_ACCELERATION, 1, accelerations.data());
+            servos.setTargetVelocities(nServos, ids.data(), positions.data());
+        }
+        servos.readTelemetry(nServos, ids.data(), telemetry.data(), responded.data());
+        servos.getCurrentPosition(ids[cycle % nServos]);
+    }
+
+    printf("%d servos, %d cycles, costs in ns\n", nServos, nCycles);
+    printf("%-20s %10s %10s %10s %10s\n", "function", "calls", "min", "mean", "max");
+    for (byte f = 0; f < STSProfile::COUNT; f++)
+    {
+        STSProfileEntry const &entry = servos.getProfile(f);
+        printf("%-20s %10u %10u %10u %10u\n", NAMES[f], entry.calls, entry.minimum, entry.mean(), entry.maximum);
+    }
+    return 0;
+}
@@ -0,0 +1,157 @@
+// Measure how the effective transaction rate of the driver degrades as the link gets worse.
+//
+// For each fault kind (and all of them mixed), and for increasing fault rates, servos are polled with
+// single register reads (readRegisters / receiveMessage path) and SYNC READ. The report gives the
+// delivered transactions per second, the latency distribution of single reads and the time needed to
+// get a valid reading again after a failure.
+//
+// Usage: FaultSweep [transactions per point] [capture], the traffic of the mixed 5% point being recorded
+// for TraceAnalyzer if a capture file is given.
+
+#include "STSServoDriver.h"
+#include "STSSimulator.h"
+#include "SerialTrace.h"
+
+#include <algorithm>
+#include <memory>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+namespace
+{
+    int const N_SERVOS = 12;
+    int const MAXIMUM_ANGLE = 4095; // Register read, a known non-zero value: 0 or anything else is a failure.
+
+    struct Result
+    {
+        double transactionsPerSecond;
+        double successRate;
+        double p50, p99, maxLatency; ///< Single read latency, in us.
+        double meanRecovery, maxRecovery; ///< Time from a failed read to the next valid one on the same servo, in ms.
+        int syncResponses;    ///< Servos that answered SYNC READ.
+        uint64_t faults;
+    };
+
+    Result run(STSFaultScenario const &scenario, int const nTransactions, char const *capture = nullptr)
+    {
+        VirtualClock::current().reset();
+        STSSimulatedBus bus;
+        byte ids[N_SERVOS];
+        for (int i = 0; i < N_SERVOS; i++)
+        {
+            ids[i] = i + 1;
+            bus.addServo(ids[i]);
+        }
+        HardwareSerial port;
+        std::unique_ptr<SerialTrace> trace;
+        if (capture != nullptr)
+        {
+            trace.reset(new SerialTrace(&bus, capture));
+            port.attach(trace.get());
+        }
+        else
+            port.attach(&bus);
+        STSServoDriver servos;
+        servos.init(&port);
+        bus.setFaultScenario(scenario);
+
+        std::vector<double> latencies;
+        std::vector<double> recoveries;
+        unsigned long failedSince[N_SERVOS] = {0};
+        bool failing[N_SERVOS] = {false};
+        int successes = 0;
+        int syncResponses = 0;
+        byte feedback[2 * N_SERVOS];
+        byte responded[(N_SERVOS + 7) / 8];
+
+        unsigned long const start = micros();
+        for (int t = 0; t < nTransactions; t++)
+        {
+            // One SYNC READ every N_SERVOS single reads.
+            if (t % (N_SERVOS + 1) == N_SERVOS)
+            {
+                syncResponses += servos.syncReadRegisters(N_SERVOS, ids, STSRegisters::CURRENT_POSITION, 2, feedback, responded);
+                continue;
+            }
+            int const s = t % (N_SERVOS + 1);
+            unsigned long const t0 = micros();
+            bool const ok = servos.readTwoBytesRegister(ids[s], STSRegisters::MAXIMUM_ANGLE) == MAXIMUM_ANGLE;
+            unsigned long const t1 = micros();
+            latencies.push_back(t1 - t0);
+            if (ok)
+            {
+                successes++;
+                if (failing[s])
+                    recoveries.push_back((t1 - failedSince[s]) / 1000.0);
+                failing[s] = false;
+            }
+            else if (!failing[s])
+            {
+                failing[s] = true;
+                failedSince[s] = t0;
+            }
+        }
+        double const elapsed = (micros() - start) * 1e-6;
+
+        Result r;
+        int const nReads = latencies.size();
+        std::sort(latencies.begin(), latencies.end());
+        r.transactionsPerSecond = (successes + syncResponses) / elapsed;
+        r.successRate = 100.0 * successes / nReads;
+        r.p50 = latencies[nReads / 2];
+        r.p99 = latencies[nReads * 99 / 100];
+        r.maxLatency = latencies.back();
+        r.meanRecovery = 0;
+        r.maxRecovery = 0;
+        for (double const &d : recoveries)
+        {
+            r.meanRecovery += d / recoveries.size();
+            r.maxRecovery = std::max(r.maxRecovery, d);
+        }
+        r.syncResponses = syncResponses;
+        r.faults = bus.faultCount();
+        return r;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int const nTransactions = argc > 1 ? atoi(argv[1]) : 20000;
+    char const *capture = argc > 2 ? argv[2] : nullptr;
+    char const *kinds[] = {"drop", "checksum", "stray", "truncate", "late", "vanish", "mixed"};
+    double const rates[] = {0.001, 0.01, 0.05, 0.1};
+
+    printf("%-9s %6s %8s | %9s %6s | %8s %8s %8s | %9s %9s\n", "fault", "rate", "faults", "tx/s", "ok %",
+           "p50(us)", "p99(us)", "max(us)", "rec(ms)", "maxrec(ms)");
+    Result const r = run(STSFaultScenario(), nTransactions);
+    printf("%-9s %6.3f %8lu | %9.0f %6.2f | %8.0f %8.0f %8.0f | %9.2f %9.2f\n", "none", 0.0, 0ul,
+           r.transactionsPerSecond, r.successRate, r.p50, r.p99, r.maxLatency, r.meanRecovery, r.maxRecovery);
+    for (char const *kind : kinds)
+    {
+        for (double const &rate : rates)
+        {
+            STSFaultScenario scenario;
+            std::string const k(kind);
+            bool const mixed = k == "mixed";
+            double const p = mixed ? rate / 6 : rate;
+            if (mixed || k == "drop")
+                scenario.dropReply = p;
+            if (mixed || k == "checksum")
+                scenario.corruptChecksum = p;
+            if (mixed || k == "stray")
+                scenario.strayBytes = p;
+            if (mixed || k == "truncate")
+                scenario.truncateReply = p;
+            if (mixed || k == "late")
+                scenario.lateReply = p;
+            if (mixed || k == "vanish")
+                scenario.vanish = p;
+            Result const r = run(scenario, nTransactions, mixed && rate == 0.05 ? capture : nullptr);
+            printf("%-9s %6.3f %8lu | %9.0f %6.2f | %8.0f %8.0f %8.0f | %9.2f %9.2f\n", kind, rate,
+                   static_cast<unsigned long>(r.faults), r.transactionsPerSecond, r.successRate,
+                   r.p50, r.p99, r.maxLatency, r.meanRecovery, r.maxRecovery);
+        }
+    }
+    return 0;
+}
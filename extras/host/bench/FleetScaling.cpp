@@ -0,0 +1,86 @@
+// Stress the driver with full buses of 253 servos, several buses running in parallel (one thread each).
+//
+// Each cycle sends the target positions of all servos (SYNC WRITE) and reads back their positions
+// (SYNC READ). The report compares the virtual bus time to the real time spent, and the share of
+// real time spent integrating the servo models: the simulator should never be the bottleneck.
+//
+// Usage: FleetScaling [buses] [servos per bus] [cycles]
+
+#include "STSServoDriver.h"
+#include "STSSimulator.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct BusResult
+    {
+        int responses = 0;
+        double virtualTime = 0; ///< In s.
+        double realTime = 0;    ///< In s.
+        double stepTime = 0;    ///< Real time spent in the motor model, in s.
+        double wireBusy = 0;    ///< In s.
+    };
+
+    void runBus(int const nServos, int const nCycles, BusResult &result)
+    {
+        STSSimulatedBus bus;
+        std::vector<byte> ids(nServos);
+        for (int i = 0; i < nServos; i++)
+        {
+            ids[i] = i + 1;
+            bus.addServo(ids[i]);
+        }
+        HardwareSerial port;
+        port.attach(&bus);
+        STSServoDriver servos;
+        servos.init(&port);
+
+        std::vector<int> positions(nServos), speeds(nServos, 3000);
+        std::vector<byte> feedback(2 * nServos), responded((nServos + 7) / 8);
+        auto const start = std::chrono::steady_clock::now();
+        uint64_t const virtualStart = VirtualClock::current().now();
+        for (int cycle = 0; cycle < nCycles; cycle++)
+        {
+            for (int i = 0; i < nServos; i++)
+                positions[i] = (cycle * 40 + i * 16) % 4096;
+            servos.setTargetPositions(nServos, ids.data(), positions.data(), speeds.data());
+            result.responses += servos.syncReadRegisters(nServos, ids.data(), STSRegisters::CURRENT_POSITION, 2,
+                                                         feedback.data(), responded.data());
+        }
+        result.realTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        result.virtualTime = (VirtualClock::current().now() - virtualStart) * 1e-9;
+        result.stepTime = bus.stepCpuTime() * 1e-9;
+        result.wireBusy = bus.wireBusyTime() * 1e-9;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int const nBuses = argc > 1 ? atoi(argv[1]) : 4;
+    int const nServos = argc > 2 ? atoi(argv[2]) : 253;
+    int const nCycles = argc > 3 ? atoi(argv[3]) : 200;
+
+    std::vector<BusResult> results(nBuses);
+    std::vector<std::thread> threads;
+    auto const start = std::chrono::steady_clock::now();
+    for (int b = 0; b < nBuses; b++)
+        threads.emplace_back(runBus, nServos, nCycles, std::ref(results[b]));
+    for (auto &t : threads)
+        t.join();
+    double const wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%d buses x %d servos, %d cycles\n", nBuses, nServos, nCycles);
+    printf("%4s %10s %12s %12s %10s %10s\n", "bus", "responses", "cycle (ms)", "virtual/real", "wire busy", "sim share");
+    for (int b = 0; b < nBuses; b++)
+    {
+        BusResult const &r = results[b];
+        printf("%4d %10d %12.3f %12.1f %9.1f%% %9.1f%%\n", b, r.responses, 1000 * r.virtualTime / nCycles,
+               r.virtualTime / r.realTime, 100 * r.wireBusy / r.virtualTime, 100 * r.stepTime / r.realTime);
+    }
+    printf("Wall time: %.3f s\n", wall);
+    return 0;
+}
@@ -0,0 +1,119 @@
+// Feed the telemetry history with hours of samples from moving servos, as an MCU would, and report
+// its memory footprint, the cost of adding samples and the time span covered at each resolution.
+// The history is then exported in binary, as it would be sent over a serial port, for HistoryDump.
+//
+// Usage: HistoryRetention [hours] [export file]
+
+#include "STSServoDriver.h"
+#include "STSSimulator.h"
+#include "STSTelemetryHistory.h"
+
+#include <chrono>
+#include <stdio.h>
+
+namespace
+{
+    int const N_SERVOS = 4;
+    unsigned long const SAMPLE_PERIOD_MS = 1000;
+
+    /// \brief Print writing to a file.
+    class FilePrint : public Print
+    {
+    public:
+        explicit FilePrint(FILE *file) : file_(file) {}
+        size_t write(uint8_t value) override { return fputc(value, file_) == EOF ? 0 : 1; }
+
+    private:
+        FILE *file_;
+    };
+};
+
+int main(int argc, char **argv)
+{
+    double const hours = argc > 1 ? atof(argv[1]) : 8;
+    char const *path = argc > 2 ? argv[2] : "history.bin";
+
+    STSSimulatedBus bus;
+    byte ids[N_SERVOS];
+    for (int i = 0; i < N_SERVOS; i++)
+    {
+        ids[i] = i + 1;
+        bus.addServo(ids[i]);
+    }
+    // Samples are one second apart: a coarse integration step is enough.
+    bus.model().integrationStep = 10e-3;
+    Serial.attach(&bus);
+    STSServoDriver servos;
+    servos.init(&Serial);
+
+    static STSTelemetryHistory history;
+    STSTelemetry telemetry[N_SERVOS];
+    byte responded[1];
+    int positions[N_SERVOS];
+    int speeds[N_SERVOS];
+    double addTime = 0;
+    double maxAddTime = 0;
+    unsigned long const nSamples = hours * 3600 * 1000 / SAMPLE_PERIOD_MS;
+    for (unsigned long k = 0; k < nSamples; k++)
+    {
+        // Servos work harder during the first half of each hour, and heat up.
+        if (k % 5 == 0)
+        {
+            bool const busy = (k * SAMPLE_PERIOD_MS / 1000) % 3600 < 1800;
+            for (int i = 0; i < N_SERVOS; i++)
+            {
+                positions[i] = (k / 5) % 2 == 0 ? 500 + 500 * i : 3500 - 500 * i;
+                speeds[i] = busy ? 3400 : 300;
+            }
+            servos.setTargetPositions(N_SERVOS, ids, positions, speeds);
+        }
+        unsigned long const t0 = millis();
+        servos.readTelemetry(N_SERVOS, ids, telemetry, responded);
+        auto const start = std::chrono::steady_clock::now();
+        history.add(t0, N_SERVOS, ids, telemetry, responded);
+        double const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        addTime += elapsed;
+        if (elapsed > maxAddTime)
+            maxAddTime = elapsed;
+        delay(SAMPLE_PERIOD_MS - (millis() - t0));
+    }
+
+    printf("%.1f h of samples every %lu ms, %d servos\n", hours, SAMPLE_PERIOD_MS, N_SERVOS);
+    printf("History: %lu bytes for %d servos (%lu per servo), add: %.0f ns mean, %.0f ns max per batch\n",
+           static_cast<unsigned long>(sizeof(STSTelemetryHistory)), STS_HISTORY_SERVOS,
+           static_cast<unsigned long>(sizeof(STSTelemetryHistory) / STS_HISTORY_SERVOS), 1e9 * addTime / nSamples,
+           1e9 * maxAddTime);
+
+    unsigned long const now = millis();
+    uint32_t oldest = 0;
+    history.getRawSample(1, STSHistoryField::TEMPERATURE, 0, oldest);
+    printf("%-6s %10s %14s %10s %10s\n", "level", "entries", "covers (min)", "min temp", "max temp");
+    printf("%-6s %10d %14.1f\n", "raw", history.getRawCount(1, STSHistoryField::TEMPERATURE), (now - oldest) / 60000.0);
+    for (int level = 0; level < STS_HISTORY_LEVELS; level++)
+    {
+        int const n = history.getBucketCount(1, STSHistoryField::TEMPERATURE, level);
+        if (n == 0)
+            continue;
+        int minimum = 1000, maximum = -1000;
+        for (int i = 0; i < n; i++)
+        {
+            STSTelemetryHistory::Bucket const &b = history.getBucket(1, STSHistoryField::TEMPERATURE, level, i);
+            minimum = b.minimum < minimum ? b.minimum : minimum;
+            maximum = b.maximum > maximum ? b.maximum : maximum;
+        }
+        STSTelemetryHistory::Bucket const &first = history.getBucket(1, STSHistoryField::TEMPERATURE, level, 0);
+        printf("%-6d %10d %14.1f %10d %10d\n", level, n, (now - first.start) / 60000.0, minimum, maximum);
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr)
+    {
+        perror(path);
+        return 1;
+    }
+    FilePrint output(file);
+    size_t const size = history.exportTo(output);
+    fclose(file);
+    printf("Exported %lu bytes to %s (%.1f ms at 1Mbps)\n", static_cast<unsigned long>(size), path, size * 10e-3);
+    return 0;
+}
@@ -0,0 +1,250 @@
+// Publish the statistics and telemetry of a simulated bus to a STSMetricsExporter after each cycle, first without
+// scrapes, then with a scraper every 1ms over loopback HTTP and another over a Unix socket. Reports the real time
+// of publish in the bus thread (ns) in both runs, the scrapes served and their size, and checks that the scrapes
+// are valid OpenMetrics and match the driver counters. On a single core, the largest times include preemption by
+// the scraper threads. Then checks that the per-servo error counters keep counting past the 16-bit counters of
+// the driver, which wrap at 65535.
+//
+// Usage: MetricsExport [servos] [cycles] [print]   (print: show the last snapshot, as served)
+
+#include "STSMetricsExporter.h"
+#include "STSServoDriver.h"
+#include "STSSimulator.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+    char const SOCKET_PATH[] = "/tmp/sts-metrics-bench.sock";
+
+    uint64_t realNanos()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    /// \brief GET /metrics, over TCP on the loopback if port is not 0, else over the Unix socket.
+    std::string scrape(uint16_t const &port)
+    {
+        int fd;
+        if (port != 0)
+        {
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in address = {};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(port);
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+            {
+                close(fd);
+                return "";
+            }
+        }
+        else
+        {
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            sockaddr_un address = {};
+            address.sun_family = AF_UNIX;
+            strcpy(address.sun_path, SOCKET_PATH);
+            if (connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+            {
+                close(fd);
+                return "";
+            }
+        }
+        char const request[] = "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL);
+        std::string reply;
+        char buffer[4096];
+        ssize_t n;
+        while ((n = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+            reply.append(buffer, n);
+        close(fd);
+        size_t const body = reply.find("\r\n\r\n");
+        return reply.compare(0, 12, "HTTP/1.1 200") == 0 && body != std::string::npos ? reply.substr(body + 4) : "";
+    }
+
+    /// \brief Value of the first sample of a metric, -1 if absent.
+    double value(std::string const &text, char const *sample)
+    {
+        size_t const at = text.find(std::string("\n") + sample);
+        if (at == std::string::npos)
+            return -1;
+        size_t const space = text.find("} ", at);
+        return space == std::string::npos ? -1 : atof(text.c_str() + space + 2);
+    }
+
+    /// \brief Whether a scrape is well formed, with counters no larger than the final ones.
+    bool valid(std::string const &text, STSStatistics const &final)
+    {
+        if (text.size() < 6 || text.compare(text.size() - 6, 6, "# EOF\n") != 0)
+            return false;
+        double const transactions = value(text, "sts_transactions_total");
+        double const count = value(text, "sts_reply_latency_seconds_count");
+        double const inf = value(text, "sts_reply_latency_seconds_bucket{bus=\"0\",le=\"+Inf\"");
+        return transactions >= 0 && transactions <= final.transactions && count == inf && count >= 0;
+    }
+
+    struct Run
+    {
+        std::vector<uint32_t> publishNs;
+        uint64_t scrapes = 0;
+        size_t scrapeBytes = 0;
+        bool valid = true;
+        std::string last;
+    };
+
+    Run run(int const &nServos, int const &cycles, bool const &scraping)
+    {
+        VirtualClock::current().reset();
+        STSSimulatedBus bus;
+        std::vector<byte> ids(nServos);
+        for (int i = 0; i < nServos; i++)
+        {
+            ids[i] = i + 1;
+            bus.addServo(ids[i]);
+        }
+        HardwareSerial port;
+        port.attach(&bus);
+        STSServoDriver servos;
+        servos.init(&port);
+
+        STSMetricsExporter http("0");
+        STSMetricsExporter unixSocket("0");
+        std::atomic<bool> done(false);
+        std::vector<std::thread> scrapers;
+        std::vector<std::string> scraped(2);
+        std::atomic<size_t> bytes(0);
+        std::atomic<bool> parsed(true);
+        Run result;
+        if (scraping)
+        {
+            if (!http.listenHttp(0) || !unixSocket.listenUnix(SOCKET_PATH))
+            {
+                result.valid = false;
+                return result;
+            }
+            for (int s = 0; s < 2; s++)
+                scrapers.emplace_back([&, s]() {
+                    while (!done)
+                    {
+                        std::string const text = scrape(s == 0 ? http.getPort() : 0);
+                        if (text.empty())
+                            parsed = false;
+                        bytes += text.size();
+                        scraped[s] = text;
+                        // A scraper far more eager than real ones (every few seconds), but not one that takes
+                        // the whole CPU from the bus thread.
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    }
+                });
+        }
+
+        std::vector<STSTelemetry> telemetry(nServos);
+        std::vector<byte> responded((nServos + 7) / 8);
+        std::vector<int> positions(nServos), speeds(nServos, 2000);
+        result.publishNs.reserve(cycles);
+        for (int c = 0; c < cycles; c++)
+        {
+            servos.readTelemetry(nServos, ids.data(), telemetry.data(), responded.data());
+            for (int i = 0; i < nServos; i++)
+                positions[i] = 2048 + ((c / 50) % 2 ? 400 : -400);
+            servos.setTargetPositions(nServos, ids.data(), positions.data(), speeds.data());
+            uint64_t const start = realNanos();
+            http.publish(servos, nServos, ids.data(), telemetry.data(), responded.data());
+            unixSocket.publish(servos, nServos, ids.data(), telemetry.data(), responded.data());
+            result.publishNs.push_back((realNanos() - start) / 2);
+        }
+        done = true;
+        for (std::thread &scraper : scrapers)
+            scraper.join();
+        if (scraping)
+        {
+            result.scrapes = http.getScrapeCount() + unixSocket.getScrapeCount();
+            result.scrapeBytes = result.scrapes > 0 ? bytes / result.scrapes : 0;
+            result.valid = parsed && result.scrapes > 0;
+            for (std::string const &text : scraped)
+                result.valid = result.valid && valid(text, servos.getStatistics());
+            http.stop();
+            unixSocket.stop();
+            // The last snapshot, once the bus is idle: its counters are the final ones.
+            result.last = http.render();
+            result.valid = result.valid
+                           && value(result.last, "sts_transactions_total") == servos.getStatistics().transactions;
+        }
+        std::sort(result.publishNs.begin(), result.publishNs.end());
+        return result;
+    }
+
+    /// \brief Count more timeouts of a servo than its 16-bit counter in the driver holds, publishing now and then.
+    /// \return Whether the exported counter holds all of them.
+    bool countPastWrap(int const &nTimeouts)
+    {
+        VirtualClock::current().reset();
+        STSSimulatedBus bus;
+        bus.addServo(1);
+        HardwareSerial port;
+        port.attach(&bus);
+        STSServoDriver servos;
+        servos.init(&port);
+        servos.ping(1);
+        STSFaultScenario silent;
+        silent.dropReply = 1;
+        bus.setFaultScenario(silent);
+        STSMetricsExporter exporter("0");
+        for (int i = 0; i < nTimeouts; i++)
+        {
+            servos.getCurrentPosition(1);
+            if (i % 1000 == 0)
+                exporter.publish(servos);
+        }
+        exporter.publish(servos);
+        double const exported = value(exporter.render(), "sts_servo_timeouts_total{bus=\"0\",servo=\"1\"");
+        printf("%d timeouts of a servo, %.0f exported\n", nTimeouts, exported);
+        return exported == nTimeouts;
+    }
+
+    void print(char const *name, Run const &run)
+    {
+        std::vector<uint32_t> const &ns = run.publishNs;
+        uint64_t total = 0;
+        for (uint32_t const t : ns)
+            total += t;
+        printf("%-18s %8lu %8u %8u %8u %8lu %8zu\n", name, static_cast<unsigned long>(total / ns.size()),
+               ns[ns.size() / 2], ns[ns.size() * 99 / 100], ns.back(), static_cast<unsigned long>(run.scrapes),
+               run.scrapeBytes);
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int const nServos = std::min(std::max(argc > 1 ? atoi(argv[1]) : 12, 1), STS_MAX_SERVOS);
+    int const cycles = std::max(argc > 2 ? atoi(argv[2]) : 20000, 100);
+
+    printf("%d servos, %d cycles, real time of publish in the bus thread, in ns\n", nServos, cycles);
+    printf("%-18s %8s %8s %8s %8s %8s %8s\n", "", "mean", "median", "p99", "max", "scrapes", "bytes");
+    Run const quiet = run(nServos, cycles, false);
+    print("no scrapes", quiet);
+    Run const scraped = run(nServos, cycles, true);
+    print("scraped", scraped);
+    if (argc > 3 && strcmp(argv[3], "print") == 0)
+        printf("%s", scraped.last.c_str());
+
+    if (!scraped.valid)
+        printf("A scrape was missing or malformed, or did not match the driver counters\n");
+    bool const counted = countPastWrap(70000);
+    if (!counted)
+        printf("The servo counters wrapped\n");
+    return scraped.valid && counted ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+// Compare application modules each polling the registers they care about (motion end, temperature
+// threshold, status bits) with the same conditions as driver subscriptions, folded into batched reads.
+// Reports the bus traffic per cycle and checks that both detect the same edges.
+//
+// Usage: SubscriptionPolling [servos] [seconds]
+
+#include "STSServoDriver.h"
+#include "STSSimulator.h"
+
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+    unsigned long const CYCLE_MS = 20;
+    int const TEMPERATURE_LIMIT = 27;
+    int const TEMPERATURE_HYSTERESIS = 1;
+
+    struct Edges
+    {
+        int motionEnded = 0;
+        int hot = 0;
+        int cooled = 0;
+        int statusRaised = 0;
+    };
+
+    void onEdge(byte, byte registerId, int16_t, bool active, void *context)
+    {
+        Edges &edges = *static_cast<Edges *>(context);
+        if (registerId == STSRegisters::MOVING_STATUS && !active)
+            edges.motionEnded++;
+        else if (registerId == STSRegisters::CURRENT_TEMPERATURE)
+            (active ? edges.hot : edges.cooled)++;
+        else if (registerId == STSRegisters::STATUS && active)
+            edges.statusRaised++;
+    }
+
+    struct Run
+    {
+        Edges edges;
+        uint32_t transactions;
+        uint32_t bytes;
+        double busTimePerCycle; ///< In ms.
+    };
+
+    // Servo i goes back and forth, with a speed that depends on i so that motions end at different times.
+    void move(STSServoDriver &servos, std::vector<byte> const &ids, unsigned long const cycle)
+    {
+        for (size_t i = 0; i < ids.size(); i++)
+            if (cycle % (20 + 7 * i) == 0)
+                servos.setTargetPosition(ids[i], (cycle / (20 + 7 * i)) % 2 == 0 ? 3500 : 500, 3400);
+    }
+
+    Run run(int const nServos, unsigned long const nCycles, bool const subscribe)
+    {
+        VirtualClock::current().reset();
+        STSSimulatedBus bus;
+        std::vector<byte> ids(nServos);
+        for (int i = 0; i < nServos; i++)
+        {
+            ids[i] = i + 1;
+            bus.addServo(ids[i]);
+        }
+        HardwareSerial port;
+        port.attach(&bus);
+        STSServoDriver servos;
+        servos.init(&port);
+
+        Run result;
+        if (subscribe)
+        {
+            for (byte const &id : ids)
+            {
+                servos.subscribe(id, STSRegisters::MOVING_STATUS, 1, STSCondition::ANY_BIT_SET, 1, 0, onEdge, &result.edges);
+                servos.subscribe(id, STSRegisters::CURRENT_TEMPERATURE, 1, STSCondition::ABOVE_THRESHOLD,
+                                 TEMPERATURE_LIMIT, TEMPERATURE_HYSTERESIS, onEdge, &result.edges);
+                servos.subscribe(id, STSRegisters::STATUS, 1, STSCondition::ANY_BIT_SET, 0xFF, 0, onEdge, &result.edges);
+            }
+        }
+        // State kept by the polling modules, to detect the edges themselves.
+        std::vector<bool> moving(nServos, false), hot(nServos, false), fault(nServos, false);
+
+        STSStatistics const start = servos.getStatistics();
+        for (unsigned long cycle = 0; cycle < nCycles; cycle++)
+        {
+            unsigned long const t0 = millis();
+            move(servos, ids, cycle);
+            STSStatistics const before = servos.getStatistics();
+            if (subscribe)
+                servos.updateSubscriptions();
+            else
+            {
+                // Motion module.
+                for (int i = 0; i < nServos; i++)
+                {
+                    bool const m = servos.isMoving(ids[i]);
+                    if (moving[i] && !m)
+                        result.edges.motionEnded++;
+                    moving[i] = m;
+                }
+                // Thermal module.
+                for (int i = 0; i < nServos; i++)
+                {
+                    int const t = servos.readRegister(ids[i], STSRegisters::CURRENT_TEMPERATURE);
+                    bool const h = hot[i] ? t >= TEMPERATURE_LIMIT - TEMPERATURE_HYSTERESIS : t >= TEMPERATURE_LIMIT;
+                    if (h != hot[i])
+                        (h ? result.edges.hot : result.edges.cooled)++;
+                    hot[i] = h;
+                }
+                // Fault module.
+                for (int i = 0; i < nServos; i++)
+                {
+                    bool const f = servos.readRegister(ids[i], STSRegisters::STATUS) != 0;
+                    if (f && !fault[i])
+                        result.edges.statusRaised++;
+                    fault[i] = f;
+                }
+            }
+            STSStatistics const after = servos.getStatistics();
+            result.busTimePerCycle += (after.bytesSent + after.bytesReceived - before.bytesSent - before.bytesReceived) * 10e-3;
+            delay(CYCLE_MS - (millis() - t0) % CYCLE_MS);
+        }
+        STSStatistics const end = servos.getStatistics();
+        result.transactions = end.transactions - start.transactions;
+        result.bytes = end.bytesSent + end.bytesReceived - start.bytesSent - start.bytesReceived;
+        result.busTimePerCycle /= nCycles;
+        return result;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int const nServos = argc > 1 ? atoi(argv[1]) : 8;
+    double const seconds = argc > 2 ? atof(argv[2]) : 120;
+    unsigned long const nCycles = seconds * 1000 / CYCLE_MS;
+    if (3 * nServos > STS_MAX_SUBSCRIPTIONS)
+    {
+        printf("At most %d servos with STS_MAX_SUBSCRIPTIONS = %d\n", STS_MAX_SUBSCRIPTIONS / 3, STS_MAX_SUBSCRIPTIONS);
+        return 1;
+    }
+
+    printf("%d servos, %lu cycles of %lu ms: motion end, temperature above %d, status bits\n", nServos, nCycles,
+           CYCLE_MS, TEMPERATURE_LIMIT);
+    printf("%-14s %14s %12s %16s | %8s %8s %8s %8s\n", "", "transactions", "bytes", "bus (ms/cycle)", "stopped",
+           "hot", "cooled", "status");
+    Run const runs[2] = {run(nServos, nCycles, false), run(nServos, nCycles, true)};
+    char const *names[2] = {"polling", "subscriptions"};
+    for (int k = 0; k < 2; k++)
+    {
+        Run const &r = runs[k];
+        printf("%-14s %14lu %12lu %16.3f | %8d %8d %8d %8d\n", names[k], static_cast<unsigned long>(r.transactions),
+               static_cast<unsigned long>(r.bytes), r.busTimePerCycle, r.edges.motionEnded, r.edges.hot,
+               r.edges.cooled, r.edges.statusRaised);
+    }
+    return 0;
+}
@@ -0,0 +1,273 @@
+// Teach a motion to simulated servos by moving them "by hand", record it with STSRecorder and replay it.
+// First compares the rate at which the positions of all the servos can be sampled: one read per servo, as the
+// FollowMe example does, readTelemetry, and readPositions, which STSRecorder uses (a single servo is read as fast
+// on its own). Then records a multi-joint motion with a pause at the highest rate, with the default tolerance
+// (STS_RECORDER_TOLERANCE), compresses it further and checks the distance of the keyframes to the positions
+// sampled, then replays the keyframes and reports the tracking error and the SYNC WRITEs sent.
+//
+// Usage: TeachRecord [servos] [seconds] [tolerance] [csv file]
+//        (tolerance: of a second, coarser compression, 12 by default; csv file: export of the keyframes)
+
+#include "STSRecorder.h"
+#include "STSServoDriver.h"
+#include "STSSimulator.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+    // Room for a recording of the default length with a keyframe every 4 samples, should the compression fail.
+    uint16_t const MAX_KEYFRAMES = 2000;
+    // The hand slows down to hold still during this part of the motion, in s, then starts again.
+    double const PAUSE_START = 2;
+    double const PAUSE_END = 3;
+    double const PAUSE_RAMP = 0.25;
+
+    /// \brief Print writing to a file.
+    class FilePrint : public Print
+    {
+    public:
+        explicit FilePrint(FILE *file) : file_(file) {}
+        size_t write(uint8_t value) override { return fputc(value, file_) == EOF ? 0 : 1; }
+
+    private:
+        FILE *file_;
+    };
+
+    /// \brief Progress of the motion at time t, in s: t, but slowing down smoothly to a stop during the pause.
+    double progress(double const &t)
+    {
+        double const a = PAUSE_START;
+        double const b = PAUSE_END;
+        double const r = PAUSE_RAMP;
+        if (t < a)
+            return t;
+        if (t < a + r)
+            return a + 0.5 * (t - a) + r / (2 * M_PI) * sin(M_PI * (t - a) / r);
+        if (t < b - r)
+            return a + r / 2;
+        if (t < b)
+            return a + r / 2 + 0.5 * (t - b + r) - r / (2 * M_PI) * sin(M_PI * (t - b + r) / r);
+        return t - (b - a) + r;
+    }
+
+    /// \brief Position of a joint moved by hand, in steps: slow swings of different frequencies per joint,
+    ///        starting from rest.
+    double hand(int const &joint, double const &t)
+    {
+        double const frequency = 0.25 + 0.08 * joint;
+        double const amplitude = joint % 2 == 0 ? 600 : -600;
+        return 2048 + amplitude * (1 - cos(2 * M_PI * frequency * progress(t)));
+    }
+
+    double seconds()
+    {
+        return VirtualClock::current().now() * 1e-9;
+    }
+
+    /// \brief Position of a joint in a list of keyframes interpolated linearly, at a time in us.
+    double interpolate(std::vector<uint32_t> const &times, std::vector<int16_t> const &positions, int const &n,
+                       int const &joint, double const &time)
+    {
+        if (time <= times.front())
+            return positions[joint];
+        if (time >= times.back())
+            return positions[(times.size() - 1) * n + joint];
+        size_t const k = std::upper_bound(times.begin(), times.end(), time) - times.begin();
+        double const a = positions[(k - 1) * n + joint];
+        double const b = positions[k * n + joint];
+        return a + (b - a) * (time - times[k - 1]) / (times[k] - times[k - 1]);
+    }
+
+    /// \brief Keyframes of a recorder, copied out.
+    void copyKeyframes(STSRecorder const &recorder, std::vector<uint32_t> &times, std::vector<int16_t> &positions)
+    {
+        int const n = recorder.getServoCount();
+        times.resize(recorder.getKeyframeCount());
+        positions.resize(times.size() * n);
+        for (size_t k = 0; k < times.size(); k++)
+        {
+            times[k] = recorder.getKeyframeTime(k);
+            for (int j = 0; j < n; j++)
+                positions[k * n + j] = recorder.getKeyframePosition(k, j);
+        }
+    }
+
+    /// \brief Largest distance between the keyframes of a recorder and the positions sampled, in steps.
+    double keyframeError(STSRecorder const &recorder, std::vector<uint32_t> const &times,
+                         std::vector<int16_t> const &positions)
+    {
+        std::vector<uint32_t> keyTimes;
+        std::vector<int16_t> keyPositions;
+        copyKeyframes(recorder, keyTimes, keyPositions);
+        int const n = recorder.getServoCount();
+        double error = 0;
+        for (size_t k = 0; k < times.size(); k++)
+            for (int j = 0; j < n; j++)
+                error = std::max(error, fabs(interpolate(keyTimes, keyPositions, n, j, times[k]) - positions[k * n + j]));
+        return error;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int const nServos = std::min(std::max(argc > 1 ? atoi(argv[1]) : 6, 1), STS_RECORDER_SERVOS);
+    double const duration = std::max(argc > 2 ? atof(argv[2]) : 6.0, 1.0);
+    int const tolerance = std::max(argc > 3 ? atoi(argv[3]) : 12, 1);
+
+    VirtualClock::current().reset();
+    STSSimulatedBus bus;
+    std::vector<byte> ids(nServos);
+    for (int i = 0; i < nServos; i++)
+    {
+        ids[i] = i + 1;
+        bus.addServo(ids[i]);
+        bus.setPosition(i, hand(i, 0));
+    }
+    HardwareSerial port;
+    port.attach(&bus);
+    STSServoDriver servos;
+    servos.init(&port);
+
+    // Rate at which the positions of all the servos are sampled, over 1s each.
+    std::vector<int16_t> positions(nServos);
+    std::vector<STSTelemetry> telemetry(nServos);
+    std::vector<byte> responded((nServos + 7) / 8);
+    int rates[3] = {0, 0, 0};
+    char const *const methods[3] = {"one read per servo", "readTelemetry", "readPositions"};
+    for (int m = 0; m < 3; m++)
+    {
+        double const end = seconds() + 1;
+        while (seconds() < end)
+        {
+            if (m == 0)
+                for (int i = 0; i < nServos; i++)
+                    positions[i] = servos.getCurrentPosition(ids[i]);
+            else if (m == 1)
+                servos.readTelemetry(nServos, ids.data(), telemetry.data(), responded.data());
+            else
+                servos.readPositions(nServos, ids.data(), positions.data(), responded.data());
+            rates[m]++;
+        }
+    }
+    printf("%d servos, positions of all the servos sampled per second\n", nServos);
+    for (int m = 0; m < 3; m++)
+        printf("  %-22s %8d\n", methods[m], rates[m]);
+
+    // Record the motion with the default tolerance, logging the positions sampled to check the keyframes against.
+    std::vector<uint32_t> times(MAX_KEYFRAMES);
+    std::vector<int16_t> keyframes(MAX_KEYFRAMES * nServos);
+    STSRecorder recorder(servos, times.data(), keyframes.data(), MAX_KEYFRAMES, nServos);
+    recorder.startRecording(nServos, ids.data());
+    uint32_t const recordStart = micros();
+    bool released = true;
+    for (int i = 0; i < nServos; i++)
+        released &= bus.memory(i)[STSRegisters::TORQUE_SWITCH] == 0;
+    std::vector<uint32_t> sampleTimes;
+    std::vector<int16_t> samples;
+    double const start = seconds();
+    while (seconds() - start < duration && !recorder.isFull())
+    {
+        uint32_t const time = micros() - recordStart;
+        for (int i = 0; i < nServos; i++)
+        {
+            int16_t const position = lround(hand(i, seconds() - start));
+            bus.setPosition(i, position);
+            samples.push_back(position);
+        }
+        sampleTimes.push_back(time);
+        if (!recorder.sample())
+        {
+            sampleTimes.pop_back();
+            samples.resize(samples.size() - nServos);
+        }
+    }
+    double const recorded = seconds() - start;
+    recorder.stopRecording();
+    bus.stepToNow();
+    bool held = true;
+    for (int i = 0; i < nServos; i++)
+        held &= bus.memory(i)[STSRegisters::TORQUE_SWITCH] == 1 && fabs(bus.speed(i)) < 1;
+    uint32_t const nSamples = recorder.getSampleCount();
+    int const nRecorded = recorder.getKeyframeCount();
+    double const recordError = keyframeError(recorder, sampleTimes, samples);
+
+    // Compress further: the keyframes are then within both tolerances of the samples.
+    int const nKeyframes = recorder.compress(tolerance);
+    double const maxError = keyframeError(recorder, sampleTimes, samples);
+    std::vector<uint32_t> keyTimes;
+    std::vector<int16_t> keyPositions;
+    copyKeyframes(recorder, keyTimes, keyPositions);
+    int const sampleBytes = 4 + 2 * nServos;
+    printf("recorded %.2f s: %u samples (%.0f per s), %u dropped\n", recorded, static_cast<unsigned>(nSamples),
+           nSamples / recorded, static_cast<unsigned>(recorder.getDroppedCount()));
+    printf("  %4d keyframes within %d steps (default): %5.1f samples per keyframe, largest error %.2f steps\n",
+           nRecorded, STS_RECORDER_TOLERANCE, static_cast<double>(nSamples) / nRecorded, recordError);
+    printf("  %4d keyframes within %d + %d steps:        %5.1f samples per keyframe, largest error %.2f steps\n",
+           nKeyframes, STS_RECORDER_TOLERANCE, tolerance, static_cast<double>(nSamples) / nKeyframes, maxError);
+    printf("  %d bytes of keyframes (samples: %u bytes)\n", nKeyframes * sampleBytes,
+           static_cast<unsigned>(nSamples * sampleBytes));
+    if (argc > 4)
+    {
+        FILE *file = fopen(argv[4], "w");
+        if (file == nullptr)
+        {
+            perror(argv[4]);
+            return 1;
+        }
+        FilePrint output(file);
+        recorder.exportTo(output);
+        fclose(file);
+    }
+
+    // Replay: move to the start, then send the keyframes as they become due, sampling the motion.
+    recorder.moveToStart(0);
+    double const settle = seconds() + 2;
+    while (seconds() < settle)
+    {
+        servos.readPositions(nServos, ids.data(), positions.data(), responded.data());
+        bool reached = true;
+        for (int j = 0; j < nServos; j++)
+            reached &= abs(positions[j] - keyPositions[j]) <= 1;
+        if (reached)
+            break;
+    }
+    uint32_t const replayStart = micros();
+    recorder.startReplay(replayStart);
+    int nWrites = 0;
+    int nChecks = 0;
+    double totalError = 0;
+    double maxTracking = 0;
+    double const end = keyTimes.back() - keyTimes.front();
+    while (true)
+    {
+        nWrites += recorder.updateReplay(micros());
+        uint32_t const now = micros() - replayStart;
+        if (recorder.isReplayFinished() && now > end + 100000)
+            break;
+        int const nRead = servos.readPositions(nServos, ids.data(), positions.data(), responded.data());
+        if (nRead < nServos)
+            continue;
+        for (int j = 0; j < nServos; j++)
+        {
+            double const error = fabs(positions[j] - interpolate(sampleTimes, samples, nServos, j, keyTimes.front() + now));
+            totalError += error;
+            maxTracking = std::max(maxTracking, error);
+            nChecks++;
+        }
+    }
+    printf("replay: %d SYNC WRITEs (streaming the samples: %u), tracking error mean %.2f max %.2f steps\n", nWrites,
+           static_cast<unsigned>(nSamples), totalError / nChecks, maxTracking);
+
+    int const bound = STS_RECORDER_TOLERANCE + tolerance;
+    bool const ok = released && held && recorder.getDroppedCount() == 0 && rates[2] > rates[1]
+                    && (nServos == 1 || rates[2] > rates[0]) && recordError <= STS_RECORDER_TOLERANCE + 0.01
+                    && nRecorded * 10 < static_cast<int>(nSamples) && maxError <= bound + 0.01
+                    && nWrites == nKeyframes - 1 && maxTracking <= 2 * bound;
+    if (!ok)
+        printf("The recording, its compression or its replay is off\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+// Log the telemetry of several simulated buses to a columnar store, and measure how much of the host
+// time the logging takes compared to the rate at which the buses produce samples. Then query the store
+// by servo and time range, with and without the help of the chunk index.
+//
+// Usage: TelemetryIngest [buses] [servos per bus] [cycles] [store directory]
+
+#include "STSServoDriver.h"
+#include "STSSimulator.h"
+#include "STSTelemetryStore.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    struct BusResult
+    {
+        uint64_t samples = 0;
+        double virtualTime = 0; ///< In s.
+        double appendTime = 0;  ///< Real time spent appending to the store, in s.
+    };
+
+    void runBus(int const bus, int const nServos, int const nCycles, STSTelemetryWriter &store, BusResult &result)
+    {
+        STSSimulatedBus simulator;
+        std::vector<byte> ids(nServos);
+        for (int i = 0; i < nServos; i++)
+        {
+            // Each bus has its own range of IDs, so that the servos can be told apart in the store.
+            ids[i] = bus * nServos + i + 1;
+            simulator.addServo(ids[i]);
+        }
+        HardwareSerial port;
+        port.attach(&simulator);
+        STSServoDriver servos;
+        servos.init(&port);
+
+        std::vector<int> positions(nServos), speeds(nServos, 3000);
+        std::vector<STSTelemetry> telemetry(nServos);
+        std::vector<byte> responded((nServos + 7) / 8);
+        for (int cycle = 0; cycle < nCycles; cycle++)
+        {
+            if (cycle % 50 == 0)
+            {
+                for (int i = 0; i < nServos; i++)
+                    positions[i] = (cycle * 37 + i * 300) % 4096;
+                servos.setTargetPositions(nServos, ids.data(), positions.data(), speeds.data());
+            }
+            result.samples += servos.readTelemetry(nServos, ids.data(), telemetry.data(), responded.data());
+            auto const t0 = std::chrono::steady_clock::now();
+            store.append(VirtualClock::current().now(), nServos, ids.data(), telemetry.data(), responded.data());
+            result.appendTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        }
+        result.virtualTime = VirtualClock::current().now() * 1e-9;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int const nBuses = argc > 1 ? atoi(argv[1]) : 4;
+    int const nServos = argc > 2 ? atoi(argv[2]) : 20;
+    int const nCycles = argc > 3 ? atoi(argv[3]) : 5000;
+    char const *directory = argc > 4 ? argv[4] : "telemetry.sts";
+    if (nBuses * nServos > 253)
+    {
+        printf("At most 253 servos in total\n");
+        return 1;
+    }
+
+    std::vector<BusResult> results(nBuses);
+    {
+        STSTelemetryWriter store(directory, 16384);
+        if (!store.isOpen())
+        {
+            printf("Cannot create store %s\n", directory);
+            return 1;
+        }
+        std::vector<std::thread> threads;
+        for (int b = 0; b < nBuses; b++)
+            threads.emplace_back(runBus, b, nServos, nCycles, std::ref(store), std::ref(results[b]));
+        for (auto &t : threads)
+            t.join();
+    }
+
+    printf("%d buses x %d servos, %d cycles\n", nBuses, nServos, nCycles);
+    printf("%4s %10s %14s %16s %10s\n", "bus", "samples", "bus rate (/s)", "ingest rate (/s)", "headroom");
+    uint64_t totalSamples = 0;
+    double totalRate = 0;
+    double totalAppend = 0;
+    for (int b = 0; b < nBuses; b++)
+    {
+        BusResult const &r = results[b];
+        double const busRate = r.samples / r.virtualTime;
+        double const ingestRate = r.samples / r.appendTime;
+        printf("%4d %10lu %14.0f %16.0f %9.0fx\n", b, static_cast<unsigned long>(r.samples), busRate, ingestRate,
+               ingestRate / busRate);
+        totalSamples += r.samples;
+        totalRate += busRate;
+        totalAppend += r.appendTime;
+    }
+    printf("All buses: %.0f samples/s produced, store ingests %.0f samples/s\n", totalRate, totalSamples / totalAppend);
+
+    STSTelemetryReader reader(directory);
+    if (!reader.isOpen() || reader.size() != totalSamples)
+    {
+        printf("Store reopened with %lu samples, expected %lu\n", static_cast<unsigned long>(reader.size()),
+               static_cast<unsigned long>(totalSamples));
+        return 1;
+    }
+    // Time range of the last 10% of the run, for a servo of the last bus.
+    uint64_t const end = static_cast<uint64_t>(results[0].virtualTime * 1e9) + 1;
+    uint64_t const from = end - end / 10;
+    int const id = nBuses * nServos;
+
+    auto const t0 = std::chrono::steady_clock::now();
+    int64_t sum = 0;
+    uint64_t n = 0;
+    uint64_t const scanned = reader.forEach(from, end, id, [&](uint64_t row) { sum += reader.positions()[row]; n++; });
+    double const indexed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    auto const t1 = std::chrono::steady_clock::now();
+    uint64_t nFull = 0;
+    for (uint64_t row = 0; row < reader.size(); row++)
+        if (reader.timestamps()[row] >= from && reader.timestamps()[row] < end && reader.ids()[row] == id)
+            nFull++;
+    double const full = std::chrono::duration<double>(std::chrono::steady_clock::now() - t1).count();
+
+    printf("Query servo %d, last 10%% of the run: %lu samples (mean position %.0f), %lu / %lu chunks scanned, "
+           "%.3f ms (full scan %.3f ms)\n", id, static_cast<unsigned long>(n), n > 0 ? static_cast<double>(sum) / n : 0.0,
+           static_cast<unsigned long>(scanned), static_cast<unsigned long>(reader.chunkCount()), indexed * 1e3, full * 1e3);
+    return nFull == n ? 0 : 1;
+}
@@ -0,0 +1,218 @@
+// Play smooth paths sampled at 100Hz on simulated servos, either streaming one SYNC WRITE of setpoints per
+// sample, or as sparse knots with STSTrajectoryPlayer. Both run the same 50Hz telemetry read, used by the
+// player to re-plan a servo pushed away from its path halfway through.
+// Reports the motion traffic, the tracking error against the path, the bus utilization and the longest CPU time of
+// STSTrajectoryPlayer::update, which fits a knot when re-planning.
+//
+// Usage: TrajectoryStreaming [servos] [seconds] [tolerance]
+
+#include "STSServoDriver.h"
+#include "STSSimulator.h"
+#include "STSTrajectory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+    uint16_t const PERIOD_MS = 10;
+    unsigned long const TELEMETRY_MS = 20;
+    int const PUSH = 300;
+    uint16_t const REPLAN_BOUND = 60;
+
+    struct Run
+    {
+        uint32_t motionTransactions = 0;
+        uint32_t motionBytes = 0;
+        uint32_t knots = 0;
+        uint32_t replans = 0;
+        double squaredError = 0;
+        double maxError = 0;
+        uint64_t errorSamples = 0;
+        double busUtilization = 0;
+        uint32_t longestUpdate = 0; ///< Longest CPU time of STSTrajectoryPlayer::update, in ns.
+    };
+
+    // Minimum-jerk interpolation from 0 to 1.
+    double minimumJerk(double const &s)
+    {
+        return s * s * s * (10 - 15 * s + 6 * s * s);
+    }
+
+    // Servos cycle through three kinds of smooth motions: sine, point-to-point moves with pauses, and
+    // a sum of two sines.
+    std::vector<int16_t> makePath(int const &servo, int const &nSamples)
+    {
+        std::vector<int16_t> path(nSamples);
+        double const waypoints[] = {2048, 3000, 1200, 2600, 800, 2048};
+        for (int i = 0; i < nSamples; i++)
+        {
+            double const t = i * PERIOD_MS * 1e-3;
+            double p = 2048;
+            switch (servo % 3)
+            {
+                case 0:
+                    p = 2048 + 800 * std::sin(2 * M_PI * t / (3 + 0.5 * servo));
+                    break;
+                case 1:
+                {
+                    // 1.5s moves, then 0.5s pauses.
+                    int const move = static_cast<int>(t / 2) % 5;
+                    double const s = std::min(1.0, std::fmod(t, 2) / 1.5);
+                    p = waypoints[move] + (waypoints[move + 1] - waypoints[move]) * minimumJerk(s);
+                    break;
+                }
+                default:
+                    p = 2048 + 600 * std::sin(2 * M_PI * t / 4) + 200 * std::sin(2 * M_PI * t / 1.3 + servo);
+            }
+            path[i] = static_cast<int16_t>(std::lround(p));
+        }
+        return path;
+    }
+
+    double pathAt(std::vector<int16_t> const &path, double const &timeMs)
+    {
+        double const sample = timeMs / PERIOD_MS;
+        int const i = static_cast<int>(sample);
+        if (i + 1 >= static_cast<int>(path.size()))
+            return path.back();
+        return path[i] + (sample - i) * (path[i + 1] - path[i]);
+    }
+
+    Run run(int const nServos, int const nSamples, uint16_t const tolerance, bool const knots)
+    {
+        VirtualClock::current().reset();
+        STSSimulatedBus bus;
+        std::vector<byte> ids(nServos);
+        std::vector<std::vector<int16_t>> paths(nServos);
+        for (int i = 0; i < nServos; i++)
+        {
+            ids[i] = i + 1;
+            bus.addServo(ids[i]);
+            paths[i] = makePath(i, nSamples);
+            bus.setPosition(i, paths[i][0]);
+        }
+        HardwareSerial port;
+        port.attach(&bus);
+        STSServoDriver servos;
+        servos.init(&port);
+        std::vector<int> positions(nServos, 0), speeds(nServos, 0);
+        for (int i = 0; i < nServos; i++)
+            servos.setTargetPosition(ids[i], paths[i][0]);
+
+        // The knots are fitted ahead of time; the servo pushed away has the rest of its path fitted while playing.
+        STSTrajectoryPlayer player(servos);
+        std::vector<std::vector<STSKnot>> fitted(nServos, std::vector<STSKnot>(nSamples));
+        for (int i = 0; i < nServos; i++)
+            player.setPath(ids[i], paths[i].data(), nSamples, PERIOD_MS, tolerance, REPLAN_BOUND, fitted[i].data(),
+                           nSamples);
+
+        std::vector<STSTelemetry> telemetry(nServos);
+        std::vector<byte> responded((nServos + 7) / 8);
+        Run result;
+        uint64_t const busStart = bus.wireBusyTime();
+        unsigned long const start = millis();
+        unsigned long const duration = static_cast<unsigned long>(nSamples) * PERIOD_MS;
+        player.start(start);
+        unsigned long nextSample = start;
+        unsigned long nextTelemetry = start;
+        bool pushed = false;
+        while (millis() - start < duration)
+        {
+            unsigned long const now = millis();
+            STSStatistics const before = servos.getStatistics();
+            if (knots)
+            {
+                uint32_t const cpuStart = cpuNanos();
+                player.update(now);
+                result.longestUpdate = std::max(result.longestUpdate, cpuNanos() - cpuStart);
+            }
+            else if (now >= nextSample)
+            {
+                int const sample = (now - start) / PERIOD_MS;
+                for (int i = 0; i < nServos; i++)
+                    positions[i] = paths[i][sample];
+                servos.setTargetPositions(nServos, ids.data(), positions.data(), speeds.data());
+                nextSample += PERIOD_MS;
+            }
+            STSStatistics const after = servos.getStatistics();
+            result.motionTransactions += after.transactions - before.transactions;
+            result.motionBytes += after.bytesSent - before.bytesSent;
+
+            if (now >= nextTelemetry)
+            {
+                servos.readTelemetry(nServos, ids.data(), telemetry.data(), responded.data());
+                if (knots)
+                    player.reportTelemetry(now, nServos, ids.data(), telemetry.data(), responded.data());
+                nextTelemetry += TELEMETRY_MS;
+            }
+
+            // Halfway through, the first servo is pushed away from its path.
+            if (!pushed && now - start >= duration / 2)
+            {
+                bus.stepToNow();
+                bus.setPosition(0, bus.position(0) + PUSH);
+                pushed = true;
+            }
+
+            // Tracking error, sampled every ms, leaving out the 200ms following the push.
+            delay(1);
+            bus.stepToNow();
+            double const t = VirtualClock::current().now() * 1e-6 - start;
+            if (t > duration / 2 && t < duration / 2 + 200)
+                continue;
+            for (int i = 0; i < nServos; i++)
+            {
+                double const error = std::fabs(bus.position(i) - pathAt(paths[i], t));
+                result.squaredError += error * error;
+                result.maxError = std::max(result.maxError, error);
+                result.errorSamples++;
+            }
+        }
+        result.knots = knots ? player.getKnotCount() : static_cast<uint32_t>(nServos) * nSamples;
+        result.replans = player.getReplanCount();
+        result.busUtilization = (bus.wireBusyTime() - busStart) * 1e-6 / (millis() - start);
+        return result;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    int const nServos = argc > 1 ? atoi(argv[1]) : 6;
+    double const seconds = argc > 2 ? atof(argv[2]) : 20;
+    uint16_t const tolerance = argc > 3 ? atoi(argv[3]) : 20;
+    int const nSamples = static_cast<int>(seconds * 1000 / PERIOD_MS);
+    if (nServos > STS_TRAJECTORY_SERVOS)
+    {
+        printf("At most %d servos with STS_TRAJECTORY_SERVOS = %d\n", STS_TRAJECTORY_SERVOS, STS_TRAJECTORY_SERVOS);
+        return 1;
+    }
+
+    // Offline fit of the paths, without disturbance.
+    uint32_t offlineKnots = 0;
+    for (int i = 0; i < nServos; i++)
+    {
+        std::vector<int16_t> const path = makePath(i, nSamples);
+        std::vector<STSKnot> fitted(nSamples);
+        offlineKnots += STSTrajectory::fit(path.data(), nSamples, PERIOD_MS, tolerance, fitted.data(), nSamples);
+    }
+
+    printf("%d servos, %.0fs at %dHz, tolerance %d steps, telemetry at %luHz\n", nServos, seconds, 1000 / PERIOD_MS,
+           tolerance, 1000 / TELEMETRY_MS);
+    printf("Offline fit: %u knots for %d samples\n", offlineKnots, nServos * nSamples);
+    printf("%-10s %12s %14s %8s %8s %10s %10s %10s\n", "mode", "motion tx", "motion B/s", "knots", "replans",
+           "rms error", "max error", "bus load");
+    Run results[2];
+    for (int mode = 0; mode < 2; mode++)
+    {
+        Run const &r = results[mode] = run(nServos, nSamples, tolerance, mode == 1);
+        printf("%-10s %12u %14.0f %8u %8u %10.1f %10.1f %9.1f%%\n", mode == 1 ? "knots" : "streaming",
+               r.motionTransactions, r.motionBytes / seconds, r.knots, r.replans,
+               std::sqrt(r.squaredError / r.errorSamples), r.maxError, 100 * r.busUtilization);
+    }
+    printf("Motion traffic divided by %.1f\n", static_cast<double>(results[0].motionBytes) / results[1].motionBytes);
+    printf("Longest STSTrajectoryPlayer::update: %.1f us of host CPU\n", results[1].longestUpdate * 1e-3);
+    return 0;
+}
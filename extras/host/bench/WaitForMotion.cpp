@@ -0,0 +1,86 @@
+// Time a move-and-wait loop, as in the SimpleMotion example, against the simulated servo dynamics,
+// and compare it to the duration of the trapezoidal profile the servo follows.
+//
+// Usage: WaitForMotion [capture], the bus traffic being recorded for TraceAnalyzer if a capture file is given.
+
+#include "STSServoDriver.h"
+#include "STSSimulator.h"
+#include "SerialTrace.h"
+
+#include <memory>
+#include <stdio.h>
+
+namespace
+{
+    // Duration of a trapezoidal motion, in s.
+    double profileDuration(double distance, double speed, double acceleration)
+    {
+        if (distance * acceleration < speed * speed)
+            return 2 * sqrt(distance / acceleration);
+        return distance / speed + speed / acceleration;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    STSSimulatedBus bus;
+    bus.addServo(1);
+    std::unique_ptr<SerialTrace> trace;
+    if (argc > 1)
+    {
+        trace.reset(new SerialTrace(&bus, argv[1]));
+        if (!trace->isOpen())
+        {
+            perror(argv[1]);
+            return 1;
+        }
+        Serial.attach(trace.get());
+    }
+    else
+        Serial.attach(&bus);
+
+    STSServoDriver servos;
+    if (!servos.init(&Serial))
+    {
+        printf("No servo found\n");
+        return 1;
+    }
+    servos.setMode(1, STSMode::POSITION);
+
+    struct Move
+    {
+        int target;
+        int speed;
+        byte acceleration;
+        unsigned long pollPeriodMs;
+    };
+    Move const moves[] = {
+        {0, 4095, 0, 50}, {4095, 2400, 50, 50}, {0, 2400, 50, 0}, {2048, 500, 10, 50}, {4095, 500, 10, 0}};
+
+    printf("%8s %8s %6s %8s | %10s %10s %6s\n", "target", "speed", "acc", "poll(ms)", "model(ms)", "loop(ms)", "polls");
+    for (Move const &move : moves)
+    {
+        int const start = servos.getCurrentPosition(1);
+        servos.setTargetAcceleration(1, move.acceleration);
+        unsigned long const t0 = micros();
+        servos.setTargetPosition(1, move.target, move.speed);
+        int polls = 0;
+        do
+        {
+            delay(move.pollPeriodMs);
+            polls++;
+        } while (servos.isMoving(1));
+        double const elapsed = (micros() - t0) / 1000.0;
+
+        STSMotorModel const &model = bus.model();
+        double const speed = move.speed < model.maxSpeed ? move.speed : model.maxSpeed;
+        double const acceleration = move.acceleration == 0 ? model.maxAcceleration : move.acceleration * 100.0;
+        double const expected = 1000 * profileDuration(abs(move.target - start), speed, acceleration);
+        printf("%8d %8d %6d %8lu | %10.1f %10.1f %6d\n",
+               move.target, move.speed, move.acceleration, move.pollPeriodMs, expected, elapsed, polls);
+    }
+    printf("Final position: %d, temperature: %d degC, wire busy %.1f%% of %lu ms\n",
+           servos.getCurrentPosition(1), servos.getCurrentTemperature(1),
+           100.0 * bus.wireBusyTime() / (micros() * 1000.0), millis());
+    return 0;
+}
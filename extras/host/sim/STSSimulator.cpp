@@ -0,0 +1,542 @@
+#include "STSSimulator.h"
+#include "STSServoDriver.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace instruction
+{
+    byte const PING_      = 0x01;
+    byte const READ       = 0x02;
+    byte const WRITE      = 0x03;
+    byte const REGWRITE   = 0x04;
+    byte const ACTION     = 0x05;
+    byte const RESET      = 0x06;
+    byte const SYNCREAD   = 0x82;
+    byte const SYNCWRITE  = 0x83;
+};
+
+namespace
+{
+    double const CURRENT_UNIT = 0.0065; // CURRENT_CURRENT register unit, in A.
+    byte const BROADCAST_ID = 0xFE;
+    // Baud rates of the BAUDRATE register values.
+    long const BAUD_RATES[] = {1000000, 500000, 250000, 128000, 115200, 76800, 57600, 38400};
+
+    // Two-bytes registers are sign-magnitude, bit 15 is sign.
+    int readWord(byte const *memory, byte const &address)
+    {
+        int value = memory[address] + (memory[address + 1] << 8);
+        if (value & 0x8000)
+            return -(value & 0x7FFF);
+        return value;
+    }
+
+    void writeWord(byte *memory, byte const &address, int const &value)
+    {
+        uint16_t raw = std::min(abs(value), 0x7FFF);
+        if (value < 0)
+            raw |= 0x8000;
+        memory[address] = raw & 0xFF;
+        memory[address + 1] = raw >> 8;
+    }
+
+    // Default register values of a STS3215, from the memory table.
+    void setDefaults(byte memory[256], byte const &id)
+    {
+        for (int i = 0; i < 256; i++)
+            memory[i] = 0;
+        memory[STSRegisters::FIRMWARE_MAJOR] = 3;
+        memory[STSRegisters::FIRMWARE_MINOR] = 10;
+        memory[STSRegisters::SERVO_MAJOR] = 9;
+        memory[STSRegisters::SERVO_MINOR] = 3;
+        memory[STSRegisters::ID] = id;
+        memory[STSRegisters::RESPONSE_STATUS_LEVEL] = 1;
+        memory[STSRegisters::MAXIMUM_ANGLE] = 0xFF;
+        memory[STSRegisters::MAXIMUM_ANGLE + 1] = 0x0F;
+        memory[STSRegisters::MAXIMUM_TEMPERATURE] = 70;
+        memory[STSRegisters::MAXIMUM_VOLTAGE] = 80;
+        memory[STSRegisters::MINIMUM_VOLTAGE] = 40;
+        memory[STSRegisters::MAXIMUM_TORQUE] = 0xE8;
+        memory[STSRegisters::MAXIMUM_TORQUE + 1] = 0x03;
+        memory[STSRegisters::UNLOADING_CONDITION] = 44;
+        memory[STSRegisters::LED_ALARM_CONDITION] = 47;
+        memory[STSRegisters::POS_PROPORTIONAL_GAIN] = 32;
+        memory[STSRegisters::POS_DERIVATIVE_GAIN] = 32;
+        memory[STSRegisters::MINIMUM_STARTUP_FORCE] = 16;
+        memory[STSRegisters::CK_INSENSITIVE_AREA] = 1;
+        memory[STSRegisters::CCK_INSENSITIVE_AREA] = 1;
+        memory[STSRegisters::CURRENT_PROTECTION_TH] = 0xF4;
+        memory[STSRegisters::CURRENT_PROTECTION_TH + 1] = 0x01;
+        memory[STSRegisters::ANGULAR_RESOLUTION] = 1;
+        memory[STSRegisters::TORQUE_PROTECTION_TH] = 20;
+        memory[STSRegisters::TORQUE_PROTECTION_TIME] = 200;
+        memory[STSRegisters::OVERLOAD_TORQUE] = 80;
+        memory[STSRegisters::SPEED_PROPORTIONAL_GAIN] = 10;
+        memory[STSRegisters::OVERCURRENT_TIME] = 200;
+        memory[STSRegisters::SPEED_INTEGRAL_GAIN] = 10;
+        memory[STSRegisters::TORQUE_SWITCH] = 1;
+        memory[STSRegisters::WRITE_LOCK] = 1;
+        memory[STSRegisters::TORQUE_LIMIT] = 0xE8;
+        memory[STSRegisters::TORQUE_LIMIT + 1] = 0x03;
+        memory[STSRegisters::CURRENT_VOLTAGE] = 74;
+    }
+
+    // Motor model kernel over n servos. Branchless, and with restrict pointers (only honored on function
+    // parameters), so that the compiler can vectorize it (this needs -fno-trapping-math).
+    void stepKernel(int const n,
+                    double const dt,
+                    STSMotorModel const &model,
+                    double const *__restrict__ target,
+                    double const *__restrict__ command,
+                    double const *__restrict__ maxSpeed,
+                    double const *__restrict__ maxAcceleration,
+                    double const *__restrict__ velocityMode,
+                    double const *__restrict__ torque,
+                    double *__restrict__ position,
+                    double *__restrict__ speed,
+                    double *__restrict__ acceleration,
+                    double *__restrict__ current,
+                    double *__restrict__ temperature)
+    {
+        double const defaultSpeed = model.maxSpeed;
+        double const defaultAcceleration = model.maxAcceleration;
+        double const idleCurrent = model.idleCurrent;
+        double const currentPerSpeed = model.currentPerSpeed;
+        double const currentPerAcceleration = model.currentPerAcceleration;
+        double const ambientTemperature = model.ambientTemperature;
+        double const thermalResistance = model.thermalResistance;
+        double const thermalRate = dt / model.thermalTimeConstant;
+        double const inverseDt = 1 / dt;
+
+        for (int i = 0; i < n; i++)
+        {
+            // A free motor is stopped quickly by friction.
+            double const a = torque[i] * maxAcceleration[i] > 0 ? maxAcceleration[i] : defaultAcceleration;
+            double const vmax = maxSpeed[i] > 0 ? std::min(maxSpeed[i], defaultSpeed) : defaultSpeed;
+            double const vcommand = std::max(-defaultSpeed, std::min(defaultSpeed, command[i]));
+
+            // Position mode: trapezoidal profile, braking in time to stop on the target.
+            double const error = target[i] - position[i];
+            double const profile = std::copysign(std::min(vmax, std::sqrt(2 * a * std::fabs(error))), error);
+            double const desired = torque[i] * (velocityMode[i] * vcommand + (1 - velocityMode[i]) * profile);
+
+            double const dv = std::max(-a * dt, std::min(a * dt, desired - speed[i]));
+            double const v = speed[i] + dv;
+            double const p = position[i] + v * dt;
+
+            // In velocity mode or when free, the position wraps around. Otherwise, the motion stops on the target.
+            double const holds = torque[i] * (1 - velocityMode[i]);
+            double const newError = target[i] - p;
+            double const crossed = newError * error <= 0 ? 1.0 : 0.0;
+            double const settled = std::fabs(newError) < 0.5 ? (std::fabs(v) <= a * dt ? 1.0 : 0.0) : 0.0;
+            double const reached = holds * std::max(crossed, settled);
+            double const wrapped = p + 4096 * ((p < 0 ? 1.0 : 0.0) - (p >= 4096 ? 1.0 : 0.0));
+
+            position[i] = holds * (reached * target[i] + (1 - reached) * p) + (1 - holds) * wrapped;
+            speed[i] = (1 - reached) * v;
+            double const motorAcceleration = dv * inverseDt;
+            acceleration[i] = motorAcceleration;
+            current[i] = torque[i] * (idleCurrent + currentPerSpeed * std::fabs(v) + currentPerAcceleration * std::fabs(motorAcceleration));
+            temperature[i] += (ambientTemperature + thermalResistance * current[i] - temperature[i]) * thermalRate;
+        }
+    }
+};
+
+STSSimulatedBus::STSSimulatedBus() :
+    baudRate_(1000000),
+    lastStep_(0),
+    wireFree_(0),
+    wireBusyTime_(0),
+    stepCpuTime_(0),
+    rxBuffered_(0),
+    rxBufferSize_(0),
+    rxHighWater_(0),
+    rxOverflowCount_(0),
+    uniform_(0.0, 1.0),
+    faultCount_(0),
+    eepromWriteCount_(0)
+{
+    for (int i = 0; i < 256; i++)
+        servoIndex_[i] = -1;
+}
+
+int STSSimulatedBus::addServo(byte const &id)
+{
+    int const index = size();
+    memory_.emplace_back();
+    setDefaults(memory_.back().data(), id);
+    pendingWrite_.emplace_back();
+    servoIndex_[id] = index;
+
+    targetPosition_.push_back(0);
+    commandSpeed_.push_back(0);
+    maxSpeed_.push_back(0);
+    maxAcceleration_.push_back(0);
+    velocityMode_.push_back(0);
+    torque_.push_back(0);
+    position_.push_back(2048);
+    speed_.push_back(0);
+    acceleration_.push_back(0);
+    current_.push_back(0);
+    temperature_.push_back(model_.ambientTemperature);
+    silentUntil_.push_back(0);
+
+    writeWord(memory(index), STSRegisters::TARGET_POSITION, 2048);
+    updateCommand(index);
+    updateFeedbackRegisters();
+    return index;
+}
+
+int STSSimulatedBus::servoIndex(byte const &id) const
+{
+    return servoIndex_[id];
+}
+
+void STSSimulatedBus::setPosition(int const &index, double const &position)
+{
+    stepToNow();
+    position_[index] = position;
+    updateFeedbackRegisters();
+}
+
+void STSSimulatedBus::setFaultScenario(STSFaultScenario const &scenario)
+{
+    faults_ = scenario;
+    random_.seed(scenario.seed);
+}
+
+void STSSimulatedBus::begin(long baudRate)
+{
+    baudRate_ = baudRate;
+    lastStep_ = VirtualClock::current().now();
+}
+
+uint64_t STSSimulatedBus::byteTime() const
+{
+    // 8N1: 10 bits per byte.
+    return 10000000000ULL / baudRate_;
+}
+
+size_t STSSimulatedBus::write(const uint8_t *data, size_t length)
+{
+    VirtualClock &clock = VirtualClock::current();
+    uint64_t const duration = length * byteTime();
+    clock.advance(duration);
+    wireBusyTime_ += duration;
+    input_.insert(input_.end(), data, data + length);
+    parseInput();
+    return length;
+}
+
+uint64_t STSSimulatedBus::startWrite(const uint8_t *data, size_t length, uint64_t const &date)
+{
+    // The wire is busy in the background: the clock of the caller does not move.
+    uint64_t const duration = length * byteTime();
+    uint64_t const end = std::max(date, wireFree_) + duration;
+    wireFree_ = end;
+    wireBusyTime_ += duration;
+    input_.insert(input_.end(), data, data + length);
+    parseInput();
+    return end;
+}
+
+int STSSimulatedBus::read(unsigned long timeoutMs)
+{
+    VirtualClock &clock = VirtualClock::current();
+    fillRxBuffer();
+    if (rxBuffered_ == 0)
+    {
+        // Wait for the next byte, which finds the buffer empty.
+        uint64_t const deadline = clock.now() + timeoutMs * 1000000ULL;
+        if (output_.empty() || output_.front().arrival > deadline)
+        {
+            clock.advanceTo(deadline);
+            return -1;
+        }
+        clock.advanceTo(output_.front().arrival);
+        rxBuffered_ = 1;
+        rxHighWater_ = std::max<size_t>(rxHighWater_, 1);
+    }
+    byte const value = output_.front().value;
+    output_.pop_front();
+    rxBuffered_--;
+    return value;
+}
+
+int STSSimulatedBus::available()
+{
+    fillRxBuffer();
+    return static_cast<int>(rxBuffered_);
+}
+
+void STSSimulatedBus::fillRxBuffer()
+{
+    // Nothing is read between two calls: the bytes arrived since then fill the buffer in order.
+    uint64_t const now = VirtualClock::current().now();
+    while (rxBuffered_ < output_.size() && output_[rxBuffered_].arrival <= now)
+    {
+        if (rxBufferSize_ > 0 && rxBuffered_ >= rxBufferSize_)
+        {
+            output_.erase(output_.begin() + rxBuffered_);
+            rxOverflowCount_++;
+            continue;
+        }
+        rxBuffered_++;
+    }
+    rxHighWater_ = std::max(rxHighWater_, rxBuffered_);
+}
+
+void STSSimulatedBus::stepToNow()
+{
+    uint64_t const now = VirtualClock::current().now();
+    if (now <= lastStep_)
+        return;
+    auto const cpuStart = std::chrono::steady_clock::now();
+    double remaining = (now - lastStep_) * 1e-9;
+    while (remaining > 0)
+    {
+        double const dt = std::min(remaining, model_.integrationStep);
+        step(dt);
+        remaining -= dt;
+    }
+    updateFeedbackRegisters();
+    lastStep_ = now;
+    stepCpuTime_ += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - cpuStart).count();
+}
+
+void STSSimulatedBus::step(double const &dt)
+{
+    stepKernel(size(), dt, model_,
+               targetPosition_.data(), commandSpeed_.data(), maxSpeed_.data(), maxAcceleration_.data(),
+               velocityMode_.data(), torque_.data(),
+               position_.data(), speed_.data(), acceleration_.data(), current_.data(), temperature_.data());
+}
+
+void STSSimulatedBus::updateFeedbackRegisters()
+{
+    int const n = size();
+    std::vector<int> positionRegister(n), speedRegister(n), currentRegister(n), temperatureRegister(n);
+    std::vector<byte> movingRegister(n);
+    for (int i = 0; i < n; i++)
+    {
+        positionRegister[i] = static_cast<int>(position_[i] + 0.5) & 0x0FFF;
+        speedRegister[i] = static_cast<int>(std::round(speed_[i]));
+        currentRegister[i] = static_cast<int>(current_[i] / CURRENT_UNIT + 0.5);
+        temperatureRegister[i] = static_cast<int>(temperature_[i] + 0.5);
+        // Moving until the target is reached, even if the motion has not really started yet.
+        bool const holds = torque_[i] > 0 && velocityMode_[i] == 0;
+        movingRegister[i] = speed_[i] != 0 || (holds && std::fabs(targetPosition_[i] - position_[i]) >= 0.5);
+    }
+    for (int i = 0; i < n; i++)
+    {
+        byte *m = memory_[i].data();
+        writeWord(m, STSRegisters::CURRENT_POSITION, positionRegister[i]);
+        writeWord(m, STSRegisters::CURRENT_SPEED, speedRegister[i]);
+        writeWord(m, STSRegisters::CURRENT_CURRENT, currentRegister[i]);
+        m[STSRegisters::CURRENT_TEMPERATURE] = static_cast<byte>(temperatureRegister[i]);
+        m[STSRegisters::MOVING_STATUS] = movingRegister[i];
+    }
+}
+
+void STSSimulatedBus::updateCommand(int const &index)
+{
+    byte const *m = memory(index);
+    targetPosition_[index] = readWord(m, STSRegisters::TARGET_POSITION);
+    commandSpeed_[index] = readWord(m, STSRegisters::RUNNING_SPEED);
+    maxSpeed_[index] = std::abs(readWord(m, STSRegisters::RUNNING_SPEED));
+    maxAcceleration_[index] = m[STSRegisters::TARGET_ACCELERATION] * 100.0;
+    velocityMode_[index] = m[STSRegisters::OPERATION_MODE] == STSMode::VELOCITY ? 1 : 0;
+    torque_[index] = m[STSRegisters::TORQUE_SWITCH] != 0 ? 1 : 0;
+}
+
+void STSSimulatedBus::parseInput()
+{
+    size_t start = 0;
+    while (input_.size() - start >= 4)
+    {
+        const byte *frame = &input_[start];
+        if (frame[0] != 0xFF || frame[1] != 0xFF || frame[3] < 2)
+        {
+            start++;
+            continue;
+        }
+        size_t const frameLength = frame[3] + 4;
+        if (input_.size() - start < frameLength)
+            break;
+        byte checksum = 0;
+        for (size_t i = 2; i < frameLength - 1; i++)
+            checksum += frame[i];
+        if (static_cast<byte>(~checksum) == frame[frameLength - 1])
+            execute(frame[2], frame[4], &frame[5], frame[3] - 2);
+        start += frameLength;
+    }
+    input_.erase(input_.begin(), input_.begin() + start);
+}
+
+void STSSimulatedBus::execute(byte const &id, byte const &instruction, const byte *parameters, byte const &length)
+{
+    // Replies and command changes happen now: integrate the motion so far.
+    stepToNow();
+
+    if (instruction == instruction::SYNCWRITE && length >= 2)
+    {
+        byte const dataLength = parameters[1];
+        for (int i = 2; i + dataLength < length + 1; i += dataLength + 1)
+        {
+            int const s = servoIndex_[parameters[i]];
+            if (s >= 0 && listens(s))
+                writeMemory(s, parameters[0], &parameters[i + 1], dataLength);
+        }
+        return;
+    }
+    if (instruction == instruction::SYNCREAD && length >= 2)
+    {
+        // Each servo replies in turn, in the order of the request.
+        for (int i = 2; i < length; i++)
+        {
+            int const s = servoIndex_[parameters[i]];
+            if (s >= 0 && listens(s) && parameters[0] + parameters[1] <= 256)
+                reply(s, &memory(s)[parameters[0]], parameters[1]);
+        }
+        return;
+    }
+
+    int first = 0;
+    int last = size();
+    if (id != BROADCAST_ID)
+    {
+        first = servoIndex_[id];
+        if (first < 0)
+            return;
+        last = first + 1;
+    }
+    for (int s = first; s < last; s++)
+    {
+        if (!listens(s))
+            continue;
+        byte *m = memory(s);
+        bool const answer = id != BROADCAST_ID;
+        bool const answerWrite = answer && m[STSRegisters::RESPONSE_STATUS_LEVEL] > 0;
+        switch (instruction)
+        {
+            case instruction::PING_:
+                if (answer)
+                    reply(s, nullptr, 0);
+                break;
+            case instruction::READ:
+                if (answer && length == 2 && parameters[0] + parameters[1] <= 256)
+                    reply(s, &m[parameters[0]], parameters[1]);
+                break;
+            case instruction::WRITE:
+                if (length > 1)
+                    writeMemory(s, parameters[0], &parameters[1], length - 1);
+                if (answerWrite)
+                    reply(s, nullptr, 0);
+                break;
+            case instruction::REGWRITE:
+                pendingWrite_[s].assign(parameters, parameters + length);
+                m[STSRegisters::ASYNCHRONOUS_WRITE_ST] = 1;
+                if (answerWrite)
+                    reply(s, nullptr, 0);
+                break;
+            case instruction::ACTION:
+                if (pendingWrite_[s].size() > 1)
+                    writeMemory(s, pendingWrite_[s][0], &pendingWrite_[s][1], pendingWrite_[s].size() - 1);
+                pendingWrite_[s].clear();
+                m[STSRegisters::ASYNCHRONOUS_WRITE_ST] = 0;
+                break;
+            case instruction::RESET:
+                setDefaults(m, m[STSRegisters::ID]);
+                writeWord(m, STSRegisters::TARGET_POSITION, static_cast<int>(position_[s] + 0.5));
+                updateCommand(s);
+                break;
+        }
+    }
+}
+
+bool STSSimulatedBus::listens(int const &index)
+{
+    // A servo at another baud rate only sees noise. A new rate applies after the reply to the write changing it.
+    byte const rate = memory(index)[STSRegisters::BAUDRATE];
+    return rate < sizeof(BAUD_RATES) / sizeof(BAUD_RATES[0]) && BAUD_RATES[rate] == baudRate_;
+}
+
+void STSSimulatedBus::writeMemory(int const &index, byte const &address, const byte *data, byte const &length)
+{
+    byte *m = memory(index);
+    byte const oldId = m[STSRegisters::ID];
+    bool const unlocked = m[STSRegisters::WRITE_LOCK] == 0;
+    // Feedback registers are read-only.
+    for (int i = 0; i < length && address + i < STSRegisters::CURRENT_POSITION; i++)
+    {
+        m[address + i] = data[i];
+        if (unlocked && address + i < STSRegisters::TORQUE_SWITCH)
+            eepromWriteCount_++;
+    }
+    if (m[STSRegisters::ID] != oldId)
+    {
+        servoIndex_[oldId] = -1;
+        servoIndex_[m[STSRegisters::ID]] = index;
+    }
+    updateCommand(index);
+}
+
+void STSSimulatedBus::reply(int const &index, const byte *parameters, byte const &length)
+{
+    byte const *m = memory(index);
+    uint64_t const now = VirtualClock::current().now();
+    if (silentUntil_[index] > now)
+        return;
+    uint64_t const delay = static_cast<uint64_t>(model_.processingTime * 1e9) + m[STSRegisters::RESPONSE_DELAY] * 2000ULL;
+    uint64_t date = std::max(now, wireFree_) + delay;
+
+    std::vector<byte> frame(length + 6);
+    frame[0] = 0xFF;
+    frame[1] = 0xFF;
+    frame[2] = m[STSRegisters::ID];
+    frame[3] = length + 2;
+    frame[4] = 0; // Status: no error.
+    byte checksum = frame[2] + frame[3] + frame[4];
+    for (int i = 0; i < length; i++)
+    {
+        frame[5 + i] = parameters[i];
+        checksum += parameters[i];
+    }
+    frame[5 + length] = ~checksum;
+
+    // Fault injection: at most one fault per reply.
+    double draw = uniform_(random_);
+    bool faulty = true;
+    if ((draw -= faults_.vanish) < 0)
+    {
+        silentUntil_[index] = now + static_cast<uint64_t>(faults_.vanishDuration * 1e9);
+        faultCount_++;
+        return;
+    }
+    else if ((draw -= faults_.dropReply) < 0)
+    {
+        faultCount_++;
+        return;
+    }
+    else if ((draw -= faults_.corruptChecksum) < 0)
+        frame.back() ^= 1 << (random_() % 8);
+    else if ((draw -= faults_.strayBytes) < 0)
+        frame.insert(frame.begin(), 1 + random_() % 3, static_cast<byte>(random_()));
+    else if ((draw -= faults_.truncateReply) < 0)
+        frame.resize(1 + random_() % (frame.size() - 1));
+    else if ((draw -= faults_.lateReply) < 0)
+        date += static_cast<uint64_t>(faults_.lateDelay * 1e9);
+    else
+        faulty = false;
+    if (faulty)
+        faultCount_++;
+
+    for (byte const &b : frame)
+    {
+        date += byteTime();
+        output_.push_back(RxByte{date, b});
+    }
+    wireBusyTime_ += frame.size() * byteTime();
+    wireFree_ = date;
+}
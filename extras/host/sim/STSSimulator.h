@@ -0,0 +1,199 @@
+/// \file STSSimulator.h
+/// \brief Simulated bus of STS servos, for running the driver on a host without hardware.
+///
+/// \details The bus decodes the instructions written by the driver, answers them like the servos
+///          would (with realistic wire and response times on the VirtualClock) and integrates a
+///          simple motor model for each servo, so that motions take as long as on the real servo.
+///
+///          The state of all servos is stored as structure of arrays and integrated by batch kernels
+///          over the whole bus, so that buses of hundreds of servos are cheap to simulate. Each bus
+///          only uses the VirtualClock of the calling thread: several buses can be run in parallel,
+///          one per thread.
+#ifndef STSSIMULATOR_H
+#define STSSIMULATOR_H
+
+#include <Arduino.h>
+
+#include <array>
+#include <deque>
+#include <random>
+#include <vector>
+
+/// \brief Parameters of the motor model, roughly matching a STS3215 at 7.4V.
+struct STSMotorModel
+{
+    double maxSpeed = 3400;           ///< Speed used when RUNNING_SPEED is 0, in steps/s.
+    double maxAcceleration = 50000;   ///< Acceleration used when TARGET_ACCELERATION is 0, in steps/s^2.
+    double idleCurrent = 0.02;        ///< Current with torque on at rest, in A.
+    double currentPerSpeed = 5e-5;    ///< Current due to friction, in A/(step/s).
+    double currentPerAcceleration = 1e-5; ///< Current due to inertia, in A/(step/s^2).
+    double ambientTemperature = 25;   ///< In degC.
+    double thermalResistance = 30;    ///< Temperature rise at steady state, in degC/A.
+    double thermalTimeConstant = 120; ///< In s.
+    double processingTime = 20e-6;    ///< Time before a servo starts replying, in addition to RESPONSE_DELAY, in s.
+    double integrationStep = 1e-3;    ///< Maximum integration step of the model, in s.
+};
+
+/// \brief Faults injected in the replies of the simulated servos.
+/// \details Each reply is hit by at most one fault, drawn with the given probabilities.
+struct STSFaultScenario
+{
+    double dropReply = 0;        ///< Probability that a reply is not sent.
+    double corruptChecksum = 0;  ///< Probability that a reply has a wrong checksum.
+    double strayBytes = 0;       ///< Probability that noise bytes are sent before a reply.
+    double truncateReply = 0;    ///< Probability that a reply is cut short.
+    double lateReply = 0;        ///< Probability that a reply is sent late.
+    double lateDelay = 15e-3;    ///< Delay of a late reply, in s (the driver times out after 10ms).
+    double vanish = 0;           ///< Probability that a servo stops answering for a while, instead of replying.
+    double vanishDuration = 0.1; ///< Time a vanished servo stays silent, in s.
+    unsigned int seed = 1;       ///< Seed of the random generator.
+};
+
+/// \brief A bus of simulated servos, to be attached to a HardwareSerial.
+class STSSimulatedBus : public SerialDevice
+{
+public:
+    STSSimulatedBus();
+
+    /// \brief Add a servo to the bus, with the default register values of a STS3215.
+    /// \return Index of the servo on the bus.
+    int addServo(byte const &id);
+
+    /// \brief Number of servos on the bus.
+    int size() const { return static_cast<int>(memory_.size()); }
+
+    /// \brief Find a servo.
+    /// \return Index of the servo, -1 if there is no servo with this ID.
+    int servoIndex(byte const &id) const;
+
+    /// \brief Register table of a servo.
+    byte *memory(int const &index) { return memory_[index].data(); }
+
+    /// \brief Position of a servo, in steps.
+    double position(int const &index) const { return position_[index]; }
+
+    /// \brief Speed of a servo, in steps/s.
+    double speed(int const &index) const { return speed_[index]; }
+
+    /// \brief Move a servo from the outside, e.g. by hand.
+    void setPosition(int const &index, double const &position);
+
+    /// \brief Motor model used for all servos.
+    STSMotorModel &model() { return model_; }
+
+    /// \brief Set the faults to inject from now on.
+    void setFaultScenario(STSFaultScenario const &scenario);
+
+    /// \brief Number of replies hit by a fault so far.
+    uint64_t faultCount() const { return faultCount_; }
+
+    /// \brief Limit the receive buffer of the serial port, 0 (the default) for an unlimited one.
+    /// \details Reply bytes arriving while the buffer holds size unread bytes are lost, like in the 64-byte
+    ///          buffer of the AVR HardwareSerial.
+    void setRxBufferSize(size_t const &size) { rxBufferSize_ = size; }
+
+    /// \brief Largest number of unread bytes the receive buffer held.
+    size_t rxHighWater() const { return rxHighWater_; }
+
+    /// \brief Number of reply bytes lost because the receive buffer was full.
+    uint64_t rxOverflowCount() const { return rxOverflowCount_; }
+
+    /// \brief Number of EEPROM register writes that reached the EEPROM, i.e. while WRITE_LOCK was 0, over all servos.
+    /// \details Like on the servos, EEPROM registers written while locked only change in RAM.
+    uint64_t eepromWriteCount() const { return eepromWriteCount_; }
+
+    /// \brief Total time the wire was busy (requests and replies), in ns.
+    uint64_t wireBusyTime() const { return wireBusyTime_; }
+
+    /// \brief Real (not virtual) time spent integrating the motor model, in ns.
+    uint64_t stepCpuTime() const { return stepCpuTime_; }
+
+    /// \brief Integrate the servos up to the current time, e.g. before reading their state from the outside.
+    void stepToNow();
+
+    void begin(long baudRate) override;
+    size_t write(const uint8_t *data, size_t length) override;
+    /// \note The frames are executed when handed over, up to a frame duration before they are fully on the wire.
+    uint64_t startWrite(const uint8_t *data, size_t length, uint64_t const &date) override;
+    int read(unsigned long timeoutMs) override;
+    int available() override;
+
+private:
+    /// \brief Batch kernel: integrate the motor model of all servos.
+    void step(double const &dt);
+
+    /// \brief Batch kernel: copy the model state of all servos to their feedback registers.
+    void updateFeedbackRegisters();
+
+    /// \brief Decode the control registers of a servo into the model inputs, after a write.
+    void updateCommand(int const &index);
+
+    /// \brief Decode the complete frames present in the input buffer.
+    void parseInput();
+
+    /// \brief Execute an instruction.
+    void execute(byte const &id, byte const &instruction, const byte *parameters, byte const &length);
+
+    /// \brief Apply a write to a servo.
+    void writeMemory(int const &index, byte const &address, const byte *data, byte const &length);
+
+    /// \brief Queue the reply of a servo.
+    void reply(int const &index, const byte *parameters, byte const &length);
+
+    /// \brief Duration of a byte on the wire, in ns.
+    uint64_t byteTime() const;
+
+    /// \brief Whether a servo receives the frames sent at the baud rate of the port, see STSRegisters::BAUDRATE.
+    bool listens(int const &index);
+
+    /// \brief Move the reply bytes arrived by now into the receive buffer, dropping those that do not fit.
+    void fillRxBuffer();
+
+    STSMotorModel model_;
+
+    // Register tables, and ID to servo index.
+    std::vector<std::array<byte, 256>> memory_;
+    std::vector<std::vector<byte>> pendingWrite_; ///< Write registered by REG WRITE, applied on ACTION.
+    short servoIndex_[256];
+
+    // Model inputs, decoded from the registers on write.
+    std::vector<double> targetPosition_;
+    std::vector<double> commandSpeed_;    ///< RUNNING_SPEED, signed.
+    std::vector<double> maxSpeed_;        ///< Speed limit of the profile.
+    std::vector<double> maxAcceleration_;
+    std::vector<double> velocityMode_;    ///< 1 in velocity mode, 0 otherwise.
+    std::vector<double> torque_;          ///< 1 if torque is enabled, 0 otherwise.
+
+    // Model state.
+    std::vector<double> position_;
+    std::vector<double> speed_;
+    std::vector<double> acceleration_;
+    std::vector<double> current_;
+    std::vector<double> temperature_;
+    std::vector<uint64_t> silentUntil_; ///< Date until which a vanished servo does not answer, in ns.
+
+    long baudRate_;
+    uint64_t lastStep_;     ///< Date up to which servos have been integrated, in ns.
+    uint64_t wireFree_;     ///< Date at which the wire becomes free, in ns.
+    uint64_t wireBusyTime_;
+    uint64_t stepCpuTime_;
+    std::vector<byte> input_;  ///< Bytes received, not yet decoded.
+    struct RxByte
+    {
+        uint64_t arrival;
+        byte value;
+    };
+    std::deque<RxByte> output_; ///< Reply bytes, with their arrival date.
+    size_t rxBuffered_;         ///< Number of bytes at the front of output_ that are in the receive buffer.
+    size_t rxBufferSize_;
+    size_t rxHighWater_;
+    uint64_t rxOverflowCount_;
+
+    STSFaultScenario faults_;
+    std::mt19937 random_;
+    std::uniform_real_distribution<double> uniform_;
+    uint64_t faultCount_;
+    uint64_t eepromWriteCount_;
+};
+
+#endif
@@ -0,0 +1,88 @@
+// Run an example sketch, compiled as it is, against a simulated bus: setup(), then loop() until the given
+// virtual time has elapsed, as the Arduino core does.
+//
+// The servos are on Serial, or on the port given by SKETCH_SERVO_PORT for boards with a second port, Serial
+// then being printed to the standard output. Reports the duration of setup, the loop rate, the mean and
+// longest loop, and the share of the time the bus is busy, to evaluate a sketch before flashing it.
+//
+// Usage: <sketch> [seconds] [servos], the servos having IDs 1 to n (2 by default).
+
+#include "Arduino.h"
+#include "STSSimulator.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef SKETCH_SERVO_PORT
+#define SKETCH_SERVO_PORT Serial
+#endif
+
+void setup();
+void loop();
+
+namespace
+{
+    // A loop taking no bus or delay time would run forever in virtual time.
+    unsigned long const MAX_LOOPS = 1000000;
+
+    /// \brief Serial monitor: bytes written are printed, nothing is ever received.
+    class Console : public SerialDevice
+    {
+    public:
+        void begin(long) override {}
+
+        size_t write(const uint8_t *data, size_t length) override
+        {
+            return fwrite(data, 1, length, stdout);
+        }
+
+        int read(unsigned long) override { return -1; }
+
+        int available() override { return 0; }
+    };
+};
+
+int main(int argc, char **argv)
+{
+    double const seconds = argc > 1 ? atof(argv[1]) : 10;
+    int const nServos = argc > 2 ? atoi(argv[2]) : 2;
+    char const *name = strrchr(argv[0], '/') != nullptr ? strrchr(argv[0], '/') + 1 : argv[0];
+
+    STSSimulatedBus bus;
+    for (int i = 0; i < nServos; i++)
+        bus.addServo(i + 1);
+    Console console;
+    HardwareSerial &servoPort = SKETCH_SERVO_PORT;
+    if (&servoPort != &Serial)
+        Serial.attach(&console);
+    servoPort.attach(&bus);
+
+    VirtualClock &clock = VirtualClock::current();
+    setup();
+    uint64_t const setupTime = clock.now();
+
+    uint64_t const wireStart = bus.wireBusyTime();
+    uint64_t const end = setupTime + static_cast<uint64_t>(seconds * 1e9);
+    uint64_t longest = 0;
+    unsigned long loops = 0;
+    while (clock.now() < end && loops < MAX_LOOPS)
+    {
+        uint64_t const start = clock.now();
+        loop();
+        longest = std::max(longest, clock.now() - start);
+        loops++;
+    }
+    double const elapsed = (clock.now() - setupTime) * 1e-9;
+    fflush(stdout);
+
+    printf("%s: %d servos, setup %.1f ms\n", name, nServos, setupTime * 1e-6);
+    if (elapsed == 0)
+        printf("  loop() takes no bus or delay time: %lu loops\n", loops);
+    else
+        printf("  %lu loops in %.1f s: %.2f Hz, mean %.2f ms, longest %.2f ms, bus busy %.2f%%\n", loops, elapsed,
+               loops / elapsed, 1e3 * elapsed / loops, longest * 1e-6,
+               100 * (bus.wireBusyTime() - wireStart) * 1e-9 / elapsed);
+    printf("  LED (pin %d): %s\n", LED_BUILTIN, digitalRead(LED_BUILTIN) == HIGH ? "on" : "off");
+    return 0;
+}
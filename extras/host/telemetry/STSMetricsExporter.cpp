@@ -0,0 +1,360 @@
+#include "STSMetricsExporter.h"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace
+{
+    // Flag of middle_: the slot was published and not taken by the reader yet.
+    byte const FRESH = 0x80;
+    // Time the server waits for a request, and between two checks of stop, in ms.
+    int const REQUEST_TIMEOUT_MS = 1000;
+    int const POLL_MS = 100;
+
+    char const CONTENT_TYPE[] = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+    /// \brief Formatting of the metric families, each sample labeled with the bus.
+    class Writer
+    {
+    public:
+        explicit Writer(std::string const &bus) : bus_(bus) {}
+
+        void family(char const *name, char const *type, char const *help, char const *unit = nullptr)
+        {
+            text_ += "# TYPE ";
+            text_ += name;
+            text_ += ' ';
+            text_ += type;
+            text_ += '\n';
+            if (unit != nullptr)
+            {
+                text_ += "# UNIT ";
+                text_ += name;
+                text_ += ' ';
+                text_ += unit;
+                text_ += '\n';
+            }
+            text_ += "# HELP ";
+            text_ += name;
+            text_ += ' ';
+            text_ += help;
+            text_ += '\n';
+        }
+
+        /// \param[in] servo Servo ID label, -1 for none.
+        /// \param[in] le Bucket bound label, nullptr for none.
+        void sample(char const *name, char const *suffix, int const &servo, char const *le, double const &value)
+        {
+            char line[160];
+            int n = snprintf(line, sizeof(line), "%s%s{bus=\"%s\"", name, suffix, bus_.c_str());
+            if (servo >= 0)
+                n += snprintf(line + n, sizeof(line) - n, ",servo=\"%d\"", servo);
+            if (le != nullptr)
+                n += snprintf(line + n, sizeof(line) - n, ",le=\"%s\"", le);
+            snprintf(line + n, sizeof(line) - n, "} %.10g\n", value);
+            text_ += line;
+        }
+
+        std::string &text() { return text_; }
+
+    private:
+        std::string const &bus_;
+        std::string text_;
+    };
+
+    bool sendAll(int const &fd, char const *data, size_t length)
+    {
+        while (length > 0)
+        {
+            ssize_t const n = send(fd, data, length, MSG_NOSIGNAL);
+            if (n <= 0)
+                return false;
+            data += n;
+            length -= n;
+        }
+        return true;
+    }
+};
+
+STSMetricsExporter::STSMetricsExporter(char const *bus) :
+    bus_(bus),
+    back_(0),
+    front_(1),
+    middle_(2),
+    sequence_(0),
+    listenFd_(-1),
+    port_(0),
+    running_(false),
+    scrapes_(0)
+{
+    memset(slots_, 0, sizeof(slots_));
+    memset(telemetry_, 0, sizeof(telemetry_));
+    memset(hasTelemetry_, 0, sizeof(hasTelemetry_));
+    memset(lastTimeouts_, 0, sizeof(lastTimeouts_));
+    memset(lastErrors_, 0, sizeof(lastErrors_));
+    memset(timeouts_, 0, sizeof(timeouts_));
+    memset(errors_, 0, sizeof(errors_));
+    memset(known_, 0, sizeof(known_));
+}
+
+STSMetricsExporter::~STSMetricsExporter()
+{
+    stop();
+}
+
+bool STSMetricsExporter::listenHttp(uint16_t const &port)
+{
+    if (listenFd_ >= 0)
+        return false;
+    int const fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    int const reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (bind(fd, reinterpret_cast<sockaddr *>(&address), length) != 0
+        || getsockname(fd, reinterpret_cast<sockaddr *>(&address), &length) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    port_ = ntohs(address.sin_port);
+    return start(fd);
+}
+
+bool STSMetricsExporter::listenUnix(char const *path)
+{
+    sockaddr_un address = {};
+    if (listenFd_ >= 0 || strlen(path) >= sizeof(address.sun_path))
+        return false;
+    int const fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return false;
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    unlink(path);
+    if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    unixPath_ = path;
+    return start(fd);
+}
+
+bool STSMetricsExporter::start(int const &fd)
+{
+    if (listen(fd, 8) != 0)
+    {
+        close(fd);
+        if (!unixPath_.empty())
+            unlink(unixPath_.c_str());
+        unixPath_.clear();
+        port_ = 0;
+        return false;
+    }
+    listenFd_ = fd;
+    running_ = true;
+    thread_ = std::thread(&STSMetricsExporter::serve, this);
+    return true;
+}
+
+void STSMetricsExporter::stop()
+{
+    if (listenFd_ < 0)
+        return;
+    running_ = false;
+    thread_.join();
+    close(listenFd_);
+    listenFd_ = -1;
+    port_ = 0;
+    if (!unixPath_.empty())
+        unlink(unixPath_.c_str());
+    unixPath_.clear();
+}
+
+void STSMetricsExporter::publish(STSServoDriver &driver,
+                                 byte const &numberOfServos,
+                                 const byte servoIds[],
+                                 const STSTelemetry telemetry[],
+                                 const byte *responded)
+{
+    for (int i = 0; i < numberOfServos; i++)
+        if (responded == nullptr || (responded[i / 8] & (1 << (i % 8))))
+        {
+            telemetry_[servoIds[i]] = telemetry[i];
+            hasTelemetry_[servoIds[i]] = true;
+        }
+
+    STSMetricsSnapshot &snapshot = slots_[back_];
+    snapshot.sequence = sequence_++;
+    snapshot.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    snapshot.statistics = driver.getStatistics();
+    snapshot.nServos = driver.getKnownServoCount();
+    bool known[256] = {};
+    for (int i = 0; i < snapshot.nServos; i++)
+    {
+        STSMetricsSnapshot::Servo &servo = snapshot.servos[i];
+        servo.id = driver.getKnownServoId(i);
+        // The counters of the driver wrap at 65535, and restart from 0 when a servo becomes known again: only
+        // their increase since the last publish is added to the totals exported.
+        uint16_t timeouts = 0;
+        uint16_t errors = 0;
+        driver.getServoStatistics(servo.id, timeouts, errors);
+        if (!known_[servo.id])
+            lastTimeouts_[servo.id] = lastErrors_[servo.id] = 0;
+        timeouts_[servo.id] += static_cast<uint16_t>(timeouts - lastTimeouts_[servo.id]);
+        errors_[servo.id] += static_cast<uint16_t>(errors - lastErrors_[servo.id]);
+        lastTimeouts_[servo.id] = timeouts;
+        lastErrors_[servo.id] = errors;
+        known[servo.id] = true;
+        servo.timeouts = timeouts_[servo.id];
+        servo.errors = errors_[servo.id];
+        servo.hasTelemetry = hasTelemetry_[servo.id];
+        servo.telemetry = telemetry_[servo.id];
+    }
+    memcpy(known_, known, sizeof(known_));
+    // Release the snapshot, and take the slot the reader is not using as the next one.
+    back_ = middle_.exchange(back_ | FRESH, std::memory_order_acq_rel) & ~FRESH;
+}
+
+std::string STSMetricsExporter::render()
+{
+    if (middle_.load(std::memory_order_relaxed) & FRESH)
+        front_ = middle_.exchange(front_, std::memory_order_acq_rel) & ~FRESH;
+    STSMetricsSnapshot const &snapshot = slots_[front_];
+    STSStatistics const &statistics = snapshot.statistics;
+
+    Writer writer(bus_);
+    writer.family("sts_transactions", "counter", "Instructions sent.");
+    writer.sample("sts_transactions", "_total", -1, nullptr, statistics.transactions);
+    writer.family("sts_timeouts", "counter", "Expected replies not received in time.");
+    writer.sample("sts_timeouts", "_total", -1, nullptr, statistics.timeouts);
+    writer.family("sts_errors", "counter", "Invalid replies (header, checksum).");
+    writer.sample("sts_errors", "_total", -1, nullptr, statistics.errors);
+    writer.family("sts_sent_bytes", "counter", "Bytes written to the bus.", "bytes");
+    writer.sample("sts_sent_bytes", "_total", -1, nullptr, statistics.bytesSent);
+    writer.family("sts_received_bytes", "counter", "Bytes read from the bus.", "bytes");
+    writer.sample("sts_received_bytes", "_total", -1, nullptr, statistics.bytesReceived);
+
+    writer.family("sts_reply_latency_seconds", "histogram",
+                  "Time from the end of a request to the end of its valid reply.", "seconds");
+    uint64_t count = 0;
+    for (int b = 0; b < STS_LATENCY_BUCKETS; b++)
+    {
+        count += statistics.latency[b];
+        char le[32];
+        if (b < STS_LATENCY_BUCKETS - 1)
+            snprintf(le, sizeof(le), "%g", (STSLatency::FIRST_BOUND_US << b) * 1e-6);
+        else
+            snprintf(le, sizeof(le), "+Inf");
+        writer.sample("sts_reply_latency_seconds", "_bucket", -1, le, count);
+    }
+    writer.sample("sts_reply_latency_seconds", "_count", -1, nullptr, count);
+    writer.sample("sts_reply_latency_seconds", "_sum", -1, nullptr, statistics.latencySum * 1e-6);
+
+    writer.family("sts_servos", "gauge", "Servos known to the driver.");
+    writer.sample("sts_servos", "", -1, nullptr, snapshot.nServos);
+    writer.family("sts_servo_timeouts", "counter", "Requests to the servo left unanswered.");
+    for (int i = 0; i < snapshot.nServos; i++)
+        writer.sample("sts_servo_timeouts", "_total", snapshot.servos[i].id, nullptr, snapshot.servos[i].timeouts);
+    writer.family("sts_servo_errors", "counter", "Invalid replies of the servo.");
+    for (int i = 0; i < snapshot.nServos; i++)
+        writer.sample("sts_servo_errors", "_total", snapshot.servos[i].id, nullptr, snapshot.servos[i].errors);
+
+    struct Gauge
+    {
+        char const *name;
+        char const *help;
+        char const *unit;
+    };
+    Gauge const gauges[] = {
+        {"sts_servo_position_steps", "CURRENT_POSITION.", "steps"},
+        {"sts_servo_temperature_celsius", "CURRENT_TEMPERATURE.", "celsius"},
+        {"sts_servo_voltage_volts", "CURRENT_VOLTAGE.", "volts"},
+        {"sts_servo_current_amperes", "CURRENT_CURRENT.", "amperes"},
+        {"sts_servo_status", "STATUS register: error flags.", nullptr},
+    };
+    for (int g = 0; g < 5; g++)
+    {
+        writer.family(gauges[g].name, "gauge", gauges[g].help, gauges[g].unit);
+        for (int i = 0; i < snapshot.nServos; i++)
+        {
+            STSMetricsSnapshot::Servo const &servo = snapshot.servos[i];
+            if (!servo.hasTelemetry)
+                continue;
+            double const values[] = {static_cast<double>(servo.telemetry.position),
+                                     static_cast<double>(servo.telemetry.temperature),
+                                     servo.telemetry.voltage * 0.1,
+                                     servo.telemetry.current * 0.0065,
+                                     static_cast<double>(servo.telemetry.status)};
+            writer.sample(gauges[g].name, "", servo.id, nullptr, values[g]);
+        }
+    }
+
+    writer.family("sts_publish_timestamp_seconds", "gauge", "Time the bus thread published the metrics.", "seconds");
+    writer.sample("sts_publish_timestamp_seconds", "", -1, nullptr, snapshot.timestamp * 1e-9);
+    writer.text() += "# EOF\n";
+    return writer.text();
+}
+
+void STSMetricsExporter::serve()
+{
+    while (running_)
+    {
+        pollfd event = {listenFd_, POLLIN, 0};
+        if (poll(&event, 1, POLL_MS) <= 0)
+            continue;
+        int const fd = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0)
+            continue;
+        answer(fd);
+        close(fd);
+    }
+}
+
+void STSMetricsExporter::answer(int const &fd)
+{
+    // Read the request line and headers: only the path matters.
+    std::string request;
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < 4096)
+    {
+        pollfd event = {fd, POLLIN, 0};
+        if (poll(&event, 1, REQUEST_TIMEOUT_MS) <= 0)
+            return;
+        char buffer[1024];
+        ssize_t const n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+            return;
+        request.append(buffer, n);
+    }
+    std::string header;
+    std::string body;
+    if (request.compare(0, 13, "GET /metrics ") == 0 || request.compare(0, 6, "GET / ") == 0)
+    {
+        body = render();
+        header = "HTTP/1.1 200 OK\r\nContent-Type: ";
+        header += CONTENT_TYPE;
+        scrapes_++;
+    }
+    else
+    {
+        body = "Not found\n";
+        header = "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain";
+    }
+    header += "\r\nContent-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+    if (sendAll(fd, header.data(), header.size()))
+        sendAll(fd, body.data(), body.size());
+}
@@ -0,0 +1,135 @@
+/// \file STSMetricsExporter.h
+/// \brief Bus health in the OpenMetrics text format, served over loopback HTTP or a Unix socket, for the metrics
+///        scraper of a Linux host.
+///
+/// \details The thread running the bus publishes a snapshot of the driver statistics (transactions, errors, reply
+///          latency histogram) and of the health of each servo after its cycles. Publishing copies the snapshot
+///          into a triple buffer and swaps it in with a single atomic exchange: it never waits for the server, and
+///          takes no lock and makes no system call. The server thread takes the latest snapshot the same way when
+///          scraped, and formats it: a scrape never delays the bus thread.
+///
+///          Exported metrics, all labeled with the bus name:
+///            - sts_transactions, sts_timeouts, sts_errors, sts_sent_bytes, sts_received_bytes (counters)
+///            - sts_reply_latency_seconds (histogram, see STSStatistics::latency)
+///            - sts_servos (gauge): servos known to the driver
+///            - sts_servo_timeouts, sts_servo_errors (counters, per servo): the 16-bit counters of the driver are
+///              accumulated on each publish, so they do not wrap as long as it is called at least once per 65535
+///              events of a servo
+///            - sts_servo_position_steps, sts_servo_temperature_celsius, sts_servo_voltage_volts,
+///              sts_servo_current_amperes, sts_servo_status (gauges, per servo, once its telemetry is published)
+///            - sts_publish_timestamp_seconds (gauge): time of the snapshot
+#ifndef STSMETRICSEXPORTER_H
+#define STSMETRICSEXPORTER_H
+
+#include <STSServoDriver.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#if !STS_ENABLE_STATISTICS
+#error "STSMetricsExporter needs STS_ENABLE_STATISTICS"
+#endif
+
+/// \brief State of the bus at a given time, see STSMetricsExporter::publish.
+struct STSMetricsSnapshot
+{
+    /// \brief Health of a servo.
+    struct Servo
+    {
+        byte id;
+        bool hasTelemetry;      ///< Whether telemetry holds the last published feedback of the servo.
+        uint64_t timeouts;      ///< See STSServoDriver::getServoStatistics, accumulated by publish.
+        uint64_t errors;
+        STSTelemetry telemetry;
+    };
+
+    uint64_t sequence;          ///< Number of snapshots published before this one.
+    uint64_t timestamp;         ///< Time of the snapshot, in ns since the Unix epoch.
+    STSStatistics statistics;
+    byte nServos;
+    Servo servos[STS_MAX_SERVOS];
+};
+
+/// \brief Serves the snapshots published by the bus thread to a metrics scraper.
+class STSMetricsExporter
+{
+public:
+    /// \param[in] bus Value of the bus label of all the metrics.
+    explicit STSMetricsExporter(char const *bus = "0");
+    ~STSMetricsExporter();
+
+    /// \brief Serve the metrics over HTTP on the loopback interface, at /metrics.
+    /// \param[in] port TCP port, 0 for any free port (see getPort).
+    /// \return False if the port could not be bound, or the exporter is already serving.
+    bool listenHttp(uint16_t const &port);
+
+    /// \brief Serve the metrics over HTTP on a Unix socket, e.g. for curl --unix-socket.
+    /// \param[in] path Path of the socket, replaced if it exists and removed by stop.
+    /// \return False if the socket could not be bound, or the exporter is already serving.
+    bool listenUnix(char const *path);
+
+    /// \brief TCP port served by listenHttp, 0 if none.
+    uint16_t getPort() const { return port_; }
+
+    /// \brief Stop serving, waiting for the scrape in progress if any.
+    void stop();
+
+    /// \brief Publish the state of the bus. Called by the thread of the bus, e.g. after each cycle.
+    /// \details Wait-free: copies the statistics of the driver and of its known servos, and the given telemetry.
+    /// \param[in] driver Driver of the bus, only used from the calling thread.
+    /// \param[in] numberOfServos Number of servos in servoIds and telemetry, 0 if no telemetry is given.
+    /// \param[in] servoIds IDs of the servos whose telemetry is given.
+    /// \param[in] telemetry Feedback of the servos, as returned by STSServoDriver::readTelemetry.
+    /// \param[in] responded Bitmap of the servos of servoIds that replied, nullptr if they all did.
+    void publish(STSServoDriver &driver,
+                 byte const &numberOfServos = 0,
+                 const byte servoIds[] = nullptr,
+                 const STSTelemetry telemetry[] = nullptr,
+                 const byte *responded = nullptr);
+
+    /// \brief Format the latest snapshot in the OpenMetrics text format.
+    /// \note Takes the latest snapshot as the reader of the triple buffer: only call it from a single thread,
+    ///       and not while serving.
+    std::string render();
+
+    /// \brief Number of scrapes served.
+    uint64_t getScrapeCount() const { return scrapes_.load(); }
+
+private:
+    /// \brief Accept and answer scrapes until stop.
+    void serve();
+
+    /// \brief Answer a connection.
+    void answer(int const &fd);
+
+    /// \brief Start serving on a bound socket.
+    bool start(int const &fd);
+
+    std::string bus_;
+    /// Triple buffer: the writer fills slots_[back_], the reader formats slots_[front_], and the last published
+    /// slot is in middle_, with FRESH set until the reader takes it.
+    STSMetricsSnapshot slots_[3];
+    byte back_;
+    byte front_;
+    std::atomic<byte> middle_;
+    uint64_t sequence_;
+    /// Telemetry of each servo ID, kept between publishes.
+    STSTelemetry telemetry_[256];
+    bool hasTelemetry_[256];
+    /// Error counters of each servo ID: the 16-bit ones of the driver at the last publish, and their total.
+    uint16_t lastTimeouts_[256];
+    uint16_t lastErrors_[256];
+    uint64_t timeouts_[256];
+    uint64_t errors_[256];
+    bool known_[256];       ///< Whether the servo was known to the driver at the last publish.
+
+    int listenFd_;
+    uint16_t port_;
+    std::string unixPath_;
+    std::atomic<bool> running_;
+    std::atomic<uint64_t> scrapes_;
+    std::thread thread_;
+};
+
+#endif
@@ -0,0 +1,272 @@
+#include "STSTelemetryStore.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    // The columns are grown by this many chunks at a time, then doubled.
+    uint64_t const INITIAL_CHUNKS = 16;
+
+    std::string columnPath(char const *directory, STSTelemetryFormat::Column const &column)
+    {
+        return std::string(directory) + "/" + STSTelemetryFormat::columnFile(column);
+    }
+
+    std::string indexPath(char const *directory)
+    {
+        return std::string(directory) + "/index.bin";
+    }
+}
+
+char const *STSTelemetryFormat::columnFile(Column const &column)
+{
+    static char const *const FILES[N_COLUMNS] = {
+        "timestamp.u64", "id.u8", "position.i16", "speed.i16", "current.i16", "temperature.u8", "status.u8"};
+    return FILES[column];
+}
+
+size_t STSTelemetryFormat::columnWidth(Column const &column)
+{
+    static size_t const WIDTHS[N_COLUMNS] = {8, 1, 2, 2, 2, 1, 1};
+    return WIDTHS[column];
+}
+
+STSTelemetryWriter::STSTelemetryWriter(char const *directory, uint32_t const &chunkRows) :
+    open_(false),
+    indexFd_(-1),
+    chunkRows_(chunkRows > 0 ? chunkRows : 1),
+    capacity_(0),
+    rowCount_(0),
+    chunkCount_(0),
+    chunk_()
+{
+    for (int c = 0; c < STSTelemetryFormat::N_COLUMNS; c++)
+    {
+        columnFd_[c] = -1;
+        column_[c] = nullptr;
+    }
+    mkdir(directory, 0755);
+    for (int c = 0; c < STSTelemetryFormat::N_COLUMNS; c++)
+    {
+        columnFd_[c] = ::open(columnPath(directory, static_cast<STSTelemetryFormat::Column>(c)).c_str(),
+                              O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (columnFd_[c] < 0)
+            return;
+    }
+    indexFd_ = ::open(indexPath(directory).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (indexFd_ < 0)
+        return;
+    open_ = grow();
+    writeHeader();
+}
+
+STSTelemetryWriter::~STSTelemetryWriter()
+{
+    if (open_)
+        flush();
+    for (int c = 0; c < STSTelemetryFormat::N_COLUMNS; c++)
+    {
+        size_t const width = STSTelemetryFormat::columnWidth(static_cast<STSTelemetryFormat::Column>(c));
+        if (column_[c] != nullptr)
+            munmap(column_[c], capacity_ * width);
+        if (columnFd_[c] >= 0)
+        {
+            if (open_ && ftruncate(columnFd_[c], rowCount_ * width) != 0)
+                perror("ftruncate");
+            close(columnFd_[c]);
+        }
+    }
+    if (indexFd_ >= 0)
+        close(indexFd_);
+}
+
+void STSTelemetryWriter::append(uint64_t const &timestamp, byte const &id, STSTelemetry const &telemetry)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    appendRow(timestamp, id, telemetry);
+}
+
+void STSTelemetryWriter::append(uint64_t const &timestamp,
+                                byte const &numberOfServos,
+                                const byte servoIds[],
+                                STSTelemetry const telemetry[],
+                                byte const *responded)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i = 0; i < numberOfServos; i++)
+        if (responded[i / 8] & (1 << (i % 8)))
+            appendRow(timestamp, servoIds[i], telemetry[i]);
+}
+
+void STSTelemetryWriter::flush()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    // The partial chunk is written too, it is rewritten once complete.
+    if (chunk_.rowCount > 0)
+        writeChunk();
+    writeHeader();
+}
+
+void STSTelemetryWriter::appendRow(uint64_t const &timestamp, byte const &id, STSTelemetry const &telemetry)
+{
+    if (!open_ || (rowCount_ == capacity_ && !grow()))
+        return;
+    uint64_t const row = rowCount_;
+    reinterpret_cast<uint64_t *>(column_[STSTelemetryFormat::TIMESTAMP])[row] = timestamp;
+    column_[STSTelemetryFormat::ID][row] = id;
+    reinterpret_cast<int16_t *>(column_[STSTelemetryFormat::POSITION])[row] = telemetry.position;
+    reinterpret_cast<int16_t *>(column_[STSTelemetryFormat::SPEED])[row] = telemetry.speed;
+    reinterpret_cast<int16_t *>(column_[STSTelemetryFormat::CURRENT])[row] = telemetry.current;
+    column_[STSTelemetryFormat::TEMPERATURE][row] = telemetry.temperature;
+    column_[STSTelemetryFormat::STATUS][row] = telemetry.status;
+    rowCount_++;
+
+    if (chunk_.rowCount == 0)
+    {
+        chunk_.firstRow = row;
+        chunk_.minTimestamp = timestamp;
+        chunk_.maxTimestamp = timestamp;
+    }
+    if (timestamp < chunk_.minTimestamp)
+        chunk_.minTimestamp = timestamp;
+    if (timestamp > chunk_.maxTimestamp)
+        chunk_.maxTimestamp = timestamp;
+    chunk_.servos[id / 8] |= 1 << (id % 8);
+    chunk_.rowCount++;
+    if (chunk_.rowCount == chunkRows_)
+    {
+        writeChunk();
+        chunkCount_++;
+        chunk_ = STSTelemetryFormat::ChunkEntry();
+    }
+}
+
+bool STSTelemetryWriter::grow()
+{
+    uint64_t const capacity = capacity_ == 0 ? INITIAL_CHUNKS * chunkRows_ : 2 * capacity_;
+    for (int c = 0; c < STSTelemetryFormat::N_COLUMNS; c++)
+    {
+        size_t const width = STSTelemetryFormat::columnWidth(static_cast<STSTelemetryFormat::Column>(c));
+        if (ftruncate(columnFd_[c], capacity * width) != 0)
+        {
+            perror("ftruncate");
+            return false;
+        }
+        void *data = column_[c] == nullptr
+            ? mmap(nullptr, capacity * width, PROT_READ | PROT_WRITE, MAP_SHARED, columnFd_[c], 0)
+            : mremap(column_[c], capacity_ * width, capacity * width, MREMAP_MAYMOVE);
+        if (data == MAP_FAILED)
+        {
+            perror("mmap");
+            return false;
+        }
+        column_[c] = static_cast<uint8_t *>(data);
+    }
+    capacity_ = capacity;
+    return true;
+}
+
+void STSTelemetryWriter::writeChunk()
+{
+    off_t const offset = sizeof(STSTelemetryFormat::IndexHeader) + chunkCount_ * sizeof(STSTelemetryFormat::ChunkEntry);
+    if (pwrite(indexFd_, &chunk_, sizeof(chunk_), offset) != sizeof(chunk_))
+        perror("pwrite");
+}
+
+void STSTelemetryWriter::writeHeader()
+{
+    STSTelemetryFormat::IndexHeader header = STSTelemetryFormat::IndexHeader();
+    memcpy(header.magic, STSTelemetryFormat::MAGIC, sizeof(header.magic));
+    header.version = STSTelemetryFormat::VERSION;
+    header.chunkRows = chunkRows_;
+    header.rowCount = rowCount_;
+    header.chunkCount = chunkCount_ + (chunk_.rowCount > 0 ? 1 : 0);
+    if (pwrite(indexFd_, &header, sizeof(header), 0) != sizeof(header))
+        perror("pwrite");
+}
+
+STSTelemetryReader::STSTelemetryReader(char const *directory) :
+    open_(false),
+    index_(MAP_FAILED),
+    indexSize_(0),
+    chunks_(nullptr),
+    rowCount_(0),
+    chunkCount_(0)
+{
+    for (int c = 0; c < STSTelemetryFormat::N_COLUMNS; c++)
+    {
+        column_[c] = nullptr;
+        mappedSize_[c] = 0;
+    }
+
+    int fd = ::open(indexPath(directory).c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(STSTelemetryFormat::IndexHeader))
+    {
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+    indexSize_ = st.st_size;
+    index_ = mmap(nullptr, indexSize_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (index_ == MAP_FAILED)
+        return;
+    STSTelemetryFormat::IndexHeader const *header = static_cast<STSTelemetryFormat::IndexHeader const *>(index_);
+    if (memcmp(header->magic, STSTelemetryFormat::MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != STSTelemetryFormat::VERSION)
+        return;
+    rowCount_ = header->rowCount;
+    chunkCount_ = header->chunkCount;
+    uint64_t const maxChunks = (indexSize_ - sizeof(*header)) / sizeof(STSTelemetryFormat::ChunkEntry);
+    if (chunkCount_ > maxChunks)
+        chunkCount_ = maxChunks;
+    chunks_ = reinterpret_cast<STSTelemetryFormat::ChunkEntry const *>(header + 1);
+
+    for (int c = 0; c < STSTelemetryFormat::N_COLUMNS; c++)
+    {
+        STSTelemetryFormat::Column const column = static_cast<STSTelemetryFormat::Column>(c);
+        fd = ::open(columnPath(directory, column).c_str(), O_RDONLY);
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            if (fd >= 0)
+                close(fd);
+            return;
+        }
+        // A store still being written may be larger than its row count, never smaller.
+        size_t const size = rowCount_ * STSTelemetryFormat::columnWidth(column);
+        if (static_cast<size_t>(st.st_size) < size)
+        {
+            close(fd);
+            return;
+        }
+        if (size > 0)
+        {
+            void *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED)
+            {
+                close(fd);
+                return;
+            }
+            madvise(data, size, MADV_SEQUENTIAL);
+            column_[c] = static_cast<uint8_t const *>(data);
+            mappedSize_[c] = size;
+        }
+        close(fd);
+    }
+    open_ = true;
+}
+
+STSTelemetryReader::~STSTelemetryReader()
+{
+    for (int c = 0; c < STSTelemetryFormat::N_COLUMNS; c++)
+        if (column_[c] != nullptr)
+            munmap(const_cast<uint8_t *>(column_[c]), mappedSize_[c]);
+    if (index_ != MAP_FAILED)
+        munmap(index_, indexSize_);
+}
@@ -0,0 +1,185 @@
+/// \file STSTelemetryStore.h
+/// \brief Columnar storage of servo telemetry, for long logging runs on a Linux host.
+///
+/// \details A store is a directory of fixed-width column files, one per field, where row i of every
+///          column holds sample i:
+///            - timestamp.u64   timestamp (uint64, e.g. ns)
+///            - id.u8           servo ID
+///            - position.i16    CURRENT_POSITION
+///            - speed.i16       CURRENT_SPEED
+///            - current.i16     CURRENT_CURRENT
+///            - temperature.u8  CURRENT_TEMPERATURE
+///            - status.u8       STATUS
+///          and an index (index.bin): a IndexHeader followed by one ChunkEntry per chunk of
+///          IndexHeader::chunkRows consecutive rows, giving the time range and servos of the chunk.
+///          All values are little-endian. The columns can be mapped directly by analysis tools
+///          (e.g. numpy.memmap), the index being used to only touch the chunks of a time range or servo.
+#ifndef STSTELEMETRYSTORE_H
+#define STSTELEMETRYSTORE_H
+
+#include <STSServoDriver.h>
+
+#include <mutex>
+
+namespace STSTelemetryFormat
+{
+    char const MAGIC[8] = {'S', 'T', 'S', 'T', 'E', 'L', 'E', 'M'};
+    uint32_t const VERSION = 1;
+
+    struct IndexHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t chunkRows;   ///< Number of rows per chunk, the last chunk may be shorter.
+        uint64_t rowCount;    ///< Number of valid rows in the columns.
+        uint64_t chunkCount;  ///< Number of entries following the header.
+        uint8_t reserved[32];
+    };
+
+    struct ChunkEntry
+    {
+        uint64_t firstRow;
+        uint32_t rowCount;
+        uint32_t reserved;
+        uint64_t minTimestamp;
+        uint64_t maxTimestamp;
+        uint8_t servos[32];   ///< Bitmap of the servo IDs present in the chunk.
+
+        bool hasServo(byte const &id) const { return servos[id / 8] & (1 << (id % 8)); }
+    };
+
+    static_assert(sizeof(IndexHeader) == 64, "Unexpected index header layout");
+    static_assert(sizeof(ChunkEntry) == 64, "Unexpected chunk entry layout");
+
+    /// \brief Columns of a store.
+    enum Column
+    {
+        TIMESTAMP,
+        ID,
+        POSITION,
+        SPEED,
+        CURRENT,
+        TEMPERATURE,
+        STATUS,
+        N_COLUMNS
+    };
+
+    /// \brief File name of a column in the store directory.
+    char const *columnFile(Column const &column);
+
+    /// \brief Width of a column, in bytes.
+    size_t columnWidth(Column const &column);
+}
+
+/// \brief Appends samples to a telemetry store.
+/// \details The column files are memory-mapped and grown in large steps, so that appending a sample is
+///          a few stores to memory. Appends are thread-safe: a single writer can be shared by the threads
+///          of several buses, each appending its batches of samples.
+class STSTelemetryWriter
+{
+public:
+    /// \brief Create a store, replacing any previous store in this directory.
+    /// \param[in] directory Store directory, created if needed.
+    /// \param[in] chunkRows Number of rows per index chunk.
+    STSTelemetryWriter(char const *directory, uint32_t const &chunkRows = 65536);
+
+    /// \brief Flush and close the store, trimming the columns to their final size.
+    ~STSTelemetryWriter();
+
+    /// \brief Whether the store could be created.
+    bool isOpen() const { return open_; }
+
+    /// \brief Append one sample.
+    void append(uint64_t const &timestamp, byte const &id, STSTelemetry const &telemetry);
+
+    /// \brief Append the result of STSServoDriver::readTelemetry, the servos that did not reply being skipped.
+    void append(uint64_t const &timestamp,
+                byte const &numberOfServos,
+                const byte servoIds[],
+                STSTelemetry const telemetry[],
+                byte const *responded);
+
+    /// \brief Write the index, making all the samples appended so far visible to readers.
+    void flush();
+
+    /// \brief Number of samples in the store.
+    uint64_t size() const { return rowCount_; }
+
+private:
+    void appendRow(uint64_t const &timestamp, byte const &id, STSTelemetry const &telemetry);
+    bool grow();
+    void writeChunk();
+    void writeHeader();
+
+    bool open_;
+    int columnFd_[STSTelemetryFormat::N_COLUMNS];
+    uint8_t *column_[STSTelemetryFormat::N_COLUMNS];
+    int indexFd_;
+    uint32_t chunkRows_;
+    uint64_t capacity_;  ///< Number of rows the columns are sized for.
+    uint64_t rowCount_;
+    uint64_t chunkCount_; ///< Number of complete chunks.
+    STSTelemetryFormat::ChunkEntry chunk_; ///< Chunk being filled.
+    std::mutex mutex_;
+};
+
+/// \brief Read-only access to a telemetry store, for analysis.
+class STSTelemetryReader
+{
+public:
+    explicit STSTelemetryReader(char const *directory);
+    ~STSTelemetryReader();
+
+    /// \brief Whether the store could be opened.
+    bool isOpen() const { return open_; }
+
+    /// \brief Number of samples.
+    uint64_t size() const { return rowCount_; }
+
+    uint64_t const *timestamps() const { return reinterpret_cast<uint64_t const *>(column_[STSTelemetryFormat::TIMESTAMP]); }
+    byte const *ids() const { return column_[STSTelemetryFormat::ID]; }
+    int16_t const *positions() const { return reinterpret_cast<int16_t const *>(column_[STSTelemetryFormat::POSITION]); }
+    int16_t const *speeds() const { return reinterpret_cast<int16_t const *>(column_[STSTelemetryFormat::SPEED]); }
+    int16_t const *currents() const { return reinterpret_cast<int16_t const *>(column_[STSTelemetryFormat::CURRENT]); }
+    byte const *temperatures() const { return column_[STSTelemetryFormat::TEMPERATURE]; }
+    byte const *statuses() const { return column_[STSTelemetryFormat::STATUS]; }
+
+    /// \brief Number of chunks in the index.
+    uint64_t chunkCount() const { return chunkCount_; }
+    STSTelemetryFormat::ChunkEntry const &chunk(uint64_t const &index) const { return chunks_[index]; }
+
+    /// \brief Call f(row) for each sample with from <= timestamp < to, of servo id (or of all servos if id is negative).
+    /// \details Only the chunks whose index entry matches are scanned.
+    /// \return Number of chunks scanned.
+    template <typename F>
+    uint64_t forEach(uint64_t const &from, uint64_t const &to, int const &id, F f) const
+    {
+        uint64_t scanned = 0;
+        uint64_t const *t = timestamps();
+        byte const *servo = ids();
+        for (uint64_t c = 0; c < chunkCount_; c++)
+        {
+            STSTelemetryFormat::ChunkEntry const &entry = chunks_[c];
+            if (entry.maxTimestamp < from || entry.minTimestamp >= to || (id >= 0 && !entry.hasServo(id)))
+                continue;
+            scanned++;
+            uint64_t const end = entry.firstRow + entry.rowCount < rowCount_ ? entry.firstRow + entry.rowCount : rowCount_;
+            for (uint64_t row = entry.firstRow; row < end; row++)
+                if (t[row] >= from && t[row] < to && (id < 0 || servo[row] == id))
+                    f(row);
+        }
+        return scanned;
+    }
+
+private:
+    bool open_;
+    uint8_t const *column_[STSTelemetryFormat::N_COLUMNS];
+    size_t mappedSize_[STSTelemetryFormat::N_COLUMNS];
+    void *index_;
+    size_t indexSize_;
+    STSTelemetryFormat::ChunkEntry const *chunks_;
+    uint64_t rowCount_;
+    uint64_t chunkCount_;
+};
+
+#endif
@@ -0,0 +1,513 @@
+// Probe a servo bus from a Linux host: a real one through a serial adapter, or the simulated one.
+//
+//   scan                     list the servos answering ping: type, model, firmware, baud rate, response delay
+//   latency [count]          ping and read round-trip time of each servo: min, percentiles, max, failures
+//   syncwrite [n] [seconds]  SYNC WRITE throughput addressing n servos (the servos found, repeated up to n)
+//   sweep [count]            read round-trip time against RESPONSE_DELAY, then against the baud rate
+//
+// Every command prints a table, or JSON with --json. The servos only receive their current position as
+// target, and the settings changed by sweep are restored at the end; they are never saved in EEPROM, so a
+// power cycle also restores them. The target is a tty (e.g. /dev/ttyUSB0) or sim[:n], a simulated bus of n
+// servos with IDs 1 to n (6 by default).
+//
+// Usage: BusProbe <tty|sim[:n]> <command> [arguments] [--json] [--baud rate]
+
+#include "STSServoDriver.h"
+#include "STSSimulator.h"
+#include "TtySerial.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace
+{
+    // Baud rates of the BAUDRATE register values.
+    long const BAUD_RATES[] = {1000000, 500000, 250000, 128000, 115200, 76800, 57600, 38400};
+    int const N_BAUD_RATES = sizeof(BAUD_RATES) / sizeof(BAUD_RATES[0]);
+    // RESPONSE_DELAY values of the sweep, in units of 2us.
+    byte const RESPONSE_DELAYS[] = {0, 25, 50, 125, 250};
+
+    struct Bus
+    {
+        std::unique_ptr<STSSimulatedBus> simulator;
+        std::unique_ptr<TtySerial> tty;
+        HardwareSerial port;
+        STSServoDriver servos;
+        long baudRate = 1000000;
+    };
+
+    /// \brief Round-trip times of a kind of request, in us.
+    struct Distribution
+    {
+        std::vector<double> samples;
+        int failures = 0;
+
+        void sort() { std::sort(samples.begin(), samples.end()); }
+
+        /// \brief Percentile of the sorted samples, 0 if there are none.
+        double percentile(double const &p) const
+        {
+            if (samples.empty())
+                return 0;
+            size_t const rank = static_cast<size_t>(p / 100 * (samples.size() - 1) + 0.5);
+            return samples[std::min(rank, samples.size() - 1)];
+        }
+    };
+
+    /// \brief Minimal JSON writer: objects and arrays, keys and separators placed automatically.
+    class Json
+    {
+    public:
+        void open(char const *key, char const bracket) { this->key(key); printf("%c", bracket); first_ = true; }
+        void close(char const bracket) { printf("%c", bracket); first_ = false; }
+        void number(char const *key, double const &value) { this->key(key); printf("%.6g", value); }
+        void string(char const *key, char const *value) { this->key(key); printf("\"%s\"", value); }
+        void boolean(char const *key, bool const &value) { this->key(key); printf(value ? "true" : "false"); }
+
+    private:
+        void key(char const *key)
+        {
+            if (!first_)
+                printf(",");
+            first_ = false;
+            if (key != nullptr)
+                printf("\"%s\":", key);
+        }
+
+        bool first_ = true;
+    };
+
+    uint32_t failureCount(STSServoDriver &servos)
+    {
+        STSStatistics const &statistics = servos.getStatistics();
+        return statistics.timeouts + statistics.errors;
+    }
+
+    char const *typeName(byte const &servoMajor)
+    {
+        switch (servoMajor)
+        {
+            case 9: return "STS";
+            case 5: return "SCS";
+            default: return "unknown";
+        }
+    }
+
+    int baudCode(long const &baudRate)
+    {
+        for (int i = 0; i < N_BAUD_RATES; i++)
+            if (BAUD_RATES[i] == baudRate)
+                return i;
+        return -1;
+    }
+
+    std::vector<byte> findServos(STSServoDriver &servos)
+    {
+        std::vector<byte> ids;
+        for (int id = 0; id < STS_BROADCAST_ID; id++)
+            if (servos.ping(id))
+                ids.push_back(id);
+        return ids;
+    }
+
+    /// \brief Time ping or reads of CURRENT_POSITION, count times per servo, cycling through the servos.
+    /// \param[out] perServo If not null, one distribution per servo, else all samples go to total.
+    void measure(STSServoDriver &servos, std::vector<byte> const &ids, int const &count, bool const &ping,
+                 std::vector<Distribution> *perServo, Distribution &total)
+    {
+        // Untimed first contact: the driver probes the type of a servo on its first read, and waits for
+        // the bus to be idle after a failed reply.
+        for (byte const id : ids)
+            servos.readTwoBytesRegister(id, STSRegisters::CURRENT_POSITION);
+        for (int k = 0; k < count; k++)
+        {
+            for (size_t i = 0; i < ids.size(); i++)
+            {
+                Distribution &d = perServo != nullptr ? (*perServo)[i] : total;
+                uint32_t const failures = failureCount(servos);
+                unsigned long const start = micros();
+                bool ok;
+                if (ping)
+                    ok = servos.ping(ids[i]);
+                else
+                {
+                    servos.readTwoBytesRegister(ids[i], STSRegisters::CURRENT_POSITION);
+                    ok = failureCount(servos) == failures;
+                }
+                unsigned long const end = micros();
+                if (ok)
+                    d.samples.push_back(end - start);
+                else
+                    d.failures++;
+            }
+        }
+        if (perServo != nullptr)
+            for (Distribution &d : *perServo)
+                d.sort();
+        total.sort();
+    }
+
+    void printDistributionHeader(char const *name)
+    {
+        printf(" | %-5s %7s %7s %7s %7s %7s %5s", name, "min", "p50", "p90", "p99", "max", "fail");
+    }
+
+    void printDistribution(Distribution const &d)
+    {
+        printf(" | %5s %7.0f %7.0f %7.0f %7.0f %7.0f %5d", "", d.percentile(0), d.percentile(50), d.percentile(90),
+               d.percentile(99), d.percentile(100), d.failures);
+    }
+
+    void writeDistribution(Json &json, char const *key, Distribution const &d)
+    {
+        json.open(key, '{');
+        json.number("samples", d.samples.size());
+        json.number("failures", d.failures);
+        json.number("min_us", d.percentile(0));
+        json.number("p50_us", d.percentile(50));
+        json.number("p90_us", d.percentile(90));
+        json.number("p99_us", d.percentile(99));
+        json.number("max_us", d.percentile(100));
+        json.close('}');
+    }
+
+    int scan(Bus &bus, bool const &asJson)
+    {
+        STSServoDriver &servos = bus.servos;
+        std::vector<byte> const ids = findServos(servos);
+        Json json;
+        if (asJson)
+            json.open(nullptr, '[');
+        else
+            printf("%3s %-7s %6s %8s %8s %14s\n", "id", "type", "model", "firmware", "baud", "response (us)");
+        bool ok = true;
+        for (byte const id : ids)
+        {
+            uint32_t const failures = failureCount(servos);
+            byte const firmwareMajor = servos.readRegister(id, STSRegisters::FIRMWARE_MAJOR);
+            byte const firmwareMinor = servos.readRegister(id, STSRegisters::FIRMWARE_MINOR);
+            byte const servoMajor = servos.readRegister(id, STSRegisters::SERVO_MAJOR);
+            byte const servoMinor = servos.readRegister(id, STSRegisters::SERVO_MINOR);
+            byte const baud = servos.readRegister(id, STSRegisters::BAUDRATE);
+            byte const responseDelay = servos.readRegister(id, STSRegisters::RESPONSE_DELAY);
+            bool const complete = failureCount(servos) == failures;
+            ok = ok && complete;
+            long const baudRate = baud < N_BAUD_RATES ? BAUD_RATES[baud] : 0;
+            if (asJson)
+            {
+                json.open(nullptr, '{');
+                json.number("id", id);
+                json.string("type", typeName(servoMajor));
+                json.string("model", (std::to_string(servoMajor) + "." + std::to_string(servoMinor)).c_str());
+                json.string("firmware", (std::to_string(firmwareMajor) + "." + std::to_string(firmwareMinor)).c_str());
+                json.number("baud", baudRate);
+                json.number("response_delay_us", 2 * responseDelay);
+                json.boolean("complete", complete);
+                json.close('}');
+            }
+            else
+                printf("%3d %-7s %3d.%-2d %5d.%-2d %8ld %14d%s\n", id, typeName(servoMajor), servoMajor, servoMinor,
+                       firmwareMajor, firmwareMinor, baudRate, 2 * responseDelay, complete ? "" : "  (read failed)");
+        }
+        if (asJson)
+        {
+            json.close(']');
+            printf("\n");
+        }
+        else
+            printf("%zu servos at %ld baud\n", ids.size(), bus.baudRate);
+        return ok ? 0 : 1;
+    }
+
+    int latency(Bus &bus, int const &count, bool const &asJson)
+    {
+        std::vector<byte> const ids = findServos(bus.servos);
+        std::vector<Distribution> pings(ids.size()), reads(ids.size());
+        Distribution allPings, allReads;
+        measure(bus.servos, ids, count, true, &pings, allPings);
+        measure(bus.servos, ids, count, false, &reads, allReads);
+
+        int failures = 0;
+        Json json;
+        if (asJson)
+            json.open(nullptr, '[');
+        else
+        {
+            printf("Round-trip times in us, %d requests per servo at %ld baud\n%3s", count, bus.baudRate, "id");
+            printDistributionHeader("ping");
+            printDistributionHeader("read");
+            printf("\n");
+        }
+        for (size_t i = 0; i < ids.size(); i++)
+        {
+            failures += pings[i].failures + reads[i].failures;
+            if (asJson)
+            {
+                json.open(nullptr, '{');
+                json.number("id", ids[i]);
+                writeDistribution(json, "ping", pings[i]);
+                writeDistribution(json, "read", reads[i]);
+                json.close('}');
+            }
+            else
+            {
+                printf("%3d", ids[i]);
+                printDistribution(pings[i]);
+                printDistribution(reads[i]);
+                printf("\n");
+            }
+        }
+        if (asJson)
+        {
+            json.close(']');
+            printf("\n");
+        }
+        return failures == 0 ? 0 : 1;
+    }
+
+    int syncWrite(Bus &bus, int numberOfServos, double const &seconds, bool const &asJson)
+    {
+        STSServoDriver &servos = bus.servos;
+        std::vector<byte> ids = findServos(servos);
+        if (numberOfServos <= 0)
+            numberOfServos = ids.size();
+        numberOfServos = std::min(numberOfServos, static_cast<int>(STS_BROADCAST_ID));
+        if (ids.empty() || numberOfServos <= 0)
+        {
+            fprintf(stderr, "No servo found\n");
+            return 1;
+        }
+        ids.resize(std::min(static_cast<int>(ids.size()), numberOfServos));
+        size_t const nFound = ids.size();
+        // The servos found hold their position. Beyond them, they are repeated to pad the frame up to the
+        // requested size: unused IDs would be probed by the driver on every call.
+        std::vector<int> positions, speeds(numberOfServos, 0);
+        for (size_t i = 0; i < nFound; i++)
+            positions.push_back(servos.readTwoBytesRegister(ids[i], STSRegisters::CURRENT_POSITION));
+        for (int i = nFound; i < numberOfServos; i++)
+        {
+            ids.push_back(ids[i % nFound]);
+            positions.push_back(positions[i % nFound]);
+        }
+
+        STSStatistics const start = servos.getStatistics();
+        unsigned long const startTime = micros();
+        unsigned long elapsed = 0;
+        long calls = 0;
+        while (elapsed < seconds * 1e6)
+        {
+            servos.setTargetPositions(numberOfServos, ids.data(), positions.data(), speeds.data());
+            calls++;
+            elapsed = micros() - startTime;
+        }
+        STSStatistics const &end = servos.getStatistics();
+        double const duration = elapsed * 1e-6;
+        double const frames = end.transactions - start.transactions;
+        double const bytes = end.bytesSent - start.bytesSent;
+        // 10 bits per byte on the wire: start, 8 data bits, stop.
+        double const utilization = 10 * bytes / bus.baudRate / duration;
+
+        if (asJson)
+        {
+            Json json;
+            json.open(nullptr, '{');
+            json.number("servos", numberOfServos);
+            json.number("servos_found", nFound);
+            json.number("baud", bus.baudRate);
+            json.number("seconds", duration);
+            json.number("calls_per_s", calls / duration);
+            json.number("frames_per_s", frames / duration);
+            json.number("updates_per_s", calls * numberOfServos / duration);
+            json.number("bytes_per_s", bytes / duration);
+            json.number("bus_utilization", utilization);
+            json.close('}');
+            printf("\n");
+        }
+        else
+        {
+            printf("SYNC WRITE of %d servos (%zu found) at %ld baud, %.1f s\n", numberOfServos, nFound, bus.baudRate,
+                   duration);
+            printf("%10s %10s %12s %10s %8s\n", "calls/s", "frames/s", "updates/s", "bytes/s", "bus");
+            printf("%10.1f %10.1f %12.0f %10.0f %7.1f%%\n", calls / duration, frames / duration,
+                   calls * numberOfServos / duration, bytes / duration, 100 * utilization);
+        }
+        return calls > 0 ? 0 : 1;
+    }
+
+    int sweep(Bus &bus, int const &count, bool const &asJson)
+    {
+        STSServoDriver &servos = bus.servos;
+        std::vector<byte> const ids = findServos(servos);
+        if (ids.empty())
+        {
+            fprintf(stderr, "No servo found\n");
+            return 1;
+        }
+        std::vector<byte> responseDelays;
+        for (byte const id : ids)
+            responseDelays.push_back(servos.readRegister(id, STSRegisters::RESPONSE_DELAY));
+
+        Json json;
+        if (asJson)
+        {
+            json.open(nullptr, '{');
+            json.open("response_delay", '[');
+        }
+        else
+        {
+            printf("Read round-trip times in us, %d reads per servo, %zu servos\n%14s", count, ids.size(), "");
+            printDistributionHeader("");
+            printf("\n");
+        }
+        // RAM copies of EEPROM settings, with the EEPROM locked: nothing is saved.
+        for (byte const value : RESPONSE_DELAYS)
+        {
+            servos.writeRegister(STS_BROADCAST_ID, STSRegisters::RESPONSE_DELAY, value);
+            Distribution reads;
+            measure(servos, ids, count, false, nullptr, reads);
+            if (asJson)
+            {
+                json.open(nullptr, '{');
+                json.number("response_delay_us", 2 * value);
+                writeDistribution(json, "read", reads);
+                json.close('}');
+            }
+            else
+            {
+                printf("delay %5dus ", 2 * value);
+                printDistribution(reads);
+                printf("\n");
+            }
+        }
+        for (size_t i = 0; i < ids.size(); i++)
+            servos.writeRegister(ids[i], STSRegisters::RESPONSE_DELAY, responseDelays[i]);
+        if (asJson)
+        {
+            json.close(']');
+            json.open("baud", '[');
+        }
+
+        // All the servos found answer at the rate of the port.
+        int const originalCode = baudCode(bus.baudRate);
+        int stranded = 0;
+        if (originalCode >= 0)
+        {
+            for (int code = 0; code < N_BAUD_RATES; code++)
+            {
+                servos.writeRegister(STS_BROADCAST_ID, STSRegisters::BAUDRATE, code);
+                servos.init(&bus.port, BAUD_RATES[code]);
+                Distribution reads;
+                measure(servos, ids, count, false, nullptr, reads);
+                if (asJson)
+                {
+                    json.open(nullptr, '{');
+                    json.number("baud", BAUD_RATES[code]);
+                    writeDistribution(json, "read", reads);
+                    json.close('}');
+                }
+                else
+                {
+                    printf("baud %8ld ", BAUD_RATES[code]);
+                    printDistribution(reads);
+                    printf("\n");
+                }
+                servos.writeRegister(STS_BROADCAST_ID, STSRegisters::BAUDRATE, originalCode);
+                servos.init(&bus.port, bus.baudRate);
+            }
+            for (byte const id : ids)
+                if (!servos.ping(id))
+                    stranded++;
+        }
+        else if (!asJson)
+            printf("%ld baud is not a BAUDRATE register value: no baud rate sweep\n", bus.baudRate);
+
+        if (asJson)
+        {
+            json.close(']');
+            json.number("stranded", stranded);
+            json.close('}');
+            printf("\n");
+        }
+        if (stranded > 0)
+            fprintf(stderr, "%d servos no longer answer at %ld baud: power cycle them to restore their settings\n",
+                    stranded, bus.baudRate);
+        return stranded == 0 ? 0 : 1;
+    }
+
+    void usage()
+    {
+        fprintf(stderr, "Usage: BusProbe <tty|sim[:n]> <command> [arguments] [--json] [--baud rate]\n"
+                        "  scan\n  latency [count]\n  syncwrite [servos] [seconds]\n  sweep [count]\n");
+    }
+};
+
+int main(int argc, char **argv)
+{
+    bool asJson = false;
+    long baudRate = 1000000;
+    std::vector<char const *> arguments;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--json") == 0)
+            asJson = true;
+        else if (strcmp(argv[i], "--baud") == 0 && i + 1 < argc)
+            baudRate = atol(argv[++i]);
+        else
+            arguments.push_back(argv[i]);
+    }
+    if (arguments.size() < 2)
+    {
+        usage();
+        return 2;
+    }
+    char const *target = arguments[0];
+    std::string const command = arguments[1];
+    auto argument = [&](size_t const index, double const fallback)
+    {
+        return arguments.size() > index + 2 ? atof(arguments[index + 2]) : fallback;
+    };
+
+    Bus bus;
+    bus.baudRate = baudRate;
+    if (strncmp(target, "sim", 3) == 0 && (target[3] == '\0' || target[3] == ':'))
+    {
+        int const nServos = target[3] == ':' ? atoi(target + 4) : 6;
+        bus.simulator.reset(new STSSimulatedBus);
+        for (int i = 0; i < nServos; i++)
+            bus.simulator->addServo(i + 1);
+        // The simulated servos answer at the rate of the port.
+        int const code = baudCode(baudRate);
+        for (int i = 0; i < nServos && code >= 0; i++)
+            bus.simulator->memory(i)[STSRegisters::BAUDRATE] = code;
+        bus.port.attach(bus.simulator.get());
+    }
+    else
+    {
+        bus.tty.reset(new TtySerial(target));
+        if (!bus.tty->isOpen())
+        {
+            fprintf(stderr, "Cannot open %s: %s\n", target, strerror(errno));
+            return 2;
+        }
+        bus.port.attach(bus.tty.get());
+    }
+    bus.servos.init(&bus.port, baudRate);
+
+    if (command == "scan")
+        return scan(bus, asJson);
+    if (command == "latency")
+        return latency(bus, static_cast<int>(argument(0, 100)), asJson);
+    if (command == "syncwrite")
+        return syncWrite(bus, static_cast<int>(argument(0, 0)), argument(1, 2), asJson);
+    if (command == "sweep")
+        return sweep(bus, static_cast<int>(argument(0, 50)), asJson);
+    usage();
+    return 2;
+}
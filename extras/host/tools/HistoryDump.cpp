@@ -0,0 +1,116 @@
+// Decode a telemetry history exported by STSTelemetryHistory::exportTo, e.g. captured from a serial port.
+//
+// Prints one CSV line per raw sample and per bucket: id, field, level (raw for raw samples), time (ms),
+// minimum, maximum, mean (the three being the sample value for raw samples). Frames with a bad checksum
+// are skipped, and bytes are discarded until the next frame header.
+//
+// Usage: HistoryDump [export file], reading from the standard input by default.
+
+#include "STSTelemetryHistory.h"
+
+#include <stdio.h>
+#include <vector>
+
+namespace
+{
+    char const *const FIELD_NAMES[STSHistoryField::COUNT] = {"current", "temperature"};
+
+    uint16_t word(uint8_t const *p)
+    {
+        return p[0] | (p[1] << 8);
+    }
+
+    uint32_t longWord(uint8_t const *p)
+    {
+        return word(p) | (static_cast<uint32_t>(word(p + 2)) << 16);
+    }
+
+    char const *fieldName(uint8_t const field)
+    {
+        return field < STSHistoryField::COUNT ? FIELD_NAMES[field] : "unknown";
+    }
+
+    void decodeRaw(std::vector<uint8_t> const &payload)
+    {
+        uint8_t const count = payload[2];
+        if (payload.size() < 7u + 4 * count)
+            return;
+        // Times are stored as deltas: walk back from the newest sample.
+        std::vector<uint32_t> times(count);
+        uint32_t t = longWord(&payload[3]);
+        for (int i = count - 1; i >= 0; i--)
+        {
+            times[i] = t;
+            t -= word(&payload[7 + 4 * i + 2]);
+        }
+        for (int i = 0; i < count; i++)
+        {
+            int16_t const value = word(&payload[7 + 4 * i]);
+            printf("%d,%s,raw,%u,%d,%d,%d\n", payload[0], fieldName(payload[1]), times[i], value, value, value);
+        }
+    }
+
+    void decodeBuckets(std::vector<uint8_t> const &payload)
+    {
+        uint8_t const count = payload[3];
+        if (payload.size() < 4u + 10 * count)
+            return;
+        for (int i = 0; i < count; i++)
+        {
+            uint8_t const *b = &payload[4 + 10 * i];
+            printf("%d,%s,%d,%u,%d,%d,%d\n", payload[0], fieldName(payload[1]), payload[2], longWord(b),
+                   static_cast<int16_t>(word(b + 4)), static_cast<int16_t>(word(b + 6)), static_cast<int16_t>(word(b + 8)));
+        }
+    }
+};
+
+int main(int argc, char **argv)
+{
+    FILE *file = argc > 1 ? fopen(argv[1], "rb") : stdin;
+    if (file == nullptr)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    printf("id,field,level,time_ms,minimum,maximum,mean\n");
+    int badFrames = 0;
+    int previous = -1;
+    int c;
+    while ((c = fgetc(file)) != EOF)
+    {
+        if (previous != STSHistoryExport::MAGIC0 || c != STSHistoryExport::MAGIC1)
+        {
+            previous = c;
+            continue;
+        }
+        previous = -1;
+        uint8_t header[3];
+        if (fread(header, 1, 3, file) != 3)
+            break;
+        std::vector<uint8_t> payload(word(header + 1));
+        int const checksumByte = payload.size() == fread(payload.data(), 1, payload.size(), file) ? fgetc(file) : EOF;
+        if (checksumByte == EOF)
+            break;
+        uint8_t checksum = header[0] + header[1] + header[2];
+        for (uint8_t const &b : payload)
+            checksum += b;
+        if (static_cast<uint8_t>(~checksum) != checksumByte)
+        {
+            badFrames++;
+            continue;
+        }
+        if (header[0] == STSHistoryExport::INFO && payload.size() >= 6)
+            fprintf(stderr, "History v%d: %d raw samples, %d levels of %d buckets, factor %d, %d servos\n",
+                    payload[0], payload[1], payload[3], payload[2], payload[4], payload[5]);
+        else if (header[0] == STSHistoryExport::RAW && payload.size() >= 7)
+            decodeRaw(payload);
+        else if (header[0] == STSHistoryExport::BUCKETS && payload.size() >= 4)
+            decodeBuckets(payload);
+    }
+    if (badFrames > 0)
+        fprintf(stderr, "%d frames with a bad checksum skipped\n", badFrames);
+    if (file != stdin)
+        fclose(file);
+    return badFrames > 0 ? 1 : 0;
+}
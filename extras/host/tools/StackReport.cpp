@@ -0,0 +1,255 @@
+// Report the peak stack depth of each driver API (see STSServoDriver::getStackUsage) on a simulated bus of 253
+// servos: each API is called with its smallest payload, then with its largest one (a single servo against all of
+// them, one register against the largest blocks), which sizes the variable-length arrays of the driver.
+// With --check, the largest depth of each API is asserted against the bounds of a file, made of lines
+// "<API> <bytes>" ('#' starts a comment): the exit code is 1 if an API exceeds its bound or has none.
+//
+// The depths are those of the host build (compiler, flags, 64-bit frames); run the same calls on the target, or
+// read getStackUsage there, to size its stacks.
+//
+// Usage: StackReport [--check bounds-file]
+
+#include "STSServoDriver.h"
+#include "STSSimulator.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace
+{
+    int const N_SERVOS = 253;
+
+    char const *const API_NAMES[STSStackApi::COUNT] = {
+        "PING", "READ_REGISTER", "WRITE_REGISTER", "EEPROM_WRITE", "SET_TARGET_POSITIONS", "SET_TARGET_VELOCITIES",
+        "SYNC_WRITE_REGISTERS", "SYNC_READ_REGISTERS", "PING_SERVOS", "READ_TELEMETRY", "UPDATE_SUBSCRIPTIONS",
+        "CONFIGURATION"};
+
+    struct Bus
+    {
+        STSSimulatedBus simulator;
+        HardwareSerial port;
+        STSServoDriver servos;
+        std::vector<byte> ids;
+
+        Bus() : ids(N_SERVOS)
+        {
+            for (int i = 0; i < N_SERVOS; i++)
+            {
+                ids[i] = i + 1;
+                simulator.addServo(ids[i]);
+            }
+            port.attach(&simulator);
+            servos.init(&port);
+        }
+    };
+
+    void notify(byte, byte, int16_t, bool, void *) {}
+    void onTelemetry(void *, byte const &, STSTelemetry const &) {}
+
+    /// \brief Call an API with its smallest payload (large false) or its largest one.
+    void exercise(Bus &bus, byte const &api, bool const &large)
+    {
+        STSServoDriver &servos = bus.servos;
+        byte const *ids = bus.ids.data();
+        int const n = large ? N_SERVOS : 1;
+        std::vector<int> values(n, 2048), speeds(n, 1000);
+        std::vector<byte> accelerations(n, 50), responded((n + 7) / 8);
+        std::vector<STSTelemetry> telemetry(n);
+        std::vector<int16_t> values16(n);
+        switch (api)
+        {
+            case STSStackApi::PING:
+                servos.ping(ids[0]);
+                servos.getCapabilities(ids[large ? N_SERVOS - 1 : 0]);
+                break;
+            case STSStackApi::READ_REGISTER:
+                servos.readRegister(ids[0], STSRegisters::CURRENT_TEMPERATURE);
+                if (large)
+                {
+                    servos.getCurrentPosition(ids[0]);
+                    servos.getCurrentCurrent(ids[0]);
+                    servos.isMoving(ids[0]);
+                }
+                break;
+            case STSStackApi::WRITE_REGISTER:
+                servos.writeRegister(ids[0], STSRegisters::TORQUE_SWITCH, 1);
+                if (large)
+                {
+                    servos.writeTwoBytesRegister(ids[0], STSRegisters::TARGET_POSITION, 2048);
+                    servos.setTargetPosition(ids[0], 2048, 1000);
+                    servos.setMode(ids[0], STSMode::POSITION);
+                    servos.trigerAction();
+                }
+                break;
+            case STSStackApi::EEPROM_WRITE:
+                servos.setPositionOffset(ids[0], large ? 100 : 0);
+                if (large)
+                {
+                    servos.setId(ids[1], 254 - 1);
+                    servos.setId(254 - 1, ids[1]);
+                }
+                break;
+            case STSStackApi::SET_TARGET_POSITIONS:
+                // Differing values: a SYNC WRITE, not a broadcast.
+                values[n - 1] = 1024;
+                servos.setTargetPositions(n, ids, values.data(), speeds.data());
+                servos.setTargetMotions(n, ids, values.data(), speeds.data(), accelerations.data());
+                break;
+            case STSStackApi::SET_TARGET_VELOCITIES:
+                speeds[n - 1] = 0;
+                servos.setTargetVelocities(n, ids, speeds.data());
+                break;
+            case STSStackApi::SYNC_WRITE_REGISTERS:
+            {
+                byte const length = large ? 250 / 2 : 1;
+                std::vector<byte> data(n * length, 1);
+                data[0] = 0;
+                servos.syncWriteRegisters(n, ids, STSRegisters::TARGET_ACCELERATION, length, data.data());
+                break;
+            }
+            case STSStackApi::SYNC_READ_REGISTERS:
+            {
+                byte const length = large ? 250 : 1;
+                std::vector<byte> data(n * length);
+                servos.syncReadRegisters(n, ids, 0, length, data.data(), responded.data());
+                break;
+            }
+            case STSStackApi::PING_SERVOS:
+                servos.pingServos(n, ids, responded.data());
+                break;
+            case STSStackApi::READ_TELEMETRY:
+                servos.readTelemetry(n, ids, telemetry.data(), responded.data());
+                servos.readTelemetry(n, ids, onTelemetry, nullptr, responded.data());
+                servos.readPositions(n, ids, values16.data(), responded.data());
+                break;
+            case STSStackApi::UPDATE_SUBSCRIPTIONS:
+            {
+                int handles[STS_MAX_SUBSCRIPTIONS];
+                int const nSubscriptions = large ? STS_MAX_SUBSCRIPTIONS : 1;
+                for (int i = 0; i < nSubscriptions; i++)
+                    handles[i] = servos.subscribe(ids[i], STSRegisters::CURRENT_TEMPERATURE, 1, STSCondition::ABOVE_THRESHOLD,
+                                                  60, 2, notify, nullptr);
+                servos.updateSubscriptions();
+                for (int i = 0; i < nSubscriptions; i++)
+                    servos.unsubscribe(handles[i]);
+                break;
+            }
+            case STSStackApi::CONFIGURATION:
+            {
+                STSConfigProfile profile;
+                servos.captureConfiguration(ids[0], profile);
+                std::vector<STSConfigDrift> drift(n);
+                servos.checkConfiguration(n, ids, profile, drift.data(), responded.data());
+                if (large)
+                {
+                    drift[0].mismatched[0] = 0xFF;
+                    servos.repairConfiguration(ids[0], profile, drift[0]);
+                }
+                break;
+            }
+        }
+    }
+
+    /// \brief Read a bounds file.
+    /// \return False if it cannot be read, or names an unknown API.
+    bool readBounds(char const *path, std::map<std::string, int> &bounds)
+    {
+        FILE *file = fopen(path, "r");
+        if (file == nullptr)
+        {
+            perror(path);
+            return false;
+        }
+        char line[256];
+        bool ok = true;
+        while (fgets(line, sizeof(line), file) != nullptr)
+        {
+            char *comment = strchr(line, '#');
+            if (comment != nullptr)
+                *comment = '\0';
+            char name[64];
+            int bytes;
+            int const fields = sscanf(line, "%63s %d", name, &bytes);
+            if (fields <= 0)
+                continue;
+            bool known = false;
+            for (char const *api : API_NAMES)
+                known |= strcmp(api, name) == 0;
+            if (fields != 2 || !known)
+            {
+                fprintf(stderr, "%s: bad line: %s", path, line);
+                ok = false;
+                continue;
+            }
+            bounds[name] = bytes;
+        }
+        fclose(file);
+        return ok;
+    }
+};
+
+int main(int argc, char **argv)
+{
+    char const *boundsPath = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--check") == 0 && i + 1 < argc)
+            boundsPath = argv[++i];
+        else
+        {
+            fprintf(stderr, "Usage: %s [--check bounds-file]\n", argv[0]);
+            return 2;
+        }
+    }
+    std::map<std::string, int> bounds;
+    if (boundsPath != nullptr && !readBounds(boundsPath, bounds))
+        return 2;
+
+    Bus bus;
+    printf("%d simulated servos; stack depth in bytes, payloads of the largest calls\n", N_SERVOS);
+    printf("%-22s %8s %8s %8s %8s %8s", "API", "smallest", "largest", "request", "reply", "servos");
+    if (boundsPath != nullptr)
+        printf(" %8s", "bound");
+    printf("\n");
+    bool ok = true;
+    for (byte api = 0; api < STSStackApi::COUNT; api++)
+    {
+        int depth[2];
+        for (int large = 0; large < 2; large++)
+        {
+            bus.servos.resetStackUsage();
+            exercise(bus, api, large);
+            depth[large] = bus.servos.getStackUsage(api).depth;
+        }
+        STSStackUsage const &usage = bus.servos.getStackUsage(api);
+        int const largest = std::max(depth[0], depth[1]);
+        printf("%-22s %8d %8d %8d %8d %8d", API_NAMES[api], depth[0], depth[1], usage.requestLength,
+               usage.replyLength, usage.batchServos);
+        if (boundsPath != nullptr)
+        {
+            auto const bound = bounds.find(API_NAMES[api]);
+            if (bound == bounds.end())
+            {
+                printf(" %8s  no bound", "-");
+                ok = false;
+            }
+            else
+            {
+                printf(" %8d", bound->second);
+                if (largest > bound->second)
+                {
+                    printf("  exceeded");
+                    ok = false;
+                }
+            }
+        }
+        printf("\n");
+    }
+    if (!ok)
+        printf("Some APIs exceed their stack bound, or have none\n");
+    return ok ? 0 : 1;
+}
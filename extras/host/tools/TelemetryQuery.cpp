@@ -0,0 +1,116 @@
+// Query a telemetry store written by STSTelemetryWriter.
+//
+// Without --csv, prints a summary per servo of the selected samples; with --csv, prints the samples.
+// Only the chunks of the store matching the time range and servo are read.
+//
+// Usage: TelemetryQuery [--from s] [--to s] [--id n] [--csv] store
+
+#include "STSTelemetryStore.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+namespace
+{
+    struct ServoSummary
+    {
+        uint64_t samples = 0;
+        uint64_t first = 0;
+        uint64_t last = 0;
+        int minPosition = 0;
+        int maxPosition = 0;
+        int maxSpeed = 0;
+        int maxCurrent = 0;
+        int maxTemperature = 0;
+        uint64_t errors = 0; ///< Samples with a non-zero STATUS.
+    };
+}
+
+int main(int argc, char **argv)
+{
+    double from = 0;
+    double to = 1e18;
+    int id = -1;
+    bool csv = false;
+    char const *path = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--from") == 0 && i + 1 < argc)
+            from = atof(argv[++i]);
+        else if (strcmp(argv[i], "--to") == 0 && i + 1 < argc)
+            to = atof(argv[++i]);
+        else if (strcmp(argv[i], "--id") == 0 && i + 1 < argc)
+            id = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--csv") == 0)
+            csv = true;
+        else
+            path = argv[i];
+    }
+    if (path == nullptr)
+    {
+        fprintf(stderr, "Usage: %s [--from s] [--to s] [--id n] [--csv] store\n", argv[0]);
+        return 2;
+    }
+
+    STSTelemetryReader reader(path);
+    if (!reader.isOpen())
+    {
+        fprintf(stderr, "%s: not a telemetry store\n", path);
+        return 1;
+    }
+
+    // Timestamps are in ns.
+    uint64_t const fromNs = static_cast<uint64_t>(from * 1e9);
+    uint64_t const toNs = to >= 1.8e10 ? UINT64_MAX : static_cast<uint64_t>(to * 1e9);
+    uint64_t const *timestamps = reader.timestamps();
+    byte const *ids = reader.ids();
+
+    if (csv)
+    {
+        printf("timestamp,id,position,speed,current,temperature,status\n");
+        reader.forEach(fromNs, toNs, id, [&](uint64_t row) {
+            printf("%lu,%d,%d,%d,%d,%d,%d\n", static_cast<unsigned long>(timestamps[row]), ids[row],
+                   reader.positions()[row], reader.speeds()[row], reader.currents()[row],
+                   reader.temperatures()[row], reader.statuses()[row]);
+        });
+        return 0;
+    }
+
+    static ServoSummary servos[256];
+    uint64_t const scanned = reader.forEach(fromNs, toNs, id, [&](uint64_t row) {
+        ServoSummary &s = servos[ids[row]];
+        int const position = reader.positions()[row];
+        if (s.samples == 0)
+        {
+            s.first = timestamps[row];
+            s.minPosition = position;
+            s.maxPosition = position;
+        }
+        s.samples++;
+        s.first = std::min(s.first, timestamps[row]);
+        s.last = std::max(s.last, timestamps[row]);
+        s.minPosition = std::min(s.minPosition, position);
+        s.maxPosition = std::max(s.maxPosition, position);
+        s.maxSpeed = std::max(s.maxSpeed, abs(reader.speeds()[row]));
+        s.maxCurrent = std::max(s.maxCurrent, abs(reader.currents()[row]));
+        s.maxTemperature = std::max(s.maxTemperature, static_cast<int>(reader.temperatures()[row]));
+        if (reader.statuses()[row] != 0)
+            s.errors++;
+    });
+
+    printf("%lu samples in %lu chunks, %lu chunks scanned\n", static_cast<unsigned long>(reader.size()),
+           static_cast<unsigned long>(reader.chunkCount()), static_cast<unsigned long>(scanned));
+    printf("%4s %10s %10s %10s %8s %8s %8s %8s %8s %8s\n", "id", "samples", "from (s)", "to (s)", "min pos",
+           "max pos", "max spd", "max cur", "max temp", "errors");
+    for (int i = 0; i < 256; i++)
+    {
+        ServoSummary const &s = servos[i];
+        if (s.samples == 0)
+            continue;
+        printf("%4d %10lu %10.3f %10.3f %8d %8d %8d %8d %8d %8lu\n", i, static_cast<unsigned long>(s.samples),
+               s.first * 1e-9, s.last * 1e-9, s.minPosition, s.maxPosition, s.maxSpeed, s.maxCurrent,
+               s.maxTemperature, static_cast<unsigned long>(s.errors));
+    }
+    return 0;
+}
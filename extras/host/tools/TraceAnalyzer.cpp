@@ -0,0 +1,674 @@
+// Offline analysis of a bus capture written by SerialTrace.
+//
+// Requests and replies are reconstructed from the byte streams, to give the latency distribution per
+// instruction and per servo, the bus utilization over time, the idle gaps and what they were spent on
+// (post-send delays, timeouts, delays of the application, waiting for replies, host processing), and the top sources of
+// wasted bus time.
+//
+// The capture is memory-mapped and processed in a single pass, with constant memory: multi-gigabyte
+// captures can be analyzed.
+//
+// Usage: TraceAnalyzer [--window ms] [--timeline] [--top n] capture
+
+#include "SerialTrace.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace
+{
+    int const N_INSTRUCTIONS = 9;
+    char const *const INSTRUCTION_NAMES[N_INSTRUCTIONS] = {
+        "PING", "READ", "WRITE", "REGWRITE", "ACTION", "RESET", "SYNCREAD", "SYNCWRITE", "other"};
+
+    int instructionIndex(uint8_t const instruction)
+    {
+        switch (instruction)
+        {
+            case 0x01: return 0;
+            case 0x02: return 1;
+            case 0x03: return 2;
+            case 0x04: return 3;
+            case 0x05: return 4;
+            case 0x06: return 5;
+            case 0x82: return 6;
+            case 0x83: return 7;
+            default: return 8;
+        }
+    }
+
+    /// Log-linear histogram of durations in ns: 16 buckets per power of two, so within 6% of the value.
+    class Histogram
+    {
+    public:
+        void add(uint64_t const value)
+        {
+            counts_[bucket(value)]++;
+            count_++;
+            sum_ += value;
+            max_ = std::max(max_, value);
+        }
+
+        uint64_t count() const { return count_; }
+        uint64_t sum() const { return sum_; }
+        uint64_t max() const { return max_; }
+
+        /// Value below which a fraction q of the samples fall.
+        uint64_t quantile(double const q) const
+        {
+            if (count_ == 0)
+                return 0;
+            uint64_t const rank = static_cast<uint64_t>(q * (count_ - 1));
+            uint64_t seen = 0;
+            for (int i = 0; i < N_BUCKETS; i++)
+            {
+                seen += counts_[i];
+                if (seen > rank)
+                    return std::min(midpoint(i), max_);
+            }
+            return max_;
+        }
+
+    private:
+        static int const SUB = 16;
+        static int const N_BUCKETS = 61 * SUB;
+
+        static int bucket(uint64_t const value)
+        {
+            if (value < SUB)
+                return value;
+            int const exponent = 63 - __builtin_clzll(value);
+            return (exponent - 3) * SUB + ((value >> (exponent - 4)) & (SUB - 1));
+        }
+
+        static uint64_t midpoint(int const index)
+        {
+            if (index < SUB)
+                return index;
+            int const shift = index / SUB - 1;
+            return (static_cast<uint64_t>(SUB + index % SUB) << shift) + ((1ULL << shift) >> 1);
+        }
+
+        uint32_t counts_[N_BUCKETS] = {0};
+        uint64_t count_ = 0;
+        uint64_t sum_ = 0;
+        uint64_t max_ = 0;
+    };
+
+    /// Incremental parser of FF FF ID LEN ... CHK frames, resynchronizing on garbage.
+    class FrameParser
+    {
+    public:
+        enum Result { PENDING, COMPLETE, DISCARDED };
+
+        Result feed(uint8_t const c)
+        {
+            if (length_ == 0 || length_ == 1)
+            {
+                if (c == 0xFF)
+                {
+                    frame_[length_++] = c;
+                    return PENDING;
+                }
+                return discard();
+            }
+            if (length_ == 2 && c == 0xFF)
+                return PENDING; // Extra header byte.
+            if (length_ == 3 && c < 2)
+                return discard();
+            frame_[length_++] = c;
+            if (length_ < 4 || length_ < frame_[3] + 4)
+                return PENDING;
+            uint8_t checksum = 0;
+            for (int i = 2; i < length_ - 1; i++)
+                checksum += frame_[i];
+            int const n = length_;
+            length_ = 0;
+            if (static_cast<uint8_t>(~checksum) != frame_[n - 1])
+            {
+                badChecksums_++;
+                return DISCARDED;
+            }
+            return COMPLETE;
+        }
+
+        uint8_t id() const { return frame_[2]; }
+        uint8_t paramLength() const { return frame_[3] - 2; }
+        uint8_t instruction() const { return frame_[4]; } ///< Instruction of a request, error byte of a reply.
+        uint8_t const *parameters() const { return frame_ + 5; }
+
+        uint64_t badChecksums() const { return badChecksums_; }
+        uint64_t discardedBytes() const { return discardedBytes_; }
+
+    private:
+        Result discard()
+        {
+            discardedBytes_ += length_ + 1;
+            length_ = 0;
+            return DISCARDED;
+        }
+
+        uint8_t frame_[260];
+        int length_ = 0;
+        uint64_t badChecksums_ = 0;
+        uint64_t discardedBytes_ = 0;
+    };
+
+    enum Cause
+    {
+        POST_SEND_DELAY,
+        TIMEOUT_WAIT,
+        APPLICATION_DELAY,
+        REPLY_WAIT,
+        HOST,
+        N_CAUSES
+    };
+    char const *const CAUSE_NAMES[N_CAUSES] = {"post-send delay", "timeout wait", "application delay", "reply wait", "host processing"};
+
+    struct ServoStats
+    {
+        Histogram latency;
+        uint64_t replies = 0;
+        uint64_t missing = 0;
+        uint64_t timeouts = 0;
+        uint64_t errors = 0;
+    };
+
+    struct InstructionStats
+    {
+        Histogram latency;
+        uint64_t requests = 0;
+        uint64_t replies = 0;
+        uint64_t missing = 0;
+        uint64_t timeouts = 0;
+        uint64_t flushed = 0;
+    };
+
+    struct Interval
+    {
+        uint64_t start;
+        uint64_t end;
+        Cause cause;
+    };
+
+    class Analyzer
+    {
+    public:
+        Analyzer(uint64_t const window, bool const timeline) :
+            window_(window), timeline_(timeline), windowUtilization_()
+        {
+            memset(wasted_, 0, sizeof(wasted_));
+        }
+
+        void process(STSTrace::RecordHeader const &header, uint8_t const *payload)
+        {
+            records_++;
+            if (first_)
+            {
+                traceStart_ = header.start;
+                lastActivity_ = header.start;
+                windowStart_ = header.start;
+                first_ = false;
+            }
+            traceEnd_ = std::max(traceEnd_, header.end);
+            switch (header.type)
+            {
+                case STSTrace::BEGIN:
+                    if (header.length >= 4)
+                    {
+                        uint32_t rate;
+                        memcpy(&rate, payload, sizeof(rate));
+                        byteTime_ = rate > 0 ? 10000000000ULL / rate : 0;
+                        baudRate_ = rate;
+                    }
+                    break;
+                case STSTrace::TX:
+                    processTx(header, payload);
+                    break;
+                case STSTrace::RX:
+                    processRx(header, payload);
+                    break;
+                case STSTrace::TIMEOUT:
+                    addWait(header.start, header.end, TIMEOUT_WAIT);
+                    timeoutTime_ += header.end - header.start;
+                    if (pending_)
+                    {
+                        instructions_[instructionIndex(pendingInstruction_)].timeouts++;
+                        servos_[waitedServo()].timeouts++;
+                    }
+                    break;
+                case STSTrace::DELAY:
+                    addWait(header.start, header.end, header.start == lastTxEnd_ ? POST_SEND_DELAY : APPLICATION_DELAY);
+                    break;
+                default:
+                    unknownRecords_++;
+                    break;
+            }
+        }
+
+        void report(int const nTop)
+        {
+            closeRequest();
+            closeUtilization(traceEnd_);
+            double const duration = (traceEnd_ - traceStart_) * 1e-9;
+
+            printf("Duration %.3f s, %lu records, %u bauds\n", duration, static_cast<unsigned long>(records_), baudRate_);
+            printf("Bytes sent %lu, received %lu (%lu flushed unread), discarded %lu, bad checksums %lu\n\n",
+                   static_cast<unsigned long>(bytesSent_), static_cast<unsigned long>(bytesReceived_),
+                   static_cast<unsigned long>(bytesFlushed_),
+                   static_cast<unsigned long>(tx_.discardedBytes() + rx_.discardedBytes()),
+                   static_cast<unsigned long>(tx_.badChecksums() + rx_.badChecksums()));
+
+            printf("Latency from end of request to reply read, per instruction (us)\n");
+            printf("%-10s %10s %10s %8s %8s %8s | %8s %8s %8s %8s\n", "", "requests", "replies", "missing",
+                   "timeouts", "flushed", "p50", "p90", "p99", "max");
+            for (int i = 0; i < N_INSTRUCTIONS; i++)
+            {
+                InstructionStats const &s = instructions_[i];
+                if (s.requests == 0)
+                    continue;
+                printf("%-10s %10lu %10lu %8lu %8lu %8lu | ", INSTRUCTION_NAMES[i], static_cast<unsigned long>(s.requests),
+                       static_cast<unsigned long>(s.replies), static_cast<unsigned long>(s.missing),
+                       static_cast<unsigned long>(s.timeouts), static_cast<unsigned long>(s.flushed));
+                printLatency(s.latency);
+            }
+
+            printf("\nPer servo (us)\n");
+            printf("%-10s %10s %8s %8s %8s | %8s %8s %8s %8s\n", "id", "replies", "missing", "timeouts", "errors",
+                   "p50", "p90", "p99", "max");
+            for (int id = 0; id < 256; id++)
+            {
+                ServoStats const &s = servos_[id];
+                if (s.replies == 0 && s.missing == 0 && s.timeouts == 0)
+                    continue;
+                printf("%-10d %10lu %8lu %8lu %8lu | ", id, static_cast<unsigned long>(s.replies),
+                       static_cast<unsigned long>(s.missing), static_cast<unsigned long>(s.timeouts),
+                       static_cast<unsigned long>(s.errors));
+                printLatency(s.latency);
+            }
+
+            printf("\nBus utilization per %.1f ms window: mean %.1f%%, min %.1f%%, max %.1f%%, "
+                   "windows above 90%%: %lu / %lu\n", window_ * 1e-6,
+                   nWindows_ > 0 ? 100.0 * windowUtilizationSum_ / nWindows_ : 0.0,
+                   100.0 * minUtilization_, 100.0 * maxUtilization_, static_cast<unsigned long>(busyWindows_),
+                   static_cast<unsigned long>(nWindows_));
+            printf("Utilization histogram (%% of windows):");
+            for (int i = 0; i < 10; i++)
+                printf(" %d-%d%%: %.1f", 10 * i, 10 * (i + 1), nWindows_ > 0 ? 100.0 * windowUtilization_[i] / nWindows_ : 0.0);
+            printf("\n");
+
+            printf("\nIdle gaps: %lu, p50 %.1f us, p99 %.1f us, max %.1f us\n", static_cast<unsigned long>(gaps_.count()),
+                   gaps_.quantile(0.5) * 1e-3, gaps_.quantile(0.99) * 1e-3, gaps_.max() * 1e-3);
+            double const total = traceEnd_ - traceStart_;
+            printf("Time on the bus %8.1f ms (%5.1f%%)\n", busy_ * 1e-6, total > 0 ? 100.0 * busy_ / total : 0.0);
+            for (int c = 0; c < N_CAUSES; c++)
+            {
+                uint64_t const t = causeTotal(static_cast<Cause>(c));
+                printf("%-15s %8.1f ms (%5.1f%%)\n", CAUSE_NAMES[c], t * 1e-6, total > 0 ? 100.0 * t / total : 0.0);
+            }
+            printf("(time spent waiting in reads that timed out: %.1f ms)\n", timeoutTime_ * 1e-6);
+
+            printf("\nTop sources of idle bus time\n");
+            printf("%-4s %-18s %-10s %5s %10s %7s\n", "", "cause", "request", "servo", "ms", "%");
+            struct Source
+            {
+                uint64_t time;
+                int cause;
+                int instruction;
+                int servo;
+            };
+            std::vector<Source> sources;
+            for (int c = 0; c < N_CAUSES; c++)
+                for (int i = 0; i < N_INSTRUCTIONS + 1; i++)
+                    for (int id = 0; id < 256; id++)
+                        if (wasted_[c][i][id] > 0)
+                            sources.push_back({wasted_[c][i][id], c, i, id});
+            std::sort(sources.begin(), sources.end(), [](Source const &a, Source const &b) { return a.time > b.time; });
+            for (int k = 0; k < nTop && k < static_cast<int>(sources.size()); k++)
+            {
+                Source const &s = sources[k];
+                char servo[8] = "-";
+                if (s.instruction < N_INSTRUCTIONS && s.servo != 0xFE)
+                    snprintf(servo, sizeof(servo), "%d", s.servo);
+                printf("%-4d %-18s %-10s %5s %10.2f %6.1f%%\n", k + 1, CAUSE_NAMES[s.cause],
+                       s.instruction < N_INSTRUCTIONS ? INSTRUCTION_NAMES[s.instruction] : "none", servo,
+                       s.time * 1e-6, total > 0 ? 100.0 * s.time / total : 0.0);
+            }
+            if (bytesFlushed_ > 0)
+                printf("\n%.1f ms of the bus were used by replies flushed unread: late replies, or status replies to "
+                       "writes (consider lowering the response level of the servos).\n", bytesFlushed_ * byteTime_ * 1e-6);
+            if (unknownRecords_ > 0)
+                printf("\n%lu records of unknown type were skipped.\n", static_cast<unsigned long>(unknownRecords_));
+        }
+
+    private:
+        void processTx(STSTrace::RecordHeader const &header, uint8_t const *payload)
+        {
+            bytesSent_ += header.length;
+            addActivity(header.start, header.end, header.length, HOST);
+            lastTxEnd_ = header.end;
+            for (int i = 0; i < header.length; i++)
+            {
+                if (tx_.feed(payload[i]) != FrameParser::COMPLETE)
+                    continue;
+                closeRequest();
+                openRequest(header.end);
+            }
+        }
+
+        void processRx(STSTrace::RecordHeader const &header, uint8_t const *payload)
+        {
+            bool const polled = header.flags & STSTrace::flags::POLLED;
+            bytesReceived_ += header.length;
+            if (polled)
+                bytesFlushed_ += header.length;
+            if (header.end > header.start)
+                addActivity(header.start, header.end, header.length, REPLY_WAIT);
+            else
+            {
+                // The bytes were already there: they arrived at the earliest right after the last activity.
+                uint64_t const start = std::max(lastActivity_, traceStart_);
+                addActivity(start, std::min(header.end, start + header.length * byteTime_), header.length, HOST);
+            }
+            for (int i = 0; i < header.length; i++)
+            {
+                if (rx_.feed(payload[i]) != FrameParser::COMPLETE)
+                    continue;
+                ServoStats &servo = servos_[rx_.id()];
+                if (rx_.instruction() != 0)
+                    servo.errors++;
+                if (!pending_)
+                    continue;
+                InstructionStats &instruction = instructions_[instructionIndex(pendingInstruction_)];
+                markReplied(rx_.id());
+                if (polled)
+                {
+                    instruction.flushed++;
+                    continue;
+                }
+                // Byte i was read at most (length - 1 - i) byte times before the end of the record.
+                uint64_t const t = std::max(header.start, header.end - std::min(header.end, (header.length - 1 - i) * byteTime_));
+                uint64_t const latency = t > pendingEnd_ ? t - pendingEnd_ : 0;
+                instruction.replies++;
+                instruction.latency.add(latency);
+                servo.replies++;
+                servo.latency.add(latency);
+            }
+        }
+
+        void openRequest(uint64_t const end)
+        {
+            pending_ = true;
+            pendingEnd_ = end;
+            pendingInstruction_ = tx_.instruction();
+            pendingId_ = tx_.id();
+            memset(expected_, 0, sizeof(expected_));
+            instructions_[instructionIndex(pendingInstruction_)].requests++;
+            // Only reads are expected to be answered: status replies to writes depend on the servo configuration.
+            if (pendingInstruction_ == 0x82)
+            {
+                for (int i = 2; i < tx_.paramLength(); i++)
+                    expected_[tx_.parameters()[i]] = true;
+            }
+            else if ((pendingInstruction_ == 0x01 || pendingInstruction_ == 0x02) && pendingId_ != 0xFE)
+                expected_[pendingId_] = true;
+        }
+
+        void markReplied(uint8_t const id)
+        {
+            expected_[id] = false;
+        }
+
+        void closeRequest()
+        {
+            if (!pending_)
+                return;
+            InstructionStats &instruction = instructions_[instructionIndex(pendingInstruction_)];
+            for (int id = 0; id < 256; id++)
+            {
+                if (!expected_[id])
+                    continue;
+                instruction.missing++;
+                servos_[id].missing++;
+            }
+            pending_ = false;
+        }
+
+        /// Servo being waited for: the first one that did not answer yet.
+        int waitedServo() const
+        {
+            for (int id = 0; id < 256; id++)
+                if (expected_[id])
+                    return id;
+            return pendingId_;
+        }
+
+        void addWait(uint64_t const start, uint64_t const end, Cause const cause)
+        {
+            // Waits can only overlap gaps after the last activity: older ones are dropped.
+            waits_.erase(std::remove_if(waits_.begin(), waits_.end(),
+                                        [this](Interval const &w) { return w.end <= lastActivity_; }),
+                         waits_.end());
+            if (waits_.size() >= 64)
+                waits_.erase(waits_.begin());
+            waits_.push_back({start, end, cause});
+        }
+
+        /// Bus busy with nBytes, ending at end and not before start. The idle time before it that no wait
+        /// explains is attributed to idleCause.
+        void addActivity(uint64_t const start, uint64_t const end, int const nBytes, Cause const idleCause)
+        {
+            uint64_t const wire = byteTime_ > 0 ? nBytes * byteTime_ : end - start;
+            uint64_t busyStart = std::max(start, end > wire ? end - wire : 0);
+            busyStart = std::max(busyStart, lastActivity_);
+            if (busyStart > lastActivity_)
+                addGap(lastActivity_, busyStart, idleCause);
+            if (end > busyStart)
+            {
+                addBusy(busyStart, end);
+                lastActivity_ = end;
+            }
+        }
+
+        void addGap(uint64_t const start, uint64_t const end, Cause const idleCause)
+        {
+            gaps_.add(end - start);
+            int const instruction = pending_ ? instructionIndex(pendingInstruction_) : N_INSTRUCTIONS;
+            int const servo = pending_ ? waitedServo() : 0;
+            uint64_t attributed = 0;
+            for (Interval const &w : waits_)
+            {
+                uint64_t const s = std::max(start, w.start);
+                uint64_t const e = std::min(end, w.end);
+                if (e <= s)
+                    continue;
+                // Nested waits (e.g. a delay during a timeout) are not counted twice.
+                uint64_t const overlap = std::min(e - s, end - start - attributed);
+                wasted_[w.cause][instruction][servo] += overlap;
+                attributed += overlap;
+            }
+            wasted_[idleCause][instruction][servo] += end - start - attributed;
+        }
+
+        void addBusy(uint64_t start, uint64_t const end)
+        {
+            busy_ += end - start;
+            while (start < end)
+            {
+                closeUtilization(start);
+                uint64_t const e = std::min(end, windowStart_ + window_);
+                windowBusy_ += e - start;
+                start = e;
+            }
+        }
+
+        /// Emit all the windows that end before t.
+        void closeUtilization(uint64_t const t)
+        {
+            while (windowStart_ + window_ <= t)
+            {
+                double const u = static_cast<double>(windowBusy_) / window_;
+                if (timeline_)
+                    printf("window %.3f ms utilization %.1f%%\n", (windowStart_ - traceStart_) * 1e-6, 100.0 * u);
+                windowUtilizationSum_ += u;
+                windowUtilization_[std::min(9, static_cast<int>(u * 10))]++;
+                minUtilization_ = nWindows_ == 0 ? u : std::min(minUtilization_, u);
+                maxUtilization_ = std::max(maxUtilization_, u);
+                if (u > 0.9)
+                    busyWindows_++;
+                nWindows_++;
+                windowStart_ += window_;
+                windowBusy_ = 0;
+            }
+        }
+
+        uint64_t causeTotal(Cause const cause) const
+        {
+            uint64_t t = 0;
+            for (int i = 0; i < N_INSTRUCTIONS + 1; i++)
+                for (int id = 0; id < 256; id++)
+                    t += wasted_[cause][i][id];
+            return t;
+        }
+
+        static void printLatency(Histogram const &h)
+        {
+            printf("%8.1f %8.1f %8.1f %8.1f\n", h.quantile(0.5) * 1e-3, h.quantile(0.9) * 1e-3,
+                   h.quantile(0.99) * 1e-3, h.max() * 1e-3);
+        }
+
+        uint64_t const window_;
+        bool const timeline_;
+
+        bool first_ = true;
+        uint64_t records_ = 0;
+        uint64_t unknownRecords_ = 0;
+        uint64_t traceStart_ = 0;
+        uint64_t traceEnd_ = 0;
+        uint32_t baudRate_ = 0;
+        uint64_t byteTime_ = 0; ///< Wire time of a byte, in ns.
+
+        FrameParser tx_;
+        FrameParser rx_;
+        uint64_t bytesSent_ = 0;
+        uint64_t bytesReceived_ = 0;
+        uint64_t bytesFlushed_ = 0;
+
+        bool pending_ = false; ///< Whether a request was sent, its replies being attributed to it.
+        uint64_t pendingEnd_ = 0;
+        uint8_t pendingInstruction_ = 0;
+        uint8_t pendingId_ = 0;
+        bool expected_[256] = {false}; ///< Servos expected to answer the pending request.
+
+        InstructionStats instructions_[N_INSTRUCTIONS];
+        ServoStats servos_[256];
+
+        uint64_t lastActivity_ = 0; ///< End of the last byte on the bus.
+        uint64_t lastTxEnd_ = 0;
+        std::vector<Interval> waits_;
+        Histogram gaps_;
+        uint64_t wasted_[N_CAUSES][N_INSTRUCTIONS + 1][256]; ///< Idle time per cause, pending request and servo.
+        uint64_t timeoutTime_ = 0;
+        uint64_t busy_ = 0;
+
+        uint64_t windowStart_ = 0;
+        uint64_t windowBusy_ = 0;
+        uint64_t nWindows_ = 0;
+        uint64_t busyWindows_ = 0;
+        uint64_t windowUtilization_[10];
+        double windowUtilizationSum_ = 0;
+        double minUtilization_ = 0;
+        double maxUtilization_ = 0;
+    };
+}
+
+int main(int argc, char **argv)
+{
+    double windowMs = 100;
+    bool timeline = false;
+    int nTop = 10;
+    char const *path = nullptr;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--window") == 0 && i + 1 < argc)
+            windowMs = atof(argv[++i]);
+        else if (strcmp(argv[i], "--timeline") == 0)
+            timeline = true;
+        else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc)
+            nTop = atoi(argv[++i]);
+        else
+            path = argv[i];
+    }
+    if (path == nullptr || windowMs <= 0)
+    {
+        fprintf(stderr, "Usage: %s [--window ms] [--timeline] [--top n] capture\n", argv[0]);
+        return 2;
+    }
+
+    int const fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        perror(path);
+        return 1;
+    }
+    size_t const size = st.st_size;
+    if (size < sizeof(STSTrace::FileHeader))
+    {
+        fprintf(stderr, "%s: not a capture\n", path);
+        return 1;
+    }
+    uint8_t const *data = static_cast<uint8_t const *>(mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0));
+    if (data == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+    madvise(const_cast<uint8_t *>(data), size, MADV_SEQUENTIAL);
+
+    STSTrace::FileHeader fileHeader;
+    memcpy(&fileHeader, data, sizeof(fileHeader));
+    if (memcmp(fileHeader.magic, STSTrace::MAGIC, sizeof(fileHeader.magic)) != 0 || fileHeader.version != STSTrace::VERSION)
+    {
+        fprintf(stderr, "%s: not a capture, or unsupported version\n", path);
+        return 1;
+    }
+
+    // The analyzer is heap-allocated: its per-servo histograms are too large for the stack.
+    std::unique_ptr<Analyzer> analyzer(new Analyzer(static_cast<uint64_t>(windowMs * 1e6), timeline));
+
+    // Pages already processed are released as we go, so that memory use does not grow with the capture.
+    size_t const RELEASE_CHUNK = 16 << 20;
+    size_t released = 0;
+    size_t offset = sizeof(STSTrace::FileHeader);
+    while (offset + sizeof(STSTrace::RecordHeader) <= size)
+    {
+        STSTrace::RecordHeader header;
+        memcpy(&header, data + offset, sizeof(header));
+        if (offset + sizeof(header) + header.length > size)
+            break;
+        analyzer->process(header, data + offset + sizeof(header));
+        offset += sizeof(header) + header.length;
+        if (offset - released >= 2 * RELEASE_CHUNK)
+        {
+            madvise(const_cast<uint8_t *>(data) + released, RELEASE_CHUNK, MADV_DONTNEED);
+            released += RELEASE_CHUNK;
+        }
+    }
+    if (offset != size)
+        fprintf(stderr, "%s: capture truncated after %lu bytes\n", path, static_cast<unsigned long>(offset));
+
+    analyzer->report(nTop);
+    munmap(const_cast<uint8_t *>(data), size);
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include "STSBusPlanner.h"
+
+namespace
+{
+    // 8N1: one start bit and one stop bit per byte.
+    float const BITS_PER_BYTE = 10.0;
+
+    // Group index of a servo: ungrouped servos form their own group.
+    int groupIndex(const STSServoTraffic traffic[], int const& servo)
+    {
+        if (traffic[servo].group == 0xFF)
+            return 256 + servo;
+        return traffic[servo].group;
+    }
+};
+
+float STSBusPlanner::plan(byte const &numberOfServos,
+                          const STSServoTraffic traffic[],
+                          byte const &numberOfBuses,
+                          const long baudRates[],
+                          byte busAssignment[],
+                          float utilization[])
+{
+    if (numberOfBuses == 0)
+        return 0;
+
+    // Load of each group, in bits/s, with one representative servo per group.
+    float groupLoad[numberOfServos];
+    byte groupLeader[numberOfServos];
+    int nGroups = 0;
+    for (int i = 0; i < numberOfServos; i++)
+    {
+        int g = 0;
+        while (g < nGroups && groupIndex(traffic, groupLeader[g]) != groupIndex(traffic, i))
+            g++;
+        if (g == nGroups)
+        {
+            groupLeader[g] = i;
+            groupLoad[g] = 0;
+            nGroups++;
+        }
+        groupLoad[g] += traffic[i].bytesPerCycle * traffic[i].rate * BITS_PER_BYTE;
+    }
+
+    // Sort groups by decreasing load (insertion sort, small sizes).
+    for (int i = 1; i < nGroups; i++)
+        for (int j = i; j > 0 && groupLoad[j] > groupLoad[j - 1]; j--)
+        {
+            float load = groupLoad[j];
+            groupLoad[j] = groupLoad[j - 1];
+            groupLoad[j - 1] = load;
+            byte leader = groupLeader[j];
+            groupLeader[j] = groupLeader[j - 1];
+            groupLeader[j - 1] = leader;
+        }
+
+    // Place each group where the resulting utilization is the lowest.
+    float busUtilization[numberOfBuses];
+    byte groupBus[numberOfServos];
+    for (int b = 0; b < numberOfBuses; b++)
+        busUtilization[b] = 0;
+    for (int g = 0; g < nGroups; g++)
+    {
+        int best = 0;
+        for (int b = 1; b < numberOfBuses; b++)
+            if (busUtilization[b] + groupLoad[g] / baudRates[b] < busUtilization[best] + groupLoad[g] / baudRates[best])
+                best = b;
+        groupBus[g] = best;
+        busUtilization[best] += groupLoad[g] / baudRates[best];
+    }
+
+    // Refine: move a group off the most loaded bus while this lowers the maximum.
+    for (int iteration = 0; iteration < nGroups; iteration++)
+    {
+        int worst = 0;
+        for (int b = 1; b < numberOfBuses; b++)
+            if (busUtilization[b] > busUtilization[worst])
+                worst = b;
+        int bestGroup = -1;
+        int bestBus = 0;
+        float bestMax = busUtilization[worst];
+        for (int g = 0; g < nGroups; g++)
+        {
+            if (groupBus[g] != worst)
+                continue;
+            for (int b = 0; b < numberOfBuses; b++)
+            {
+                if (b == worst)
+                    continue;
+                float newWorst = busUtilization[worst] - groupLoad[g] / baudRates[worst];
+                float newOther = busUtilization[b] + groupLoad[g] / baudRates[b];
+                float newMax = newWorst > newOther ? newWorst : newOther;
+                if (newMax < bestMax)
+                {
+                    bestMax = newMax;
+                    bestGroup = g;
+                    bestBus = b;
+                }
+            }
+        }
+        if (bestGroup < 0)
+            break;
+        busUtilization[worst] -= groupLoad[bestGroup] / baudRates[worst];
+        busUtilization[bestBus] += groupLoad[bestGroup] / baudRates[bestBus];
+        groupBus[bestGroup] = bestBus;
+    }
+
+    for (int i = 0; i < numberOfServos; i++)
+        for (int g = 0; g < nGroups; g++)
+            if (groupIndex(traffic, groupLeader[g]) == groupIndex(traffic, i))
+                busAssignment[i] = groupBus[g];
+
+    float maxUtilization = 0;
+    for (int b = 0; b < numberOfBuses; b++)
+    {
+        if (utilization != nullptr)
+            utilization[b] = busUtilization[b];
+        if (busUtilization[b] > maxUtilization)
+            maxUtilization = busUtilization[b];
+    }
+    return maxUtilization;
+}
+
+byte STSBusPlanner::servoIdsOnBus(byte const &numberOfServos,
+                                  const STSServoTraffic traffic[],
+                                  const byte busAssignment[],
+                                  byte const &bus,
+                                  byte servoIds[])
+{
+    byte n = 0;
+    for (int i = 0; i < numberOfServos; i++)
+        if (busAssignment[i] == bus)
+            servoIds[n++] = traffic[i].servoId;
+    return n;
+}
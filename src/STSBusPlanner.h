@@ -0,0 +1,57 @@
+/// \file STSBusPlanner.h
+/// \brief Assignment of servos to serial buses from their measured traffic.
+///
+/// \details When servos are spread over several serial ports (one STSServoDriver per port),
+///          the slowest bus limits the loop rate. This planner computes which servo should go
+///          on which bus so that the most loaded bus is as lightly loaded as possible, while
+///          keeping servos that must move together (e.g. one leg) on the same bus, so that
+///          they can still be addressed in a single SYNC WRITE / SYNC READ.
+#ifndef STSBUS_PLANNER_H
+#define STSBUS_PLANNER_H
+
+#include <Arduino.h>
+
+/// \brief Measured traffic of a servo.
+struct STSServoTraffic
+{
+    byte servoId;               ///< Servo ID.
+    byte group;                 ///< Synchronization group: servos of the same group stay on the same bus. 0xFF for none.
+    unsigned int bytesPerCycle; ///< Bytes exchanged with this servo per cycle (requests and replies).
+    float rate;                 ///< Cycle rate for this servo, in Hz.
+};
+
+/// \brief Planner assigning servos to buses.
+class STSBusPlanner
+{
+public:
+    /// \brief Compute an assignment of servos to buses minimizing the maximum bus utilization.
+    /// \details Groups are placed largest first on the bus where they raise the utilization the least,
+    ///          then moved between buses while this lowers the maximum utilization.
+    /// \param[in] numberOfServos Number of servos.
+    /// \param[in] traffic Measured traffic of each servo.
+    /// \param[in] numberOfBuses Number of buses.
+    /// \param[in] baudRates Baud rate of each bus.
+    /// \param[out] busAssignment Bus index of each servo (corresponds to traffic).
+    /// \param[out] utilization Optional, predicted utilization of each bus, in [0, 1] if feasible.
+    /// \return Predicted utilization of the most loaded bus: above 1, the requested rates cannot be sustained.
+    static float plan(byte const &numberOfServos,
+                      const STSServoTraffic traffic[],
+                      byte const &numberOfBuses,
+                      const long baudRates[],
+                      byte busAssignment[],
+                      float utilization[] = nullptr);
+
+    /// \brief Extract the list of servos assigned to a bus, to be used with the driver of that bus.
+    /// \param[in] numberOfServos Number of servos.
+    /// \param[in] traffic Traffic array given to plan.
+    /// \param[in] busAssignment Assignment computed by plan.
+    /// \param[in] bus Bus index.
+    /// \param[out] servoIds IDs of the servos on this bus (must hold numberOfServos elements).
+    /// \return Number of servos on this bus.
+    static byte servoIdsOnBus(byte const &numberOfServos,
+                              const STSServoTraffic traffic[],
+                              const byte busAssignment[],
+                              byte const &bus,
+                              byte servoIds[]);
+};
+#endif
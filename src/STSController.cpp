@@ -0,0 +1,245 @@
+#include "STSController.h"
+
+#if STS_ENABLE_CONTROLLER
+
+namespace
+{
+    namespace jointFlag
+    {
+        byte const HAS_FEEDBACK = 0x01;
+        byte const HAS_TARGET   = 0x02;
+    };
+
+    // Cycles a joint keeps its command without feedback, before being stopped.
+    byte const HOLD_CYCLES = 1;
+    // Largest RUNNING_SPEED command, in steps/s: well above the top speed of the servos (about 3400 steps/s),
+    // and small enough for the terms of the PID law to fit in 32 bits.
+    int32_t const MAX_COMMAND = 4095;
+    // Longest time integrated at once, in us: after a long gap, the integral does not jump.
+    uint32_t const MAX_INTEGRATION_US = 100000;
+    // Longest single wait: delayMicroseconds is only accurate up to 16383us on AVR.
+    uint32_t const MAX_DELAY_US = 10000;
+
+    int32_t clamp(int32_t const &value, int32_t const &limit)
+    {
+        return value > limit ? limit : (value < -limit ? -limit : value);
+    }
+};
+
+STSController::STSController(STSServoDriver &driver) :
+    driver_(driver),
+    nJoints_(0),
+    law_(pid),
+    lawContext_(nullptr),
+    periodUs_(0),
+    nextCycle_(0),
+    lastStart_(0)
+{
+    start(0);
+}
+
+void STSController::clear()
+{
+    nJoints_ = 0;
+}
+
+int STSController::findJoint(byte const &servoId) const
+{
+    for (int i = 0; i < nJoints_; i++)
+        if (servoIds_[i] == servoId)
+            return i;
+    return -1;
+}
+
+bool STSController::addJoint(byte const &servoId, STSPidGains const &gains)
+{
+    int i = findJoint(servoId);
+    if (i < 0)
+    {
+        if (nJoints_ == STS_CONTROLLER_JOINTS || servoId >= STS_BROADCAST_ID)
+            return false;
+        i = nJoints_++;
+        STSJoint &joint = joints_[i];
+        joint.servoId = servoId;
+        joint.target = 0;
+        joint.targetSpeed = 0;
+        joint.position = 0;
+        joint.speed = 0;
+        joint.command = 0;
+        joint.integral = 0;
+        joint.missed = 0;
+        servoIds_[i] = servoId;
+        commands_[i] = 0;
+        feedbackTimes_[i] = 0;
+        flags_[i] = 0;
+    }
+    joints_[i].gains = gains;
+    return true;
+}
+
+bool STSController::setTarget(byte const &servoId, int16_t const &position, int16_t const &speed)
+{
+    int const i = findJoint(servoId);
+    if (i < 0)
+        return false;
+    joints_[i].target = position;
+    joints_[i].targetSpeed = speed;
+    flags_[i] |= jointFlag::HAS_TARGET;
+    return true;
+}
+
+STSJoint *STSController::getJoint(byte const &servoId)
+{
+    int const i = findJoint(servoId);
+    return i < 0 ? nullptr : &joints_[i];
+}
+
+void STSController::setLaw(STSControlLaw law, void *context)
+{
+    law_ = law != nullptr ? law : pid;
+    lawContext_ = context;
+}
+
+void STSController::start(uint32_t const &periodUs)
+{
+    periodUs_ = periodUs;
+    for (int i = 0; i < nJoints_; i++)
+    {
+        // Probe the servos now, rather than in the first cycle.
+        driver_.getCapabilities(servoIds_[i]);
+        joints_[i].integral = 0;
+        joints_[i].missed = 0;
+        flags_[i] &= ~jointFlag::HAS_FEEDBACK;
+    }
+    statistics_.cycles = 0;
+    statistics_.overruns = 0;
+    statistics_.missed = 0;
+    statistics_.minPeriod = 0xFFFFFFFF;
+    statistics_.maxPeriod = 0;
+    statistics_.maxJitter = 0;
+    statistics_.maxCycleTime = 0;
+    statistics_.totalJitter = 0;
+    statistics_.totalCycleTime = 0;
+    nextCycle_ = micros();
+}
+
+int STSController::runCycle()
+{
+    uint32_t now = micros();
+    if (periodUs_ > 0)
+    {
+        int32_t wait = static_cast<int32_t>(nextCycle_ - now);
+        while (wait > 0)
+        {
+            delayMicroseconds(wait > static_cast<int32_t>(MAX_DELAY_US) ? MAX_DELAY_US : wait);
+            now = micros();
+            wait = static_cast<int32_t>(nextCycle_ - now);
+        }
+        uint32_t const jitter = now - nextCycle_;
+        statistics_.totalJitter += jitter;
+        if (jitter > statistics_.maxJitter)
+            statistics_.maxJitter = jitter;
+        // A whole period late: the missed cycles are dropped rather than run back to back.
+        if (jitter >= periodUs_)
+        {
+            statistics_.overruns++;
+            nextCycle_ = now + periodUs_;
+        }
+        else
+            nextCycle_ += periodUs_;
+    }
+    if (statistics_.cycles > 0)
+    {
+        uint32_t const period = now - lastStart_;
+        if (period < statistics_.minPeriod)
+            statistics_.minPeriod = period;
+        if (period > statistics_.maxPeriod)
+            statistics_.maxPeriod = period;
+    }
+    lastStart_ = now;
+
+    byte responded[(STS_CONTROLLER_JOINTS + 7) / 8];
+    int const nResponded = driver_.readTelemetry(nJoints_, servoIds_, onFeedback, this, responded);
+    for (int i = 0; i < nJoints_; i++)
+    {
+        if (responded[i / 8] & (1 << (i % 8)))
+            continue;
+        statistics_.missed++;
+        STSJoint &joint = joints_[i];
+        if (joint.missed < 0xFF)
+            joint.missed++;
+        if (joint.missed > HOLD_CYCLES)
+        {
+            joint.command = 0;
+            commands_[i] = 0;
+        }
+    }
+    driver_.setTargetVelocities(nJoints_, servoIds_, commands_);
+
+    uint32_t const cycleTime = micros() - now;
+    statistics_.totalCycleTime += cycleTime;
+    if (cycleTime > statistics_.maxCycleTime)
+        statistics_.maxCycleTime = cycleTime;
+    statistics_.cycles++;
+    return nResponded;
+}
+
+void STSController::stop()
+{
+    for (int i = 0; i < nJoints_; i++)
+    {
+        joints_[i].command = 0;
+        commands_[i] = 0;
+    }
+    driver_.setTargetVelocities(nJoints_, servoIds_, commands_);
+}
+
+void STSController::onFeedback(void *context, byte const &index, STSTelemetry const &telemetry)
+{
+    STSController &controller = *static_cast<STSController *>(context);
+    STSJoint &joint = controller.joints_[index];
+    uint32_t const now = micros();
+    joint.position = telemetry.position;
+    joint.speed = telemetry.speed;
+    joint.missed = 0;
+    uint32_t periodUs = 0;
+    if (controller.flags_[index] & jointFlag::HAS_FEEDBACK)
+        periodUs = now - controller.feedbackTimes_[index];
+    if (!(controller.flags_[index] & jointFlag::HAS_TARGET))
+    {
+        joint.target = joint.position;
+        joint.targetSpeed = 0;
+        controller.flags_[index] |= jointFlag::HAS_TARGET;
+    }
+    controller.flags_[index] |= jointFlag::HAS_FEEDBACK;
+    controller.feedbackTimes_[index] = now;
+    joint.command = controller.law_(controller.lawContext_, joint, periodUs);
+    controller.commands_[index] = joint.command;
+}
+
+int16_t STSController::pid(void *, STSJoint &joint, uint32_t const &periodUs)
+{
+    STSPidGains const &gains = joint.gains;
+    int32_t const limit = gains.maxSpeed < MAX_COMMAND ? gains.maxSpeed : MAX_COMMAND;
+    // Short way around the turn: in velocity mode, the position wraps around.
+    int32_t error = static_cast<int32_t>(joint.target) - joint.position;
+    error -= 4096 * ((error >= 2048) - (error < -2048));
+    int32_t const speedError = clamp(static_cast<int32_t>(joint.targetSpeed) - joint.speed, 2 * MAX_COMMAND);
+
+    int32_t integral = 0;
+    if (gains.ki != 0)
+    {
+        uint32_t const dt = periodUs < MAX_INTEGRATION_US ? periodUs : MAX_INTEGRATION_US;
+        // Bound: the integral term alone reaches the limit, and ki * integral fits in 32 bits.
+        int32_t const bound = limit * 256 * 1000 / abs(gains.ki);
+        integral = clamp(joint.integral + error * static_cast<int32_t>(dt) / 1000, bound);
+    }
+    int32_t const feedback = (gains.kp * error + gains.ki * integral / 1000 + gains.kd * speedError) / 256;
+    int32_t const command = joint.targetSpeed + feedback;
+    // Anti-windup: while the command is limited, the integral may only move back.
+    if ((command <= limit || integral < joint.integral) && (command >= -limit || integral > joint.integral))
+        joint.integral = integral;
+    return clamp(command, limit);
+}
+
+#endif
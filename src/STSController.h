@@ -0,0 +1,146 @@
+/// \file STSController.h
+/// \brief Host-side position loop around servos in velocity mode.
+///
+/// \details Each cycle reads the feedback of all the joints in one SYNC READ, runs the control law of each
+///          joint as soon as its reply is complete, while the next replies are still arriving, then sends all
+///          the RUNNING_SPEED commands in one SYNC WRITE. With a STSTxPipeline set on the driver, this write
+///          goes out in the background while the application runs. Cycles are started on a fixed schedule,
+///          or back to back for the highest rate the bus allows.
+#ifndef STSCONTROLLER_H
+#define STSCONTROLLER_H
+
+#include <Arduino.h>
+#include "STSServoConfig.h"
+#include "STSServoDriver.h"
+
+#if STS_ENABLE_CONTROLLER
+
+/// \brief Gains of the fixed-point PID law, see STSController::pid.
+/// \details Gains are Q8 fixed point: 256 stands for 1.
+struct STSPidGains
+{
+    int16_t kp;         ///< Gain on the position error, in (steps/s)/step.
+    int16_t ki;         ///< Gain on the integral of the position error, in (steps/s)/(step.s).
+    int16_t kd;         ///< Gain on the speed error, in (steps/s)/(steps/s).
+    uint16_t maxSpeed;  ///< Limit of the command, in steps/s.
+};
+
+/// \brief State of a joint, given to the control law.
+struct STSJoint
+{
+    byte servoId;
+    int16_t target;       ///< Position setpoint, in steps.
+    int16_t targetSpeed;  ///< Speed setpoint, in steps/s: feedforward of the command.
+    int16_t position;     ///< Last CURRENT_POSITION, in steps.
+    int16_t speed;        ///< Last CURRENT_SPEED, in steps/s.
+    int16_t command;      ///< Last RUNNING_SPEED command, in steps/s.
+    STSPidGains gains;    ///< Gains of the PID law.
+    int32_t integral;     ///< Integral of the position error of the PID law, in steps.ms.
+    byte missed;          ///< Consecutive cycles without feedback.
+};
+
+/// \brief Control law of a joint, called with its feedback as soon as it is read.
+/// \note Runs in the middle of the SYNC READ of the next joints: it must not use the bus, and takes bus time
+///       only if it lasts longer than the reply of the next joint (about 150us at 1Mbps).
+/// \param context Pointer given to STSController::setLaw
+/// \param joint Joint, position and speed just updated. The law may keep its own state in it.
+/// \param periodUs Time since the previous feedback of this joint, in us, 0 for the first one.
+/// \return RUNNING_SPEED command, in steps/s.
+typedef int16_t (*STSControlLaw)(void *context, STSJoint &joint, uint32_t const &periodUs);
+
+/// \brief Timing of the cycles, see STSController::getStatistics. Durations in us.
+struct STSControllerStatistics
+{
+    uint32_t cycles;
+    uint32_t overruns;       ///< Cycles started a whole period late or more: the schedule was shifted.
+    uint32_t missed;         ///< Joint feedbacks not received.
+    uint32_t minPeriod;      ///< Shortest time between two cycle starts.
+    uint32_t maxPeriod;      ///< Longest time between two cycle starts.
+    uint32_t maxJitter;      ///< Largest delay of a cycle start after its due date.
+    uint32_t maxCycleTime;   ///< Longest read, compute and write.
+    uint64_t totalJitter;
+    uint64_t totalCycleTime;
+
+    uint32_t meanJitter() const { return cycles == 0 ? 0 : totalJitter / cycles; }
+    uint32_t meanCycleTime() const { return cycles == 0 ? 0 : totalCycleTime / cycles; }
+};
+
+/// \brief Position loop on the host around servos in velocity mode (see STSServoDriver::setMode).
+class STSController
+{
+public:
+    /// \param[in] driver Driver of the bus the joints are on.
+    explicit STSController(STSServoDriver &driver);
+
+    /// \brief Remove all joints.
+    void clear();
+
+    /// \brief Add a joint, or change its gains, the servo being in velocity mode.
+    /// \details Its setpoint starts as its position at the first cycle: the joint holds still until setTarget.
+    /// \param[in] servoId ID of the servo
+    /// \param[in] gains Gains of the PID law.
+    /// \return False if there is no room left for this joint (see STS_CONTROLLER_JOINTS).
+    bool addJoint(byte const &servoId, STSPidGains const &gains);
+
+    /// \brief Set the setpoint of a joint, for the next cycles.
+    /// \param[in] servoId ID of the servo
+    /// \param[in] position Target position, in steps.
+    /// \param[in] speed Speed of the target, in steps/s, fed forward to the command.
+    /// \return False if the servo is not a joint.
+    bool setTarget(byte const &servoId, int16_t const &position, int16_t const &speed = 0);
+
+    /// \brief Get the state of a joint.
+    /// \return nullptr if the servo is not a joint.
+    STSJoint *getJoint(byte const &servoId);
+
+    /// \brief Replace the control law of all the joints.
+    /// \param[in] law Control law, nullptr for the PID law.
+    /// \param[in] context Passed to the law
+    void setLaw(STSControlLaw law, void *context = nullptr);
+
+    /// \brief Start the cycles, resetting the state of the laws and the statistics.
+    /// \note The joints not known to the driver yet are probed (see STSServoDriver::getCapabilities).
+    /// \param[in] periodUs Period of the cycles, in us, 0 to run them back to back.
+    void start(uint32_t const &periodUs);
+
+    /// \brief Wait for the next cycle to be due, then run it: read the feedback, run the laws, write the commands.
+    /// \details A joint without feedback keeps its command for one cycle, then is commanded to stop.
+    /// \return Number of joints whose feedback was read.
+    int runCycle();
+
+    /// \brief Command all the joints to stop, in one SYNC WRITE.
+    void stop();
+
+    /// \brief Get the timing of the cycles since start.
+    STSControllerStatistics const &getStatistics() const { return statistics_; }
+
+    /// \brief Default control law: fixed-point PID on the position error, with speed feedforward.
+    /// \details command = targetSpeed + (kp * error + ki * integral + kd * (targetSpeed - speed)) / 256, limited to
+    ///          maxSpeed. The position error is taken the short way around the turn. The integral stops while the
+    ///          command is limited, and is bounded so that its term alone cannot exceed the limit.
+    static int16_t pid(void *context, STSJoint &joint, uint32_t const &periodUs);
+
+private:
+    /// \brief Callback of readTelemetry: update the joint and run its law.
+    static void onFeedback(void *context, byte const &index, STSTelemetry const &telemetry);
+
+    /// \brief Find the index of a joint, -1 if the servo is not a joint.
+    int findJoint(byte const &servoId) const;
+
+    STSServoDriver &driver_;
+    STSJoint joints_[STS_CONTROLLER_JOINTS];
+    byte servoIds_[STS_CONTROLLER_JOINTS];      ///< IDs of the joints, for the batches.
+    int commands_[STS_CONTROLLER_JOINTS];       ///< Commands of the joints, for the SYNC WRITE.
+    uint32_t feedbackTimes_[STS_CONTROLLER_JOINTS];  ///< Time of the last feedback of the joints, in us.
+    byte flags_[STS_CONTROLLER_JOINTS];         ///< See jointFlag.
+    byte nJoints_;
+    STSControlLaw law_;
+    void *lawContext_;
+    uint32_t periodUs_;
+    uint32_t nextCycle_;       ///< Due date of the next cycle, in us.
+    uint32_t lastStart_;       ///< Start of the last cycle, in us.
+    STSControllerStatistics statistics_;
+};
+
+#endif
+#endif
@@ -0,0 +1,291 @@
+#include "STSRecorder.h"
+
+#include <stdio.h>
+
+#if STS_ENABLE_RECORDER
+
+namespace
+{
+    // Largest RUNNING_SPEED sent, in steps/s: RUNNING_SPEED is a signed 16-bit register.
+    float const MAX_SPEED = 32767;
+    // Acceleration of the servo when TARGET_ACCELERATION is 0, in steps/s^2.
+    float const MAX_ACCELERATION = 50000;
+};
+
+STSRecorder::STSRecorder(STSServoDriver &driver,
+                         uint32_t times[],
+                         int16_t positions[],
+                         uint16_t const &maxKeyframes,
+                         byte const &maxServos) :
+    driver_(driver),
+    times_(times),
+    positions_(positions),
+    maxKeyframes_(maxKeyframes),
+    maxServos_(maxServos < STS_RECORDER_SERVOS ? maxServos : STS_RECORDER_SERVOS),
+    nServos_(0),
+    tolerance_(0),
+    startTime_(0),
+    sampleCount_(0),
+    droppedCount_(0),
+    full_(false),
+    nKeyframes_(0),
+    hasPending_(false),
+    replayStart_(0),
+    nextKeyframe_(0)
+{
+}
+
+bool STSRecorder::startRecording(byte const &numberOfServos, const byte servoIds[], uint16_t const &tolerance)
+{
+    if (numberOfServos > maxServos_)
+        return false;
+    nServos_ = numberOfServos;
+    byte torque[STS_RECORDER_SERVOS];
+    for (int i = 0; i < nServos_; i++)
+    {
+        servoIds_[i] = servoIds[i];
+        torque[i] = 0;
+        // Probe the servos now, rather than in the first sample.
+        driver_.getCapabilities(servoIds_[i]);
+    }
+    driver_.syncWriteRegisters(nServos_, servoIds_, STSRegisters::TORQUE_SWITCH, 1, torque);
+
+    tolerance_ = tolerance;
+    sampleCount_ = 0;
+    droppedCount_ = 0;
+    full_ = false;
+    nKeyframes_ = 0;
+    hasPending_ = false;
+    nextKeyframe_ = 0;
+    startTime_ = micros();
+    return true;
+}
+
+bool STSRecorder::sample()
+{
+    if (full_ || nServos_ == 0)
+        return false;
+    int16_t positions[STS_RECORDER_SERVOS];
+    byte responded[(STS_RECORDER_SERVOS + 7) / 8];
+    uint32_t const now = micros();
+    if (driver_.readPositions(nServos_, servoIds_, positions, responded) < nServos_)
+    {
+        droppedCount_++;
+        return false;
+    }
+    sampleCount_++;
+    if (!addSample(now - startTime_, positions))
+    {
+        full_ = true;
+        return false;
+    }
+    return true;
+}
+
+void STSRecorder::stopRecording(bool const &holdPosition)
+{
+    commitPending();
+    nextKeyframe_ = nKeyframes_;
+    if (!holdPosition || nServos_ == 0)
+        return;
+    // The servos hold where they were left, not their target from before the recording. Those that do not
+    // reply hold their last keyframe, or stay free if there is none.
+    int16_t positions[STS_RECORDER_SERVOS];
+    byte responded[(STS_RECORDER_SERVOS + 7) / 8];
+    driver_.readPositions(nServos_, servoIds_, positions, responded);
+    byte ids[STS_RECORDER_SERVOS];
+    int targets[STS_RECORDER_SERVOS];
+    int speeds[STS_RECORDER_SERVOS];
+    byte torque[STS_RECORDER_SERVOS];
+    byte n = 0;
+    for (int i = 0; i < nServos_; i++)
+    {
+        if (responded[i / 8] & (1 << (i % 8)))
+            targets[n] = positions[i];
+        else if (nKeyframes_ > 0)
+            targets[n] = getKeyframePosition(nKeyframes_ - 1, i);
+        else
+            continue;
+        ids[n] = servoIds_[i];
+        speeds[n] = 0;
+        torque[n] = 1;
+        n++;
+    }
+    driver_.setTargetPositions(n, ids, targets, speeds);
+    driver_.syncWriteRegisters(n, ids, STSRegisters::TORQUE_SWITCH, 1, torque);
+}
+
+int STSRecorder::compress(uint16_t const &tolerance)
+{
+    commitPending();
+    // Each keyframe is read before being overwritten: the keyframes kept are stored at or before it.
+    uint16_t const n = nKeyframes_;
+    nKeyframes_ = 0;
+    tolerance_ = tolerance;
+    int16_t positions[STS_RECORDER_SERVOS];
+    for (uint16_t k = 0; k < n; k++)
+    {
+        for (int i = 0; i < nServos_; i++)
+            positions[i] = positions_[k * nServos_ + i];
+        addSample(times_[k], positions);
+    }
+    commitPending();
+    nextKeyframe_ = nKeyframes_;
+    return nKeyframes_;
+}
+
+void STSRecorder::moveToStart(int const &speed)
+{
+    if (nKeyframes_ == 0)
+        return;
+    int targets[STS_RECORDER_SERVOS];
+    int speeds[STS_RECORDER_SERVOS];
+    for (int i = 0; i < nServos_; i++)
+    {
+        targets[i] = positions_[i];
+        speeds[i] = speed;
+    }
+    driver_.setTargetPositions(nServos_, servoIds_, targets, speeds);
+}
+
+void STSRecorder::startReplay(uint32_t const &nowUs)
+{
+    replayStart_ = nowUs;
+    nextKeyframe_ = 1;
+    for (int i = 0; i < nServos_; i++)
+        speeds_[i] = 0;
+}
+
+int STSRecorder::updateReplay(uint32_t const &nowUs)
+{
+    if (isReplayFinished())
+        return 0;
+    uint32_t const elapsed = times_[0] + (nowUs - replayStart_);
+    // A servo brakes to stop on its target: the next keyframe is sent ahead by the time the fastest servo takes
+    // to start braking, so that the servos go through the keyframes without slowing down.
+    uint32_t lead = 0;
+    if (nextKeyframe_ >= 2)
+    {
+        int fastest = 0;
+        for (int i = 0; i < nServos_; i++)
+            if (speeds_[i] > fastest)
+                fastest = speeds_[i];
+        lead = fastest * (1e6f / 2 / MAX_ACCELERATION);
+        uint32_t const segment = times_[nextKeyframe_ - 1] - times_[nextKeyframe_ - 2];
+        if (lead > segment)
+            lead = segment;
+    }
+    if (elapsed + lead < times_[nextKeyframe_ - 1])
+        return 0;
+    uint16_t k = nextKeyframe_;
+    while (k + 1 < nKeyframes_ && elapsed >= times_[k])
+        k++;
+
+    // Each servo is given the speed that brings it from where it is to the keyframe on time: a servo that fell
+    // behind catches up.
+    int16_t positions[STS_RECORDER_SERVOS];
+    byte responded[(STS_RECORDER_SERVOS + 7) / 8];
+    driver_.readPositions(nServos_, servoIds_, positions, responded);
+    uint32_t const now = times_[0] + (micros() - replayStart_);
+    float const duration = times_[k] > now ? times_[k] - now : 1;
+    int targets[STS_RECORDER_SERVOS];
+    byte accelerations[STS_RECORDER_SERVOS];
+    for (int i = 0; i < nServos_; i++)
+    {
+        int16_t const target = getKeyframePosition(k, i);
+        int16_t const from = responded[i / 8] & (1 << (i % 8)) ? positions[i] : getKeyframePosition(k - 1, i);
+        int const distance = abs(target - from);
+        if (distance > 0)
+        {
+            float const speed = ceil(distance * 1e6f / duration);
+            speeds_[i] = speed < MAX_SPEED ? speed : MAX_SPEED;
+        }
+        targets[i] = target;
+        accelerations[i] = 0;
+    }
+    driver_.setTargetMotions(nServos_, servoIds_, targets, speeds_, accelerations);
+    nextKeyframe_ = k + 1;
+    return 1;
+}
+
+size_t STSRecorder::exportTo(Print &output) const
+{
+    size_t written = output.print("time_us");
+    char text[16];
+    for (int i = 0; i < nServos_; i++)
+    {
+        snprintf(text, sizeof(text), ",%d", servoIds_[i]);
+        written += output.print(text);
+    }
+    written += output.print("\n");
+    for (uint16_t k = 0; k < getKeyframeCount(); k++)
+    {
+        snprintf(text, sizeof(text), "%lu", static_cast<unsigned long>(times_[k]));
+        written += output.print(text);
+        for (int i = 0; i < nServos_; i++)
+        {
+            snprintf(text, sizeof(text), ",%d", getKeyframePosition(k, i));
+            written += output.print(text);
+        }
+        written += output.print("\n");
+    }
+    return written;
+}
+
+bool STSRecorder::addSample(uint32_t const &time, const int16_t positions[])
+{
+    // The pending sample is the furthest the segment from the last keyframe reaches: it becomes a keyframe,
+    // and the segment restarts from it.
+    if (hasPending_ && !extendsSegment(time, positions))
+        commitPending();
+    if (nKeyframes_ == maxKeyframes_)
+        return false;
+    if (nKeyframes_ == 0)
+    {
+        times_[0] = time;
+        for (int i = 0; i < nServos_; i++)
+            positions_[i] = positions[i];
+        nKeyframes_ = 1;
+        return true;
+    }
+    uint16_t const last = nKeyframes_ - 1;
+    float const dt = time > times_[last] ? time - times_[last] : 1;
+    for (int i = 0; i < nServos_; i++)
+    {
+        float const distance = positions[i] - getKeyframePosition(last, i);
+        float const low = (distance - tolerance_) / dt;
+        float const high = (distance + tolerance_) / dt;
+        if (!hasPending_ || low > lowSlope_[i])
+            lowSlope_[i] = low;
+        if (!hasPending_ || high < highSlope_[i])
+            highSlope_[i] = high;
+    }
+    times_[nKeyframes_] = time;
+    for (int i = 0; i < nServos_; i++)
+        positions_[nKeyframes_ * nServos_ + i] = positions[i];
+    hasPending_ = true;
+    return true;
+}
+
+bool STSRecorder::extendsSegment(uint32_t const &time, const int16_t positions[]) const
+{
+    uint16_t const last = nKeyframes_ - 1;
+    float const dt = time > times_[last] ? time - times_[last] : 1;
+    for (int i = 0; i < nServos_; i++)
+    {
+        float const slope = (positions[i] - getKeyframePosition(last, i)) / dt;
+        if (slope < lowSlope_[i] || slope > highSlope_[i])
+            return false;
+    }
+    return true;
+}
+
+void STSRecorder::commitPending()
+{
+    if (!hasPending_)
+        return;
+    nKeyframes_++;
+    hasPending_ = false;
+}
+
+#endif
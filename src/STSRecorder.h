@@ -0,0 +1,157 @@
+/// \file STSRecorder.h
+/// \brief Teach-and-record: motions taught by moving the servos by hand, recorded as keyframes and replayed.
+///
+/// \details Recording releases the torque of all the servos in one SYNC WRITE, then samples their positions with
+///          back-to-back SYNC READs of CURRENT_POSITION alone (STSServoDriver::readPositions), the highest rate the
+///          bus allows. The samples are compressed as they come: a sample is only kept as a keyframe when the
+///          motion from the last keyframe to the next sample can no longer be interpolated linearly within a
+///          tolerance, on every servo at once. Holding still or moving steadily thus costs no room, and seconds of
+///          motion sampled at about 1kHz fit in a small fixed buffer. The keyframes are replayed with one SYNC
+///          WRITE each, the speed of each servo set for it to reach the next keyframe on time.
+#ifndef STSRECORDER_H
+#define STSRECORDER_H
+
+#include <Arduino.h>
+#include "STSServoConfig.h"
+#include "STSServoDriver.h"
+
+#if STS_ENABLE_RECORDER
+
+/// \brief Records the motion of a set of servos moved by hand, then replays it.
+/// \details The keyframes are stored in buffers given by the application: keyframe k is at times[k], in us from
+///          the start of the recording, with the position of servoIds[j] at positions[k * numberOfServos + j].
+class STSRecorder
+{
+public:
+    /// \param[in] driver Driver of the bus the servos are on.
+    /// \param[out] times Buffer of the keyframe times, maxKeyframes entries.
+    /// \param[out] positions Buffer of the keyframe positions, maxKeyframes * maxServos entries.
+    /// \param[in] maxKeyframes Number of keyframes the buffers hold.
+    /// \param[in] maxServos Largest number of servos recorded at once, at most STS_RECORDER_SERVOS.
+    STSRecorder(STSServoDriver &driver,
+                uint32_t times[],
+                int16_t positions[],
+                uint16_t const &maxKeyframes,
+                byte const &maxServos);
+
+    /// \brief Release the torque of the servos in one SYNC WRITE, and start a new recording.
+    /// \note The servos not known to the driver yet are probed (see STSServoDriver::getCapabilities).
+    /// \param[in] numberOfServos Number of servos.
+    /// \param[in] servoIds Array of servo IDs to record.
+    /// \param[in] tolerance Largest distance between the samples and the keyframes interpolated linearly, in
+    ///            steps. The default, STS_RECORDER_TOLERANCE, absorbs the encoder noise: with 0, only the samples
+    ///            lying exactly on a line between their neighbors are left out, and a noisy recording is kept
+    ///            almost whole.
+    /// \return False if there are more servos than maxServos.
+    bool startRecording(byte const &numberOfServos,
+                        const byte servoIds[],
+                        uint16_t const &tolerance = STS_RECORDER_TOLERANCE);
+
+    /// \brief Read the positions of all the servos in one SYNC READ, and add them to the recording.
+    /// \details Call it back to back to sample at the highest rate. The sample is timed at the start of the read.
+    /// \return False if a servo did not reply (the sample is dropped, see getDroppedCount), or the buffer is full.
+    bool sample();
+
+    /// \brief Whether the buffer is full: the recording ends at the last keyframe stored.
+    bool isFull() const { return full_; }
+
+    /// \brief End the recording, the last sample becoming a keyframe.
+    /// \param[in] holdPosition Whether to enable the torque again, the servos holding their current position.
+    void stopRecording(bool const &holdPosition = true);
+
+    /// \brief Compress the keyframes of a finished recording again, in place, with a larger tolerance.
+    /// \details The distance between the samples and the keyframes is then at most the sum of both tolerances.
+    /// \param[in] tolerance Tolerance of the new keyframes to the current ones, in steps.
+    /// \return Number of keyframes.
+    int compress(uint16_t const &tolerance);
+
+    /// \brief Move the servos to the first keyframe, in one SYNC WRITE, e.g. before startReplay.
+    /// \param[in] speed Speed of the motion, in steps/s (0: maximum speed of the servo).
+    void moveToStart(int const &speed);
+
+    /// \brief Start replaying the keyframes, the servos being at rest on the first one.
+    /// \param[in] nowUs Current time, e.g. micros()
+    void startReplay(uint32_t const &nowUs);
+
+    /// \brief Send the keyframe that is due, in one SYNC WRITE of the target positions and speeds.
+    /// \details Keyframe k is sent when keyframe k - 1 is reached. As the servos brake to stop on their target, it
+    ///          is sent ahead by the time the fastest one takes to start braking (at the maximum acceleration,
+    ///          TARGET_ACCELERATION being set to 0). The positions are read first, in one SYNC READ, so that each
+    ///          servo is given the speed that brings it to keyframe k on time, catching up if it fell behind.
+    ///          Keyframes already past when called late are skipped.
+    /// \note Keyframes are sent late by up to the time between two calls: call it at least every millisecond.
+    /// \param[in] nowUs Current time
+    /// \return Number of keyframes sent.
+    int updateReplay(uint32_t const &nowUs);
+
+    /// \brief Whether the last keyframe has been sent.
+    bool isReplayFinished() const { return nextKeyframe_ >= nKeyframes_; }
+
+    /// \brief Write the keyframes as CSV text, e.g. to a file of an SD card: a header of the servo IDs, then a
+    ///        line per keyframe, with its time in us and the position of each servo.
+    /// \return Number of bytes written.
+    size_t exportTo(Print &output) const;
+
+    /// \brief Number of servos recorded.
+    byte getServoCount() const { return nServos_; }
+
+    /// \brief Number of keyframes, the pending sample of a recording in progress included.
+    uint16_t getKeyframeCount() const { return nKeyframes_ + hasPending_; }
+
+    /// \brief Time of a keyframe, in us from the start of the recording.
+    uint32_t getKeyframeTime(uint16_t const &keyframe) const { return times_[keyframe]; }
+
+    /// \brief Position of a servo at a keyframe, in steps.
+    /// \param[in] keyframe Index of the keyframe.
+    /// \param[in] servo Index of the servo in the servoIds of startRecording.
+    int16_t getKeyframePosition(uint16_t const &keyframe, byte const &servo) const
+    {
+        return positions_[keyframe * nServos_ + servo];
+    }
+
+    /// \brief Number of samples recorded since startRecording.
+    uint32_t getSampleCount() const { return sampleCount_; }
+
+    /// \brief Number of samples dropped since startRecording, a servo having not replied.
+    uint32_t getDroppedCount() const { return droppedCount_; }
+
+private:
+    /// \brief Add a sample to the keyframes.
+    /// \return False if the buffer is full.
+    bool addSample(uint32_t const &time, const int16_t positions[]);
+
+    /// \brief Whether the pending keyframe can be moved to a sample: the line from the last keyframe to this
+    ///        sample passes within tolerance of all the samples since.
+    bool extendsSegment(uint32_t const &time, const int16_t positions[]) const;
+
+    /// \brief Make the pending sample a keyframe.
+    void commitPending();
+
+    STSServoDriver &driver_;
+    uint32_t *times_;
+    int16_t *positions_;
+    uint16_t maxKeyframes_;
+    byte maxServos_;
+
+    byte nServos_;
+    byte servoIds_[STS_RECORDER_SERVOS];
+    uint16_t tolerance_;
+    uint32_t startTime_;
+    uint32_t sampleCount_;
+    uint32_t droppedCount_;
+    bool full_;
+    /// Keyframes stored, the last one being the start of the segment in progress. The last sample, at the end of
+    /// the segment, is stored after them, at index nKeyframes_.
+    uint16_t nKeyframes_;
+    bool hasPending_;
+    /// Slopes of the lines from the last keyframe passing within tolerance of all the samples since, in steps/us.
+    float lowSlope_[STS_RECORDER_SERVOS];
+    float highSlope_[STS_RECORDER_SERVOS];
+
+    uint32_t replayStart_;
+    uint16_t nextKeyframe_;
+    int speeds_[STS_RECORDER_SERVOS];
+};
+
+#endif
+#endif
@@ -0,0 +1,176 @@
+/// \file STSServoConfig.h
+/// \brief Compile-time configuration of the STS servo driver.
+///
+/// \details Each option can be overridden from the build flags (e.g. build_flags = -DSTS_ENABLE_SCS=0
+///          in platformio.ini) to leave out what a deployment does not need: on small MCUs like the
+///          Arduino Uno, the disabled code and data disappear from the flash and SRAM footprint.
+#ifndef STSSERVO_CONFIG_H
+#define STSSERVO_CONFIG_H
+
+/// Support SCS servos alongside STS servos: servo type probing, SCS byte order and lock register.
+/// If disabled, all servos are handled as STS.
+#ifndef STS_ENABLE_SCS
+#define STS_ENABLE_SCS 1
+#endif
+
+/// Maximum number of servos the driver keeps state for (type, capabilities, counters).
+#ifndef STS_MAX_SERVOS
+#define STS_MAX_SERVOS 32
+#endif
+
+/// Batch instructions on several servos: SYNC WRITE (setTargetPositions) and SYNC READ (syncReadRegisters, pingServos).
+#ifndef STS_ENABLE_BATCH
+#define STS_ENABLE_BATCH 1
+#endif
+
+/// Change notifications on registers (STSServoDriver::subscribe), polled with SYNC READ: requires STS_ENABLE_BATCH.
+#ifndef STS_ENABLE_SUBSCRIPTIONS
+#define STS_ENABLE_SUBSCRIPTIONS STS_ENABLE_BATCH
+#endif
+#if STS_ENABLE_SUBSCRIPTIONS && !STS_ENABLE_BATCH
+#error "STS_ENABLE_SUBSCRIPTIONS requires STS_ENABLE_BATCH"
+#endif
+
+/// Maximum number of subscriptions.
+#ifndef STS_MAX_SUBSCRIPTIONS
+#define STS_MAX_SUBSCRIPTIONS 8
+#endif
+
+/// Sparse-knot trajectories (STSTrajectoryPlayer), sent with SYNC WRITE: requires STS_ENABLE_BATCH.
+#ifndef STS_ENABLE_TRAJECTORY
+#define STS_ENABLE_TRAJECTORY STS_ENABLE_BATCH
+#endif
+#if STS_ENABLE_TRAJECTORY && !STS_ENABLE_BATCH
+#error "STS_ENABLE_TRAJECTORY requires STS_ENABLE_BATCH"
+#endif
+
+/// Maximum number of servos played at once by an STSTrajectoryPlayer.
+#ifndef STS_TRAJECTORY_SERVOS
+#define STS_TRAJECTORY_SERVOS 8
+#endif
+
+/// Largest number of steps of the motion model spent by each STSTrajectoryPlayer::update on fitting a knot while
+/// playing, after a servo strayed from its path: bounds the time update takes, roughly 100us per step on AVR.
+#ifndef STS_TRAJECTORY_FIT_STEPS
+#define STS_TRAJECTORY_FIT_STEPS 512
+#endif
+
+/// Double-buffered transmission of SYNC WRITE frames over a background transport (STSTxPipeline): requires STS_ENABLE_BATCH.
+#ifndef STS_ENABLE_TX_PIPELINE
+#define STS_ENABLE_TX_PIPELINE STS_ENABLE_BATCH
+#endif
+#if STS_ENABLE_TX_PIPELINE && !STS_ENABLE_BATCH
+#error "STS_ENABLE_TX_PIPELINE requires STS_ENABLE_BATCH"
+#endif
+
+/// Size of each of the two buffers of a STSTxPipeline: the largest frame is 259 bytes.
+#ifndef STS_TX_BUFFER_SIZE
+#define STS_TX_BUFFER_SIZE 260
+#endif
+
+/// Host-side position loop around servos in velocity mode (STSController), fed by SYNC READ and commanding with
+/// SYNC WRITE: requires STS_ENABLE_BATCH.
+#ifndef STS_ENABLE_CONTROLLER
+#define STS_ENABLE_CONTROLLER STS_ENABLE_BATCH
+#endif
+#if STS_ENABLE_CONTROLLER && !STS_ENABLE_BATCH
+#error "STS_ENABLE_CONTROLLER requires STS_ENABLE_BATCH"
+#endif
+
+/// Maximum number of joints of an STSController.
+#ifndef STS_CONTROLLER_JOINTS
+#define STS_CONTROLLER_JOINTS 8
+#endif
+
+/// Teach-and-record of motions moved by hand (STSRecorder), sampled with SYNC READ and replayed with SYNC WRITE:
+/// requires STS_ENABLE_BATCH.
+#ifndef STS_ENABLE_RECORDER
+#define STS_ENABLE_RECORDER STS_ENABLE_BATCH
+#endif
+#if STS_ENABLE_RECORDER && !STS_ENABLE_BATCH
+#error "STS_ENABLE_RECORDER requires STS_ENABLE_BATCH"
+#endif
+
+/// Maximum number of servos recorded at once by an STSRecorder.
+#ifndef STS_RECORDER_SERVOS
+#define STS_RECORDER_SERVOS 8
+#endif
+
+/// Default tolerance of an STSRecorder, in steps: a few steps of encoder noise on a servo moved by hand, which
+/// would otherwise make almost every sample a keyframe.
+#ifndef STS_RECORDER_TOLERANCE
+#define STS_RECORDER_TOLERANCE 3
+#endif
+
+/// EEPROM configuration drift check and repair against a profile (STSServoDriver::checkConfiguration), read with
+/// SYNC READ: requires STS_ENABLE_BATCH.
+#ifndef STS_ENABLE_CONFIG_CHECK
+#define STS_ENABLE_CONFIG_CHECK STS_ENABLE_BATCH
+#endif
+#if STS_ENABLE_CONFIG_CHECK && !STS_ENABLE_BATCH
+#error "STS_ENABLE_CONFIG_CHECK requires STS_ENABLE_BATCH"
+#endif
+
+/// Transaction and error counters, see STSServoDriver::getStatistics.
+#ifndef STS_ENABLE_STATISTICS
+#define STS_ENABLE_STATISTICS 1
+#endif
+
+/// Buckets of the reply latency histogram of the statistics (STSStatistics::latency): bucket i counts the replies
+/// taking less than 128us << i, the last one all the others.
+#ifndef STS_LATENCY_BUCKETS
+#define STS_LATENCY_BUCKETS 8
+#endif
+
+/// CPU cost of the driver functions, wire waits excluded, see STSServoDriver::getProfile. Off by default: when
+/// disabled, the instrumentation compiles out completely.
+#ifndef STS_ENABLE_PROFILING
+#define STS_ENABLE_PROFILING 0
+#endif
+
+/// Peak stack depth and payload sizes reached inside each driver API, see STSServoDriver::getStackUsage. Off by
+/// default: when disabled, the instrumentation compiles out completely.
+#ifndef STS_ENABLE_STACK_STATISTICS
+#define STS_ENABLE_STACK_STATISTICS 0
+#endif
+
+/// Clock read by the profiling: micros() by default (4us resolution on AVR), or e.g. a cycle counter
+/// (DWT->CYCCNT on Cortex-M). The costs are reported in the unit of this clock.
+#ifndef STS_PROFILE_CLOCK
+#define STS_PROFILE_CLOCK() micros()
+#endif
+
+/// Asynchronous execution: ACTION instruction triggering the writes made with asynchronous = true.
+#ifndef STS_ENABLE_ASYNC
+#define STS_ENABLE_ASYNC 1
+#endif
+
+/// Floating-point helpers (getCurrentCurrent in A). Integer variants remain available.
+#ifndef STS_ENABLE_FLOAT
+#define STS_ENABLE_FLOAT 1
+#endif
+
+/// Size of the telemetry history (STSTelemetryHistory), fixed at compile time. Each servo keeps, for each field,
+/// STS_HISTORY_RAW raw samples, then STS_HISTORY_LEVELS levels of STS_HISTORY_BUCKETS buckets, each bucket
+/// summarizing STS_HISTORY_FACTOR buckets of the level below (or raw samples, for the first level).
+#ifndef STS_HISTORY_SERVOS
+#define STS_HISTORY_SERVOS 8
+#endif
+#ifndef STS_HISTORY_RAW
+#define STS_HISTORY_RAW 60
+#endif
+#ifndef STS_HISTORY_BUCKETS
+#define STS_HISTORY_BUCKETS 30
+#endif
+#ifndef STS_HISTORY_LEVELS
+#define STS_HISTORY_LEVELS 3
+#endif
+#ifndef STS_HISTORY_FACTOR
+#define STS_HISTORY_FACTOR 10
+#endif
+// The ring indices and counts of the history are bytes.
+static_assert(STS_HISTORY_RAW >= 1 && STS_HISTORY_RAW <= 255, "STS_HISTORY_RAW must be between 1 and 255");
+static_assert(STS_HISTORY_BUCKETS >= 1 && STS_HISTORY_BUCKETS <= 255, "STS_HISTORY_BUCKETS must be between 1 and 255");
+static_assert(STS_HISTORY_FACTOR >= 1 && STS_HISTORY_FACTOR <= 255, "STS_HISTORY_FACTOR must be between 1 and 255");
+
+#endif
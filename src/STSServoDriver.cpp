@@ -8,12 +8,241 @@ namespace instruction
     byte const WRITE      = 0x03;
     byte const REGWRITE   = 0x04;
     byte const ACTION     = 0x05;
+    byte const SYNCREAD   = 0x82;
     byte const SYNCWRITE  = 0x83;
     byte const RESET      = 0x06;
 };
 
-STSServoDriver::STSServoDriver() : dirPin_(0)
+namespace
 {
+    unsigned long const RECEIVE_TIMEOUT_MS    = 10;
+    unsigned long const PING_SWEEP_TIMEOUT_MS = 2; // Fallback sweep: a missing servo should not cost a full timeout.
+    // Silence after which no late reply is coming anymore: longer than the largest RESPONSE_DELAY (510us).
+    unsigned int const BUS_IDLE_US = 600;
+
+    namespace receiveState
+    {
+        byte const HEADER   = 0; ///< Waiting for the first 0xFF.
+        byte const HEADER_2 = 1; ///< Waiting for the second 0xFF.
+        byte const ID       = 2;
+        byte const LENGTH   = 3;
+        byte const DATA     = 4;
+        byte const CHECKSUM = 5;
+    };
+    // Largest batches fitting in a frame, whose length is a single byte.
+    byte const MAX_SYNC_WRITE_SERVOS = (255 - 4) / 7;
+    byte const MAX_SYNC_WRITE_MOTIONS = (255 - 4) / 8;
+    byte const MAX_SYNC_WRITE_VELOCITIES = (255 - 4) / 3;
+    byte const MAX_SYNC_READ_SERVOS  = 248; // Multiple of 8 to keep the responder bitmap aligned.
+    int const MAX_FRAME_LENGTH = 255 + 4;
+
+    /// \brief Decode a two-byte register, as read from a servo of the given type.
+    int16_t decodeWord(ServoType const &type, byte const bytes[2])
+    {
+        int16_t value = 0;
+        switch(type)
+        {
+#if STS_ENABLE_SCS
+            case ServoType::SCS:
+                value = static_cast<int16_t>(bytes[1] +  (bytes[0] << 8));
+                break;
+#endif
+            case ServoType::STS:
+                value = static_cast<int16_t>(bytes[0] +  (bytes[1] << 8));
+                break;
+            default:
+                return 0;
+        }
+        // Bit 15 is sign
+        int16_t signedValue = value & ~0x8000;
+        if (value & 0x8000)
+            signedValue = -signedValue;
+        return signedValue;
+    }
+#if STS_ENABLE_BATCH
+    byte const TELEMETRY_LENGTH = STSRegisters::CURRENT_CURRENT + 2 - STSRegisters::CURRENT_POSITION;
+
+    /// \brief Reply handler of syncReadRegisters: copy the registers to the output buffer.
+    void copyReply(void *context, byte const &index, const byte *data, byte const &length)
+    {
+        memcpy(static_cast<byte *>(context) + index * length, data, length);
+    }
+
+    /// \brief Reply handler of readTelemetry: store the registers, the two-byte ones as read.
+    void storeTelemetry(void *context, byte const &index, const byte *data, byte const &)
+    {
+        STSTelemetry &telemetry = static_cast<STSTelemetry *>(context)[index];
+        // Offsets in the block are relative to CURRENT_POSITION.
+        byte const speed = STSRegisters::CURRENT_SPEED - STSRegisters::CURRENT_POSITION;
+        byte const current = STSRegisters::CURRENT_CURRENT - STSRegisters::CURRENT_POSITION;
+        telemetry.position = data[0] | (data[1] << 8);
+        telemetry.speed = data[speed] | (data[speed + 1] << 8);
+        telemetry.current = data[current] | (data[current + 1] << 8);
+        telemetry.voltage = data[STSRegisters::CURRENT_VOLTAGE - STSRegisters::CURRENT_POSITION];
+        telemetry.temperature = data[STSRegisters::CURRENT_TEMPERATURE - STSRegisters::CURRENT_POSITION];
+        telemetry.status = data[STSRegisters::STATUS - STSRegisters::CURRENT_POSITION];
+        telemetry.moving = data[STSRegisters::MOVING_STATUS - STSRegisters::CURRENT_POSITION];
+    }
+
+    /// \brief Reply handler of readPositions: store the register as read.
+    void storePosition(void *context, byte const &index, const byte *data, byte const &)
+    {
+        static_cast<int16_t *>(context)[index] = data[0] | (data[1] << 8);
+    }
+
+    /// \brief Context of forwardTelemetry.
+    struct TelemetryForward
+    {
+        ServoType const *types;  ///< Type of each servo, determined before the SYNC READ.
+        STSTelemetryCallback callback;
+        void *context;
+    };
+
+    /// \brief Reply handler of readTelemetry with a callback: decode the registers and hand them over.
+    void forwardTelemetry(void *context, byte const &index, const byte *data, byte const &)
+    {
+        TelemetryForward const &forward = *static_cast<TelemetryForward const *>(context);
+        ServoType const type = forward.types[index];
+        STSTelemetry telemetry;
+        telemetry.position = decodeWord(type, &data[0]);
+        telemetry.speed = decodeWord(type, &data[STSRegisters::CURRENT_SPEED - STSRegisters::CURRENT_POSITION]);
+        telemetry.current = decodeWord(type, &data[STSRegisters::CURRENT_CURRENT - STSRegisters::CURRENT_POSITION]);
+        telemetry.voltage = data[STSRegisters::CURRENT_VOLTAGE - STSRegisters::CURRENT_POSITION];
+        telemetry.temperature = data[STSRegisters::CURRENT_TEMPERATURE - STSRegisters::CURRENT_POSITION];
+        telemetry.status = data[STSRegisters::STATUS - STSRegisters::CURRENT_POSITION];
+        telemetry.moving = data[STSRegisters::MOVING_STATUS - STSRegisters::CURRENT_POSITION];
+        forward.callback(forward.context, index, telemetry);
+    }
+
+    void wordToBytes(int16_t const &word, byte bytes[2])
+    {
+        bytes[0] = static_cast<uint16_t>(word) & 0xFF;
+        bytes[1] = static_cast<uint16_t>(word) >> 8;
+    }
+#endif
+#if STS_ENABLE_CONFIG_CHECK
+    bool isChecked(byte const mask[], int const &i)
+    {
+        return mask[i / 8] & (1 << (i % 8));
+    }
+
+    /// \brief CRC-16/CCITT of the checked registers of the configuration region, the others counting as 0.
+    uint16_t configDigest(const byte values[], const byte mask[])
+    {
+        uint16_t crc = 0xFFFF;
+        for (int i = 0; i < STSConfigRegion::LENGTH; i++)
+        {
+            crc ^= (isChecked(mask, i) ? values[i] : 0) << 8;
+            for (int bit = 0; bit < 8; bit++)
+                crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+        return crc;
+    }
+
+    /// \brief Context of checkConfigReply.
+    struct ConfigCheck
+    {
+        STSConfigProfile const *profile;
+        STSConfigDrift *drift;
+        int nDrifted;
+    };
+
+    /// \brief Reply handler of checkConfiguration: compare the digests, then the registers if they differ.
+    void checkConfigReply(void *context, byte const &index, const byte *data, byte const &)
+    {
+        ConfigCheck &check = *static_cast<ConfigCheck *>(context);
+        STSConfigProfile const &profile = *check.profile;
+        STSConfigDrift &drift = check.drift[index];
+        drift.digest = configDigest(data, profile.mask);
+        memset(drift.mismatched, 0, sizeof(drift.mismatched));
+        if (drift.digest == profile.digest)
+            return;
+        // Different digests: at least one checked register differs.
+        for (int i = 0; i < STSConfigRegion::LENGTH; i++)
+            if (isChecked(profile.mask, i) && data[i] != profile.values[i])
+                drift.mismatched[i / 8] |= 1 << (i % 8);
+        check.nDrifted++;
+    }
+#endif
+#if STS_ENABLE_SUBSCRIPTIONS
+    // Fixed cost of a SYNC READ, in bytes of wire time at 1Mbps: the turnaround before the first reply,
+    // and the time to handle the transaction.
+    int const SYNC_READ_OVERHEAD_BYTES = 5;
+
+    namespace subscriptionState
+    {
+        byte const IN_USE    = 0x01;
+        byte const HAS_VALUE = 0x02;
+        byte const ACTIVE    = 0x04;
+    };
+
+    // Wire size of a SYNC READ of length registers on n servos: request, then one reply per servo.
+    int syncReadCost(int const& n, int const& length)
+    {
+        return SYNC_READ_OVERHEAD_BYTES + 8 + n + n * (6 + length);
+    }
+#endif
+};
+
+// Profiling: STS_PROFILE records the CPU cost of the enclosing function, STS_WAIT_BEGIN and STS_WAIT_END
+// bracket the waits for the bus to exclude from it. STS_EXCLUDE_BEGIN and STS_EXCLUDE_END bracket application
+// code called by the driver, e.g. reply handlers: their whole time is excluded, the waits within counted once.
+// They compile out when profiling is disabled.
+#if STS_ENABLE_PROFILING
+#define STS_PROFILE(function) ProfileScope profileScope(*this, function)
+#define STS_WAIT_BEGIN() uint32_t const profileWaitStart = STS_PROFILE_CLOCK()
+#define STS_WAIT_END() profileWait_ += STS_PROFILE_CLOCK() - profileWaitStart
+#define STS_EXCLUDE_BEGIN() uint32_t const profileExcludeStart = STS_PROFILE_CLOCK(), profileExcludeWait = profileWait_
+#define STS_EXCLUDE_END() profileWait_ = profileExcludeWait + (STS_PROFILE_CLOCK() - profileExcludeStart)
+#else
+#define STS_PROFILE(function)
+#define STS_WAIT_BEGIN()
+#define STS_WAIT_END()
+#define STS_EXCLUDE_BEGIN()
+#define STS_EXCLUDE_END()
+#endif
+
+// Stack statistics: STS_STACK_SCOPE accounts the enclosing API call, STS_STACK_MARK records the depth and payload
+// sizes at the deepest points of the driver. They compile out when the statistics are disabled.
+#if STS_ENABLE_STACK_STATISTICS
+#define STS_STACK_SCOPE(api) StackScope stackScope(*this, api)
+#define STS_STACK_MARK(request, reply, servos) markStack(request, reply, servos)
+#else
+#define STS_STACK_SCOPE(api)
+#define STS_STACK_MARK(request, reply, servos)
+#endif
+
+STSServoDriver::STSServoDriver() : dirPin_(0), nSlots_(0), lastSlot_(0), receiveFailed_(false)
+{
+#if STS_ENABLE_STACK_STATISTICS
+    stackBase_ = 0;
+    stackApi_ = 0;
+    stackNesting_ = 0;
+    resetStackUsage();
+#endif
+#if STS_ENABLE_STATISTICS
+    requestEnd_ = 0;
+#endif
+#if STS_ENABLE_SCS
+    busType_ = ServoType::UNKNOWN;
+#endif
+#if STS_ENABLE_BATCH
+    busDeclared_ = false;
+#endif
+#if STS_ENABLE_TX_PIPELINE
+    txPipeline_ = nullptr;
+    txFrame_ = nullptr;
+    txLength_ = 0;
+#endif
+#if STS_ENABLE_PROFILING
+    profileWait_ = 0;
+    resetProfile();
+#endif
+#if STS_ENABLE_SUBSCRIPTIONS
+    for (int i = 0; i < STS_MAX_SUBSCRIPTIONS; i++)
+        subscriptions_[i].state = 0;
+    nReadGroups_ = 0;
+#endif
 }
 
 bool STSServoDriver::init(byte const& dirPin, HardwareSerial *serialPort,long const& baudRate)
@@ -25,15 +254,28 @@ bool STSServoDriver::init(byte const& dirPin, HardwareSerial *serialPort,long co
     // Open port
     port_ = serialPort;
     port_->begin(baudRate);
-    port_->setTimeout(10);
+    port_->setTimeout(RECEIVE_TIMEOUT_MS);
     dirPin_ = dirPin;
     if (this->dirPin_ < 255)
     {
         pinMode(dirPin_, OUTPUT);
     }
 
-    for (int i = 0; i < 256; i++)
-        servoType_[i] = ServoType::UNKNOWN;
+    nSlots_ = 0;
+    lastSlot_ = 0;
+    receiveFailed_ = false;
+#if STS_ENABLE_BATCH
+    busDeclared_ = false;
+#endif
+#if STS_ENABLE_STATISTICS
+    statistics_ = STSStatistics();
+#endif
+#if STS_ENABLE_PROFILING
+    resetProfile();
+#endif
+#if STS_ENABLE_STACK_STATISTICS
+    resetStackUsage();
+#endif
 
     // Test that a servo is present.
     for (byte i = 0; i < 0xFE; i++)
@@ -49,6 +291,7 @@ bool STSServoDriver::init(HardwareSerial *serialPort, long const& baudRate)
 
 bool STSServoDriver::ping(byte const &servoId)
 {
+    STS_STACK_SCOPE(STSStackApi::PING);
     byte response[1] = {0xFF};
     int send = sendMessage(servoId,
                            instruction::PING_,
@@ -59,6 +302,7 @@ bool STSServoDriver::ping(byte const &servoId)
         return false;
     // Read response
     int rd = receiveMessage(servoId, 1, response);
+    updateSlot(servoId, rd, response[0]);
     if (rd < 0)
         return false;
     return response[0] == 0x00;
@@ -66,81 +310,126 @@ bool STSServoDriver::ping(byte const &servoId)
 
 bool STSServoDriver::setId(byte const &oldServoId, byte const &newServoId)
 {
-    if (servoType_[oldServoId] == ServoType::UNKNOWN)
-    {
-        determineServoType(oldServoId);
-    }
-
+    STS_STACK_SCOPE(STSStackApi::EEPROM_WRITE);
     if (oldServoId >= 0xFE || newServoId >= 0xFE)
         return false;
     if (ping(newServoId))
         return false; // address taken
 
-    unsigned char lockRegister = STSRegisters::WRITE_LOCK;
-    if (servoType_[oldServoId] == ServoType::SCS)
-    {
-        lockRegister = STSRegisters::TORQUE_LIMIT; // On SCS, this has been remapped.
-    }
+    byte const lock = lockRegister(oldServoId);
     // Unlock EEPROM
-    if (!writeRegister(oldServoId, lockRegister, 0))
+    if (!writeRegister(oldServoId, lock, 0))
         return false;
     // Write new ID
     if (!writeRegister(oldServoId, STSRegisters::ID, newServoId))
         return false;
     // Lock EEPROM
-    if (!writeRegister(newServoId, lockRegister, 1))
+    if (!writeRegister(newServoId, lock, 1))
         return false;
-    // Update servo type cache.
-    servoType_[newServoId] = servoType_[oldServoId];
-    servoType_[oldServoId] = ServoType::UNKNOWN;
+    // Update servo type cache: the slot now belongs to the new ID.
+    removeSlot(newServoId);
+    ServoSlot *slot = findSlot(oldServoId);
+    if (slot != nullptr)
+        slotIds_[slot - slots_] = newServoId;
     return ping(newServoId);
 }
 
+byte STSServoDriver::getCapabilities(byte const &servoId)
+{
+    STS_STACK_SCOPE(STSStackApi::PING);
+    ServoSlot *slot = findSlot(servoId);
+#if STS_ENABLE_SCS
+    if (slot == nullptr || !(slot->capabilities & STSCapabilities::PROBED))
+    {
+        determineServoType(servoId);
+        slot = findSlot(servoId);
+    }
+#endif
+    return slot == nullptr ? 0 : slot->capabilities;
+}
+
+#if STS_ENABLE_SCS
+void STSServoDriver::setBusType(ServoType const &type)
+{
+    busType_ = type;
+}
+#endif
+
+byte STSServoDriver::getKnownServoCount() const
+{
+    return nSlots_;
+}
+
+byte STSServoDriver::getKnownServoId(byte const &index) const
+{
+    return slotIds_[index];
+}
+
 bool STSServoDriver::setPositionOffset(byte const &servoId, int const &positionOffset)
 {
-    if (!writeRegister(servoId, STSRegisters::WRITE_LOCK, 0))
+    STS_STACK_SCOPE(STSStackApi::EEPROM_WRITE);
+    byte const lock = lockRegister(servoId);
+    if (!writeRegister(servoId, lock, 0))
         return false;
     // Write new position offset
     if (!writeTwoBytesRegister(servoId, STSRegisters::POSITION_CORRECTION, positionOffset))
         return false;
     // Lock EEPROM
-    if (!writeRegister(servoId, STSRegisters::WRITE_LOCK, 1))
+    if (!writeRegister(servoId, lock, 1))
         return false;
     return true;
 }
 
 int STSServoDriver::getCurrentPosition(byte const &servoId)
 {
+    STS_STACK_SCOPE(STSStackApi::READ_REGISTER);
     return readTwoBytesRegister(servoId, STSRegisters::CURRENT_POSITION);
 }
 
 int STSServoDriver::getCurrentSpeed(byte const &servoId)
 {
+    STS_STACK_SCOPE(STSStackApi::READ_REGISTER);
     return readTwoBytesRegister(servoId, STSRegisters::CURRENT_SPEED);
 }
 
 int STSServoDriver::getCurrentTemperature(byte const &servoId)
 {
+    STS_STACK_SCOPE(STSStackApi::READ_REGISTER);
     return readTwoBytesRegister(servoId, STSRegisters::CURRENT_TEMPERATURE);
 }
 
+#if STS_ENABLE_FLOAT
 float STSServoDriver::getCurrentCurrent(byte const &servoId)
 {
+    STS_STACK_SCOPE(STSStackApi::READ_REGISTER);
     int16_t current = readTwoBytesRegister(servoId, STSRegisters::CURRENT_CURRENT);
     return current * 0.0065;
 }
+#endif
+
+int STSServoDriver::getCurrentCurrentMilliamps(byte const &servoId)
+{
+    STS_STACK_SCOPE(STSStackApi::READ_REGISTER);
+    // One unit is 6.5mA.
+    int32_t current = readTwoBytesRegister(servoId, STSRegisters::CURRENT_CURRENT);
+    return static_cast<int>(current * 13 / 2);
+}
 
 bool STSServoDriver::isMoving(byte const &servoId)
 {
+    STS_STACK_SCOPE(STSStackApi::READ_REGISTER);
     byte const result = readRegister(servoId, STSRegisters::MOVING_STATUS);
     return result > 0;
 }
 
 bool STSServoDriver::setTargetPosition(byte const &servoId, int const &position, int const &speed, bool const &asynchronous)
 {
+    STS_STACK_SCOPE(STSStackApi::WRITE_REGISTER);
     byte params[6] = {0, 0, // Position
         0, 0, // Padding
         0, 0}; // Velocity
+    if (servoId == STS_BROADCAST_ID && servoType(servoId) == ServoType::UNKNOWN)
+        return false;
     convertIntToBytes(servoId, position, &params[0]);
     convertIntToBytes(servoId, speed, &params[4]);
     return writeRegisters(servoId, STSRegisters::TARGET_POSITION, sizeof(params), params, asynchronous);
@@ -148,32 +437,65 @@ bool STSServoDriver::setTargetPosition(byte const &servoId, int const &position,
 
 bool STSServoDriver::setTargetVelocity(byte const &servoId, int const &velocity, bool const &asynchronous)
 {
+    STS_STACK_SCOPE(STSStackApi::WRITE_REGISTER);
     return writeTwoBytesRegister(servoId, STSRegisters::RUNNING_SPEED, velocity, asynchronous);
 }
 
 bool STSServoDriver::setTargetAcceleration(byte const &servoId, byte const &acceleration, bool const &asynchronous)
 {
+    STS_STACK_SCOPE(STSStackApi::WRITE_REGISTER);
     return writeRegister(servoId, STSRegisters::TARGET_ACCELERATION, acceleration, asynchronous);
 }
 
 bool STSServoDriver::setMode(unsigned char const& servoId, STSMode const& mode)
 {
+    STS_STACK_SCOPE(STSStackApi::WRITE_REGISTER);
     return writeRegister(servoId, STSRegisters::OPERATION_MODE, static_cast<unsigned char>(mode));
 }
 
-
+#if STS_ENABLE_ASYNC
 bool STSServoDriver::trigerAction()
 {
+    STS_STACK_SCOPE(STSStackApi::WRITE_REGISTER);
     byte noParam = 0;
-    int send = sendMessage(0xFE, instruction::ACTION, 0, &noParam);
+    int send = sendMessage(STS_BROADCAST_ID, instruction::ACTION, 0, &noParam);
     return send == 6;
 }
+#endif
 
 int STSServoDriver::sendMessage(byte const &servoId,
                                 byte const &commandID,
                                 byte const &paramLength,
                                 byte *parameters)
 {
+    STS_PROFILE(STSProfile::SEND_MESSAGE);
+#if STS_ENABLE_TX_PIPELINE
+    // Keep the frames in order, and the bus free for replies.
+    if (txPipeline_ != nullptr)
+    {
+        STS_WAIT_BEGIN();
+        txPipeline_->flush();
+        STS_WAIT_END();
+    }
+#endif
+    // Drop the bytes left from earlier transactions (e.g. status replies of writes, which are not read),
+    // so that the bytes read next are the reply to this request. After a failed reply, late replies may
+    // still be on their way: wait for the bus to be silent, lest they be taken for the reply to this request.
+    bool const answered = commandID == instruction::PING_ || commandID == instruction::READ
+                          || commandID == instruction::SYNCREAD;
+    if (answered)
+    {
+        bool dropped;
+        do
+        {
+            if (receiveFailed_)
+                delayMicroseconds(BUS_IDLE_US);
+            dropped = false;
+            while (port_->read() != -1)
+                dropped = true;
+        } while (receiveFailed_ && dropped);
+        receiveFailed_ = false;
+    }
     byte message[6 + paramLength];
     byte checksum = servoId + paramLength + 2 + commandID;
     message[0] = 0xFF;
@@ -190,12 +512,23 @@ int STSServoDriver::sendMessage(byte const &servoId,
     if (this->dirPin_ < 255){
         digitalWrite(dirPin_, HIGH);
     }
+    STS_STACK_MARK(paramLength, 0, 0);
+    STS_WAIT_BEGIN();
     int ret = port_->write(message, 6 + paramLength);
     if (this->dirPin_ < 255){
         digitalWrite(dirPin_, LOW);
     }
-    // Give time for the message to be processed.
-    delayMicroseconds(200);
+#if STS_ENABLE_STATISTICS
+    statistics_.transactions++;
+    statistics_.bytesSent += ret;
+    if (answered)
+        requestEnd_ = micros();
+#endif
+    // Give time for the message to be processed, and the status reply of a write, which is not read, to be sent.
+    // Nothing replies to a broadcast write, and replies that are read are consumed as soon as they arrive.
+    if (servoId != STS_BROADCAST_ID && !answered)
+        delayMicroseconds(200);
+    STS_WAIT_END();
     return ret;
 }
 
@@ -221,6 +554,7 @@ bool STSServoDriver::writeRegister(byte const &servoId,
                                    byte const &value,
                                    bool const &asynchronous)
 {
+    STS_STACK_SCOPE(STSStackApi::WRITE_REGISTER);
     return writeRegisters(servoId, registerId, 1, &value, asynchronous);
 }
 
@@ -229,6 +563,10 @@ bool STSServoDriver::writeTwoBytesRegister(byte const &servoId,
                                            int16_t const &value,
                                            bool const &asynchronous)
 {
+    STS_STACK_SCOPE(STSStackApi::WRITE_REGISTER);
+    // SCS and STS servos encode values differently: there is no single broadcast for a mixed bus.
+    if (servoId == STS_BROADCAST_ID && servoType(servoId) == ServoType::UNKNOWN)
+        return false;
     byte params[2] = {0, 0};
     convertIntToBytes(servoId, value, params);
     return writeRegisters(servoId, registerId, 2, params, asynchronous);
@@ -236,6 +574,7 @@ bool STSServoDriver::writeTwoBytesRegister(byte const &servoId,
 
 byte STSServoDriver::readRegister(byte const &servoId, byte const &registerId)
 {
+    STS_STACK_SCOPE(STSStackApi::READ_REGISTER);
     byte result = 0;
     int rc = readRegisters(servoId, registerId, 1, &result);
     if (rc < 0)
@@ -245,36 +584,17 @@ byte STSServoDriver::readRegister(byte const &servoId, byte const &registerId)
 
 int16_t STSServoDriver::readTwoBytesRegister(byte const &servoId, byte const &registerId)
 {
-    if (servoType_[servoId] == ServoType::UNKNOWN)
-    {
-        determineServoType(servoId);
-    }
-
+    STS_STACK_SCOPE(STSStackApi::READ_REGISTER);
     unsigned char result[2] = {0, 0};
-    int16_t value = 0;
-    int16_t signedValue = 0;
     int rc = readRegisters(servoId, registerId, 2, result);
     if (rc < 0)
         return 0;
-    switch(servoType_[servoId])
-    {
-        case ServoType::SCS:
-            value = static_cast<int16_t>(result[1] +  (result[0] << 8));
-            // Bit 15 is sign
-            signedValue = value & ~0x8000;
-            if (value & 0x8000)
-                signedValue = -signedValue;
-            return signedValue;
-        case ServoType::STS:
-            value = static_cast<int16_t>(result[0] +  (result[1] << 8));
-            // Bit 15 is sign
-            signedValue = value & ~0x8000;
-            if (value & 0x8000)
-                signedValue = -signedValue;
-            return signedValue;
-        default:
-            return 0;
-    }
+    return convertBytesToInt(servoId, result);
+}
+
+int16_t STSServoDriver::convertBytesToInt(byte const& servoId, byte const bytes[2])
+{
+    return decodeWord(servoType(servoId), bytes);
 }
 
 int STSServoDriver::readRegisters(byte const &servoId,
@@ -283,9 +603,6 @@ int STSServoDriver::readRegisters(byte const &servoId,
                                   byte *outputBuffer)
 {
     byte readParam[2] = {startRegister, readLength};
-    // Flush
-    while (port_->read() != -1)
-        ;;
     int send = sendMessage(servoId, instruction::READ, 2, readParam);
     // Failed to send
     if (send != 8)
@@ -293,6 +610,7 @@ int STSServoDriver::readRegisters(byte const &servoId,
     // Read
     byte result[readLength + 1];
     int rd = receiveMessage(servoId, readLength + 1, result);
+    updateSlot(servoId, rd, result[0]);
     if (rd < 0)
         return rd;
 
@@ -305,41 +623,130 @@ int STSServoDriver::receiveMessage(byte const& servoId,
                                    byte const& readLength,
                                    byte *outputBuffer)
 {
+    byte replyId = 0;
+    int rc = receiveAnyMessage(replyId, readLength, outputBuffer);
+    if (rc < 0)
+        return rc;
+    if (replyId != servoId)
+    {
+        receiveFailed_ = true;
+        return -2;
+    }
+    return 0;
+}
+
+int STSServoDriver::receiveAnyMessage(byte &servoId,
+                                      byte const& readLength,
+                                      byte *outputBuffer)
+{
+    STS_PROFILE(STSProfile::RECEIVE_MESSAGE);
     if (this->dirPin_ < 255){
         digitalWrite(dirPin_, LOW);
     }
-    
-    byte result[readLength + 5];
-    size_t rd = port_->readBytes(result, readLength + 5);
-    if (rd != (unsigned short)(readLength + 5))
-        return -1;
-    // Check message integrity
-    if (result[0] != 0xFF || result[1] != 0xFF || result[2] != servoId || result[3] != readLength + 1)
-        return -2;
-    byte checksum = 0;
-    for (int i = 2; i < readLength + 4; i++)
-        checksum += result[i];
-    checksum = ~checksum;
-    if (result[readLength + 4] != checksum)
-        return -3;
 
-    // Copy result to output buffer
-    for (int i = 0; i < readLength; i++)
-        outputBuffer[i] = result[i + 4];
-    return 0;
+    // Bytes are consumed one by one as they arrive: the replies to a batch never pile up in the serial
+    // buffer, and only the frame in flight is held. A lost or stray byte costs a single reply: the parser
+    // hunts for the next header instead of reading a fixed number of bytes.
+    byte state = receiveState::HEADER;
+    byte checksum = 0;
+    byte received = 0;
+    int skipped = 0;
+    STS_STACK_MARK(0, readLength, 0);
+    while (true)
+    {
+        byte value;
+        STS_WAIT_BEGIN();
+        size_t const rd = port_->readBytes(&value, 1);
+        STS_WAIT_END();
+        if (rd != 1)
+        {
+#if STS_ENABLE_STATISTICS
+            statistics_.timeouts++;
+#endif
+            receiveFailed_ = true;
+            return -1;
+        }
+#if STS_ENABLE_STATISTICS
+        statistics_.bytesReceived++;
+#endif
+        // More garbage than the largest frame: the replies are lost.
+        if (skipped > MAX_FRAME_LENGTH)
+        {
+#if STS_ENABLE_STATISTICS
+            statistics_.errors++;
+#endif
+            receiveFailed_ = true;
+            return -2;
+        }
+        switch (state)
+        {
+            case receiveState::HEADER:
+            case receiveState::HEADER_2:
+                if (value == 0xFF)
+                    state++;
+                else
+                {
+                    state = receiveState::HEADER;
+                    skipped++;
+                }
+                break;
+            case receiveState::ID:
+                // Extra 0xFF before the ID are part of the header.
+                if (value == 0xFF)
+                    break;
+                if (value == STS_BROADCAST_ID)
+                {
+                    state = receiveState::HEADER;
+                    skipped += 3;
+                    break;
+                }
+                servoId = value;
+                checksum = value;
+                state = receiveState::LENGTH;
+                break;
+            case receiveState::LENGTH:
+                // Not the reply expected, e.g. the status reply of a write: hunt for the next header.
+                if (value != readLength + 1)
+                {
+                    state = receiveState::HEADER;
+                    skipped += 4;
+                    break;
+                }
+                checksum += value;
+                state = readLength > 0 ? receiveState::DATA : receiveState::CHECKSUM;
+                break;
+            case receiveState::DATA:
+                outputBuffer[received++] = value;
+                checksum += value;
+                if (received == readLength)
+                    state = receiveState::CHECKSUM;
+                break;
+            default:
+                if (value != static_cast<byte>(~checksum))
+                {
+#if STS_ENABLE_STATISTICS
+                    statistics_.errors++;
+#endif
+                    receiveFailed_ = true;
+                    return -3;
+                }
+#if STS_ENABLE_STATISTICS
+                recordLatency();
+#endif
+                return 0;
+        }
+    }
 }
 
 void STSServoDriver::convertIntToBytes(byte const& servoId, int const &value, byte result[2])
 {
+    STS_PROFILE(STSProfile::CONVERT_INT_TO_BYTES);
     uint16_t servoValue = 0;
-    if (servoType_[servoId] == ServoType::UNKNOWN)
-    {
-        determineServoType(servoId);
-    }
 
     // Handle different servo type.
-    switch(servoType_[servoId])
+    switch(servoType(servoId))
     {
+#if STS_ENABLE_SCS
         case ServoType::SCS:
             // Little endian ; byte 10 is sign.
             servoValue = abs(value);
@@ -348,6 +755,7 @@ void STSServoDriver::convertIntToBytes(byte const& servoId, int const &value, by
             // Invert endianness
             servoValue = (servoValue >> 8) + ((servoValue & 0xFF) << 8);
             break;
+#endif
         case ServoType::STS:
         default:
             servoValue = abs(value);
@@ -359,44 +767,1149 @@ void STSServoDriver::convertIntToBytes(byte const& servoId, int const &value, by
     result[1] = static_cast<unsigned char>((servoValue >> 8) & 0xFF);
 }
 
+#if STS_ENABLE_BATCH
+#if STS_ENABLE_TX_PIPELINE
+void STSServoDriver::setTxPipeline(STSTxPipeline *pipeline)
+{
+    if (txPipeline_ != nullptr)
+        txPipeline_->flush();
+    txPipeline_ = pipeline;
+}
+#endif
+
+void STSServoDriver::sendByte(byte const &value)
+{
+#if STS_ENABLE_TX_PIPELINE
+    if (txFrame_ != nullptr)
+    {
+        // A frame longer than the buffer is still counted, to be discarded by endSyncWrite.
+        if (txLength_ < STS_TX_BUFFER_SIZE)
+            txFrame_[txLength_] = value;
+        txLength_++;
+        return;
+    }
+#endif
+    STS_WAIT_BEGIN();
+    port_->write(value);
+    STS_WAIT_END();
+}
+
 void STSServoDriver::sendAndUpdateChecksum(byte convertedValue[], byte &checksum)
 {
-    port_->write(convertedValue, 2);
+    sendByte(convertedValue[0]);
+    sendByte(convertedValue[1]);
     checksum += convertedValue[0] + convertedValue[1];
 }
 
+void STSServoDriver::beginSyncWrite(byte const &numberOfServos,
+                                    byte const &startRegister,
+                                    byte const &writeLength,
+                                    byte &checksum)
+{
+    byte const length = numberOfServos * (writeLength + 1) + 4;
+    STS_STACK_MARK(length - 2, 0, numberOfServos);
+#if STS_ENABLE_TX_PIPELINE
+    if (txPipeline_ != nullptr)
+    {
+        STS_WAIT_BEGIN();
+        txFrame_ = txPipeline_->beginFrame();
+        STS_WAIT_END();
+        txLength_ = 0;
+    }
+#endif
+    sendByte(0xFF);
+    sendByte(0xFF);
+    sendByte(STS_BROADCAST_ID);
+    sendByte(length);
+    sendByte(instruction::SYNCWRITE);
+    sendByte(startRegister);
+    sendByte(writeLength);
+    checksum = STS_BROADCAST_ID + length + instruction::SYNCWRITE + startRegister + writeLength;
+#if STS_ENABLE_STATISTICS
+    statistics_.transactions++;
+    statistics_.bytesSent += length + 4;
+#endif
+}
+
+void STSServoDriver::endSyncWrite(byte const &checksum)
+{
+    sendByte(~checksum);
+#if STS_ENABLE_TX_PIPELINE
+    if (txFrame_ != nullptr)
+    {
+        if (txLength_ <= STS_TX_BUFFER_SIZE)
+            txPipeline_->commitFrame(txLength_);
+        else
+            txPipeline_->discardFrame();
+        txFrame_ = nullptr;
+    }
+#endif
+}
+
+bool STSServoDriver::setBusServos(byte const &numberOfServos, const byte servoIds[])
+{
+    busDeclared_ = false;
+    for (int i = 0; i < numberOfServos; i++)
+        if (addSlot(servoIds[i]) == nullptr)
+            return false;
+    busDeclared_ = true;
+    return true;
+}
+
+bool STSServoDriver::coversBus(byte const &numberOfServos, const byte servoIds[])
+{
+    if (!busDeclared_ || numberOfServos < nSlots_)
+        return false;
+    for (byte s = 0; s < nSlots_; s++)
+    {
+        int i = 0;
+        while (i < numberOfServos && servoIds[i] != slotIds_[s])
+            i++;
+        if (i == numberOfServos)
+            return false;
+    }
+    return true;
+}
+
+bool STSServoDriver::isUniformMotion(byte const &numberOfServos,
+                                     const byte servoIds[],
+                                     const int positions[],
+                                     const int speeds[],
+                                     const byte accelerations[])
+{
+    if (numberOfServos < 2)
+        return false;
+    for (int i = 1; i < numberOfServos; i++)
+        if (positions[i] != positions[0] || speeds[i] != speeds[0]
+            || (accelerations != nullptr && accelerations[i] != accelerations[0]))
+            return false;
+    if (!coversBus(numberOfServos, servoIds))
+        return false;
+    // SCS and STS servos encode the same value differently.
+    ServoType const type = servoType(servoIds[0]);
+    for (int i = 1; i < numberOfServos; i++)
+        if (servoType(servoIds[i]) != type)
+            return false;
+    return true;
+}
+
+void STSServoDriver::syncWriteRegisters(byte const &numberOfServos,
+                                        const byte servoIds[],
+                                        byte const &startRegister,
+                                        byte const &writeLength,
+                                        const byte *data)
+{
+    STS_STACK_SCOPE(STSStackApi::SYNC_WRITE_REGISTERS);
+    // At least one servo per frame, whose length is a single byte.
+    if (numberOfServos == 0 || writeLength == 0 || writeLength > 255 - 5)
+        return;
+    STS_PROFILE(STSProfile::SYNC_WRITE_REGISTERS);
+    if (coversBus(numberOfServos, servoIds))
+    {
+        // Most common value.
+        int common = 0;
+        int commonCount = 1;
+        for (int i = 0; i + commonCount < numberOfServos; i++)
+        {
+            int count = 1;
+            for (int j = i + 1; j < numberOfServos; j++)
+                if (memcmp(&data[i * writeLength], &data[j * writeLength], writeLength) == 0)
+                    count++;
+            if (count > commonCount)
+            {
+                common = i;
+                commonCount = count;
+            }
+        }
+        // Wire size of a broadcast WRITE, then of a SYNC WRITE of the other servos, against a single SYNC WRITE.
+        int const others = numberOfServos - commonCount;
+        int const mixedCost = writeLength + 7 + (others > 0 ? 8 + others * (writeLength + 1) : 0);
+        if (mixedCost < 8 + numberOfServos * (writeLength + 1))
+        {
+            byte const *value = &data[common * writeLength];
+            writeRegisters(STS_BROADCAST_ID, startRegister, writeLength, value);
+            if (others > 0)
+                sendSyncWrites(numberOfServos, servoIds, startRegister, writeLength, data, others, value);
+            return;
+        }
+    }
+    sendSyncWrites(numberOfServos, servoIds, startRegister, writeLength, data, numberOfServos, nullptr);
+}
+
+void STSServoDriver::sendSyncWrites(byte const &numberOfServos,
+                                    const byte servoIds[],
+                                    byte const &startRegister,
+                                    byte const &writeLength,
+                                    const byte *data,
+                                    byte const &count,
+                                    const byte *skip)
+{
+    // The frame length is a single byte: large batches are split into several SYNC WRITE.
+    int const maxServos = (255 - 4) / (writeLength + 1);
+    int remaining = count;
+    int index = 0;
+    while (remaining > 0)
+    {
+        byte const frameServos = remaining < maxServos ? remaining : maxServos;
+        byte checksum;
+        beginSyncWrite(frameServos, startRegister, writeLength, checksum);
+        for (int sent = 0; sent < frameServos && index < numberOfServos; index++)
+        {
+            byte const *value = &data[index * writeLength];
+            if (skip != nullptr && memcmp(value, skip, writeLength) == 0)
+                continue;
+            sendByte(servoIds[index]);
+            checksum += servoIds[index];
+            for (int i = 0; i < writeLength; i++)
+            {
+                sendByte(value[i]);
+                checksum += value[i];
+            }
+            sent++;
+        }
+        endSyncWrite(checksum);
+        remaining -= frameServos;
+    }
+}
+
 void STSServoDriver::setTargetPositions(byte const &numberOfServos, const byte servoIds[],
                                         const int positions[],
                                         const int speeds[])
 {
-    port_->write(0xFF);
-    port_->write(0xFF);
-    port_->write(0XFE);
-    port_->write(numberOfServos * 7 + 4);
-    port_->write(instruction::SYNCWRITE);
-    port_->write(STSRegisters::TARGET_POSITION);
-    port_->write(6);
-    byte checksum = 0xFE + numberOfServos * 7 + 4 + instruction::SYNCWRITE + STSRegisters::TARGET_POSITION + 6;
+    STS_STACK_SCOPE(STSStackApi::SET_TARGET_POSITIONS);
+    if (isUniformMotion(numberOfServos, servoIds, positions, speeds, nullptr))
+    {
+        // Homing the whole bus: a single WRITE of the value all the servos encode the same way.
+        byte params[6] = {0, 0, 0, 0, 0, 0};
+        convertIntToBytes(servoIds[0], positions[0], &params[0]);
+        convertIntToBytes(servoIds[0], speeds[0], &params[4]);
+        writeRegisters(STS_BROADCAST_ID, STSRegisters::TARGET_POSITION, sizeof(params), params);
+        return;
+    }
+    // The frame length is a single byte: large batches are split into several SYNC WRITE, one after the other
+    // rather than recursively, so that the stack does not grow with the batch.
+    if (numberOfServos > MAX_SYNC_WRITE_SERVOS)
+    {
+        for (int first = 0; first < numberOfServos; first += MAX_SYNC_WRITE_SERVOS)
+        {
+            int const remaining = numberOfServos - first;
+            setTargetPositions(remaining < MAX_SYNC_WRITE_SERVOS ? remaining : MAX_SYNC_WRITE_SERVOS,
+                               &servoIds[first],
+                               &positions[first],
+                               &speeds[first]);
+        }
+        return;
+    }
+    STS_PROFILE(STSProfile::SET_TARGET_POSITIONS);
+    // Probe unknown servos before starting the frame: a probe in the middle of it would corrupt it.
+    for (int index = 0; index < numberOfServos; index++)
+        servoType(servoIds[index]);
+    byte checksum;
+    beginSyncWrite(numberOfServos, STSRegisters::TARGET_POSITION, 6, checksum);
     for (int index = 0; index < numberOfServos; index++)
     {
         checksum += servoIds[index];
-        port_->write(servoIds[index]);
+        sendByte(servoIds[index]);
+        byte intAsByte[2];
+        convertIntToBytes(servoIds[index], positions[index], intAsByte);
+        sendAndUpdateChecksum(intAsByte, checksum);
+        sendByte(0);
+        sendByte(0);
+        convertIntToBytes(servoIds[index], speeds[index], intAsByte);
+        sendAndUpdateChecksum(intAsByte, checksum);
+    }
+    endSyncWrite(checksum);
+}
+
+void STSServoDriver::setTargetMotions(byte const &numberOfServos,
+                                      const byte servoIds[],
+                                      const int positions[],
+                                      const int speeds[],
+                                      const byte accelerations[])
+{
+    STS_STACK_SCOPE(STSStackApi::SET_TARGET_POSITIONS);
+    if (isUniformMotion(numberOfServos, servoIds, positions, speeds, accelerations))
+    {
+        byte params[7] = {accelerations[0], 0, 0, 0, 0, 0, 0};
+        convertIntToBytes(servoIds[0], positions[0], &params[1]);
+        convertIntToBytes(servoIds[0], speeds[0], &params[5]);
+        writeRegisters(STS_BROADCAST_ID, STSRegisters::TARGET_ACCELERATION, sizeof(params), params);
+        return;
+    }
+    if (numberOfServos > MAX_SYNC_WRITE_MOTIONS)
+    {
+        for (int first = 0; first < numberOfServos; first += MAX_SYNC_WRITE_MOTIONS)
+        {
+            int const remaining = numberOfServos - first;
+            setTargetMotions(remaining < MAX_SYNC_WRITE_MOTIONS ? remaining : MAX_SYNC_WRITE_MOTIONS,
+                             &servoIds[first],
+                             &positions[first],
+                             &speeds[first],
+                             &accelerations[first]);
+        }
+        return;
+    }
+    STS_PROFILE(STSProfile::SET_TARGET_MOTIONS);
+    // Probe unknown servos before starting the frame: a probe in the middle of it would corrupt it.
+    for (int index = 0; index < numberOfServos; index++)
+        servoType(servoIds[index]);
+    // TARGET_ACCELERATION, TARGET_POSITION, RUNNING_TIME, RUNNING_SPEED
+    byte checksum;
+    beginSyncWrite(numberOfServos, STSRegisters::TARGET_ACCELERATION, 7, checksum);
+    for (int index = 0; index < numberOfServos; index++)
+    {
+        sendByte(servoIds[index]);
+        sendByte(accelerations[index]);
+        checksum += servoIds[index] + accelerations[index];
         byte intAsByte[2];
         convertIntToBytes(servoIds[index], positions[index], intAsByte);
         sendAndUpdateChecksum(intAsByte, checksum);
-        port_->write(0);
-        port_->write(0);
+        sendByte(0);
+        sendByte(0);
         convertIntToBytes(servoIds[index], speeds[index], intAsByte);
         sendAndUpdateChecksum(intAsByte, checksum);
     }
-    port_->write(~checksum);
+    endSyncWrite(checksum);
+}
+
+void STSServoDriver::setTargetVelocities(byte const &numberOfServos,
+                                         const byte servoIds[],
+                                         const int velocities[])
+{
+    STS_STACK_SCOPE(STSStackApi::SET_TARGET_VELOCITIES);
+    if (numberOfServos == 0)
+        return;
+    // Only the same velocity for the whole bus is broadcast: a broadcast of the most common one followed by a
+    // SYNC WRITE of the others would briefly command it to every servo.
+    if (isUniformMotion(numberOfServos, servoIds, velocities, velocities, nullptr))
+    {
+        byte params[2];
+        convertIntToBytes(servoIds[0], velocities[0], params);
+        writeRegisters(STS_BROADCAST_ID, STSRegisters::RUNNING_SPEED, sizeof(params), params);
+        return;
+    }
+    if (numberOfServos > MAX_SYNC_WRITE_VELOCITIES)
+    {
+        for (int first = 0; first < numberOfServos; first += MAX_SYNC_WRITE_VELOCITIES)
+        {
+            int const remaining = numberOfServos - first;
+            setTargetVelocities(remaining < MAX_SYNC_WRITE_VELOCITIES ? remaining : MAX_SYNC_WRITE_VELOCITIES,
+                                &servoIds[first],
+                                &velocities[first]);
+        }
+        return;
+    }
+    STS_PROFILE(STSProfile::SET_TARGET_VELOCITIES);
+    // Probe unknown servos before starting the frame: a probe in the middle of it would corrupt it.
+    for (int index = 0; index < numberOfServos; index++)
+        servoType(servoIds[index]);
+    byte checksum;
+    beginSyncWrite(numberOfServos, STSRegisters::RUNNING_SPEED, 2, checksum);
+    for (int index = 0; index < numberOfServos; index++)
+    {
+        sendByte(servoIds[index]);
+        checksum += servoIds[index];
+        byte intAsByte[2];
+        convertIntToBytes(servoIds[index], velocities[index], intAsByte);
+        sendAndUpdateChecksum(intAsByte, checksum);
+    }
+    endSyncWrite(checksum);
 }
+#endif
 
+#if STS_ENABLE_SCS
 void STSServoDriver::determineServoType(byte const& servoId)
 {
-    switch(readRegister(servoId, STSRegisters::SERVO_MAJOR))
+    // FIRMWARE_MAJOR, FIRMWARE_MINOR, (reserved), SERVO_MAJOR, SERVO_MINOR. The capabilities only depend on
+    // SERVO_MAJOR so far: the firmware revision is read in the same block, but no revision is known to differ.
+    // No room to cache the result: don't probe on every access, the servo is handled as STS.
+    // A broadcast read can never be answered: don't wait for a reply.
+    if ((findSlot(servoId) == nullptr && nSlots_ == STS_MAX_SERVOS) || servoId == STS_BROADCAST_ID)
+        return;
+    byte version[5];
+    if (readRegisters(servoId, STSRegisters::FIRMWARE_MAJOR, sizeof(version), version) < 0)
+        return;
+    ServoSlot *slot = addSlot(servoId);
+    if (slot == nullptr)
+        return;
+    slot->capabilities |= STSCapabilities::PROBED;
+    switch(version[STSRegisters::SERVO_MAJOR - STSRegisters::FIRMWARE_MAJOR])
+    {
+        case 9: slot->type = ServoType::STS; break;
+        case 5:
+            slot->type = ServoType::SCS;
+            // SCS firmwares predate the SYNC READ instruction.
+            slot->capabilities |= STSCapabilities::NO_SYNC_READ;
+            break;
+    }
+}
+
+ServoType STSServoDriver::broadcastType()
+{
+    if (busType_ != ServoType::UNKNOWN)
+        return busType_;
+    // Only the servos already probed count: probing the others would cost a read each.
+    ServoType type = ServoType::UNKNOWN;
+    for (byte i = 0; i < nSlots_; i++)
+    {
+        if (!(slots_[i].capabilities & STSCapabilities::PROBED) || slots_[i].type == ServoType::UNKNOWN)
+            continue;
+        if (type == ServoType::UNKNOWN)
+            type = slots_[i].type;
+        else if (slots_[i].type != type)
+            return ServoType::UNKNOWN;
+    }
+    return type == ServoType::UNKNOWN ? ServoType::STS : type;
+}
+
+#endif
+
+byte STSServoDriver::lockRegister(byte const& servoId)
+{
+#if STS_ENABLE_SCS
+    if (servoType(servoId) == ServoType::SCS)
+        return STSRegisters::TORQUE_LIMIT; // On SCS, this has been remapped.
+#else
+    (void) servoId;
+#endif
+    return STSRegisters::WRITE_LOCK;
+}
+
+ServoType STSServoDriver::servoType(byte const& servoId)
+{
+#if !STS_ENABLE_SCS
+    (void) servoId;
+    return ServoType::STS;
+#else
+    if (servoId == STS_BROADCAST_ID)
+        return broadcastType();
+    ServoSlot *slot = findSlot(servoId);
+    if (slot == nullptr || !(slot->capabilities & STSCapabilities::PROBED))
+    {
+        determineServoType(servoId);
+        slot = findSlot(servoId);
+        if (slot == nullptr)
+            return nSlots_ == STS_MAX_SERVOS ? ServoType::STS : ServoType::UNKNOWN;
+    }
+    return slot->type;
+#endif
+}
+
+STSServoDriver::ServoSlot *STSServoDriver::findSlot(byte const& servoId)
+{
+    if (lastSlot_ < nSlots_ && slotIds_[lastSlot_] == servoId)
+        return &slots_[lastSlot_];
+    for (byte i = 0; i < nSlots_; i++)
+        if (slotIds_[i] == servoId)
+        {
+            lastSlot_ = i;
+            return &slots_[i];
+        }
+    return nullptr;
+}
+
+STSServoDriver::ServoSlot *STSServoDriver::addSlot(byte const& servoId)
+{
+    ServoSlot *slot = findSlot(servoId);
+    if (slot != nullptr || servoId >= 0xFE || nSlots_ == STS_MAX_SERVOS)
+        return slot;
+    lastSlot_ = nSlots_;
+    slotIds_[nSlots_] = servoId;
+    slot = &slots_[nSlots_];
+    slot->capabilities = 0;
+    slot->status = 0;
+#if STS_ENABLE_SCS
+    slot->type = ServoType::UNKNOWN;
+    slot->reserved = 0;
+#endif
+#if STS_ENABLE_STATISTICS
+    slot->timeouts = 0;
+    slot->errors = 0;
+#endif
+    nSlots_++;
+    return slot;
+}
+
+void STSServoDriver::removeSlot(byte const& servoId)
+{
+    ServoSlot *slot = findSlot(servoId);
+    if (slot == nullptr)
+        return;
+    // Keep the table dense: the last slot takes the place of the removed one.
+    nSlots_--;
+    byte const index = slot - slots_;
+    slotIds_[index] = slotIds_[nSlots_];
+    slots_[index] = slots_[nSlots_];
+    lastSlot_ = 0;
+}
+
+void STSServoDriver::updateSlot(byte const& servoId, int const& receiveResult, byte const& status)
+{
+    // Only servos that answered get a slot.
+    ServoSlot *slot = receiveResult == 0 ? addSlot(servoId) : findSlot(servoId);
+    if (slot == nullptr)
+        return;
+    if (receiveResult == 0)
+        slot->status = status;
+#if STS_ENABLE_STATISTICS
+    else if (receiveResult == -1)
+        slot->timeouts++;
+    else
+        slot->errors++;
+#endif
+}
+
+#if STS_ENABLE_BATCH
+int STSServoDriver::syncReadRegisters(byte const &numberOfServos,
+                                      const byte servoIds[],
+                                      byte const &startRegister,
+                                      byte const &readLength,
+                                      byte *outputBuffer,
+                                      byte *responded)
+{
+    STS_STACK_SCOPE(STSStackApi::SYNC_READ_REGISTERS);
+    return syncRead(numberOfServos, servoIds, startRegister, readLength, copyReply, outputBuffer, responded, 0);
+}
+
+int STSServoDriver::syncRead(byte const &numberOfServos,
+                             const byte servoIds[],
+                             byte const &startRegister,
+                             byte const &readLength,
+                             ReplyHandler handler,
+                             void *context,
+                             byte *responded,
+                             byte const &offset,
+                             unsigned long const &singleTimeoutMs)
+{
+    // The frame length is a single byte: large batches are split into several SYNC READ.
+    if (numberOfServos > MAX_SYNC_READ_SERVOS)
+    {
+        int const nFirst = syncRead(MAX_SYNC_READ_SERVOS, servoIds, startRegister, readLength, handler, context,
+                                    responded, offset, singleTimeoutMs);
+        return nFirst + syncRead(numberOfServos - MAX_SYNC_READ_SERVOS,
+                                 &servoIds[MAX_SYNC_READ_SERVOS],
+                                 startRegister,
+                                 readLength,
+                                 handler,
+                                 context,
+                                 &responded[MAX_SYNC_READ_SERVOS / 8],
+                                 offset + MAX_SYNC_READ_SERVOS,
+                                 singleTimeoutMs);
+    }
+    STS_PROFILE(STSProfile::SYNC_READ_REGISTERS);
+    for (int i = 0; i < (numberOfServos + 7) / 8; i++)
+        responded[i] = 0;
+    if (numberOfServos == 0)
+        return 0;
+
+    int nResponses = 0;
+    // Frame in flight: status byte, then the registers.
+    byte result[readLength + 1];
+    // Servos known not to support SYNC READ are read one by one, the others in a single transaction.
+    byte readParam[numberOfServos + 2];
+    byte syncIndex[numberOfServos];
+    int nSync = 0;
+    STS_STACK_MARK(0, 0, numberOfServos);
+    readParam[0] = startRegister;
+    readParam[1] = readLength;
+    for (int i = 0; i < numberOfServos; i++)
+    {
+        ServoSlot const *slot = findSlot(servoIds[i]);
+        if (slot != nullptr && (slot->capabilities & STSCapabilities::NO_SYNC_READ))
+        {
+            if (singleTimeoutMs > 0)
+                port_->setTimeout(singleTimeoutMs);
+            int const read = readRegisters(servoIds[i], startRegister, readLength, result);
+            if (singleTimeoutMs > 0)
+                port_->setTimeout(RECEIVE_TIMEOUT_MS);
+            if (read == 0)
+            {
+                STS_EXCLUDE_BEGIN();
+                handler(context, offset + i, result, readLength);
+                STS_EXCLUDE_END();
+                responded[i / 8] |= 1 << (i % 8);
+                nResponses++;
+            }
+        }
+        else
+        {
+            readParam[nSync + 2] = servoIds[i];
+            syncIndex[nSync] = i;
+            nSync++;
+        }
+    }
+    if (nSync == 0)
+        return nResponses;
+
+    int send = sendMessage(STS_BROADCAST_ID, instruction::SYNCREAD, nSync + 2, readParam);
+    if (send != nSync + 8)
+        return nResponses;
+
+    // Servos answer in the order of the request, skipping the missing ones: match each reply
+    // by ID, and stop at the first timeout since no other reply will come after it. Each reply
+    // is handed over as soon as it is complete, while the next ones are still arriving.
+    int index = 0;
+    for (int attempt = 0; attempt < nSync && index < nSync; attempt++)
+    {
+        byte replyId = 0;
+        int rd = receiveAnyMessage(replyId, readLength + 1, result);
+        if (rd == -1)
+            break;
+        if (rd < 0)
+            continue;
+        while (index < nSync && readParam[index + 2] != replyId)
+            index++;
+        if (index == nSync)
+            break;
+        byte const i = syncIndex[index];
+        {
+            // The application code run on each reply is not the cost of the driver.
+            STS_EXCLUDE_BEGIN();
+            handler(context, offset + i, &result[1], readLength);
+            STS_EXCLUDE_END();
+        }
+        responded[i / 8] |= 1 << (i % 8);
+        updateSlot(replyId, 0, result[0]);
+        nResponses++;
+        index++;
+    }
+    for (int k = 0; k < nSync; k++)
+        if (!(responded[syncIndex[k] / 8] & (1 << (syncIndex[k] % 8))))
+            updateSlot(readParam[k + 2], -1, 0);
+    return nResponses;
+}
+
+int STSServoDriver::pingServos(byte const &numberOfServos,
+                               const byte servoIds[],
+                               byte *alive,
+                               byte *statuses)
+{
+    STS_STACK_SCOPE(STSStackApi::PING_SERVOS);
+    byte status[numberOfServos];
+    for (int i = 0; i < numberOfServos; i++)
+        status[i] = 0;
+    // The servos without SYNC READ (e.g. SCS) are read one by one: a missing one costs the short timeout only.
+    int nAlive = syncRead(numberOfServos, servoIds, STSRegisters::STATUS, 1, copyReply, status, alive, 0,
+                          PING_SWEEP_TIMEOUT_MS);
+
+    if (nAlive == 0)
+    {
+        // No answer at all: SYNC READ may not be supported, fall back to a short-timeout sweep of the servos it
+        // was sent to, the others having just been read one by one.
+        port_->setTimeout(PING_SWEEP_TIMEOUT_MS);
+        for (int i = 0; i < numberOfServos; i++)
+        {
+            ServoSlot const *known = findSlot(servoIds[i]);
+            if (known != nullptr && (known->capabilities & STSCapabilities::NO_SYNC_READ))
+                continue;
+            if (readRegisters(servoIds[i], STSRegisters::STATUS, 1, &status[i]) == 0)
+            {
+                alive[i / 8] |= 1 << (i % 8);
+                nAlive++;
+#if STS_ENABLE_SCS
+                // A single lost frame also lands here: only the servos that may lack SYNC READ are flagged, the
+                // SCS ones by determineServoType, and those of unknown type. STS servos keep their SYNC READ, and
+                // servos whose probe failed are probed again next time.
+                ServoSlot *slot = findSlot(servoIds[i]);
+                if (slot == nullptr || !(slot->capabilities & STSCapabilities::PROBED))
+                {
+                    determineServoType(servoIds[i]);
+                    slot = findSlot(servoIds[i]);
+                }
+                if (slot != nullptr && (slot->capabilities & STSCapabilities::PROBED)
+                    && slot->type == ServoType::UNKNOWN)
+                    slot->capabilities |= STSCapabilities::NO_SYNC_READ;
+#endif
+            }
+            else
+                status[i] = 0;
+        }
+        port_->setTimeout(RECEIVE_TIMEOUT_MS);
+    }
+
+    if (statuses != nullptr)
+        for (int i = 0; i < numberOfServos; i++)
+            statuses[i] = status[i];
+    return nAlive;
+}
+
+int STSServoDriver::readTelemetry(byte const &numberOfServos,
+                                  const byte servoIds[],
+                                  STSTelemetry *telemetry,
+                                  byte *responded)
+{
+    STS_STACK_SCOPE(STSStackApi::READ_TELEMETRY);
+    // The replies are stored straight into telemetry, raw. They are decoded once the bus is idle:
+    // decoding may need to read the type of a servo.
+    int nResponded = syncRead(numberOfServos, servoIds, STSRegisters::CURRENT_POSITION, TELEMETRY_LENGTH,
+                              storeTelemetry, telemetry, responded, 0);
+    for (int i = 0; i < numberOfServos; i++)
+    {
+        if (!(responded[i / 8] & (1 << (i % 8))))
+            continue;
+        byte bytes[2];
+        wordToBytes(telemetry[i].position, bytes);
+        telemetry[i].position = convertBytesToInt(servoIds[i], bytes);
+        wordToBytes(telemetry[i].speed, bytes);
+        telemetry[i].speed = convertBytesToInt(servoIds[i], bytes);
+        wordToBytes(telemetry[i].current, bytes);
+        telemetry[i].current = convertBytesToInt(servoIds[i], bytes);
+    }
+    return nResponded;
+}
+
+int STSServoDriver::readTelemetry(byte const &numberOfServos,
+                                  const byte servoIds[],
+                                  STSTelemetryCallback callback,
+                                  void *context,
+                                  byte *responded)
+{
+    STS_STACK_SCOPE(STSStackApi::READ_TELEMETRY);
+    if (numberOfServos == 0)
+        return 0;
+    // Probe unknown servos before the SYNC READ: the replies are decoded while the next ones arrive.
+    ServoType types[numberOfServos];
+    for (int i = 0; i < numberOfServos; i++)
+        types[i] = servoType(servoIds[i]);
+    TelemetryForward forward = {types, callback, context};
+    return syncRead(numberOfServos, servoIds, STSRegisters::CURRENT_POSITION, TELEMETRY_LENGTH,
+                    forwardTelemetry, &forward, responded, 0);
+}
+
+int STSServoDriver::readPositions(byte const &numberOfServos,
+                                  const byte servoIds[],
+                                  int16_t positions[],
+                                  byte *responded)
+{
+    STS_STACK_SCOPE(STSStackApi::READ_TELEMETRY);
+    int nResponded = syncRead(numberOfServos, servoIds, STSRegisters::CURRENT_POSITION, 2,
+                              storePosition, positions, responded, 0);
+    for (int i = 0; i < numberOfServos; i++)
+    {
+        if (!(responded[i / 8] & (1 << (i % 8))))
+            continue;
+        byte bytes[2];
+        wordToBytes(positions[i], bytes);
+        positions[i] = convertBytesToInt(servoIds[i], bytes);
+    }
+    return nResponded;
+}
+#endif
+
+#if STS_ENABLE_CONFIG_CHECK
+bool STSServoDriver::captureConfiguration(byte const &servoId, STSConfigProfile &profile)
+{
+    STS_STACK_SCOPE(STSStackApi::CONFIGURATION);
+    if (readRegisters(servoId, STSConfigRegion::START, STSConfigRegion::LENGTH, profile.values) != 0)
+        return false;
+    memset(profile.mask, 0xFF, sizeof(profile.mask));
+    // Calibration of each servo, see setPositionOffset.
+    ignoreConfigurationRegisters(profile, STSRegisters::POSITION_CORRECTION, 2);
+    return true;
+}
+
+void STSServoDriver::ignoreConfigurationRegisters(STSConfigProfile &profile,
+                                                  byte const &registerId,
+                                                  byte const &length)
+{
+    for (int r = registerId; r < registerId + length; r++)
+    {
+        int const i = r - STSConfigRegion::START;
+        if (i >= 0 && i < STSConfigRegion::LENGTH)
+            profile.mask[i / 8] &= ~(1 << (i % 8));
+    }
+    profile.digest = configDigest(profile.values, profile.mask);
+}
+
+int STSServoDriver::checkConfiguration(byte const &numberOfServos,
+                                       const byte servoIds[],
+                                       STSConfigProfile const &profile,
+                                       STSConfigDrift drift[],
+                                       byte *responded)
+{
+    STS_STACK_SCOPE(STSStackApi::CONFIGURATION);
+    ConfigCheck check = {&profile, drift, 0};
+    syncRead(numberOfServos, servoIds, STSConfigRegion::START, STSConfigRegion::LENGTH, checkConfigReply, &check,
+             responded, 0);
+    return check.nDrifted;
+}
+
+int STSServoDriver::repairConfiguration(byte const &servoId,
+                                        STSConfigProfile const &profile,
+                                        STSConfigDrift const &drift)
+{
+    STS_STACK_SCOPE(STSStackApi::CONFIGURATION);
+    int nWritten = 0;
+    byte const lock = lockRegister(servoId);
+    bool unlocked = false;
+    int i = 0;
+    while (i < STSConfigRegion::LENGTH)
     {
-        case 9: servoType_[servoId] = ServoType::STS; break;
-        case 5: servoType_[servoId] = ServoType::SCS; break;
+        if (!isChecked(drift.mismatched, i))
+        {
+            i++;
+            continue;
+        }
+        // Run of adjacent mismatched registers: one WRITE, so that the EEPROM is written as little as possible.
+        int length = 1;
+        while (i + length < STSConfigRegion::LENGTH && isChecked(drift.mismatched, i + length))
+            length++;
+        if (!unlocked && !writeRegister(servoId, lock, 0))
+            return -1;
+        unlocked = true;
+        if (!writeRegisters(servoId, STSConfigRegion::START + i, length, &profile.values[i]))
+            nWritten = -1;
+        else if (nWritten >= 0)
+            nWritten += length;
+        i += length;
     }
+    // Lock EEPROM
+    if (unlocked && !writeRegister(servoId, lock, 1))
+        return -1;
+    return nWritten;
 }
+#endif
+
+#if STS_ENABLE_SUBSCRIPTIONS
+int STSServoDriver::subscribe(byte const &servoId,
+                              byte const &registerId,
+                              byte const &length,
+                              byte const &condition,
+                              int16_t const &threshold,
+                              uint16_t const &hysteresis,
+                              STSNotificationCallback callback,
+                              void *context)
+{
+    if (servoId >= 0xFE || (length != 1 && length != 2) || condition > STSCondition::ANY_BIT_SET || callback == nullptr)
+        return -1;
+    for (int i = 0; i < STS_MAX_SUBSCRIPTIONS; i++)
+    {
+        Subscription &subscription = subscriptions_[i];
+        if (subscription.state & subscriptionState::IN_USE)
+            continue;
+        subscription.callback = callback;
+        subscription.context = context;
+        subscription.threshold = threshold;
+        subscription.hysteresis = hysteresis;
+        subscription.reference = 0;
+        subscription.servoId = servoId;
+        subscription.registerId = registerId;
+        subscription.length = length;
+        subscription.condition = condition;
+        subscription.state = subscriptionState::IN_USE;
+        nReadGroups_ = 0xFF;
+        return i;
+    }
+    return -1;
+}
+
+void STSServoDriver::unsubscribe(int const &handle)
+{
+    if (handle < 0 || handle >= STS_MAX_SUBSCRIPTIONS)
+        return;
+    subscriptions_[handle].state = 0;
+    nReadGroups_ = 0xFF;
+}
+
+int STSServoDriver::updateSubscriptions()
+{
+    STS_STACK_SCOPE(STSStackApi::UPDATE_SUBSCRIPTIONS);
+    if (nReadGroups_ == 0xFF)
+        planSubscriptions();
+
+    int nNotifications = 0;
+    bool missing = false;
+    for (int g = 0; g < nReadGroups_; g++)
+    {
+        ReadGroup const group = readGroups_[g];
+        // Servos of the group, each listed once.
+        byte servoIds[STS_MAX_SUBSCRIPTIONS];
+        byte nServos = 0;
+        for (int i = 0; i < STS_MAX_SUBSCRIPTIONS; i++)
+        {
+            Subscription const &subscription = subscriptions_[i];
+            if (!(subscription.state & subscriptionState::IN_USE) || subscription.group != g)
+                continue;
+            int k = 0;
+            while (k < nServos && servoIds[k] != subscription.servoId)
+                k++;
+            if (k == nServos)
+                servoIds[nServos++] = subscription.servoId;
+        }
+        if (nServos == 0)
+            continue;
+
+        byte data[nServos * group.readLength];
+        byte responded[(STS_MAX_SUBSCRIPTIONS + 7) / 8];
+        if (syncReadRegisters(nServos, servoIds, group.startRegister, group.readLength, data, responded) < nServos)
+            missing = true;
+
+        for (int i = 0; i < STS_MAX_SUBSCRIPTIONS; i++)
+        {
+            Subscription &subscription = subscriptions_[i];
+            if (!(subscription.state & subscriptionState::IN_USE) || subscription.group != g)
+                continue;
+            int k = 0;
+            while (servoIds[k] != subscription.servoId)
+                k++;
+            if (!(responded[k / 8] & (1 << (k % 8))))
+                continue;
+            byte const *value = data + k * group.readLength + subscription.registerId - group.startRegister;
+            int16_t const v = subscription.length == 2 ? convertBytesToInt(subscription.servoId, value) : *value;
+            if (evaluateSubscription(subscription, v))
+            {
+                nNotifications++;
+                subscription.callback(subscription.servoId,
+                                      subscription.registerId,
+                                      v,
+                                      subscription.state & subscriptionState::ACTIVE,
+                                      subscription.context);
+            }
+        }
+    }
+    return missing ? -1 : nNotifications;
+}
+
+void STSServoDriver::planSubscriptions()
+{
+    // Start with one group per servo, spanning all its subscribed registers.
+    byte servoIds[STS_MAX_SUBSCRIPTIONS];
+    byte groupOfServo[STS_MAX_SUBSCRIPTIONS];
+    byte start[STS_MAX_SUBSCRIPTIONS];
+    byte end[STS_MAX_SUBSCRIPTIONS];
+    byte size[STS_MAX_SUBSCRIPTIONS];
+    byte nServos = 0;
+    for (int i = 0; i < STS_MAX_SUBSCRIPTIONS; i++)
+    {
+        Subscription const &subscription = subscriptions_[i];
+        if (!(subscription.state & subscriptionState::IN_USE))
+            continue;
+        int k = 0;
+        while (k < nServos && servoIds[k] != subscription.servoId)
+            k++;
+        byte const last = subscription.registerId + subscription.length;
+        if (k == nServos)
+        {
+            servoIds[k] = subscription.servoId;
+            groupOfServo[k] = k;
+            start[k] = subscription.registerId;
+            end[k] = last;
+            size[k] = 1;
+            nServos++;
+        }
+        if (subscription.registerId < start[k])
+            start[k] = subscription.registerId;
+        if (last > end[k])
+            end[k] = last;
+    }
+
+    // Merge the two groups saving the most bus time, as long as a merge saves anything.
+    while (true)
+    {
+        int bestSaving = 0;
+        int bestA = -1;
+        int bestB = -1;
+        for (int a = 0; a < nServos; a++)
+        {
+            if (size[a] == 0)
+                continue;
+            for (int b = a + 1; b < nServos; b++)
+            {
+                if (size[b] == 0)
+                    continue;
+                byte const s = start[a] < start[b] ? start[a] : start[b];
+                byte const e = end[a] > end[b] ? end[a] : end[b];
+                int const saving = syncReadCost(size[a], end[a] - start[a]) + syncReadCost(size[b], end[b] - start[b])
+                                   - syncReadCost(size[a] + size[b], e - s);
+                if (saving > bestSaving)
+                {
+                    bestSaving = saving;
+                    bestA = a;
+                    bestB = b;
+                }
+            }
+        }
+        if (bestA < 0)
+            break;
+        if (start[bestB] < start[bestA])
+            start[bestA] = start[bestB];
+        if (end[bestB] > end[bestA])
+            end[bestA] = end[bestB];
+        size[bestA] += size[bestB];
+        size[bestB] = 0;
+        for (int k = 0; k < nServos; k++)
+            if (groupOfServo[k] == bestB)
+                groupOfServo[k] = bestA;
+    }
+
+    // Number the remaining groups, and assign them to the subscriptions.
+    byte groupIndex[STS_MAX_SUBSCRIPTIONS];
+    nReadGroups_ = 0;
+    for (int g = 0; g < nServos; g++)
+    {
+        if (size[g] == 0)
+            continue;
+        groupIndex[g] = nReadGroups_;
+        readGroups_[nReadGroups_].startRegister = start[g];
+        readGroups_[nReadGroups_].readLength = end[g] - start[g];
+        nReadGroups_++;
+    }
+    for (int i = 0; i < STS_MAX_SUBSCRIPTIONS; i++)
+    {
+        Subscription &subscription = subscriptions_[i];
+        if (!(subscription.state & subscriptionState::IN_USE))
+            continue;
+        int k = 0;
+        while (servoIds[k] != subscription.servoId)
+            k++;
+        subscription.group = groupIndex[groupOfServo[k]];
+    }
+}
+
+bool STSServoDriver::evaluateSubscription(Subscription &subscription, int16_t const &value)
+{
+    bool const hadValue = subscription.state & subscriptionState::HAS_VALUE;
+    bool const wasActive = subscription.state & subscriptionState::ACTIVE;
+    subscription.state |= subscriptionState::HAS_VALUE;
+    int32_t const v = value;
+    int32_t const threshold = subscription.threshold;
+    int32_t const hysteresis = subscription.hysteresis;
+    bool active = false;
+    switch (subscription.condition)
+    {
+        case STSCondition::VALUE_CHANGED:
+            if (!hadValue || abs(v - subscription.reference) <= hysteresis)
+            {
+                if (!hadValue)
+                    subscription.reference = value;
+                return false;
+            }
+            subscription.reference = value;
+            subscription.state |= subscriptionState::ACTIVE;
+            return true;
+        case STSCondition::ABOVE_THRESHOLD:
+            active = wasActive ? v >= threshold - hysteresis : v >= threshold;
+            break;
+        case STSCondition::BELOW_THRESHOLD:
+            active = wasActive ? v <= threshold + hysteresis : v <= threshold;
+            break;
+        case STSCondition::ANY_BIT_SET:
+            active = (value & subscription.threshold) != 0;
+            break;
+        default:
+            return false;
+    }
+    if (active == wasActive)
+        return false;
+    if (active)
+        subscription.state |= subscriptionState::ACTIVE;
+    else
+        subscription.state &= ~subscriptionState::ACTIVE;
+    return true;
+}
+#endif
+
+#if STS_ENABLE_STATISTICS
+STSStatistics const& STSServoDriver::getStatistics() const
+{
+    return statistics_;
+}
+
+void STSServoDriver::recordLatency()
+{
+    uint32_t const latency = micros() - requestEnd_;
+    byte bucket = 0;
+    while (bucket < STS_LATENCY_BUCKETS - 1 && latency >= (STSLatency::FIRST_BOUND_US << bucket))
+        bucket++;
+    statistics_.latency[bucket]++;
+    statistics_.latencySum += latency;
+}
+
+bool STSServoDriver::getServoStatistics(byte const &servoId, uint16_t &timeouts, uint16_t &errors)
+{
+    ServoSlot const *slot = findSlot(servoId);
+    if (slot == nullptr)
+        return false;
+    timeouts = slot->timeouts;
+    errors = slot->errors;
+    return true;
+}
+#endif
+
+#if STS_ENABLE_STACK_STATISTICS
+STSStackUsage const& STSServoDriver::getStackUsage(byte const &api) const
+{
+    return stackUsage_[api < STSStackApi::COUNT ? api : 0];
+}
+
+void STSServoDriver::resetStackUsage()
+{
+    for (int i = 0; i < STSStackApi::COUNT; i++)
+        stackUsage_[i] = STSStackUsage();
+}
+
+STSServoDriver::StackScope::StackScope(STSServoDriver &driver, byte const &api) : driver_(driver)
+{
+    if (driver_.stackNesting_++ > 0)
+        return;
+    driver_.stackBase_ = reinterpret_cast<uintptr_t>(this);
+    driver_.stackApi_ = api;
+    driver_.stackUsage_[api].calls++;
+}
+
+STSServoDriver::StackScope::~StackScope()
+{
+    driver_.stackNesting_--;
+}
+
+void STSServoDriver::markStack(byte const &requestLength, byte const &replyLength, byte const &batchServos)
+{
+    if (stackNesting_ == 0)
+        return;
+    volatile byte marker = 0;
+    STSStackUsage &usage = stackUsage_[stackApi_];
+    // The stack grows down on all supported targets.
+    uintptr_t const depth = stackBase_ - reinterpret_cast<uintptr_t>(&marker);
+    if (depth > usage.depth)
+        usage.depth = depth > 0xFFFF ? 0xFFFF : depth;
+    if (requestLength > usage.requestLength)
+        usage.requestLength = requestLength;
+    if (replyLength > usage.replyLength)
+        usage.replyLength = replyLength;
+    if (batchServos > usage.batchServos)
+        usage.batchServos = batchServos;
+}
+#endif
+
+#if STS_ENABLE_PROFILING
+STSProfileEntry const& STSServoDriver::getProfile(byte const &function) const
+{
+    return profile_[function < STSProfile::COUNT ? function : 0];
+}
+
+void STSServoDriver::resetProfile()
+{
+    for (int i = 0; i < STSProfile::COUNT; i++)
+        profile_[i] = STSProfileEntry();
+}
+
+STSServoDriver::ProfileScope::ProfileScope(STSServoDriver &driver, byte const &function) :
+    driver_(driver),
+    function_(function),
+    start_(STS_PROFILE_CLOCK()),
+    waitStart_(driver.profileWait_)
+{
+}
+
+STSServoDriver::ProfileScope::~ProfileScope()
+{
+    uint32_t const cost = (STS_PROFILE_CLOCK() - start_) - (driver_.profileWait_ - waitStart_);
+    STSProfileEntry &entry = driver_.profile_[function_];
+    if (entry.calls == 0 || cost < entry.minimum)
+        entry.minimum = cost;
+    if (cost > entry.maximum)
+        entry.maximum = cost;
+    entry.total += cost;
+    entry.calls++;
+}
+#endif
@@ -10,6 +10,10 @@
 #define STSSERVO_DRIVER_H
 
 #include <Arduino.h>
+#include "STSServoConfig.h"
+#if STS_ENABLE_TX_PIPELINE
+#include "STSTxPipeline.h"
+#endif
 
 namespace STSRegisters
 {
@@ -69,13 +73,168 @@ enum STSMode{
     STEP = 3
 };
 
-enum ServoType
+enum ServoType : byte
 {
     UNKNOWN = 0,
     STS = 1,
     SCS = 2
 };
 
+/// \brief ID addressing all the servos of a bus at once. Servos never reply to it, except to PING.
+byte const STS_BROADCAST_ID = 0xFE;
+
+/// \brief Capability flags detected on each servo, see STSServoDriver::getCapabilities.
+namespace STSCapabilities
+{
+    byte const PROBED       = 0x01; ///< Version registers have been read successfully.
+    byte const NO_SYNC_READ = 0x02; ///< Servo does not answer SYNC READ: batch reads use single reads instead.
+};
+
+#if STS_ENABLE_STATISTICS
+/// \brief Bus statistics, see STSServoDriver::getStatistics.
+struct STSStatistics
+{
+    uint32_t transactions;  ///< Number of instructions sent.
+    uint32_t timeouts;      ///< Number of expected replies not received in time.
+    uint32_t errors;        ///< Number of invalid replies (header, checksum).
+    uint32_t bytesSent;     ///< Number of bytes written to the bus.
+    uint32_t bytesReceived; ///< Number of bytes read from the bus.
+    /// Number of valid replies by latency, from the end of the request to the end of the reply: bucket i counts
+    /// the replies taking less than STSLatency::FIRST_BOUND_US << i, the last bucket all the others. In a batch,
+    /// the latency of a reply includes the replies before it.
+    uint32_t latency[STS_LATENCY_BUCKETS];
+    uint64_t latencySum;    ///< Sum of the latencies of the valid replies, in us.
+};
+
+/// \brief Bounds of the latency histogram of STSStatistics.
+namespace STSLatency
+{
+    uint32_t const FIRST_BOUND_US = 128;  ///< Upper bound of the first bucket, doubled for each next bucket.
+};
+#endif
+
+#if STS_ENABLE_PROFILING
+/// \brief Driver functions whose CPU cost is profiled, see STSServoDriver::getProfile.
+namespace STSProfile
+{
+    byte const SEND_MESSAGE          = 0; ///< Frame building and checksum of a request.
+    byte const RECEIVE_MESSAGE       = 1; ///< Header and checksum checks of a reply.
+    byte const CONVERT_INT_TO_BYTES  = 2; ///< Type dispatch and encoding of a value.
+    byte const SET_TARGET_POSITIONS  = 3; ///< SYNC WRITE encoder.
+    byte const SET_TARGET_MOTIONS    = 4; ///< SYNC WRITE encoder.
+    byte const SYNC_READ_REGISTERS   = 5; ///< SYNC READ request and reply matching, reply handlers excluded.
+    byte const SYNC_WRITE_REGISTERS  = 6; ///< Batch encoder of raw registers, broadcast choice included.
+    byte const SET_TARGET_VELOCITIES = 7; ///< SYNC WRITE encoder.
+    byte const COUNT                 = 8;
+};
+
+/// \brief CPU cost of a function, in units of STS_PROFILE_CLOCK.
+struct STSProfileEntry
+{
+    uint32_t calls;
+    uint32_t minimum;
+    uint32_t maximum;
+    uint64_t total;
+
+    uint32_t mean() const { return calls == 0 ? 0 : total / calls; }
+};
+#endif
+
+#if STS_ENABLE_STACK_STATISTICS
+/// \brief Driver APIs whose stack use is recorded, see STSServoDriver::getStackUsage. A call is accounted to the
+///        API called by the application, including the driver functions it calls.
+namespace STSStackApi
+{
+    byte const PING                  = 0;  ///< ping, getCapabilities (type probe).
+    byte const READ_REGISTER         = 1;  ///< readRegister, readTwoBytesRegister, getCurrent..., isMoving.
+    byte const WRITE_REGISTER        = 2;  ///< writeRegister, writeTwoBytesRegister, setTarget..., setMode, trigerAction.
+    byte const EEPROM_WRITE          = 3;  ///< setId, setPositionOffset.
+    byte const SET_TARGET_POSITIONS  = 4;  ///< setTargetPositions, setTargetMotions.
+    byte const SET_TARGET_VELOCITIES = 5;
+    byte const SYNC_WRITE_REGISTERS  = 6;
+    byte const SYNC_READ_REGISTERS   = 7;
+    byte const PING_SERVOS           = 8;
+    byte const READ_TELEMETRY        = 9;  ///< readTelemetry, readPositions.
+    byte const UPDATE_SUBSCRIPTIONS  = 10;
+    byte const CONFIGURATION         = 11; ///< captureConfiguration, checkConfiguration, repairConfiguration.
+    byte const COUNT                 = 12;
+};
+
+/// \brief Peak stack use of a driver API, and the payload sizes that drive it.
+struct STSStackUsage
+{
+    uint32_t calls;
+    uint16_t depth;          ///< Deepest stack reached by the driver below the entry of the API, in bytes.
+    byte requestLength;      ///< Largest request parameters, in bytes (frame length is this plus 6).
+    byte replyLength;        ///< Largest reply parameters, in bytes.
+    byte batchServos;        ///< Largest number of servos in a SYNC READ or SYNC WRITE frame.
+};
+#endif
+
+#if STS_ENABLE_BATCH
+/// \brief Feedback registers of a servo, see STSServoDriver::readTelemetry.
+struct STSTelemetry
+{
+    int16_t position;    ///< CURRENT_POSITION, in counts.
+    int16_t speed;       ///< CURRENT_SPEED, in counts/s.
+    int16_t current;     ///< CURRENT_CURRENT, in units of 6.5mA.
+    byte voltage;        ///< CURRENT_VOLTAGE, in units of 0.1V.
+    byte temperature;    ///< CURRENT_TEMPERATURE, in degrees Celsius.
+    byte status;         ///< STATUS register.
+    byte moving;         ///< MOVING_STATUS register.
+};
+
+/// \brief Callback of readTelemetry, called with the feedback of each servo as soon as its reply is complete.
+/// \param context Pointer given to readTelemetry
+/// \param index Index of the servo in the batch
+/// \param telemetry Feedback of the servo
+typedef void (*STSTelemetryCallback)(void *context, byte const &index, STSTelemetry const &telemetry);
+#endif
+
+#if STS_ENABLE_CONFIG_CHECK
+/// \brief EEPROM registers checked for drift, see STSServoDriver::checkConfiguration: RESPONSE_DELAY to
+///        SPEED_INTEGRAL_GAIN, i.e. all the settings but the ID and the baud rate, which a servo must have right to answer.
+namespace STSConfigRegion
+{
+    byte const START  = STSRegisters::RESPONSE_DELAY;
+    byte const LENGTH = STSRegisters::SPEED_INTEGRAL_GAIN + 1 - STSRegisters::RESPONSE_DELAY;
+};
+
+/// \brief Expected EEPROM configuration of servos, see STSServoDriver::captureConfiguration.
+struct STSConfigProfile
+{
+    byte values[STSConfigRegion::LENGTH];          ///< Expected registers, as read: values[i] is register START + i.
+    byte mask[(STSConfigRegion::LENGTH + 7) / 8];  ///< Bit i set if register START + i is checked.
+    uint16_t digest;                               ///< CRC-16 of the checked registers, the others counting as 0.
+};
+
+/// \brief Result of the configuration check of a servo.
+struct STSConfigDrift
+{
+    uint16_t digest;                                    ///< CRC-16 of the checked registers, as read.
+    byte mismatched[(STSConfigRegion::LENGTH + 7) / 8]; ///< Bit i set if register START + i differs from the profile.
+};
+#endif
+
+#if STS_ENABLE_SUBSCRIPTIONS
+/// \brief Conditions of a subscription, see STSServoDriver::subscribe.
+namespace STSCondition
+{
+    byte const VALUE_CHANGED   = 0; ///< Value moved by more than the hysteresis since the last notification.
+    byte const ABOVE_THRESHOLD = 1; ///< Active when value >= threshold, inactive again below threshold - hysteresis.
+    byte const BELOW_THRESHOLD = 2; ///< Active when value <= threshold, inactive again above threshold + hysteresis.
+    byte const ANY_BIT_SET     = 3; ///< Active when (value & threshold) != 0, threshold being the bit mask.
+};
+
+/// \brief Callback of a subscription, see STSServoDriver::subscribe.
+/// \param servoId ID of the servo
+/// \param registerId Register
+/// \param value New register value
+/// \param active Whether the condition is now true (always true for STSCondition::VALUE_CHANGED)
+/// \param context Pointer given to subscribe
+typedef void (*STSNotificationCallback)(byte servoId, byte registerId, int16_t value, bool active, void *context);
+#endif
+
 /// \brief Driver for STS servos, using UART
 class STSServoDriver
 {
@@ -112,6 +271,32 @@ public:
     /// \return True if servo could successfully change ID
     bool setId(byte const &oldServoId, byte const &newServoId);
 
+    /// \brief Get the capabilities of a servo.
+    /// \details On first call, the version registers (FIRMWARE_MAJOR to SERVO_MINOR) are read in a single
+    ///          transaction to determine the servo type and the instructions it supports. The result is cached.
+    /// \note The capabilities only depend on the servo family (SERVO_MAJOR) so far: firmware revisions are not
+    ///       distinguished, none being known to change the instructions supported, and are not kept.
+    /// \param[in] servoId ID of the servo
+    /// \return Combination of STSCapabilities flags.
+    byte getCapabilities(byte const &servoId);
+
+#if STS_ENABLE_SCS
+    /// \brief Declare the type of all the servos of the bus, used to encode the two-byte values of broadcast writes.
+    /// \details A broadcast cannot be answered, so the type of STS_BROADCAST_ID is never probed: by default
+    ///          (ServoType::UNKNOWN) it is taken from the known servos, STS if none has been probed yet.
+    /// \param[in] type ServoType::STS or ServoType::SCS, ServoType::UNKNOWN to infer it from the known servos.
+    void setBusType(ServoType const &type);
+#endif
+
+    /// \brief Get the number of servos the driver has seen answering so far.
+    /// \return Number of known servos, at most STS_MAX_SERVOS.
+    byte getKnownServoCount() const;
+
+    /// \brief Get the ID of a known servo.
+    /// \param[in] index Index of the servo, in [0, getKnownServoCount()).
+    /// \return Servo ID.
+    byte getKnownServoId(byte const &index) const;
+
     /// \brief Change the position offset of a servo.
     /// \param[in] servoId servo ID
     /// \param[in] positionOffset new position offset
@@ -135,10 +320,17 @@ public:
     /// \return Temperature, in degC. 0 on failure.
     int getCurrentTemperature(byte const &servoId);
 
+#if STS_ENABLE_FLOAT
     /// \brief Get current servo current.
     /// \param[in] servoId ID of the servo
     /// \return Current, in A.
     float getCurrentCurrent(byte const &servoId);
+#endif
+
+    /// \brief Get current servo current, without floating-point computation.
+    /// \param[in] servoId ID of the servo
+    /// \return Current, in mA.
+    int getCurrentCurrentMilliamps(byte const &servoId);
 
     /// \brief Check if the servo is moving
     /// \param[in] servoId ID of the servo
@@ -174,9 +366,11 @@ public:
     /// \param[in] mode Desired mode
     bool setMode(unsigned char const& servoId, STSMode const& mode);
 
+#if STS_ENABLE_ASYNC
     /// \brief Trigger the action previously stored by an asynchronous write on all servos.
     /// \return True on success
     bool trigerAction();
+#endif
 
     /// \brief Write to a single byte register.
     /// \param[in] servoId ID of the servo
@@ -190,6 +384,8 @@ public:
                        bool const &asynchronous = false);
 
     /// \brief Write a two-bytes register.
+    /// \note With STS_BROADCAST_ID, the value is encoded for the type of the bus (see setBusType): the write
+    ///       fails without sending anything if the known servos mix SCS and STS, which encode values differently.
     /// \param[in] servoId ID of the servo
     /// \param[in] registerId Register id (LSB).
     /// \param[in] value Register value.
@@ -212,7 +408,37 @@ public:
     /// \return Register value, 0 on failure.
     int16_t readTwoBytesRegister(byte const &servoId, byte const &registerId);
 
+#if STS_ENABLE_BATCH
+    /// \brief Declare the servos of the bus, so that batch writes giving the same value to all of them are
+    ///        sent as a single broadcast WRITE instead of a SYNC WRITE repeating it for each servo.
+    /// \details A broadcast reaches every servo of the bus: it is used only when a batch addresses all the
+    ///          servos the driver knows (declared here, or seen answering since), which must then be all the
+    ///          servos of the bus.
+    /// \note Call after init, which forgets the known servos.
+    /// \param[in] numberOfServos Number of servos, at most STS_MAX_SERVOS.
+    /// \param[in] servoIds Array of the IDs of all the servos of the bus.
+    /// \return False if there are too many servos or invalid IDs: batch writes are then never broadcast.
+    bool setBusServos(byte const &numberOfServos, const byte servoIds[]);
+
+    /// \brief Write the same registers of several servos, each with its own value.
+    /// \details When the batch addresses the whole bus (see setBusServos), it is sent as the cheapest mix of
+    ///          a broadcast WRITE of the most common value and a SYNC WRITE of the servos whose value differs:
+    ///          enabling the torque of the whole bus costs a single WRITE, whatever the number of servos.
+    /// \note In a mix, the servos whose value differs hold the common value until the SYNC WRITE reaches
+    ///       them, about 10us per byte of the frame at 1Mbps.
+    /// \param[in] numberOfServos Number of servos.
+    /// \param[in] servoIds Array of servo IDs to write to.
+    /// \param[in] startRegister First register
+    /// \param[in] writeLength Number of registers to write on each servo
+    /// \param[in] data Buffer of numberOfServos * writeLength bytes, as written: data of servoIds[i] starts at i * writeLength.
+    void syncWriteRegisters(byte const &numberOfServos,
+                            const byte servoIds[],
+                            byte const &startRegister,
+                            byte const &writeLength,
+                            const byte *data);
+
     /// @brief Sets the target positions for multiple servos simultaneously.
+    /// \note The same position and speed for the whole bus (see setBusServos) is sent as a single broadcast WRITE.
     /// @param[in] NumberOfServos Number of servo.
     /// @param[in] servoIds Array of servo IDs to control.
     /// @param[in] positions Array of target positions (corresponds to servoIds).
@@ -222,7 +448,262 @@ public:
                             const int positions[],
                             const int speeds[]);
 
+    /// \brief Sets the target position, speed and acceleration of several servos in a single SYNC WRITE.
+    /// \details The servos shape the motion themselves: they accelerate up to the speed, then brake to stop
+    ///          on the target. A whole smooth motion can thus be sent as a few commands (see STSTrajectory).
+    ///          The same motion for the whole bus (see setBusServos) is sent as a single broadcast WRITE.
+    /// \param[in] numberOfServos Number of servos.
+    /// \param[in] servoIds Array of servo IDs to control.
+    /// \param[in] positions Array of target positions (corresponds to servoIds).
+    /// \param[in] speeds Array of maximum speeds, in steps/s (0: maximum speed of the servo).
+    /// \param[in] accelerations Array of accelerations, in units of 100 steps/s^2 (0: maximum acceleration).
+    void setTargetMotions(byte const &numberOfServos,
+                          const byte servoIds[],
+                          const int positions[],
+                          const int speeds[],
+                          const byte accelerations[]);
+
+    /// \brief Sets the target velocities of several servos in velocity mode (see setMode), in a single SYNC WRITE.
+    /// \note The same velocity for the whole bus (see setBusServos) is sent as a single broadcast WRITE.
+    /// \param[in] numberOfServos Number of servos.
+    /// \param[in] servoIds Array of servo IDs to control.
+    /// \param[in] velocities Array of RUNNING_SPEED values, in steps/s (corresponds to servoIds).
+    void setTargetVelocities(byte const &numberOfServos,
+                             const byte servoIds[],
+                             const int velocities[]);
+
+#if STS_ENABLE_TX_PIPELINE
+    /// \brief Send the SYNC WRITE frames (setTargetPositions, setTargetMotions, setTargetVelocities) through a
+    ///        double-buffered pipeline.
+    /// \details The frames are encoded in the pipeline buffers and these functions return without waiting for
+    ///          the transmission, so that the next frame is encoded while the previous one is sent. Any other
+    ///          transaction first waits for the pipeline to be empty. A frame longer than STS_TX_BUFFER_SIZE is
+    ///          discarded (see STSTxPipeline::getDiscardCount).
+    /// \param[in] pipeline Pipeline over the same bus as the serial port, nullptr to write to the serial port directly.
+    void setTxPipeline(STSTxPipeline *pipeline);
+#endif
+
+    /// \brief Read the same registers from several servos in a single SYNC READ transaction.
+    /// \note Replies are collected in the order they arrive: a missing servo costs a single timeout
+    ///       for the whole batch, not one per servo. Servos known not to support SYNC READ
+    ///       (see getCapabilities) are read one by one instead.
+    /// \param[in] numberOfServos Number of servos.
+    /// \param[in] servoIds Array of servo IDs to read from.
+    /// \param[in] startRegister First register
+    /// \param[in] readLength Number of registers to read on each servo
+    /// \param[out] outputBuffer Buffer of numberOfServos * readLength bytes: data of servoIds[i] starts at i * readLength.
+    /// \param[out] responded Bitmap of responders, bit i set if servoIds[i] replied. Must hold (numberOfServos + 7) / 8 bytes.
+    /// \return Number of servos that replied.
+    int syncReadRegisters(byte const &numberOfServos,
+                          const byte servoIds[],
+                          byte const &startRegister,
+                          byte const &readLength,
+                          byte *outputBuffer,
+                          byte *responded);
+
+    /// \brief Check which servos of a known set are alive, reading their STATUS register in one transaction.
+    /// \note Servos flagged as STSCapabilities::NO_SYNC_READ are read one by one, with a short timeout. If no
+    ///       servo answers at all (e.g. SYNC READ not supported), the others are swept the same way. Servos found
+    ///       by this sweep are probed, and those not known to support SYNC READ (SCS, or of unknown type) are
+    ///       flagged as STSCapabilities::NO_SYNC_READ so that the next batches go straight to single reads.
+    /// \param[in] numberOfServos Number of servos.
+    /// \param[in] servoIds Array of servo IDs to check.
+    /// \param[out] alive Bitmap of responders, bit i set if servoIds[i] replied. Must hold (numberOfServos + 7) / 8 bytes.
+    /// \param[out] statuses Optional, STATUS register of each servo (0 for servos that did not reply).
+    /// \return Number of servos alive.
+    int pingServos(byte const &numberOfServos,
+                   const byte servoIds[],
+                   byte *alive,
+                   byte *statuses = nullptr);
+
+    /// \brief Read the feedback of several servos, as a single block of registers
+    ///        (CURRENT_POSITION to CURRENT_CURRENT) per servo in one SYNC READ.
+    /// \param[in] numberOfServos Number of servos.
+    /// \param[in] servoIds Array of servo IDs to read from.
+    /// \param[out] telemetry Feedback of each servo, left untouched for servos that did not reply.
+    /// \param[out] responded Bitmap of responders, bit i set if servoIds[i] replied. Must hold (numberOfServos + 7) / 8 bytes.
+    /// \return Number of servos that replied.
+    int readTelemetry(byte const &numberOfServos,
+                      const byte servoIds[],
+                      STSTelemetry *telemetry,
+                      byte *responded);
+
+    /// \brief Read the feedback of several servos in one SYNC READ, handing each one over as soon as its reply
+    ///        is complete: it can be processed while the next replies are still arriving.
+    /// \note The callback runs in the middle of the transaction: it must not use the bus.
+    /// \param[in] numberOfServos Number of servos.
+    /// \param[in] servoIds Array of servo IDs to read from.
+    /// \param[in] callback Function called with the feedback of each servo that replies.
+    /// \param[in] context Passed to the callback
+    /// \param[out] responded Bitmap of responders, bit i set if servoIds[i] replied. Must hold (numberOfServos + 7) / 8 bytes.
+    /// \return Number of servos that replied.
+    int readTelemetry(byte const &numberOfServos,
+                      const byte servoIds[],
+                      STSTelemetryCallback callback,
+                      void *context,
+                      byte *responded);
+
+    /// \brief Read the positions of several servos in one SYNC READ of CURRENT_POSITION alone.
+    /// \details The replies are the shortest a SYNC READ gets (8 bytes per servo, against 21 for readTelemetry):
+    ///          this is the highest rate at which the positions of a set of servos can be sampled (see STSRecorder).
+    /// \param[in] numberOfServos Number of servos.
+    /// \param[in] servoIds Array of servo IDs to read from.
+    /// \param[out] positions Position of each servo, in steps, left untouched for servos that did not reply.
+    /// \param[out] responded Bitmap of responders, bit i set if servoIds[i] replied. Must hold (numberOfServos + 7) / 8 bytes.
+    /// \return Number of servos that replied.
+    int readPositions(byte const &numberOfServos,
+                      const byte servoIds[],
+                      int16_t positions[],
+                      byte *responded);
+#endif
+
+#if STS_ENABLE_CONFIG_CHECK
+    /// \brief Read the EEPROM configuration of a reference servo as a profile, in a single READ.
+    /// \details All the registers of STSConfigRegion are checked, except POSITION_CORRECTION, which is the
+    ///          calibration of each servo: see ignoreConfigurationRegisters for other per-servo settings.
+    /// \param[in] servoId ID of the reference servo
+    /// \param[out] profile Profile
+    /// \return False if the servo did not reply.
+    bool captureConfiguration(byte const &servoId, STSConfigProfile &profile);
+
+    /// \brief Leave registers out of the check, e.g. angle limits that differ between joints.
+    /// \param[in,out] profile Profile, whose digest is updated.
+    /// \param[in] registerId First register
+    /// \param[in] length Number of registers
+    static void ignoreConfigurationRegisters(STSConfigProfile &profile, byte const &registerId, byte const &length);
+
+    /// \brief Check the EEPROM configuration of several servos against a profile, in a single SYNC READ.
+    /// \details The registers of each servo are read as one block. Its digest is checked against the one of the
+    ///          profile as the reply arrives; only a servo whose digest differs has its registers compared.
+    ///          Servos known not to support SYNC READ are read one by one.
+    /// \param[in] numberOfServos Number of servos.
+    /// \param[in] servoIds Array of servo IDs to check.
+    /// \param[in] profile Expected configuration.
+    /// \param[out] drift Result of each servo (corresponds to servoIds), left untouched for servos that did not reply.
+    /// \param[out] responded Bitmap of responders, bit i set if servoIds[i] replied. Must hold (numberOfServos + 7) / 8 bytes.
+    /// \return Number of servos that replied with a configuration differing from the profile.
+    int checkConfiguration(byte const &numberOfServos,
+                           const byte servoIds[],
+                           STSConfigProfile const &profile,
+                           STSConfigDrift drift[],
+                           byte *responded);
+
+    /// \brief Write back the registers of a servo that differ from a profile, and only those.
+    /// \details The EEPROM is unlocked, each run of adjacent mismatched registers is written in one WRITE, then
+    ///          the EEPROM is locked again. Check the servo again to verify.
+    /// \param[in] servoId ID of the servo
+    /// \param[in] profile Expected configuration.
+    /// \param[in] drift Result of checkConfiguration for this servo.
+    /// \return Number of registers written, -1 if a write failed.
+    int repairConfiguration(byte const &servoId, STSConfigProfile const &profile, STSConfigDrift const &drift);
+#endif
+
+#if STS_ENABLE_SUBSCRIPTIONS
+    /// \brief Get notified when a register of a servo changes.
+    /// \details Subscribed registers are read by updateSubscriptions, which calls the callback on edges only:
+    ///          when the condition becomes true or false (or, for STSCondition::VALUE_CHANGED, when the value
+    ///          moved by more than the hysteresis). A condition already true on the first read is notified.
+    /// \param[in] servoId ID of the servo
+    /// \param[in] registerId Register to watch
+    /// \param[in] length Register size, 1 or 2 bytes
+    /// \param[in] condition One of STSCondition
+    /// \param[in] threshold Threshold, or bit mask for STSCondition::ANY_BIT_SET
+    /// \param[in] hysteresis Band the value must cross back before the condition clears, or minimum change for VALUE_CHANGED
+    /// \param[in] callback Function to call on edges
+    /// \param[in] context Passed to the callback
+    /// \return Subscription handle, -1 if there are already STS_MAX_SUBSCRIPTIONS subscriptions or the arguments are invalid.
+    int subscribe(byte const &servoId,
+                  byte const &registerId,
+                  byte const &length,
+                  byte const &condition,
+                  int16_t const &threshold,
+                  uint16_t const &hysteresis,
+                  STSNotificationCallback callback,
+                  void *context = nullptr);
+
+    /// \brief Remove a subscription.
+    /// \param[in] handle Handle returned by subscribe
+    void unsubscribe(int const &handle);
+
+    /// \brief Read all subscribed registers and notify the edges. Call this once per cycle.
+    /// \note Subscriptions are folded into as few SYNC READ as possible: each servo is read once, over the
+    ///       span of its subscribed registers, and servos are grouped when one longer read costs less bus
+    ///       time than several.
+    /// \return Number of notifications, -1 if some servo did not reply.
+    int updateSubscriptions();
+#endif
+
+#if STS_ENABLE_STATISTICS
+    /// \brief Get the bus statistics since init.
+    STSStatistics const& getStatistics() const;
+
+    /// \brief Get the error counters of a servo.
+    /// \param[in] servoId ID of the servo
+    /// \param[out] timeouts Number of requests left unanswered.
+    /// \param[out] errors Number of invalid replies.
+    /// \return False if the servo is not known.
+    bool getServoStatistics(byte const &servoId, uint16_t &timeouts, uint16_t &errors);
+#endif
+
+#if STS_ENABLE_PROFILING
+    /// \brief Get the CPU cost of a driver function since init or resetProfile.
+    /// \details Only the CPU part is measured: the time spent writing to the port, waiting for replies and
+    ///          in the post-send delay is excluded. Costs include the functions called, e.g. setTargetPositions
+    ///          includes convertIntToBytes.
+    /// \param[in] function Function, one of STSProfile
+    STSProfileEntry const& getProfile(byte const &function) const;
+
+    /// \brief Reset the profile of all functions.
+    void resetProfile();
+#endif
+
+#if STS_ENABLE_STACK_STATISTICS
+    /// \brief Get the peak stack use of a driver API since init or resetStackUsage.
+    /// \details The depth is measured from the entry of the API down to the deepest driver frame, variable-length
+    ///          arrays sized by the payload included. The callees of the driver (HardwareSerial, the callbacks of
+    ///          batch reads) are not included: add their own depth to size a stack.
+    /// \param[in] api API, one of STSStackApi
+    STSStackUsage const& getStackUsage(byte const &api) const;
+
+    /// \brief Reset the stack use of all APIs.
+    void resetStackUsage();
+#endif
+
 private:
+#if STS_ENABLE_PROFILING
+    /// \brief Records the CPU cost of a function, from its construction to its destruction, wire waits excluded.
+    class ProfileScope
+    {
+    public:
+        ProfileScope(STSServoDriver &driver, byte const &function);
+        ~ProfileScope();
+
+    private:
+        STSServoDriver &driver_;
+        byte function_;
+        uint32_t start_;
+        uint32_t waitStart_;
+    };
+#endif
+
+#if STS_ENABLE_STACK_STATISTICS
+    /// \brief Accounts the driver functions called from its scope to an API, if it is the outermost one.
+    class StackScope
+    {
+    public:
+        StackScope(STSServoDriver &driver, byte const &api);
+        ~StackScope();
+
+    private:
+        STSServoDriver &driver_;
+    };
+
+    /// \brief Record the stack depth of the caller, and the payload sizes it handles, for the current API.
+    /// \note Not inlined: its frame is below the variable-length arrays of the caller.
+    void markStack(byte const &requestLength, byte const &replyLength, byte const &batchServos)
+        __attribute__((noinline));
+#endif
+
     /// \brief Send a message to the servos.
     /// \param[in] servoId ID of the servo
     /// \param[in] commandID Command id
@@ -247,6 +728,15 @@ private:
                        byte const &readLength,
                        byte *outputBuffer);
 
+    /// \brief Recieve a message from any servo, used to collect the replies to a batch instruction.
+    /// \param[out] servoId ID of the servo that replied
+    /// \param[in] readLength Message length
+    /// \param[in] outputBuffer Buffer where the data is placed.
+    /// \return 0 on success, -1 on timeout, -2 if invalid message, -3 if invalid checksum
+    int receiveAnyMessage(byte &servoId,
+                          byte const &readLength,
+                          byte *outputBuffer);
+
     /// \brief Write to a sequence of consecutive registers
     /// \param[in] servoId ID of the servo
     /// \param[in] startRegister First register
@@ -271,22 +761,206 @@ private:
                       byte const &readLength,
                       byte *outputBuffer);
 
+#if STS_ENABLE_BATCH
+    /// \brief Called by syncRead with each reply, as soon as it is complete.
+    /// \param context Pointer given to syncRead
+    /// \param index Index of the servo in the batch
+    /// \param data Registers read, valid during the call only
+    /// \param length Number of registers
+    typedef void (*ReplyHandler)(void *context, byte const &index, const byte *data, byte const &length);
+
+    /// \brief Read the same registers from several servos, see syncReadRegisters, handing each reply over as it arrives.
+    /// \param[in] offset Index of servoIds[0] in the whole batch, for the handler.
+    /// \param[in] singleTimeoutMs Timeout of the single reads of the servos without SYNC READ, in ms, 0 for the
+    ///            default one.
+    int syncRead(byte const &numberOfServos,
+                 const byte servoIds[],
+                 byte const &startRegister,
+                 byte const &readLength,
+                 ReplyHandler handler,
+                 void *context,
+                 byte *responded,
+                 byte const &offset,
+                 unsigned long const &singleTimeoutMs = 0);
+
     /// @brief Send two bytes and update checksum
     /// @param[in] convertedValue Converted int value
     /// @param[out] checksum Update the checksum
     void sendAndUpdateChecksum(byte convertedValue[], byte &checksum);
 
+    /// \brief Send the header of a SYNC WRITE frame
+    /// \param[in] numberOfServos Number of servos in the frame
+    /// \param[in] startRegister First register
+    /// \param[in] writeLength Number of registers written on each servo
+    /// \param[out] checksum Checksum of the header
+    void beginSyncWrite(byte const &numberOfServos, byte const &startRegister, byte const &writeLength, byte &checksum);
+
+    /// \brief Send the checksum of a SYNC WRITE frame, ending it
+    void endSyncWrite(byte const &checksum);
+
+    /// \brief Send a byte of a SYNC WRITE frame, to the serial port or to the pipeline buffer
+    void sendByte(byte const &value);
+
+    /// \brief Send a batch of writes as SYNC WRITE frames, as many as the frame length requires.
+    /// \param[in] count Number of servos to write, numberOfServos minus the servos skipped.
+    /// \param[in] skip Value of the servos to skip (already written by a broadcast), nullptr to skip none.
+    void sendSyncWrites(byte const &numberOfServos,
+                        const byte servoIds[],
+                        byte const &startRegister,
+                        byte const &writeLength,
+                        const byte *data,
+                        byte const &count,
+                        const byte *skip);
+
+    /// \brief Whether a batch addresses all the servos of a declared bus, see setBusServos.
+    bool coversBus(byte const &numberOfServos, const byte servoIds[]);
+
+    /// \brief Whether a batch of motions addresses the whole bus with the same values, encoded the same way.
+    /// \param[in] accelerations Accelerations, nullptr if not part of the command.
+    bool isUniformMotion(byte const &numberOfServos,
+                         const byte servoIds[],
+                         const int positions[],
+                         const int speeds[],
+                         const byte accelerations[]);
+#endif
+
     /// @brief Convert int to pair of bytes
     /// @param[in] value
     /// @param[out] result
     void convertIntToBytes(byte const& servoId, int const &value, byte result[2]);
 
-    /// \brief Determine servo type (STS or SCS, they don't use exactly the same protocol)
+    /// @brief Convert a pair of bytes read from a servo to int
+    /// @param[in] bytes Register value, as read
+    /// @return Signed value
+    int16_t convertBytesToInt(byte const& servoId, byte const bytes[2]);
+
+#if STS_ENABLE_SCS
+    /// \brief Determine servo type (STS or SCS, they don't use exactly the same protocol) and capabilities,
+    ///        from a single read of the version registers.
     void determineServoType(byte const& servoId);
 
+    /// \brief Type of the servos reached by a broadcast: declared with setBusType, or shared by all the probed servos.
+    /// \return ServoType::UNKNOWN if the probed servos are of different types.
+    ServoType broadcastType();
+#endif
+
+    /// \brief Get the register used to lock the EEPROM, which differs between STS and SCS.
+    byte lockRegister(byte const& servoId);
+
+    /// \brief Get the servo type, determining it on first use.
+    ServoType servoType(byte const& servoId);
+
+    /// \brief Hot state of a servo, stored contiguously for the servos actually present on the bus.
+    struct ServoSlot
+    {
+        byte capabilities; ///< See STSCapabilities.
+        byte status;       ///< Status byte of the last reply.
+#if STS_ENABLE_SCS
+        ServoType type;    ///< STS/SCS servos have slightly different protocol.
+        byte reserved;
+#endif
+#if STS_ENABLE_STATISTICS
+        uint16_t timeouts; ///< Number of requests left unanswered.
+        uint16_t errors;   ///< Number of invalid replies (header, checksum).
+#endif
+    };
+
+    /// \brief Find the slot of a servo.
+    /// \return Slot, nullptr if the servo is not known.
+    ServoSlot *findSlot(byte const& servoId);
+
+    /// \brief Find the slot of a servo, allocating one if needed.
+    /// \return Slot, nullptr if the table is full or servoId is the broadcast ID.
+    ServoSlot *addSlot(byte const& servoId);
+
+    /// \brief Forget a servo.
+    void removeSlot(byte const& servoId);
+
+    /// \brief Update the state of a servo after receiving its reply.
+    /// \param[in] servoId ID of the servo
+    /// \param[in] receiveResult Return value of receiveMessage
+    /// \param[in] status Status byte of the reply
+    void updateSlot(byte const& servoId, int const& receiveResult, byte const& status);
+
+#if STS_ENABLE_STATISTICS
+    /// \brief Count a valid reply in the latency histogram, the reply having just been received.
+    void recordLatency();
+#endif
+
     HardwareSerial *port_;
     byte dirPin_; ///< Direction pin number.
+#if STS_ENABLE_TX_PIPELINE
+    STSTxPipeline *txPipeline_;
+    byte *txFrame_;    ///< Pipeline buffer of the frame being encoded, nullptr when writing to the port.
+    size_t txLength_;
+#endif
+
+    // Servo ID to slot mapping: the IDs are scanned linearly, which for a few tens of servos
+    // is as fast as a 256-entry lookup table and much smaller.
+    byte slotIds_[STS_MAX_SERVOS];
+    ServoSlot slots_[STS_MAX_SERVOS];
+    byte nSlots_;
+    byte lastSlot_; ///< Last slot found, most accesses hit the same servo repeatedly.
+    bool receiveFailed_; ///< Whether the last reply failed: late replies may still arrive.
+#if STS_ENABLE_STATISTICS
+    uint32_t requestEnd_; ///< Time the last request expecting a reply was sent, in us.
+#endif
+#if STS_ENABLE_BATCH
+    bool busDeclared_; ///< Whether the known servos are all the servos of the bus, see setBusServos.
+#endif
+#if STS_ENABLE_SCS
+    ServoType busType_; ///< Declared type of all the servos, see setBusType.
+#endif
 
-    ServoType servoType_[256]; // Map of servo types - STS/SCS servos have slightly different protocol.
+#if STS_ENABLE_SUBSCRIPTIONS
+    struct Subscription
+    {
+        STSNotificationCallback callback;
+        void *context;
+        int16_t threshold;
+        uint16_t hysteresis;
+        int16_t reference; ///< Value last notified, for STSCondition::VALUE_CHANGED.
+        byte servoId;
+        byte registerId;
+        byte length;
+        byte condition;
+        byte state;        ///< Subscription state flags (in use, has value, active).
+        byte group;        ///< Index in readGroups_.
+    };
+
+    /// \brief Registers read from a group of servos with a single SYNC READ.
+    struct ReadGroup
+    {
+        byte startRegister;
+        byte readLength;
+    };
+
+    /// \brief Compute the read groups of the subscriptions.
+    void planSubscriptions();
+
+    /// \brief Update the state of a subscription with a new value.
+    /// \return True if the callback should be called.
+    bool evaluateSubscription(Subscription &subscription, int16_t const &value);
+
+    Subscription subscriptions_[STS_MAX_SUBSCRIPTIONS];
+    ReadGroup readGroups_[STS_MAX_SUBSCRIPTIONS];
+    byte nReadGroups_; ///< 0xFF when the groups must be recomputed.
+#endif
+
+#if STS_ENABLE_STATISTICS
+    STSStatistics statistics_;
+#endif
+
+#if STS_ENABLE_STACK_STATISTICS
+    STSStackUsage stackUsage_[STSStackApi::COUNT];
+    uintptr_t stackBase_;   ///< Address of the outermost StackScope.
+    byte stackApi_;         ///< API of the outermost StackScope.
+    byte stackNesting_;     ///< Number of StackScope on the stack.
+#endif
+
+#if STS_ENABLE_PROFILING
+    STSProfileEntry profile_[STSProfile::COUNT];
+    uint32_t profileWait_; ///< Total time spent waiting for the bus, in units of STS_PROFILE_CLOCK.
+#endif
 };
 #endif
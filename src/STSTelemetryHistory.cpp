@@ -0,0 +1,251 @@
+#include "STSTelemetryHistory.h"
+
+namespace
+{
+    /// \brief Writes a frame of the export format, computing its checksum on the fly.
+    class FrameWriter
+    {
+    public:
+        FrameWriter(Print &output, byte const &type, uint16_t const &length) :
+            output_(output), checksum_(0), written_(0)
+        {
+            output_.write(STSHistoryExport::MAGIC0);
+            output_.write(STSHistoryExport::MAGIC1);
+            written_ += 2;
+            writeByte(type);
+            writeWord(length);
+        }
+
+        void writeByte(byte const &value)
+        {
+            output_.write(value);
+            checksum_ += value;
+            written_++;
+        }
+
+        void writeWord(uint16_t const &value)
+        {
+            writeByte(value & 0xFF);
+            writeByte(value >> 8);
+        }
+
+        void writeLong(uint32_t const &value)
+        {
+            writeWord(value & 0xFFFF);
+            writeWord(value >> 16);
+        }
+
+        /// \brief Write the checksum.
+        /// \return Size of the frame, in bytes.
+        size_t end()
+        {
+            output_.write(static_cast<byte>(~checksum_));
+            return written_ + 1;
+        }
+
+    private:
+        Print &output_;
+        byte checksum_;
+        size_t written_;
+    };
+};
+
+STSTelemetryHistory::STSTelemetryHistory()
+{
+    clear();
+}
+
+void STSTelemetryHistory::clear()
+{
+    nServos_ = 0;
+    memset(series_, 0, sizeof(series_));
+}
+
+bool STSTelemetryHistory::add(byte const &servoId, uint32_t const &timeMs, int16_t const &current, int16_t const &temperature)
+{
+    int index = -1;
+    for (int i = 0; i < nServos_; i++)
+        if (servoIds_[i] == servoId)
+            index = i;
+    if (index < 0)
+    {
+        if (nServos_ == STS_HISTORY_SERVOS)
+            return false;
+        index = nServos_++;
+        servoIds_[index] = servoId;
+    }
+    addSample(series_[index][STSHistoryField::CURRENT], timeMs, current);
+    addSample(series_[index][STSHistoryField::TEMPERATURE], timeMs, temperature);
+    return true;
+}
+
+#if STS_ENABLE_BATCH
+void STSTelemetryHistory::add(uint32_t const &timeMs,
+                              byte const &numberOfServos,
+                              const byte servoIds[],
+                              STSTelemetry const telemetry[],
+                              byte const *responded)
+{
+    for (int i = 0; i < numberOfServos; i++)
+        if (responded[i / 8] & (1 << (i % 8)))
+            add(servoIds[i], timeMs, telemetry[i].current, telemetry[i].temperature);
+}
+#endif
+
+byte STSTelemetryHistory::getRawCount(byte const &servoId, byte const &field) const
+{
+    Series const *series = findSeries(servoId, field);
+    return series == nullptr ? 0 : series->rawCount;
+}
+
+int16_t STSTelemetryHistory::getRawSample(byte const &servoId, byte const &field, byte const &index, uint32_t &timeMs) const
+{
+    Series const *series = findSeries(servoId, field);
+    if (series == nullptr || index >= series->rawCount)
+        return 0;
+    // Walk back from the newest sample, whose time is known.
+    int position = (series->rawHead + STS_HISTORY_RAW - 1) % STS_HISTORY_RAW;
+    timeMs = series->lastTime;
+    for (int i = series->rawCount - 1; i > index; i--)
+    {
+        timeMs -= series->rawDelta[position];
+        position = (position + STS_HISTORY_RAW - 1) % STS_HISTORY_RAW;
+    }
+    return series->raw[position];
+}
+
+byte STSTelemetryHistory::getBucketCount(byte const &servoId, byte const &field, byte const &level) const
+{
+    Series const *series = findSeries(servoId, field);
+    if (series == nullptr || level >= STS_HISTORY_LEVELS)
+        return 0;
+    return series->count[level];
+}
+
+STSTelemetryHistory::Bucket const &STSTelemetryHistory::getBucket(byte const &servoId,
+                                                                  byte const &field,
+                                                                  byte const &level,
+                                                                  byte const &index) const
+{
+    static Bucket const EMPTY = {0, 0, 0, 0};
+    Series const *series = findSeries(servoId, field);
+    if (series == nullptr || level >= STS_HISTORY_LEVELS || index >= series->count[level])
+        return EMPTY;
+    int const oldest = (series->head[level] + STS_HISTORY_BUCKETS - series->count[level]) % STS_HISTORY_BUCKETS;
+    return series->buckets[level][(oldest + index) % STS_HISTORY_BUCKETS];
+}
+
+size_t STSTelemetryHistory::exportTo(Print &output) const
+{
+    size_t written = 0;
+    FrameWriter info(output, STSHistoryExport::INFO, 6);
+    info.writeByte(STSHistoryExport::VERSION);
+    info.writeByte(STS_HISTORY_RAW);
+    info.writeByte(STS_HISTORY_BUCKETS);
+    info.writeByte(STS_HISTORY_LEVELS);
+    info.writeByte(STS_HISTORY_FACTOR);
+    info.writeByte(nServos_);
+    written += info.end();
+
+    for (int s = 0; s < nServos_; s++)
+    {
+        for (byte field = 0; field < STSHistoryField::COUNT; field++)
+        {
+            Series const &series = series_[s][field];
+            FrameWriter raw(output, STSHistoryExport::RAW, 7 + 4 * series.rawCount);
+            raw.writeByte(servoIds_[s]);
+            raw.writeByte(field);
+            raw.writeByte(series.rawCount);
+            raw.writeLong(series.lastTime);
+            int const oldest = (series.rawHead + STS_HISTORY_RAW - series.rawCount) % STS_HISTORY_RAW;
+            for (int i = 0; i < series.rawCount; i++)
+            {
+                int const position = (oldest + i) % STS_HISTORY_RAW;
+                raw.writeWord(series.raw[position]);
+                raw.writeWord(series.rawDelta[position]);
+            }
+            written += raw.end();
+
+            for (byte level = 0; level < STS_HISTORY_LEVELS; level++)
+            {
+                FrameWriter buckets(output, STSHistoryExport::BUCKETS, 4 + 10 * series.count[level]);
+                buckets.writeByte(servoIds_[s]);
+                buckets.writeByte(field);
+                buckets.writeByte(level);
+                buckets.writeByte(series.count[level]);
+                for (int i = 0; i < series.count[level]; i++)
+                {
+                    Bucket const &bucket = getBucket(servoIds_[s], field, level, i);
+                    buckets.writeLong(bucket.start);
+                    buckets.writeWord(bucket.minimum);
+                    buckets.writeWord(bucket.maximum);
+                    buckets.writeWord(bucket.mean);
+                }
+                written += buckets.end();
+            }
+        }
+    }
+    return written;
+}
+
+STSTelemetryHistory::Series const *STSTelemetryHistory::findSeries(byte const &servoId, byte const &field) const
+{
+    if (field >= STSHistoryField::COUNT)
+        return nullptr;
+    for (int i = 0; i < nServos_; i++)
+        if (servoIds_[i] == servoId)
+            return &series_[i][field];
+    return nullptr;
+}
+
+void STSTelemetryHistory::addSample(Series &series, uint32_t const &timeMs, int16_t const &value)
+{
+    uint32_t const delta = series.rawCount == 0 ? 0 : timeMs - series.lastTime;
+    series.raw[series.rawHead] = value;
+    series.rawDelta[series.rawHead] = delta > 0xFFFF ? 0xFFFF : delta;
+    series.rawHead = (series.rawHead + 1) % STS_HISTORY_RAW;
+    if (series.rawCount < STS_HISTORY_RAW)
+        series.rawCount++;
+    series.lastTime = timeMs;
+    accumulate(series, 0, timeMs, value, value, value);
+}
+
+void STSTelemetryHistory::accumulate(Series &series, byte level, uint32_t start, int16_t minimum, int16_t maximum, int16_t mean)
+{
+    // Each complete bucket is pushed to its level and added to the bucket being filled one level up.
+    while (level < STS_HISTORY_LEVELS)
+    {
+        Accumulator &pending = series.pending[level];
+        if (pending.count == 0)
+        {
+            pending.start = start;
+            pending.minimum = minimum;
+            pending.maximum = maximum;
+            pending.sum = 0;
+        }
+        if (minimum < pending.minimum)
+            pending.minimum = minimum;
+        if (maximum > pending.maximum)
+            pending.maximum = maximum;
+        pending.sum += mean;
+        pending.count++;
+        if (pending.count < STS_HISTORY_FACTOR)
+            return;
+
+        Bucket &bucket = series.buckets[level][series.head[level]];
+        bucket.start = pending.start;
+        bucket.minimum = pending.minimum;
+        bucket.maximum = pending.maximum;
+        bucket.mean = pending.sum / STS_HISTORY_FACTOR;
+        series.head[level] = (series.head[level] + 1) % STS_HISTORY_BUCKETS;
+        if (series.count[level] < STS_HISTORY_BUCKETS)
+            series.count[level]++;
+        pending.count = 0;
+
+        start = bucket.start;
+        minimum = bucket.minimum;
+        maximum = bucket.maximum;
+        mean = bucket.mean;
+        level++;
+    }
+}
@@ -0,0 +1,136 @@
+/// \file STSTelemetryHistory.h
+/// \brief Bounded-memory history of the current and temperature of servos, at several resolutions.
+///
+/// \details For each servo and field, the most recent samples are kept raw in a ring buffer. Older samples
+///          are rolled up into buckets (minimum, maximum, mean), themselves rolled up into coarser
+///          buckets, level after level: with the default sizes and one sample per second, the last
+///          minute is kept raw and the last 8 hours as buckets of 10s, 100s and 1000s.
+///          All the memory is allocated at compile time (see STS_HISTORY_* in STSServoConfig.h) and
+///          adding a sample costs at most one update per level.
+#ifndef STSTELEMETRY_HISTORY_H
+#define STSTELEMETRY_HISTORY_H
+
+#include <Arduino.h>
+#include "STSServoConfig.h"
+#include "STSServoDriver.h"
+
+namespace STSHistoryField
+{
+    byte const CURRENT = 0;     ///< CURRENT_CURRENT, in units of 6.5mA.
+    byte const TEMPERATURE = 1; ///< CURRENT_TEMPERATURE, in degrees Celsius.
+    byte const COUNT = 2;
+};
+
+/// \brief Binary export format of the history, see STSTelemetryHistory::exportTo.
+/// \details The export is a sequence of frames: MAGIC0 MAGIC1 TYPE LEN_L LEN_H PAYLOAD CHK, with
+///          CHK = ~(TYPE + LEN_L + LEN_H + sum(PAYLOAD)), all values little-endian:
+///           - INFO: version, raw size, buckets per level, levels, factor, number of servos.
+///           - RAW: servo ID, field, count, time of the newest sample (uint32, ms), then count samples from
+///             the oldest: value (int16) and time since the previous sample (uint16, ms, saturated).
+///           - BUCKETS: servo ID, field, level, count, then count buckets from the oldest: start time
+///             (uint32, ms), minimum, maximum, mean (int16).
+namespace STSHistoryExport
+{
+    byte const MAGIC0 = 0xA5;
+    byte const MAGIC1 = 0x5A;
+    byte const VERSION = 1;
+
+    byte const INFO = 0;
+    byte const RAW = 1;
+    byte const BUCKETS = 2;
+};
+
+/// \brief Multi-resolution history of the current and temperature of up to STS_HISTORY_SERVOS servos.
+class STSTelemetryHistory
+{
+public:
+    /// \brief Summary of consecutive samples.
+    struct Bucket
+    {
+        uint32_t start;  ///< Time of the first sample, in ms.
+        int16_t minimum;
+        int16_t maximum;
+        int16_t mean;
+    };
+
+    STSTelemetryHistory();
+
+    /// \brief Forget all servos and samples.
+    void clear();
+
+    /// \brief Add a sample of a servo.
+    /// \param[in] servoId ID of the servo
+    /// \param[in] timeMs Time of the sample, e.g. millis()
+    /// \param[in] current Current, in units of 6.5mA
+    /// \param[in] temperature Temperature, in degrees Celsius
+    /// \return False if the servo is not tracked and there is no room left for it.
+    bool add(byte const &servoId, uint32_t const &timeMs, int16_t const &current, int16_t const &temperature);
+
+#if STS_ENABLE_BATCH
+    /// \brief Add the samples returned by STSServoDriver::readTelemetry, skipping the servos that did not reply.
+    void add(uint32_t const &timeMs,
+             byte const &numberOfServos,
+             const byte servoIds[],
+             STSTelemetry const telemetry[],
+             byte const *responded);
+#endif
+
+    /// \brief Number of raw samples of a servo (0 if the servo is not tracked).
+    byte getRawCount(byte const &servoId, byte const &field) const;
+
+    /// \brief Get a raw sample.
+    /// \param[in] index Index of the sample, 0 being the oldest
+    /// \param[out] timeMs Time of the sample
+    /// \return Sample value
+    int16_t getRawSample(byte const &servoId, byte const &field, byte const &index, uint32_t &timeMs) const;
+
+    /// \brief Number of buckets at a given level (0 if the servo is not tracked).
+    byte getBucketCount(byte const &servoId, byte const &field, byte const &level) const;
+
+    /// \brief Get a bucket.
+    /// \param[in] index Index of the bucket, 0 being the oldest
+    Bucket const &getBucket(byte const &servoId, byte const &field, byte const &level, byte const &index) const;
+
+    /// \brief Write the whole history in the binary format of STSHistoryExport.
+    /// \return Number of bytes written.
+    size_t exportTo(Print &output) const;
+
+private:
+    /// \brief Bucket being filled.
+    struct Accumulator
+    {
+        uint32_t start;
+        int16_t minimum;
+        int16_t maximum;
+        int32_t sum;
+        byte count;
+    };
+
+    /// \brief History of one field of one servo.
+    struct Series
+    {
+        int16_t raw[STS_HISTORY_RAW];
+        uint16_t rawDelta[STS_HISTORY_RAW]; ///< Time since the previous sample, in ms.
+        uint32_t lastTime;                  ///< Time of the newest raw sample.
+        byte rawHead;                       ///< Index of the next raw sample to write.
+        byte rawCount;
+        Bucket buckets[STS_HISTORY_LEVELS][STS_HISTORY_BUCKETS];
+        byte head[STS_HISTORY_LEVELS];
+        byte count[STS_HISTORY_LEVELS];
+        Accumulator pending[STS_HISTORY_LEVELS];
+    };
+
+    /// \brief Get the series of a servo, nullptr if the servo is not tracked.
+    Series const *findSeries(byte const &servoId, byte const &field) const;
+
+    void addSample(Series &series, uint32_t const &timeMs, int16_t const &value);
+
+    /// \brief Add a value to the bucket being filled at a level, rolling it up when complete.
+    void accumulate(Series &series, byte level, uint32_t start, int16_t minimum, int16_t maximum, int16_t mean);
+
+    byte servoIds_[STS_HISTORY_SERVOS];
+    byte nServos_;
+    Series series_[STS_HISTORY_SERVOS][STSHistoryField::COUNT];
+};
+
+#endif
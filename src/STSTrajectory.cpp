@@ -0,0 +1,397 @@
+#include "STSTrajectory.h"
+
+#if STS_ENABLE_TRAJECTORY
+
+namespace
+{
+    // Accelerations tried for each knot, in units of 100 steps/s^2.
+    byte const ACCELERATIONS[] = {5, 10, 20, 50, 100, 254};
+    byte const N_ACCELERATIONS = sizeof(ACCELERATIONS) / sizeof(ACCELERATIONS[0]);
+    // Speeds tried for each knot: at most two per power of two of the run length.
+    byte const MAX_SPEEDS = 24;
+    // Accelerations tried for each knot by a fit of bounded cost.
+    byte const BOUNDED_ACCELERATIONS[] = {10, 50, 254};
+    byte const N_BOUNDED_ACCELERATIONS = sizeof(BOUNDED_ACCELERATIONS) / sizeof(BOUNDED_ACCELERATIONS[0]);
+    // Maximum speed of the servo, used when RUNNING_SPEED is 0, in steps/s.
+    float const MAX_SPEED = 3400;
+    // Maximum acceleration of the servo, used when TARGET_ACCELERATION is 0, in steps/s^2.
+    float const MAX_ACCELERATION = 50000;
+    // Integration step of the motion model, in ms.
+    uint16_t const MODEL_STEP_MS = 1;
+
+    int sign(int const &value)
+    {
+        return (value > 0) - (value < 0);
+    }
+
+    /// \brief Advance the motion model by dt: trapezoidal profile toward the target, stopping on it.
+    void stepModel(STSMotionState &state, float const &target, float const &speed, float const &acceleration, float const &dt)
+    {
+        float const error = target - state.position;
+        float profile = sqrt(2 * acceleration * fabs(error));
+        if (profile > speed)
+            profile = speed;
+        if (error < 0)
+            profile = -profile;
+        float dv = profile - state.speed;
+        if (dv > acceleration * dt)
+            dv = acceleration * dt;
+        else if (dv < -acceleration * dt)
+            dv = -acceleration * dt;
+        float const v = state.speed + dv;
+        float const p = state.position + v * dt;
+        float const newError = target - p;
+        if (newError * error <= 0 || (fabs(newError) < 0.5f && fabs(v) <= acceleration * dt))
+        {
+            state.position = target;
+            state.speed = 0;
+        }
+        else
+        {
+            state.position = p;
+            state.speed = v;
+        }
+    }
+
+    /// \brief Follow the path with a candidate knot, for at most horizon samples.
+    /// \param[out] error Sum of the distances to the path, up to the first sample out of tolerance included.
+    /// \return Last sample within tolerance, start if none.
+    int simulate(int16_t const path[], int const &nSamples, uint16_t const &periodMs, int const &start,
+                 uint16_t const &tolerance, STSMotionState state, STSKnot const &knot, uint16_t const &stepMs,
+                 int const &horizon, float &error)
+    {
+        error = 0;
+        int reach = start;
+        int const last = nSamples - 1 - start > horizon ? start + horizon : nSamples - 1;
+        for (int i = start + 1; i <= last; i++)
+        {
+            STSTrajectory::predict(state, knot, periodMs, stepMs);
+            float const distance = fabs(state.position - path[i]);
+            error += distance;
+            if (distance > tolerance)
+                break;
+            reach = i;
+        }
+        return reach;
+    }
+
+    void addSpeed(float speeds[], byte &nSpeeds, float speed)
+    {
+        if (speed > MAX_SPEED)
+            speed = MAX_SPEED;
+        if (speed < 1)
+            speed = 1;
+        for (int i = 0; i < nSpeeds; i++)
+            if (fabs(speeds[i] - speed) < 1)
+                return;
+        if (nSpeeds < MAX_SPEEDS)
+            speeds[nSpeeds++] = speed;
+    }
+};
+
+void STSTrajectory::predict(STSMotionState &state,
+                            STSKnot const &knot,
+                            uint32_t const &durationMs,
+                            uint16_t const &stepMs)
+{
+    float const speed = knot.speed == 0 || knot.speed > MAX_SPEED ? MAX_SPEED : knot.speed;
+    float const acceleration = knot.acceleration == 0 ? MAX_ACCELERATION : knot.acceleration * 100.0f;
+    uint16_t const step = stepMs > 0 ? stepMs : 1;
+    for (uint32_t t = 0; t < durationMs; t += step)
+        stepModel(state, knot.position, speed, acceleration, (durationMs - t < step ? durationMs - t : step) * 1e-3f);
+}
+
+int STSTrajectory::fitKnot(int16_t const path[],
+                           int const &nSamples,
+                           uint16_t const &periodMs,
+                           int const &start,
+                           uint16_t const &tolerance,
+                           STSMotionState &state,
+                           STSKnot &knot,
+                           uint16_t const &maxSteps)
+{
+    // Target: end of the monotonic run starting at this sample, a plateau being a run of its own.
+    int end = start;
+    int const direction = start + 1 < nSamples ? sign(path[start + 1] - path[start]) : 0;
+    while (end + 1 < nSamples && sign(path[end + 1] - path[end]) == direction)
+        end++;
+    knot.time = static_cast<uint32_t>(start) * periodMs;
+    knot.position = path[end];
+
+    // Candidate speeds: current speed, maximum speed (to catch up with the path after a disturbance),
+    // then mean and peak speed of the path over growing parts of the run.
+    float speeds[MAX_SPEEDS];
+    byte nSpeeds = 0;
+    addSpeed(speeds, nSpeeds, fabs(state.speed));
+    addSpeed(speeds, nSpeeds, MAX_SPEED);
+    float peak = 0;
+    int next = start + 1;
+    for (int i = start; i < end; i++)
+    {
+        float const slope = abs(path[i + 1] - path[i]) * 1000.0f / periodMs;
+        if (slope > peak)
+            peak = slope;
+        if (i + 1 == next || i + 1 == end)
+        {
+            addSpeed(speeds, nSpeeds, abs(path[i + 1] - path[start]) * 1000.0f / ((i + 1 - start) * periodMs));
+            addSpeed(speeds, nSpeeds, peak);
+            next = start + 2 * (next - start);
+        }
+    }
+
+    // A fit of bounded cost integrates the model once per sample, tries fewer accelerations, and follows each
+    // candidate for its share of the steps.
+    bool const bounded = maxSteps > 0;
+    byte const *accelerations = bounded ? BOUNDED_ACCELERATIONS : ACCELERATIONS;
+    byte const nAccelerations = bounded ? N_BOUNDED_ACCELERATIONS : N_ACCELERATIONS;
+    uint16_t const stepMs = bounded ? periodMs : MODEL_STEP_MS;
+    int horizon = bounded ? maxSteps / (nSpeeds * nAccelerations) : nSamples;
+    if (horizon < 1)
+        horizon = 1;
+
+    // Keep the candidate following the path for the most samples, then with the smallest error.
+    int bestReach = -1;
+    float bestError = 0;
+    STSKnot candidate = knot;
+    for (int s = 0; s < nSpeeds; s++)
+    {
+        candidate.speed = static_cast<uint16_t>(speeds[s] + 0.5f);
+        for (int a = 0; a < nAccelerations; a++)
+        {
+            candidate.acceleration = accelerations[a];
+            float error;
+            int const reach = simulate(path, nSamples, periodMs, start, tolerance, state, candidate, stepMs, horizon,
+                                       error);
+            if (reach > bestReach || (reach == bestReach && error < bestError))
+            {
+                bestReach = reach;
+                bestError = error;
+                knot.speed = candidate.speed;
+                knot.acceleration = candidate.acceleration;
+            }
+        }
+    }
+
+    // Once on the last sample, the servo stays on the final position: the path is complete.
+    if (bestReach == nSamples - 1 && end == nSamples - 1)
+        return nSamples;
+    // Always make progress, even if the path cannot be followed within tolerance.
+    int const reach = bestReach > start ? bestReach : start + 1;
+    predict(state, knot, static_cast<uint32_t>(reach - start) * periodMs, stepMs);
+    return reach;
+}
+
+int STSTrajectory::fit(int16_t const path[],
+                       int const &nSamples,
+                       uint16_t const &periodMs,
+                       uint16_t const &tolerance,
+                       STSKnot knots[],
+                       int const &maxKnots)
+{
+    if (nSamples <= 0)
+        return 0;
+    STSMotionState state = {static_cast<float>(path[0]), 0};
+    int nKnots = 0;
+    int sample = 0;
+    while (sample < nSamples)
+    {
+        if (nKnots == maxKnots)
+            return -1;
+        sample = fitKnot(path, nSamples, periodMs, sample, tolerance, state, knots[nKnots]);
+        nKnots++;
+    }
+    return nKnots;
+}
+
+STSTrajectoryPlayer::STSTrajectoryPlayer(STSServoDriver &driver) :
+    driver_(driver),
+    nTracks_(0),
+    startTime_(0),
+    knotCount_(0),
+    replanCount_(0)
+{
+}
+
+void STSTrajectoryPlayer::clear()
+{
+    nTracks_ = 0;
+}
+
+bool STSTrajectoryPlayer::setPath(byte const &servoId,
+                                  int16_t const path[],
+                                  uint16_t const &nSamples,
+                                  uint16_t const &periodMs,
+                                  uint16_t const &tolerance,
+                                  uint16_t const &replanBound,
+                                  STSKnot knots[],
+                                  uint16_t const &maxKnots)
+{
+    Track *track = findTrack(servoId);
+    if (track == nullptr)
+    {
+        if (nTracks_ == STS_TRAJECTORY_SERVOS)
+            return false;
+        track = &tracks_[nTracks_++];
+    }
+    track->path = path;
+    track->nSamples = nSamples;
+    track->periodMs = periodMs > 0 ? periodMs : 1;
+    track->tolerance = tolerance;
+    track->replanBound = replanBound;
+    track->servoId = servoId;
+    track->nextSample = nSamples;
+    track->started = false;
+    track->knots = nullptr;
+    track->nKnots = 0;
+    if (knots != nullptr)
+    {
+        int const nKnots = STSTrajectory::fit(path, nSamples, track->periodMs, tolerance, knots, maxKnots);
+        if (nKnots >= 0)
+        {
+            track->knots = knots;
+            track->nKnots = nKnots;
+        }
+    }
+    return true;
+}
+
+void STSTrajectoryPlayer::start(uint32_t const &nowMs)
+{
+    startTime_ = nowMs;
+    knotCount_ = 0;
+    replanCount_ = 0;
+    for (int i = 0; i < nTracks_; i++)
+    {
+        Track &track = tracks_[i];
+        track.nextKnot = 0;
+        track.nextSample = 0;
+        track.nextState.position = track.nSamples > 0 ? track.path[0] : 0;
+        track.nextState.speed = 0;
+        track.started = false;
+    }
+}
+
+int STSTrajectoryPlayer::update(uint32_t const &nowMs)
+{
+    uint32_t const elapsed = nowMs - startTime_;
+    byte ids[STS_TRAJECTORY_SERVOS];
+    int positions[STS_TRAJECTORY_SERVOS];
+    int speeds[STS_TRAJECTORY_SERVOS];
+    byte accelerations[STS_TRAJECTORY_SERVOS];
+    byte nDue = 0;
+    bool fitted = false;
+    for (int i = 0; i < nTracks_; i++)
+    {
+        Track &track = tracks_[i];
+        if (track.nextSample >= track.nSamples || static_cast<uint32_t>(track.nextSample) * track.periodMs > elapsed)
+            continue;
+        if (track.nextKnot < track.nKnots)
+        {
+            // Fitted ahead of time: the state the knot starts from is the one predicted for the previous knot.
+            STSKnot const &knot = track.knots[track.nextKnot++];
+            if (track.started)
+                advancePrediction(track, knot.time);
+            track.knotState = track.started ? track.predicted : track.nextState;
+            track.knot = knot;
+            track.nextSample = track.nextKnot < track.nKnots ? track.knots[track.nextKnot].time / track.periodMs
+                                                             : track.nSamples;
+        }
+        else
+        {
+            // At most one fit per call, to bound its duration: the other knots due are fitted on the next calls.
+            if (fitted)
+                continue;
+            fitted = true;
+            track.knotState = track.nextState;
+            track.nextSample = STSTrajectory::fitKnot(track.path, track.nSamples, track.periodMs, track.nextSample,
+                                                      track.tolerance, track.nextState, track.knot,
+                                                      STS_TRAJECTORY_FIT_STEPS);
+        }
+        track.predicted = track.knotState;
+        track.predictedTime = track.knot.time;
+        track.started = true;
+        ids[nDue] = track.servoId;
+        positions[nDue] = track.knot.position;
+        speeds[nDue] = track.knot.speed;
+        accelerations[nDue] = track.knot.acceleration;
+        nDue++;
+    }
+    if (nDue > 0)
+        driver_.setTargetMotions(nDue, ids, positions, speeds, accelerations);
+    knotCount_ += nDue;
+    return nDue;
+}
+
+bool STSTrajectoryPlayer::reportPosition(byte const &servoId, int16_t const &position, uint32_t const &nowMs)
+{
+    Track *track = findTrack(servoId);
+    if (track == nullptr || !track->started)
+        return false;
+    uint32_t const elapsed = nowMs - startTime_;
+    uint32_t sample = elapsed / track->periodMs;
+    // A knot is already due: it will be fitted from the predicted state anyway.
+    if (sample >= track->nextSample && track->nextSample < track->nSamples)
+        return false;
+
+    // Compare to the motion predicted for the knot being executed: once a new knot is fitted from the
+    // measured state, the recovery toward the path is predicted too, and does not trigger another one.
+    advancePrediction(*track, elapsed);
+    if (fabs(position - track->predicted.position) <= track->replanBound)
+        return false;
+
+    // Fit the rest of the path while playing, from the measured position, keeping the speed predicted by the model.
+    if (sample >= track->nSamples)
+        sample = track->nSamples - 1;
+    track->nextKnot = track->nKnots;
+    track->nextSample = sample;
+    track->nextState = track->predicted;
+    track->nextState.position = position;
+    replanCount_++;
+    return true;
+}
+
+int STSTrajectoryPlayer::reportTelemetry(uint32_t const &nowMs,
+                                         byte const &numberOfServos,
+                                         const byte servoIds[],
+                                         STSTelemetry const telemetry[],
+                                         byte const *responded)
+{
+    int replanned = 0;
+    for (int i = 0; i < numberOfServos; i++)
+        if ((responded[i / 8] & (1 << (i % 8))) && reportPosition(servoIds[i], telemetry[i].position, nowMs))
+            replanned++;
+    return replanned;
+}
+
+bool STSTrajectoryPlayer::isFinished() const
+{
+    for (int i = 0; i < nTracks_; i++)
+        if (tracks_[i].nextSample < tracks_[i].nSamples)
+            return false;
+    return true;
+}
+
+void STSTrajectoryPlayer::advancePrediction(Track &track, uint32_t const &time)
+{
+    // The prediction is advanced from where it was left, rather than from the start of the knot each time: the
+    // model then costs one step per ms of motion, however often the positions are reported.
+    if (time < track.predictedTime)
+    {
+        track.predicted = track.knotState;
+        track.predictedTime = track.knot.time;
+    }
+    if (time <= track.predictedTime)
+        return;
+    STSTrajectory::predict(track.predicted, track.knot, time - track.predictedTime);
+    track.predictedTime = time;
+}
+
+STSTrajectoryPlayer::Track *STSTrajectoryPlayer::findTrack(byte const &servoId)
+{
+    for (int i = 0; i < nTracks_; i++)
+        if (tracks_[i].servoId == servoId)
+            return &tracks_[i];
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,195 @@
+/// \file STSTrajectory.h
+/// \brief Sparse-knot trajectories: smooth motions sent as a few servo-side motion profiles.
+///
+/// \details Streaming a path sample by sample costs a SYNC WRITE every period. But in position mode, the
+///          servo already shapes the motion itself: it accelerates at TARGET_ACCELERATION up to
+///          RUNNING_SPEED, then brakes to stop on TARGET_POSITION. A path is thus cut into knots, each
+///          knot being a (position, speed, acceleration) command for which the servo reproduces the path
+///          within a tolerance for as long as possible. Each knot is sent once: a smooth motion needs
+///          about one knot per change of direction, instead of one command per sample.
+#ifndef STSTRAJECTORY_H
+#define STSTRAJECTORY_H
+
+#include <Arduino.h>
+#include "STSServoConfig.h"
+#include "STSServoDriver.h"
+
+#if STS_ENABLE_TRAJECTORY
+
+/// \brief Motion command sent to a servo.
+struct STSKnot
+{
+    uint32_t time;      ///< Time at which the knot is sent, in ms from the start of the path.
+    int16_t position;   ///< TARGET_POSITION
+    uint16_t speed;     ///< RUNNING_SPEED, in steps/s
+    byte acceleration;  ///< TARGET_ACCELERATION, in units of 100 steps/s^2
+};
+
+/// \brief Position and speed of a servo, as predicted by the motion model.
+struct STSMotionState
+{
+    float position; ///< In steps.
+    float speed;    ///< In steps/s.
+};
+
+/// \brief Fitting of paths to knots.
+/// \details Paths are arrays of positions sampled every periodMs. The servo is modeled as following a
+///          trapezoidal profile toward the target of the last knot, stopping on it.
+class STSTrajectory
+{
+public:
+    /// \brief Fit the knot sent at a given sample of a path.
+    /// \details The target of the knot is the end of the monotonic part of the path starting at this
+    ///          sample; its speed and acceleration are chosen so that the path is followed within
+    ///          tolerance for as many samples as possible.
+    /// \param[in] path Positions, one per sample.
+    /// \param[in] nSamples Number of samples.
+    /// \param[in] periodMs Sampling period of the path, in ms.
+    /// \param[in] start Sample at which the knot is sent.
+    /// \param[in] tolerance Maximum distance to the path, in steps.
+    /// \param[in,out] state State of the servo at the start sample; on return, predicted state at the returned sample.
+    /// \param[out] knot Fitted knot.
+    /// \param[in] maxSteps Largest number of steps of the motion model spent on the fit, 0 for no limit. With a
+    ///            limit, e.g. while playing, the model is integrated once per sample, fewer accelerations are tried,
+    ///            and each candidate is followed for at most its share of the steps.
+    /// \return Sample at which the next knot is due, nSamples if this knot completes the path.
+    static int fitKnot(int16_t const path[],
+                       int const &nSamples,
+                       uint16_t const &periodMs,
+                       int const &start,
+                       uint16_t const &tolerance,
+                       STSMotionState &state,
+                       STSKnot &knot,
+                       uint16_t const &maxSteps = 0);
+
+    /// \brief Fit a whole path, the servo starting at rest on the first sample.
+    /// \param[out] knots Fitted knots.
+    /// \param[in] maxKnots Size of the knots array.
+    /// \return Number of knots, -1 if the path needs more than maxKnots knots.
+    static int fit(int16_t const path[],
+                   int const &nSamples,
+                   uint16_t const &periodMs,
+                   uint16_t const &tolerance,
+                   STSKnot knots[],
+                   int const &maxKnots);
+
+    /// \brief Predict the motion of a servo executing a knot.
+    /// \param[in,out] state State of the servo, advanced by durationMs.
+    /// \param[in] knot Knot being executed.
+    /// \param[in] durationMs Duration of the prediction, in ms.
+    /// \param[in] stepMs Integration step, in ms: coarser steps cost less, for a less accurate prediction.
+    static void predict(STSMotionState &state,
+                        STSKnot const &knot,
+                        uint32_t const &durationMs,
+                        uint16_t const &stepMs = 1);
+};
+
+/// \brief Plays paths on several servos, sending the knots as they become due.
+/// \details The knots of a path are fitted ahead of time, in setPath, when given a buffer for them: update then
+///          only sends them, all the knots due at the same time in a single SYNC WRITE. When the measured
+///          position of a servo strays from its predicted motion by more than a bound (e.g. under load), the rest
+///          of its path is fitted while playing, from the measured state, with at most one fit of bounded
+///          cost per update (see STS_TRAJECTORY_FIT_STEPS). Paths set without a buffer are fitted this way throughout.
+class STSTrajectoryPlayer
+{
+public:
+    /// \param[in] driver Driver of the bus the servos are on.
+    explicit STSTrajectoryPlayer(STSServoDriver &driver);
+
+    /// \brief Remove all paths.
+    void clear();
+
+    /// \brief Set the path of a servo, replacing any previous path of this servo.
+    /// \note The path is not copied: it must remain valid while playing.
+    /// \param[in] servoId ID of the servo
+    /// \param[in] path Positions, one per sample.
+    /// \param[in] nSamples Number of samples.
+    /// \param[in] periodMs Sampling period of the path, in ms.
+    /// \param[in] tolerance Maximum distance to the path of the fitted knots, in steps.
+    /// \param[in] replanBound Distance between the measured and predicted positions above which the knot is fitted again, in steps.
+    /// \param[out] knots Optional buffer of maxKnots knots, to fit the whole path now (see STSTrajectory::fit), which
+    ///             takes long on MCUs without FPU: call it before the motion. Must remain valid while playing.
+    ///             If the path needs more knots, it is fitted while playing instead.
+    /// \param[in] maxKnots Size of the knots buffer.
+    /// \return False if there is no room left for this servo.
+    bool setPath(byte const &servoId,
+                 int16_t const path[],
+                 uint16_t const &nSamples,
+                 uint16_t const &periodMs,
+                 uint16_t const &tolerance,
+                 uint16_t const &replanBound,
+                 STSKnot knots[] = nullptr,
+                 uint16_t const &maxKnots = 0);
+
+    /// \brief Start playing all paths, the servos being at rest on the first sample of their path.
+    /// \param[in] nowMs Current time, e.g. millis()
+    void start(uint32_t const &nowMs);
+
+    /// \brief Send the knots that are due, in a single SYNC WRITE.
+    /// \note Knots are sent late by up to the time between two calls: call at least once per period.
+    /// \param[in] nowMs Current time
+    /// \return Number of knots sent.
+    int update(uint32_t const &nowMs);
+
+    /// \brief Check the measured position of a servo against the motion predicted for its knot.
+    /// \param[in] servoId ID of the servo
+    /// \param[in] position Measured position, e.g. from readTelemetry
+    /// \param[in] nowMs Time of the measurement
+    /// \return True if the servo strayed beyond the bound: a new knot is sent on the next update.
+    bool reportPosition(byte const &servoId, int16_t const &position, uint32_t const &nowMs);
+
+    /// \brief Check the positions returned by STSServoDriver::readTelemetry, skipping the servos that did not reply.
+    /// \return Number of servos for which a new knot is due.
+    int reportTelemetry(uint32_t const &nowMs,
+                        byte const &numberOfServos,
+                        const byte servoIds[],
+                        STSTelemetry const telemetry[],
+                        byte const *responded);
+
+    /// \brief Whether the last knot of every path has been sent.
+    bool isFinished() const;
+
+    /// \brief Number of knots sent since start.
+    uint32_t getKnotCount() const { return knotCount_; }
+
+    /// \brief Number of knots fitted again after a servo strayed from its path, since start.
+    uint32_t getReplanCount() const { return replanCount_; }
+
+private:
+    /// \brief Path of a servo, and knot being executed.
+    struct Track
+    {
+        int16_t const *path;
+        uint16_t nSamples;
+        uint16_t periodMs;
+        uint16_t tolerance;
+        uint16_t replanBound;
+        byte servoId;
+        STSKnot const *knots;      ///< Knots fitted ahead of time, nullptr if none.
+        uint16_t nKnots;
+        uint16_t nextKnot;         ///< Next knot fitted ahead of time to send, nKnots once fitting while playing.
+        uint16_t nextSample;       ///< Sample at which the next knot is due, nSamples when done.
+        STSMotionState nextState;  ///< Predicted state at nextSample, when fitting while playing.
+        STSKnot knot;              ///< Knot being executed.
+        STSMotionState knotState;  ///< State when the knot was sent.
+        STSMotionState predicted;  ///< State predicted for the knot at predictedTime, advanced as time goes.
+        uint32_t predictedTime;    ///< In ms from the start.
+        bool started;              ///< Whether a knot has been sent.
+    };
+
+    /// \brief Get the track of a servo, nullptr if the servo has no path.
+    Track *findTrack(byte const &servoId);
+
+    /// \brief Advance the predicted state of a track to a time, in ms from the start.
+    void advancePrediction(Track &track, uint32_t const &time);
+
+    STSServoDriver &driver_;
+    Track tracks_[STS_TRAJECTORY_SERVOS];
+    byte nTracks_;
+    uint32_t startTime_;
+    uint32_t knotCount_;
+    uint32_t replanCount_;
+};
+
+#endif
+#endif
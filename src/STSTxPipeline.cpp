@@ -0,0 +1,138 @@
+#include "STSTxPipeline.h"
+
+#if STS_ENABLE_TX_PIPELINE
+
+namespace
+{
+    byte const NONE = 0xFF;
+
+    namespace bufferState
+    {
+        byte const FREE     = 0;
+        byte const ENCODING = 1; ///< Returned by beginFrame, not committed yet.
+        byte const QUEUED   = 2; ///< Committed, waiting for the other buffer to be sent.
+        byte const SENDING  = 3;
+    };
+};
+
+void STSAsyncTransport::writeComplete()
+{
+    if (pipeline_ != nullptr)
+        pipeline_->onWriteComplete();
+}
+
+STSTxPipeline::STSTxPipeline(STSAsyncTransport &transport) :
+    transport_(transport),
+    sending_(NONE),
+    callback_(nullptr),
+    context_(nullptr),
+    frameCount_(0),
+    stallCount_(0),
+    discardCount_(0)
+{
+    state_[0] = bufferState::FREE;
+    state_[1] = bufferState::FREE;
+    length_[0] = 0;
+    length_[1] = 0;
+    transport_.pipeline_ = this;
+}
+
+byte *STSTxPipeline::beginFrame()
+{
+    transport_.poll();
+    bool stalled = false;
+    while (true)
+    {
+        noInterrupts();
+        for (byte i = 0; i < 2; i++)
+        {
+            if (state_[i] == bufferState::FREE)
+            {
+                state_[i] = bufferState::ENCODING;
+                interrupts();
+                if (stalled)
+                    stallCount_++;
+                return buffers_[i];
+            }
+        }
+        interrupts();
+        stalled = true;
+        transport_.waitForEvent();
+    }
+}
+
+void STSTxPipeline::commitFrame(size_t const &length)
+{
+    noInterrupts();
+    for (byte i = 0; i < 2; i++)
+    {
+        if (state_[i] != bufferState::ENCODING)
+            continue;
+        length_[i] = length;
+        if (sending_ == NONE)
+            start(i);
+        else
+            state_[i] = bufferState::QUEUED;
+        break;
+    }
+    interrupts();
+    transport_.poll();
+}
+
+void STSTxPipeline::discardFrame()
+{
+    noInterrupts();
+    for (byte i = 0; i < 2; i++)
+    {
+        if (state_[i] != bufferState::ENCODING)
+            continue;
+        state_[i] = bufferState::FREE;
+        discardCount_++;
+        break;
+    }
+    interrupts();
+}
+
+bool STSTxPipeline::isIdle()
+{
+    transport_.poll();
+    return sending_ == NONE;
+}
+
+void STSTxPipeline::flush()
+{
+    transport_.poll();
+    while (sending_ != NONE)
+        transport_.waitForEvent();
+}
+
+void STSTxPipeline::setCompletionCallback(STSTxCallback callback, void *context)
+{
+    callback_ = callback;
+    context_ = context;
+}
+
+void STSTxPipeline::onWriteComplete()
+{
+    if (sending_ == NONE)
+        return;
+    byte const done = sending_;
+    state_[done] = bufferState::FREE;
+    frameCount_++;
+    // The frames are sent in the order they were committed: the queued one, if any, is the other buffer.
+    if (state_[1 - done] == bufferState::QUEUED)
+        start(1 - done);
+    else
+        sending_ = NONE;
+    if (callback_ != nullptr)
+        callback_(context_);
+}
+
+void STSTxPipeline::start(byte const &index)
+{
+    state_[index] = bufferState::SENDING;
+    sending_ = index;
+    transport_.startWrite(buffers_[index], length_[index]);
+}
+
+#endif
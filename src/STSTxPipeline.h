@@ -0,0 +1,116 @@
+/// \file STSTxPipeline.h
+/// \brief Double-buffered transmission, overlapping the encoding of a frame with the transmission of the previous one.
+///
+/// \details With a plain blocking write, the CPU encodes a frame, then waits for it to be on the wire before
+///          encoding the next one: the CPU and the wire take turns sitting idle. On transports able to send
+///          in the background (TX DMA, large FIFO), a STSTxPipeline encodes the next frame (the SYNC WRITE
+///          of another bus, the next trajectory tick...) into a second buffer while the first one is sent.
+///          The transport signals the end of each transfer with an event, typically from its
+///          transfer-complete interrupt, which starts the next frame at once.
+#ifndef STSTXPIPELINE_H
+#define STSTXPIPELINE_H
+
+#include <Arduino.h>
+#include "STSServoConfig.h"
+
+#if STS_ENABLE_TX_PIPELINE
+
+// A SYNC WRITE frame is at most 259 bytes: 4 bytes of header and length, then up to 255.
+static_assert(STS_TX_BUFFER_SIZE >= 259, "STS_TX_BUFFER_SIZE must hold the largest frame, 259 bytes");
+
+class STSTxPipeline;
+
+/// \brief Callback fired each time a frame is on the wire.
+typedef void (*STSTxCallback)(void *context);
+
+/// \brief Serial transmitter able to send a frame in the background.
+/// \details Implementations start the transfer in startWrite and call writeComplete once the last byte is
+///          on the wire, e.g. from the TX DMA interrupt. The direction pin of half-duplex buses, if any, is
+///          up to the implementation.
+class STSAsyncTransport
+{
+public:
+    STSAsyncTransport() : pipeline_(nullptr) {}
+    virtual ~STSAsyncTransport() {}
+
+    /// \brief Start sending a frame, and return at once.
+    /// \param[in] data Frame, which remains valid until writeComplete is called.
+    /// \param[in] length Length of the frame, in bytes.
+    virtual void startWrite(const byte *data, size_t const &length) = 0;
+
+    /// \brief Deliver the pending events, for transports polled instead of interrupt-driven.
+    virtual void poll() {}
+
+    /// \brief Wait for the next event, called when the pipeline cannot proceed until a transfer completes.
+    virtual void waitForEvent() { poll(); }
+
+    /// \brief Signal that the frame given to startWrite is on the wire.
+    void writeComplete();
+
+private:
+    friend class STSTxPipeline;
+    STSTxPipeline *pipeline_;
+};
+
+/// \brief Two frame buffers over a background transport: one being sent, the other being encoded.
+/// \details See STSServoDriver::setTxPipeline: the driver encodes its SYNC WRITE frames in place, in the
+///          buffer returned by beginFrame.
+class STSTxPipeline
+{
+public:
+    /// \param[in] transport Transport sending the frames.
+    explicit STSTxPipeline(STSAsyncTransport &transport);
+
+    /// \brief Get a buffer of STS_TX_BUFFER_SIZE bytes to encode the next frame in.
+    /// \details Waits for a transfer to complete if both buffers are in use.
+    byte *beginFrame();
+
+    /// \brief Queue the frame encoded in the buffer returned by beginFrame.
+    /// \details The frame is sent as soon as the previous one is on the wire, without waiting for it.
+    /// \param[in] length Length of the frame, in bytes.
+    void commitFrame(size_t const &length);
+
+    /// \brief Give back the buffer returned by beginFrame without sending it, e.g. when the frame does not fit.
+    void discardFrame();
+
+    /// \brief Whether all the queued frames are on the wire.
+    bool isIdle();
+
+    /// \brief Wait until all the queued frames are on the wire, e.g. before reading the bus.
+    void flush();
+
+    /// \brief Set a callback fired (from the transport event) each time a frame is on the wire.
+    void setCompletionCallback(STSTxCallback callback, void *context = nullptr);
+
+    /// \brief Number of frames sent.
+    uint32_t getFrameCount() const { return frameCount_; }
+
+    /// \brief Number of times beginFrame had to wait for a free buffer: the wire, not the CPU, is the bottleneck.
+    uint32_t getStallCount() const { return stallCount_; }
+
+    /// \brief Number of frames discarded, not sent.
+    uint32_t getDiscardCount() const { return discardCount_; }
+
+private:
+    friend class STSAsyncTransport;
+
+    /// \brief Event of the transport: the frame being sent is on the wire.
+    void onWriteComplete();
+
+    /// \brief Start sending a buffer.
+    void start(byte const &index);
+
+    STSAsyncTransport &transport_;
+    byte buffers_[2][STS_TX_BUFFER_SIZE];
+    size_t length_[2];
+    volatile byte state_[2];
+    volatile byte sending_; ///< Index of the buffer being sent, NONE if idle.
+    STSTxCallback callback_;
+    void *context_;
+    uint32_t frameCount_;
+    uint32_t stallCount_;
+    uint32_t discardCount_;
+};
+
+#endif
+#endif